@@ -4,56 +4,780 @@
 #include "hash_engine.h"
 #include "storage_manager.h"
 #include "metadata_db.h"
-#include "thread_pool.h"
+#include "bounded_queue.h"
+#include "resource_governor.h"
+#include "block_cipher.h"
+#include "block_reader.h"
+#include "block_sketch.h"
+#include "cancellation.h"
 #include <iostream>
-#include <future>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <unordered_map>
+#include <map>
+#include <filesystem>
+
+namespace {
+
+// One catalog entry being produced: a regular file's version, or an aggregate
+// block of small files (one version per packed file)
+struct FileJob {
+    std::string path;
+    uint32_t mode = FILE_MODE_UNKNOWN;
+    bool is_pack = false;
+    std::vector<PackedFileEntry> entries;   // is_pack only
+
+    std::string file_hash;                   // Set by the reader once the file is read
+    uint64_t file_size = 0;
+    uint64_t content_version = 0;            // Stored version with the same content, found by the reader
+
+    std::mutex ids_mutex;
+    std::vector<uint64_t> block_ids;         // By block sequence, filled in as blocks resolve
+
+    // Blocks not yet resolved, plus one hold by the reader until the whole file is
+    // read. Whoever drops it to zero hands the job to the commit stage.
+    std::atomic<size_t> pending{1};
+
+    // Checkpointing (regular files only; guarded by ids_mutex)
+    bool checkpointing = false;
+    uint64_t stat_size = 0;
+    int64_t mtime = 0;
+    std::vector<bool> resolved;
+    size_t resolved_prefix = 0;                 // Blocks [0, n) are all stored
+    size_t checkpointed = 0;                    // Blocks covered by the last saved checkpoint
+    std::map<size_t, std::string> hash_states;  // Block count -> file hash state after that many blocks
+};
+
+struct BlockTask {
+    std::shared_ptr<FileJob> job;
+    size_t seq = 0;
+    PooledBuffer data;
+    std::string hash;
+    PooledBuffer compressed;
+    BlockSketch sketch;         // Delta compression only
+    std::string delta_base;     // Set if `compressed` is a delta payload
+    int delta_depth = 0;
+    std::chrono::steady_clock::time_point enqueued_at;
+};
+
+// Decoded delta bases kept by one run; consecutive versions of a file keep hitting the same ones
+constexpr size_t DELTA_BASE_CACHE_BYTES = 64ull * 1024 * 1024;
+
+size_t workerCount(size_t configured, size_t share_divisor) {
+    if (configured > 0) return configured;
+    size_t hw = std::thread::hardware_concurrency();
+    return std::max<size_t>(1, hw / share_divisor);
+}
+
+// What blocks and files are named by in the catalog: their SHA-256, or in an
+// encrypted repository the keyed name derived from it
+std::string contentName(const BlockCipher* cipher, std::string hash) {
+    return cipher ? cipher->blockName(hash) : hash;
+}
+
+// Permission bits to record for a scanned file
+uint32_t fileMode(const FileMetadata& metadata) {
+    if (metadata.permissions == std::filesystem::perms::unknown) return FILE_MODE_UNKNOWN;
+    return static_cast<uint32_t>(metadata.permissions & std::filesystem::perms::mask);
+}
+
+} // namespace
+
+class BackupPipeline::StagedRun {
+public:
+    StagedRun(BackupPipeline& pipeline, std::shared_ptr<ProgressTracker> progress)
+        : pipeline(pipeline), progress(std::move(progress)), tracer(pipeline.trace.get()),
+          pool(pipeline.buffer_pool), governor(pipeline.governor), cipher(pipeline.cipher.get()),
+          cancel_token(pipeline.cancel_token),
+          checkpoint_blocks(pipeline.config.checkpoint_interval / BlockSplitter::BLOCK_SIZE),
+          files(pipeline.config.queue_depth),
+          to_hash(pipeline.config.queue_depth),
+          to_dedup(pipeline.config.queue_depth),
+          to_compress(pipeline.config.queue_depth),
+          to_store(pipeline.config.queue_depth),
+          to_commit(pipeline.config.queue_depth)
+    {
+        const auto& config = pipeline.config;
+        if (config.delta_compression) {
+            bases = std::make_unique<BlockReader>(pipeline.storage, pipeline.hasher,
+                                                  std::make_shared<BlockCache>(DELTA_BASE_CACHE_BYTES));
+            bases->setCipher(pipeline.cipher);
+        }
+        startStage(readers, workerCount(config.read_workers, 1), [this] { readLoop(); });
+        startStage(hashers, workerCount(config.hash_workers, 4), [this] { hashLoop(); });
+        startStage(dedupers, workerCount(config.dedup_workers, 1), [this] { dedupLoop(); });
+        startStage(compressors, workerCount(config.compress_workers, 2), [this] { compressLoop(); });
+        startStage(storers, workerCount(config.store_workers, 1), [this] { storeLoop(); });
+        committer = std::thread([this] {
+            if (governor) governor->enterWorker();
+            commitLoop();
+        });
+    }
+
+    ~StagedRun() {
+        if (!finished) {
+            fail(std::make_exception_ptr(std::runtime_error("Backup run abandoned")));
+            shutdown();
+        }
+    }
+
+    // Queue a regular file; its blocks are streamed by a reader thread
+    void addFile(const std::string& path, uint32_t mode) {
+        auto job = std::make_shared<FileJob>();
+        job->path = path;
+        job->mode = mode;
+        files.push(std::move(job));
+    }
+
+    // Queue an aggregate block of small files, bypassing the read stage
+    void addPack(PooledBuffer&& pack, std::vector<PackedFileEntry>&& entries) {
+        auto job = std::make_shared<FileJob>();
+        job->is_pack = true;
+        job->entries = std::move(entries);
+        job->pending.store(2);   // The pack block, plus a hold dropped right away
+        BlockTask task;
+        task.job = job;
+        task.data = std::move(pack);
+        task.enqueued_at = std::chrono::steady_clock::now();
+        to_hash.push(std::move(task));
+        release(job);
+    }
+
+    // Record a version created outside the stages (e.g. whole-file dedup of a small file)
+    void addVersion(uint64_t version_id) {
+        std::lock_guard<std::mutex> lock(results_mutex);
+        version_ids.push_back(version_id);
+    }
+
+    // Drain every stage and return all version ids; rethrows the first stage error
+    std::vector<uint64_t> finish() {
+        shutdown();
+        finished = true;
+        if (error) std::rethrow_exception(error);
+        return version_ids;
+    }
+
+private:
+    template<typename Loop>
+    void startStage(std::vector<std::thread>& workers, size_t count, Loop loop) {
+        for (size_t i = 0; i < count; ++i) {
+            workers.emplace_back([this, loop] {
+                if (governor) governor->enterWorker();
+                loop();
+            });
+        }
+    }
+
+    static void joinAll(std::vector<std::thread>& workers) {
+        for (auto& t : workers) {
+            if (t.joinable()) t.join();
+        }
+    }
+
+    // Close each queue once every producer feeding it has exited
+    void shutdown() {
+        files.close();
+        joinAll(readers);
+        to_hash.close();
+        joinAll(hashers);
+        to_dedup.close();
+        joinAll(dedupers);
+        to_compress.close();
+        joinAll(compressors);
+        to_store.close();
+        joinAll(storers);
+        to_commit.close();
+        if (committer.joinable()) committer.join();
+    }
+
+    void fail(std::exception_ptr e) {
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            if (!error) error = e;
+        }
+        aborted.store(true);
+        // Unblock producers waiting on full queues; consumers drain and skip
+        files.close();
+        to_hash.close();
+        to_dedup.close();
+        to_compress.close();
+        to_store.close();
+        to_commit.close();
+    }
+
+    // True once the run failed or was canceled; whichever worker sees the cancel first fails the run
+    bool stopped() {
+        if (aborted.load()) return true;
+        if (!cancel_token || !cancel_token->isCanceled()) return false;
+        fail(std::make_exception_ptr(OperationCanceled()));
+        return true;
+    }
+
+    uint64_t queueWait(BlockTask& task) {
+        uint64_t wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - task.enqueued_at).count();
+        pipeline.stats.recordQueueWait(wait_ns);
+        return wait_ns;
+    }
+
+    template<typename T>
+    void forward(BoundedQueue<T>& queue, T&& item) {
+        item.enqueued_at = std::chrono::steady_clock::now();
+        queue.push(std::move(item));
+    }
+
+    void release(const std::shared_ptr<FileJob>& job) {
+        if (job->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            to_commit.push(job);
+        }
+    }
+
+    void resolve(BlockTask& task, uint64_t block_id) {
+        FileJob& job = *task.job;
+        BackupCheckpoint checkpoint;
+        {
+            std::lock_guard<std::mutex> lock(job.ids_mutex);
+            auto& ids = job.block_ids;
+            if (ids.size() <= task.seq) ids.resize(task.seq + 1);
+            ids[task.seq] = block_id;
+
+            if (job.checkpointing) {
+                if (job.resolved.size() <= task.seq) job.resolved.resize(task.seq + 1);
+                job.resolved[task.seq] = true;
+                while (job.resolved_prefix < job.resolved.size() && job.resolved[job.resolved_prefix]) {
+                    job.resolved_prefix++;
+                }
+
+                // Newest reader hash state that the stored prefix now covers
+                auto state = job.hash_states.upper_bound(job.resolved_prefix);
+                if (state != job.hash_states.begin() && std::prev(state)->first > job.checkpointed) {
+                    --state;
+                    checkpoint.file_path = job.path;
+                    checkpoint.file_size = job.stat_size;
+                    checkpoint.mtime = job.mtime;
+                    checkpoint.block_ids.assign(ids.begin(), ids.begin() + state->first);
+                    checkpoint.hash_state = state->second;
+                    job.checkpointed = state->first;
+                    job.hash_states.erase(job.hash_states.begin(), std::next(state));
+                }
+            }
+        }
+        if (!checkpoint.block_ids.empty()) pipeline.db->saveCheckpoint(checkpoint);
+        release(task.job);
+    }
+
+    // Pick up a checkpoint of an interrupted backup of the same, unchanged file.
+    // Returns the number of blocks that need not be read again.
+    size_t resumeFromCheckpoint(FileJob& job, StreamHash& file_hasher) {
+        std::error_code ec;
+        job.stat_size = std::filesystem::file_size(job.path, ec);
+        if (ec) return 0;
+        job.mtime = static_cast<int64_t>(std::filesystem::last_write_time(job.path, ec).time_since_epoch().count());
+        if (ec) return 0;
+        job.checkpointing = true;
+
+        BackupCheckpoint checkpoint;
+        if (!pipeline.db->loadCheckpoint(job.path, checkpoint)) return 0;
+
+        size_t blocks = checkpoint.block_ids.size();
+        if (checkpoint.file_size != job.stat_size || checkpoint.mtime != job.mtime ||
+            blocks * BlockSplitter::BLOCK_SIZE > job.stat_size || !file_hasher.loadState(checkpoint.hash_state)) {
+            pipeline.db->clearCheckpoint(job.path);
+            return 0;
+        }
+
+        uint64_t bytes = static_cast<uint64_t>(blocks) * BlockSplitter::BLOCK_SIZE;
+        job.block_ids = std::move(checkpoint.block_ids);
+        job.resolved.assign(blocks, true);
+        job.resolved_prefix = blocks;
+        job.checkpointed = blocks;
+        job.file_size = bytes;
+        pipeline.stats.recordResumed(bytes);
+        if (progress) progress->addDone(bytes, blocks);
+        return blocks;
+    }
+
+    // Whole-file hash in a pass of its own, for files too large to hold
+    std::string hashFile(const std::string& path, uint64_t& size) {
+        StageTimer timer(pipeline.stats, PipelineStage::Read, tracer);
+        StreamHash file_hasher;
+        size = 0;
+        pipeline.splitter->forEachBlock(path, *pool, [&](PooledBuffer&& block) {
+            if (governor) governor->throttleRead(block.size());
+            file_hasher.update(block.data(), block.size());
+            size += block.size();
+            return !stopped();
+        });
+        timer.setBytes(size, size);
+        return contentName(cipher, file_hasher.finalize());
+    }
+
+    // A file whose content is already stored becomes a clone of that version:
+    // nothing goes to the hash, dedup, compress or store stages
+    void cloneContent(const std::shared_ptr<FileJob>& job, uint64_t source_version, size_t blocks) {
+        job->content_version = source_version;
+        if (progress) {
+            progress->addDedup(job->file_size);
+            progress->addDone(job->file_size, blocks);
+        }
+        release(job);
+    }
+
+    // Stage 1: stream files block by block; the file hash is computed on the way
+    void readLoop() {
+        std::shared_ptr<FileJob> job;
+        while (files.pop(job)) {
+            if (stopped()) continue;
+            try {
+                StreamHash file_hasher;
+                size_t seq = checkpoint_blocks > 0 ? resumeFromCheckpoint(*job, file_hasher) : 0;
+
+                // Only a file as large as some stored content can be a copy of it
+                std::error_code ec;
+                uint64_t stat_size = std::filesystem::file_size(job->path, ec);
+                bool maybe_copy = seq == 0 && !ec && pipeline.db->hasContentOfSize(stat_size);
+                if (maybe_copy && stat_size > pipeline.config.content_hold_bytes) {
+                    std::string file_hash = hashFile(job->path, job->file_size);
+                    uint64_t source_version = pipeline.db->findVersionByContent(file_hash, job->file_size);
+                    if (source_version != 0) {
+                        job->file_hash = std::move(file_hash);
+                        cloneContent(job, source_version, pipeline.splitter->getBlockCount(job->file_size));
+                        continue;
+                    }
+                    job->file_size = 0;
+                    maybe_copy = false;
+                }
+                std::vector<BlockTask> held;   // maybe_copy: blocks wait for the file hash
+
+                auto read_start = std::chrono::steady_clock::now();
+                uint64_t trace_start = tracer ? tracer->nowMicros() : 0;
+
+                pipeline.splitter->forEachBlock(job->path, *pool, [&](PooledBuffer&& block) {
+                    uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - read_start).count();
+                    pipeline.stats.record(PipelineStage::Read, elapsed_ns, block.size(), block.size());
+                    if (tracer) tracer->addEvent(PipelineStage::Read, trace_start, elapsed_ns / 1000, 0, block.size());
+
+                    if (governor) governor->throttleRead(block.size());
+                    file_hasher.update(block.data(), block.size());
+                    job->file_size += block.size();
+                    job->pending.fetch_add(1, std::memory_order_relaxed);
+                    if (job->checkpointing && (seq + 1) % checkpoint_blocks == 0) {
+                        std::lock_guard<std::mutex> lock(job->ids_mutex);
+                        job->hash_states[seq + 1] = file_hasher.saveState();
+                    }
+
+                    BlockTask task;
+                    task.job = job;
+                    task.seq = seq++;
+                    task.data = std::move(block);
+                    if (maybe_copy) {
+                        held.push_back(std::move(task));
+                    } else {
+                        forward(to_hash, std::move(task));
+                    }
+
+                    read_start = std::chrono::steady_clock::now();
+                    if (tracer) trace_start = tracer->nowMicros();
+                    return !stopped();
+                }, static_cast<uint64_t>(seq) * BlockSplitter::BLOCK_SIZE);
+
+                job->file_hash = contentName(cipher, file_hasher.finalize());
+                if (maybe_copy) {
+                    uint64_t source_version = pipeline.db->findVersionByContent(job->file_hash, job->file_size);
+                    if (source_version != 0) {
+                        job->pending.fetch_sub(held.size(), std::memory_order_relaxed);
+                        cloneContent(job, source_version, held.size());
+                        continue;
+                    }
+                    for (auto& task : held) forward(to_hash, std::move(task));
+                }
+                release(job);
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        }
+    }
+
+    // Stage 2: SHA-256 of each block
+    void hashLoop() {
+        BlockTask task;
+        while (to_hash.pop(task)) {
+            if (stopped()) continue;
+            try {
+                uint64_t wait_ns = queueWait(task);
+                pipeline.stats.recordBlock();
+                {
+                    auto slot = governor ? governor->acquireCpu() : ResourceGovernor::CpuSlot();
+                    StageTimer timer(pipeline.stats, PipelineStage::Hash, tracer, wait_ns / 1000);
+                    task.hash = contentName(cipher, pipeline.hasher->computeBlockHash(task.data.data(), task.data.size()));
+                    timer.setBytes(task.data.size(), 0);
+                }
+                forward(to_dedup, std::move(task));
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        }
+    }
+
+    // Stage 3: skip compression and the block write when the block is already stored
+    void dedupLoop() {
+        BlockTask task;
+        while (to_dedup.pop(task)) {
+            if (stopped()) continue;
+            try {
+                uint64_t wait_ns = queueWait(task);
+                uint64_t existing_id;
+                {
+                    StageTimer timer(pipeline.stats, PipelineStage::Dedup, tracer, wait_ns / 1000);
+                    existing_id = pipeline.db->findBlock(task.hash);
+                }
+                if (existing_id == 0) {
+                    forward(to_compress, std::move(task));
+                    continue;
+                }
+                pipeline.stats.recordDedupHit();
+                if (progress) {
+                    progress->addDedup(task.data.size());
+                    progress->addDone(task.data.size());
+                }
+                task.data.reset();
+                resolve(task, existing_id);
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        }
+    }
+
+    // Stage 4: zstd, then AES-GCM when the repository is encrypted
+    void compressLoop() {
+        BlockTask task;
+        while (to_compress.pop(task)) {
+            if (stopped()) continue;
+            try {
+                uint64_t wait_ns = queueWait(task);
+                {
+                    auto slot = governor ? governor->acquireCpu() : ResourceGovernor::CpuSlot();
+                    StageTimer timer(pipeline.stats, PipelineStage::Compress, tracer, wait_ns / 1000);
+                    // Room for the GCM tag so encryption never reallocates
+                    size_t tag_room = cipher ? BlockCipher::TAG_SIZE : 0;
+                    task.compressed = pool->acquire(HashEngine::compressBound(task.data.size()) + tag_room);
+                    pipeline.hasher->compressBlockInto(task.data.data(), task.data.size(), task.compressed, pipeline.config.compression_level);
+                    if (bases) compressDelta(task, tag_room);
+                    timer.setBytes(task.data.size(), task.compressed.size());
+                }
+                if (cipher) {
+                    // A delta's base reference stays in the clear, authenticated by the tag
+                    size_t offset = task.delta_base.empty() ? 0 : DELTA_BASE_SIZE;
+                    StageTimer timer(pipeline.stats, PipelineStage::Encrypt, tracer);
+                    size_t plain_size = task.compressed.size() - offset;
+                    task.compressed.resize(offset + plain_size + BlockCipher::TAG_SIZE);
+                    cipher->encrypt(task.hash, task.compressed.data() + offset, plain_size, 0,
+                                    task.compressed.data(), offset);
+                    timer.setBytes(plain_size, task.compressed.size());
+                }
+                forward(to_store, std::move(task));
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        }
+    }
+
+    // Replace the whole-block payload with a delta against the most similar
+    // indexed block, if one is found and the delta is smaller
+    void compressDelta(BlockTask& task, size_t tag_room) {
+        task.sketch = computeBlockSketch(task.data.data(), task.data.size());
+        if (cipher) cipher->sealSketch(task.sketch);
+        DBBlock base;
+        if (!pipeline.db->findSimilarBlock(task.sketch, pipeline.config.delta_max_depth, base)) return;
+        // The same block, stored by another file since this one missed in dedup
+        if (base.block_hash == task.hash) return;
+
+        BlockBuffer base_data = bases->read(base.block_hash, 2);
+        PooledBuffer delta = pool->acquire(HashEngine::compressBound(task.data.size()));
+        pipeline.hasher->compressDeltaInto(task.data.data(), task.data.size(), base_data->data(), base_data->size(),
+                                           delta, pipeline.config.compression_level);
+        if (DELTA_BASE_SIZE + delta.size() >= task.compressed.size()) return;
+
+        pipeline.stats.recordDelta(task.compressed.size() - DELTA_BASE_SIZE - delta.size());
+        task.compressed = pool->acquire(DELTA_BASE_SIZE + delta.size() + tag_room);
+        task.compressed.resize(DELTA_BASE_SIZE);
+        putDeltaBase(task.compressed.data(), base.block_hash);
+        task.compressed.append(delta.data(), delta.size());
+        task.delta_base = base.block_hash;
+        task.delta_depth = base.delta_depth + 1;
+    }
+
+    // Stage 5: block file and blocks row
+    void storeLoop() {
+        BlockTask task;
+        while (to_store.pop(task)) {
+            if (stopped()) continue;
+            try {
+                uint64_t wait_ns = queueWait(task);
+                if (governor) governor->throttleWrite(task.compressed.size());
+                {
+                    StageTimer timer(pipeline.stats, PipelineStage::Store, tracer, wait_ns / 1000);
+                    uint32_t flags = (cipher ? BLOCK_FLAG_ENCRYPTED : 0) | (task.delta_base.empty() ? 0 : BLOCK_FLAG_DELTA);
+                    if (cipher && !task.delta_base.empty()) flags |= BLOCK_FLAG_BASE_SEALED;
+                    if (!pipeline.storage->writeBlock(task.hash, task.compressed.data(), task.compressed.size(), flags)) {
+                        throw std::runtime_error("Failed to write block: " + task.hash);
+                    }
+                    timer.setBytes(task.compressed.size(), task.compressed.size());
+                }
+                uint64_t block_id;
+                {
+                    StageTimer timer(pipeline.stats, PipelineStage::Commit, tracer);
+                    block_id = pipeline.db->storeBlock(task.hash, task.data.size(), task.compressed.size(), pipeline.config.compression_level,
+                                                       task.delta_base, task.delta_depth);
+                    // Indexed once the block is readable, so it can serve as a base
+                    if (bases) pipeline.db->addBlockFeatures(block_id, task.sketch);
+                }
+                if (progress) progress->addDone(task.data.size());
+                task.data.reset();
+                task.compressed.reset();
+                resolve(task, block_id);
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        }
+    }
+
+    // Stage 6: one thread creates catalog versions as files complete, in any order
+    void commitLoop() {
+        std::shared_ptr<FileJob> job;
+        while (to_commit.pop(job)) {
+            if (stopped()) continue;
+            try {
+                StageTimer timer(pipeline.stats, PipelineStage::Commit, tracer);
+                std::vector<uint64_t> created;
+                if (job->is_pack) {
+                    created = pipeline.db->createPackedVersions(job->block_ids.at(0), job->entries);
+                    for (size_t i = 0; i < job->entries.size(); ++i) pipeline.stats.recordFile();
+                } else {
+                    uint64_t file_id = pipeline.db->getOrCreateFile(job->path);
+                    uint64_t parent_id = pipeline.db->getLatestVersionId(file_id);
+                    // Identical content already stored under any path: reuse its block list.
+                    // The reader finds most copies; this catches one stored earlier in the run.
+                    uint64_t source_version = job->content_version != 0
+                        ? job->content_version
+                        : pipeline.db->findVersionByContent(job->file_hash, job->file_size);
+                    if (source_version != 0) {
+                        created.push_back(pipeline.db->createVersionFromContent(file_id, job->file_hash, job->file_size, source_version,
+                                                                               parent_id, job->mode));
+                        pipeline.stats.recordFileDedupHit();
+                    } else {
+                        created.push_back(pipeline.db->createVersion(file_id, job->file_hash, job->file_size, job->block_ids,
+                                                                     parent_id, job->mode));
+                    }
+                    if (job->checkpointing) pipeline.db->clearCheckpoint(job->path);
+                    pipeline.stats.recordFile();
+                }
+                std::lock_guard<std::mutex> lock(results_mutex);
+                version_ids.insert(version_ids.end(), created.begin(), created.end());
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        }
+    }
+
+    BackupPipeline& pipeline;
+    std::shared_ptr<ProgressTracker> progress;
+    TraceRecorder* tracer;
+    std::shared_ptr<BufferPool> pool;
+    std::shared_ptr<ResourceGovernor> governor;
+    const BlockCipher* cipher;
+    std::shared_ptr<CancellationToken> cancel_token;
+    std::unique_ptr<BlockReader> bases;   // Delta compression only
+    size_t checkpoint_blocks;   // Save progress every this many blocks of a file (0 = never)
+
+    BoundedQueue<std::shared_ptr<FileJob>> files;
+    BoundedQueue<BlockTask> to_hash;
+    BoundedQueue<BlockTask> to_dedup;
+    BoundedQueue<BlockTask> to_compress;
+    BoundedQueue<BlockTask> to_store;
+    BoundedQueue<std::shared_ptr<FileJob>> to_commit;
+
+    std::vector<std::thread> readers, hashers, dedupers, compressors, storers;
+    std::thread committer;
+
+    std::mutex results_mutex;
+    std::vector<uint64_t> version_ids;
+    std::exception_ptr error;
+    std::atomic<bool> aborted{false};
+    bool finished = false;
+};
 
 BackupPipeline::BackupPipeline(
     std::shared_ptr<FileScanner> scanner,
     std::shared_ptr<BlockSplitter> splitter,
     std::shared_ptr<HashEngine> hasher,
     std::shared_ptr<StorageManager> storage,
-    std::shared_ptr<MetadataDB> db,
-    std::shared_ptr<ThreadPool> thread_pool
-) : scanner(scanner), splitter(splitter), hasher(hasher), storage(storage), db(db), thread_pool(thread_pool) {}
+    std::shared_ptr<MetadataDB> db
+) : scanner(scanner), splitter(splitter), hasher(hasher), storage(storage), db(db),
+    buffer_pool(BufferPool::defaultPool()) {}
 
 uint64_t BackupPipeline::runBackup(const std::string& file_path) {
-    // 1. Scan and register file
+    std::shared_ptr<ProgressTracker> progress;
+    if (progress_callback) {
+        progress = std::make_shared<ProgressTracker>(progress_callback, progress_interval);
+    }
+
     auto metadata = scanner->getFileMetadata(file_path);
-    uint64_t file_id = db->getOrCreateFile(file_path);
-    std::string full_file_hash = scanner->hashFile(file_path);
-
-    // 2. Split file
-    auto blocks = splitter->splitFile(file_path);
-    
-    // 3. Process blocks in parallel
-    std::vector<std::future<uint64_t>> futures;
-    futures.reserve(blocks.size());
-
-    // We need to maintain order of block ids for the version creation
-    // But threads finish out of order. We can store futures in order and retrieve results in order.
-    
-    for (const auto& block_data : blocks) {
-        // Enqueue job
-        futures.push_back(thread_pool->enqueue([this, block_data]() -> uint64_t {
-            std::string hash = this->hasher->computeBlockHash(block_data);
-            
-            // Optimization: Could check DB here if block exists before compressing
-            // For now, continuing with previous logic for robustness
-            auto [compressed, _] = this->hasher->compressBlock(block_data);
-            
-            this->storage->writeBlock(hash, compressed);
-            return this->db->storeBlock(hash, block_data.size(), compressed.size());
-        }));
-    }
-
-    // 4. Collect results (waits for all threads)
-    std::vector<uint64_t> block_ids;
-    block_ids.reserve(futures.size());
-    for (auto& f : futures) {
-        block_ids.push_back(f.get());
-    }
-
-    // 5. Create Version
-    return db->createVersion(file_id, full_file_hash, block_ids);
+    if (progress) {
+        progress->addTotal(metadata.file_size, splitter->getBlockCount(metadata.file_size));
+    }
+
+    StagedRun run(*this, progress);
+    run.addFile(file_path, fileMode(metadata));
+    auto version_ids = run.finish();
+    if (progress) progress->finish();
+    if (version_ids.size() != 1) throw std::runtime_error("Backup produced no version for " + file_path);
+    return version_ids.front();
+}
+
+uint64_t BackupPipeline::runBackupDirectory(const std::string& dir_path) {
+    return runBackupFiles(scanner->scanDirectory(dir_path), dir_path);
+}
+
+uint64_t BackupPipeline::runBackupFiles(const std::vector<std::string>& file_paths, const std::string& root_path,
+                                       const std::vector<uint64_t>& unchanged_version_ids) {
+    TraceRecorder* tracer = trace.get();
+    std::shared_ptr<ProgressTracker> progress;
+    if (progress_callback) {
+        progress = std::make_shared<ProgressTracker>(progress_callback, progress_interval);
+    }
+
+    std::vector<FileMetadata> metadata;
+    metadata.reserve(file_paths.size());
+    uint64_t small_bytes = 0;
+    for (const auto& path : file_paths) {
+        metadata.push_back(scanner->getFileMetadata(path));
+        const auto& m = metadata.back();
+        if (m.file_size < SMALL_FILE_THRESHOLD) {
+            small_bytes += m.file_size;
+        } else if (progress) {
+            progress->addTotal(m.file_size, splitter->getBlockCount(m.file_size));
+        }
+    }
+    if (progress) {
+        progress->addTotal(small_bytes, splitter->getBlockCount(small_bytes));
+    }
+
+    StagedRun run(*this, progress);
+
+    // Small files are appended to the current pack until it would exceed one block,
+    // then the whole pack enters the pipeline as a single block.
+    PooledBuffer pack = buffer_pool->acquire(BlockSplitter::BLOCK_SIZE);
+    pack.resize(0);
+    std::vector<PackedFileEntry> entries;
+    std::unordered_map<std::string, uint64_t> pack_offsets; // "hash:size" -> offset in current pack
+
+    auto flushPack = [&]() {
+        if (entries.empty()) return;
+        run.addPack(std::move(pack), std::move(entries));
+        pack = buffer_pool->acquire(BlockSplitter::BLOCK_SIZE);
+        pack.resize(0);
+        entries.clear();
+        pack_offsets.clear();
+    };
+
+    for (size_t i = 0; i < file_paths.size(); ++i) {
+        if (cancel_token) cancel_token->throwIfCanceled();   // Abandons the run
+        const auto& path = file_paths[i];
+        if (metadata[i].file_size >= SMALL_FILE_THRESHOLD) {
+            run.addFile(path, fileMode(metadata[i]));
+            continue;
+        }
+
+        // One read serves both the file hash and the pack contents
+        std::vector<uint8_t> content;
+        {
+            StageTimer timer(stats, PipelineStage::Read, tracer);
+            auto blocks = splitter->splitFile(path);
+            if (!blocks.empty()) content = std::move(blocks.front());
+            timer.setBytes(content.size(), content.size());
+        }
+        if (governor) governor->throttleRead(content.size());
+
+        PackedFileEntry entry;
+        entry.file_id = db->getOrCreateFile(path);
+        entry.parent_id = db->getLatestVersionId(entry.file_id);
+        {
+            StageTimer timer(stats, PipelineStage::Hash, tracer);
+            entry.file_hash = contentName(cipher.get(), hasher->computeBlockHash(content));
+            timer.setBytes(content.size(), 0);
+        }
+        entry.length = content.size();
+        entry.mode = fileMode(metadata[i]);
+
+        uint64_t source_version = db->findVersionByContent(entry.file_hash, entry.length);
+        if (source_version != 0) {
+            StageTimer timer(stats, PipelineStage::Commit, tracer);
+            run.addVersion(db->createVersionFromContent(entry.file_id, entry.file_hash, entry.length, source_version,
+                                                        entry.parent_id, entry.mode));
+            stats.recordFile();
+            stats.recordFileDedupHit();
+            if (progress) {
+                progress->addDedup(entry.length);
+                progress->addDone(entry.length, 0);
+            }
+            continue;
+        }
+
+        // A duplicate of a file already in the current pack shares its bytes
+        std::string content_key = entry.file_hash + ":" + std::to_string(entry.length);
+        auto in_pack = pack_offsets.find(content_key);
+        if (in_pack != pack_offsets.end()) {
+            entry.offset = in_pack->second;
+            entries.push_back(std::move(entry));
+            stats.recordFileDedupHit();
+            if (progress) {
+                progress->addDedup(content.size());
+                progress->addDone(content.size(), 0);
+            }
+            continue;
+        }
+
+        if (pack.size() + content.size() > BlockSplitter::BLOCK_SIZE) {
+            flushPack();
+        }
+
+        entry.offset = pack.size();
+        pack_offsets[content_key] = entry.offset;
+        entries.push_back(std::move(entry));
+        pack.append(content.data(), content.size());
+    }
+    flushPack();
+
+    auto version_ids = run.finish();
+    version_ids.insert(version_ids.end(), unchanged_version_ids.begin(), unchanged_version_ids.end());
+
+    uint64_t snapshot_id;
+    {
+        StageTimer timer(stats, PipelineStage::Commit, tracer);
+        snapshot_id = db->createSnapshot(root_path, version_ids);
+    }
+    if (progress) progress->finish();
+    return snapshot_id;
+}
+
+PipelineStatsSnapshot BackupPipeline::getStats() const {
+    return stats.snapshot();
+}
+
+void BackupPipeline::resetStats() {
+    stats.reset();
+}
+
+void BackupPipeline::setProgressCallback(ProgressCallback callback, std::chrono::milliseconds interval) {
+    progress_callback = std::move(callback);
+    progress_interval = interval;
+}
+
+void BackupPipeline::setTraceRecorder(std::shared_ptr<TraceRecorder> recorder) {
+    trace = std::move(recorder);
 }
@@ -1,16 +1,61 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <memory>
 #include <mutex>
+#include "pipeline_stats.h"
+#include "progress_reporter.h"
+#include "buffer_pool.h"
 
 class FileScanner;
 class BlockSplitter;
 class HashEngine;
 class StorageManager;
 class MetadataDB;
-class ThreadPool;
+class ResourceGovernor;
+class BlockCipher;
+class CancellationToken;
+struct FileMetadata;
+struct PackedFileEntry;
 
+// Tuning of the staged pipeline. Worker counts of 0 are derived from
+// std::thread::hardware_concurrency.
+struct PipelineConfig {
+    size_t read_workers = 2;
+    size_t hash_workers = 0;
+    size_t dedup_workers = 1;
+    size_t compress_workers = 0;
+    size_t store_workers = 2;
+    size_t queue_depth = 64;       // Blocks buffered between two stages
+
+    // zstd level for new blocks. Ingest favours throughput (negative levels
+    // are faster still); BlockCompactor recompresses blocks at rest later.
+    int compression_level = 1;
+
+    // Store a new block that resembles an indexed one as a zstd delta against
+    // it, when that is smaller (see block_sketch.h). Restoring a delta decodes
+    // its base first, so chains are capped at delta_max_depth deltas.
+    bool delta_compression = false;
+    int delta_max_depth = 2;
+
+    // Save a resumable checkpoint of a file's progress every this many bytes
+    // (0 = never). A later backup of the unchanged file continues from it.
+    uint64_t checkpoint_interval = 64ull * 1024 * 1024;
+
+    // A file as large as some stored content may be a copy of it. Up to this
+    // size its blocks are held by the reader until the whole-file hash is
+    // known; larger ones are hashed in a separate pass first. Either way a
+    // copy sends no block downstream.
+    uint64_t content_hold_bytes = 16ull * 1024 * 1024;
+};
+
+// Backups run as a staged pipeline:
+//   read -> hash -> dedup check -> compress -> store -> catalog commit
+// Each stage has its own threads, connected by bounded lock-free queues, so
+// blocks of many files are in flight at once and reading, CPU work and SQLite
+// commits overlap across file boundaries. Full queues apply back-pressure to
+// the readers, which bounds memory to roughly queue_depth blocks per stage.
 class BackupPipeline {
 public:
     BackupPipeline(
@@ -18,19 +63,74 @@ public:
         std::shared_ptr<BlockSplitter> splitter,
         std::shared_ptr<HashEngine> hasher,
         std::shared_ptr<StorageManager> storage,
-        std::shared_ptr<MetadataDB> db,
-        std::shared_ptr<ThreadPool> thread_pool
+        std::shared_ptr<MetadataDB> db
     );
 
+    // Files smaller than this are packed together into shared blocks
+    static constexpr size_t SMALL_FILE_THRESHOLD = 64 * 1024;
+
     // Run the backup for a given file path
     // Returns the Version ID created
     uint64_t runBackup(const std::string& file_path);
 
+    // Back up a set of files as one snapshot, packing small files into shared blocks.
+    // `unchanged_version_ids` (versions of files not backed up again) go into the
+    // snapshot as they are, so it can describe a whole tree.
+    // Returns the Snapshot ID created
+    uint64_t runBackupFiles(const std::vector<std::string>& file_paths, const std::string& root_path,
+                            const std::vector<uint64_t>& unchanged_version_ids = {});
+
+    // Back up every regular file below dir_path (see runBackupFiles)
+    uint64_t runBackupDirectory(const std::string& dir_path);
+
+    // Per-stage counters accumulated over all runs since construction (or last reset)
+    PipelineStatsSnapshot getStats() const;
+    void resetStats();
+
+    // Record a trace event per task (pass nullptr to disable tracing)
+    void setTraceRecorder(std::shared_ptr<TraceRecorder> recorder);
+
+    // Receive progress snapshots every `interval` while runBackup is running,
+    // plus a final one when it completes. Called from a reporter thread.
+    void setProgressCallback(ProgressCallback callback,
+                             std::chrono::milliseconds interval = std::chrono::milliseconds(250));
+
+    // Stage worker counts and queue depth for subsequent runs
+    void setPipelineConfig(const PipelineConfig& pipeline_config) { config = pipeline_config; }
+
+    // Pool that block and compression buffers are borrowed from (default: BufferPool::defaultPool())
+    void setBufferPool(std::shared_ptr<BufferPool> pool) { buffer_pool = std::move(pool); }
+    std::shared_ptr<BufferPool> getBufferPool() const { return buffer_pool; }
+
+    // Bandwidth, CPU and priority limits for the stage workers (nullptr = unlimited).
+    // The governor's limits may be changed while a backup is running.
+    void setResourceGovernor(std::shared_ptr<ResourceGovernor> resource_governor) { governor = std::move(resource_governor); }
+
+    // Encrypt new blocks after compression (nullptr = store them in the clear)
+    void setCipher(std::shared_ptr<BlockCipher> block_cipher) { cipher = std::move(block_cipher); }
+
+    // Checked by every stage between blocks (nullptr = not cancelable). Once it is
+    // canceled the run stops, throws OperationCanceled and creates no versions;
+    // blocks and checkpoints already stored are kept for the next backup.
+    void setCancellationToken(std::shared_ptr<CancellationToken> token) { cancel_token = std::move(token); }
+
 private:
+    // Stage threads and queues of one run (defined in backup_pipeline.cpp)
+    class StagedRun;
+
     std::shared_ptr<FileScanner> scanner;
     std::shared_ptr<BlockSplitter> splitter;
     std::shared_ptr<HashEngine> hasher;
     std::shared_ptr<StorageManager> storage;
     std::shared_ptr<MetadataDB> db;
-    std::shared_ptr<ThreadPool> thread_pool;
+
+    PipelineConfig config;
+    std::shared_ptr<BufferPool> buffer_pool;
+    std::shared_ptr<ResourceGovernor> governor;
+    std::shared_ptr<BlockCipher> cipher;
+    std::shared_ptr<CancellationToken> cancel_token;
+    PipelineStats stats;
+    std::shared_ptr<TraceRecorder> trace;
+    ProgressCallback progress_callback;
+    std::chrono::milliseconds progress_interval{250};
 };
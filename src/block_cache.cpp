@@ -0,0 +1,106 @@
+#include "block_cache.h"
+#include <functional>
+#include <sstream>
+#include <iomanip>
+
+namespace {
+
+// Rejected hashes remembered per shard
+constexpr size_t GHOST_ENTRIES = 4096;
+
+} // namespace
+
+std::string BlockCacheStats::toString() const {
+    std::stringstream ss;
+    ss << "hits " << hits << ", misses " << misses
+       << ", hit rate " << std::fixed << std::setprecision(1) << hitRate() * 100.0 << "%"
+       << ", " << bytes / (1024.0 * 1024.0) << "/" << capacity / (1024.0 * 1024.0) << " MB cached"
+       << ", " << evictions << " evicted, " << rejected << " not admitted";
+    return ss.str();
+}
+
+BlockCache::BlockCache(size_t capacity_bytes, size_t shard_count) {
+    if (shard_count == 0) shard_count = 1;
+    shard_capacity = capacity_bytes / shard_count;
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards.push_back(std::make_unique<Shard>());
+    }
+}
+
+BlockCache::Shard& BlockCache::shardFor(const std::string& block_hash) {
+    return *shards[std::hash<std::string>{}(block_hash) % shards.size()];
+}
+
+BlockBuffer BlockCache::get(const std::string& block_hash) {
+    Shard& shard = shardFor(block_hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(block_hash);
+    if (it == shard.index.end()) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    hits.fetch_add(1, std::memory_order_relaxed);
+    return it->second->second;
+}
+
+void BlockCache::put(const std::string& block_hash, BlockBuffer data, uint64_t ref_count) {
+    if (!data || data->size() > shard_capacity) {
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Shard& shard = shardFor(block_hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.index.count(block_hash)) return;   // Another reader inserted it first
+
+    if (ref_count <= 1 && shard.ghosts.erase(block_hash) == 0) {
+        shard.ghosts.insert(block_hash);
+        shard.ghost_order.push_back(block_hash);
+        if (shard.ghost_order.size() > GHOST_ENTRIES) {
+            shard.ghosts.erase(shard.ghost_order.front());
+            shard.ghost_order.pop_front();
+        }
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    shard.lru.emplace_front(block_hash, std::move(data));
+    shard.index[block_hash] = shard.lru.begin();
+    shard.bytes += shard.lru.front().second->size();
+    insertions.fetch_add(1, std::memory_order_relaxed);
+
+    while (shard.bytes > shard_capacity) {
+        auto& victim = shard.lru.back();
+        shard.bytes -= victim.second->size();
+        shard.index.erase(victim.first);
+        shard.lru.pop_back();
+        evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+BlockCacheStats BlockCache::stats() const {
+    BlockCacheStats s;
+    s.hits = hits.load(std::memory_order_relaxed);
+    s.misses = misses.load(std::memory_order_relaxed);
+    s.insertions = insertions.load(std::memory_order_relaxed);
+    s.evictions = evictions.load(std::memory_order_relaxed);
+    s.rejected = rejected.load(std::memory_order_relaxed);
+    s.capacity = shard_capacity * shards.size();
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        s.bytes += shard->bytes;
+    }
+    return s;
+}
+
+void BlockCache::clear() {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->lru.clear();
+        shard->index.clear();
+        shard->bytes = 0;
+        shard->ghosts.clear();
+        shard->ghost_order.clear();
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_set>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Decompressed block contents, shared read-only between the cache and its readers
+using BlockBuffer = std::shared_ptr<const std::vector<uint8_t>>;
+
+struct BlockCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t insertions = 0;
+    uint64_t evictions = 0;
+    uint64_t rejected = 0;        // Not admitted (single-use block or larger than a shard)
+    uint64_t bytes = 0;           // Currently cached
+    uint64_t capacity = 0;
+
+    double hitRate() const {
+        uint64_t lookups = hits + misses;
+        return lookups ? static_cast<double>(hits) / lookups : 0.0;
+    }
+    std::string toString() const;
+};
+
+// Size-bounded cache of decompressed blocks keyed by block hash, shared by
+// restore threads. Split into independently locked LRU shards so concurrent
+// readers rarely contend. Buffers are handed out by shared_ptr: an evicted
+// block stays valid for readers still holding it.
+class BlockCache {
+public:
+    explicit BlockCache(size_t capacity_bytes, size_t shard_count = 16);
+
+    // nullptr on a miss
+    BlockBuffer get(const std::string& block_hash);
+
+    // Offer a block. Admitted only if it is likely to be read again: `ref_count`
+    // (versions or packed files referencing it, blocks.ref_count) exceeds one, or
+    // it was offered recently (a block repeated inside one version). Single-use
+    // blocks would just evict useful ones.
+    void put(const std::string& block_hash, BlockBuffer data, uint64_t ref_count);
+
+    BlockCacheStats stats() const;
+    void clear();
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::list<std::pair<std::string, BlockBuffer>> lru;   // Front = most recently used
+        std::unordered_map<std::string, std::list<std::pair<std::string, BlockBuffer>>::iterator> index;
+        size_t bytes = 0;
+
+        // Hashes of recently rejected blocks (FIFO), for second-chance admission
+        std::unordered_set<std::string> ghosts;
+        std::deque<std::string> ghost_order;
+    };
+
+    Shard& shardFor(const std::string& block_hash);
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t shard_capacity;
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> insertions{0};
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> rejected{0};
+};
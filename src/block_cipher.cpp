@@ -0,0 +1,213 @@
+#include "block_cipher.h"
+#include "block_sketch.h"
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t NONCE_SIZE = 12;
+
+// One cipher context per thread, reused for every block
+struct CipherContext {
+    EVP_CIPHER_CTX* ctx = nullptr;
+    ~CipherContext() { EVP_CIPHER_CTX_free(ctx); }
+};
+
+thread_local CipherContext cipher_context;
+
+EVP_CIPHER_CTX* threadCipherCtx() {
+    if (!cipher_context.ctx) {
+        cipher_context.ctx = EVP_CIPHER_CTX_new();
+        if (!cipher_context.ctx) throw std::runtime_error("Failed to create cipher context");
+    }
+    return cipher_context.ctx;
+}
+
+std::string toHex(const uint8_t* bytes, size_t size) {
+    static const char* digits = "0123456789abcdef";
+    std::string hex(size * 2, '0');
+    for (size_t i = 0; i < size; i++) {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0x0f];
+    }
+    return hex;
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+} // namespace
+
+BlockCipher::BlockCipher(const std::array<uint8_t, KEY_SIZE>& key) : master_key(key) {}
+
+BlockCipher::~BlockCipher() {
+    OPENSSL_cleanse(master_key.data(), master_key.size());
+}
+
+std::shared_ptr<BlockCipher> BlockCipher::fromKeyFile(const std::string& path) {
+    std::ifstream file(path);
+    std::string hex;
+    if (!file || !(file >> hex)) {
+        throw std::runtime_error("Cannot read key file: " + path);
+    }
+    if (hex.size() != KEY_SIZE * 2) {
+        throw std::runtime_error("Key file must contain " + std::to_string(KEY_SIZE * 2) + " hex characters: " + path);
+    }
+
+    std::array<uint8_t, KEY_SIZE> key{};
+    for (size_t i = 0; i < KEY_SIZE; ++i) {
+        int hi = hexValue(hex[2 * i]);
+        int lo = hexValue(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) throw std::runtime_error("Key file is not hex: " + path);
+        key[i] = static_cast<uint8_t>(hi << 4 | lo);
+    }
+    OPENSSL_cleanse(hex.data(), hex.size());
+    auto cipher = std::make_shared<BlockCipher>(key);
+    OPENSSL_cleanse(key.data(), key.size());
+    return cipher;
+}
+
+void BlockCipher::generateKeyFile(const std::string& path) {
+    if (fs::exists(path)) {
+        throw std::runtime_error("Key file already exists: " + path);
+    }
+    std::array<uint8_t, KEY_SIZE> key{};
+    if (RAND_bytes(key.data(), static_cast<int>(key.size())) != 1) {
+        throw std::runtime_error("Failed to generate a random key");
+    }
+
+    std::string hex = toHex(key.data(), key.size());
+    OPENSSL_cleanse(key.data(), key.size());
+    {
+        std::ofstream file(path);
+        if (!file) throw std::runtime_error("Cannot create key file: " + path);
+        file << hex << "\n";
+    }
+    OPENSSL_cleanse(hex.data(), hex.size());
+
+    std::error_code ec;
+    fs::permissions(path, fs::perms::owner_read | fs::perms::owner_write, fs::perm_options::replace, ec);
+}
+
+void BlockCipher::deriveBlockKey(const std::string& block_hash, uint32_t generation,
+                                 uint8_t key[KEY_SIZE], uint8_t nonce[NONCE_SIZE]) const {
+    // Generation 0 (as written by a backup) derives from the hash alone, later
+    // ones from "<hash>/<generation>"; built on the stack, this runs per block
+    char input[128];
+    if (block_hash.size() + 12 > sizeof(input)) throw std::runtime_error("Block hash too long: " + block_hash);
+    std::memcpy(input, block_hash.data(), block_hash.size());
+    size_t input_size = block_hash.size();
+    if (generation != 0) {
+        input[input_size++] = '/';
+        input_size = std::to_chars(input + input_size, input + sizeof(input), generation).ptr - input;
+    }
+    uint8_t derived[64];
+    unsigned int derived_size = 0;
+    if (!HMAC(EVP_sha512(), master_key.data(), static_cast<int>(master_key.size()),
+              reinterpret_cast<const uint8_t*>(input), input_size, derived, &derived_size)) {
+        throw std::runtime_error("Block key derivation failed");
+    }
+    std::copy(derived, derived + KEY_SIZE, key);
+    std::copy(derived + KEY_SIZE, derived + KEY_SIZE + NONCE_SIZE, nonce);
+    OPENSSL_cleanse(derived, sizeof(derived));
+}
+
+std::string BlockCipher::blockName(const std::string& content_hash) const {
+    // Labelled so a name never equals a key derivation or the key id
+    char input[128];
+    static const char label[] = "name/";
+    if (content_hash.size() + sizeof(label) > sizeof(input)) throw std::runtime_error("Hash too long: " + content_hash);
+    std::memcpy(input, label, sizeof(label) - 1);
+    std::memcpy(input + sizeof(label) - 1, content_hash.data(), content_hash.size());
+    uint8_t digest[32];
+    unsigned int digest_size = 0;
+    if (!HMAC(EVP_sha256(), master_key.data(), static_cast<int>(master_key.size()),
+              reinterpret_cast<const uint8_t*>(input), sizeof(label) - 1 + content_hash.size(), digest, &digest_size)) {
+        throw std::runtime_error("Block name derivation failed");
+    }
+    return toHex(digest, sizeof(digest));
+}
+
+void BlockCipher::sealSketch(BlockSketch& sketch) const {
+    if (sketch.empty()) return;
+    for (size_t s = 0; s < SKETCH_SUPER_FEATURES; ++s) {
+        uint8_t input[13] = {'f', 'e', 'a', 't', '/'};
+        uint64_t feature = static_cast<uint64_t>(sketch.super_features[s]);
+        for (int i = 0; i < 8; ++i) input[5 + i] = static_cast<uint8_t>(feature >> (8 * i));
+        uint8_t digest[32];
+        unsigned int digest_size = 0;
+        if (!HMAC(EVP_sha256(), master_key.data(), static_cast<int>(master_key.size()),
+                  input, sizeof(input), digest, &digest_size)) {
+            throw std::runtime_error("Sketch keying failed");
+        }
+        uint64_t keyed = 0;
+        std::memcpy(&keyed, digest, sizeof(keyed));
+        // Same shape as computeBlockSketch: positive, slot in the low bits
+        sketch.super_features[s] = static_cast<int64_t>((keyed >> 5) << 4 | (s + 1));
+    }
+}
+
+void BlockCipher::encrypt(const std::string& block_hash, uint8_t* data, size_t size, uint32_t generation,
+                          const uint8_t* aad, size_t aad_size) const {
+    uint8_t key[KEY_SIZE];
+    uint8_t nonce[NONCE_SIZE];
+    deriveBlockKey(block_hash, generation, key, nonce);
+
+    EVP_CIPHER_CTX* ctx = threadCipherCtx();
+    int out_len = 0;
+    bool ok = EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, key, nonce) == 1 &&
+              (aad_size == 0 || EVP_EncryptUpdate(ctx, nullptr, &out_len, aad, static_cast<int>(aad_size)) == 1) &&
+              EVP_EncryptUpdate(ctx, data, &out_len, data, static_cast<int>(size)) == 1 &&
+              EVP_EncryptFinal_ex(ctx, data + out_len, &out_len) == 1 &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, TAG_SIZE, data + size) == 1;
+    OPENSSL_cleanse(key, sizeof(key));
+    if (!ok) throw std::runtime_error("Block encryption failed: " + block_hash);
+}
+
+size_t BlockCipher::decrypt(const std::string& block_hash, uint8_t* data, size_t size, uint32_t generation,
+                            const uint8_t* aad, size_t aad_size) const {
+    if (size < TAG_SIZE) {
+        throw std::runtime_error("Encrypted block too short: " + block_hash);
+    }
+    size_t plain_size = size - TAG_SIZE;
+
+    uint8_t key[KEY_SIZE];
+    uint8_t nonce[NONCE_SIZE];
+    deriveBlockKey(block_hash, generation, key, nonce);
+
+    EVP_CIPHER_CTX* ctx = threadCipherCtx();
+    int out_len = 0;
+    bool ok = EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, key, nonce) == 1 &&
+              (aad_size == 0 || EVP_DecryptUpdate(ctx, nullptr, &out_len, aad, static_cast<int>(aad_size)) == 1) &&
+              EVP_DecryptUpdate(ctx, data, &out_len, data, static_cast<int>(plain_size)) == 1 &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TAG_SIZE, data + plain_size) == 1 &&
+              EVP_DecryptFinal_ex(ctx, data + out_len, &out_len) == 1;
+    OPENSSL_cleanse(key, sizeof(key));
+    if (!ok) {
+        throw std::runtime_error("Block authentication failed (wrong key or tampered data): " + block_hash);
+    }
+    return plain_size;
+}
+
+std::string BlockCipher::keyId() const {
+    static const char label[] = "deltavault key id";
+    uint8_t digest[32];
+    unsigned int digest_size = 0;
+    HMAC(EVP_sha256(), master_key.data(), static_cast<int>(master_key.size()),
+         reinterpret_cast<const uint8_t*>(label), sizeof(label) - 1, digest, &digest_size);
+    return toHex(digest, 8);
+}
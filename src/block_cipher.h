@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+struct BlockSketch;
+
+// Convergent AES-256-GCM encryption of stored blocks.
+//
+// In an encrypted repository a block is not named by the SHA-256 of its
+// plaintext but by HMAC-SHA256(master, hash) (blockName). The name is what the
+// block file, the catalog and delta base references carry, so without the
+// master key nobody can tell whether a block they know is stored. Each block
+// gets its own key and nonce, derived from the master key and that name:
+// HMAC-SHA512(master, name) yields a 32-byte key and a 12-byte nonce.
+// Identical blocks therefore encrypt to identical bytes and still dedupe.
+// Since a key only ever encrypts one plaintext, the deterministic nonce is
+// never reused with different data.
+// A block rewritten with different stored bytes (e.g. recompressed) gets a
+// new generation number, which is mixed into the derivation so the rewrite
+// is encrypted under a fresh key and nonce.
+//
+// Encryption happens in place on the compressed payload and appends the
+// 16-byte GCM tag, which also covers optional associated data (bytes stored
+// in the clear next to the ciphertext). OpenSSL's EVP layer uses AES-NI /
+// PCLMULQDQ when available.
+class BlockCipher {
+public:
+    static constexpr size_t KEY_SIZE = 32;
+    static constexpr size_t TAG_SIZE = 16;
+
+    explicit BlockCipher(const std::array<uint8_t, KEY_SIZE>& master_key);
+    ~BlockCipher();
+
+    BlockCipher(const BlockCipher&) = delete;
+    BlockCipher& operator=(const BlockCipher&) = delete;
+
+    // Load a master key stored as 64 hex characters; throws if unreadable or malformed
+    static std::shared_ptr<BlockCipher> fromKeyFile(const std::string& path);
+
+    // Write a new random master key to `path` (fails if the file exists)
+    static void generateKeyFile(const std::string& path);
+
+    // Name under which content with SHA-256 `content_hash` (hex) is stored: 64
+    // hex characters, like the hash. Also keys whole-file content hashes.
+    std::string blockName(const std::string& content_hash) const;
+
+    // Key the super-features of a delta sketch in place, keeping equal features
+    // equal, so the catalog's feature index does not reveal known content
+    void sealSketch(BlockSketch& sketch) const;
+
+    // Encrypt `size` bytes in place; the tag is written to data[size, size + TAG_SIZE)
+    // and authenticates `aad` as well. `block_hash` is the block's name.
+    void encrypt(const std::string& block_hash, uint8_t* data, size_t size, uint32_t generation = 0,
+                 const uint8_t* aad = nullptr, size_t aad_size = 0) const;
+
+    // Decrypt a payload produced by encrypt (ciphertext followed by the tag) in
+    // place, with the same `aad`. Returns the plaintext size; throws if the tag
+    // does not verify.
+    size_t decrypt(const std::string& block_hash, uint8_t* data, size_t size, uint32_t generation = 0,
+                   const uint8_t* aad = nullptr, size_t aad_size = 0) const;
+
+    // Public fingerprint of the master key, stored with the repository so a
+    // backup cannot mix blocks encrypted under different keys
+    std::string keyId() const;
+
+private:
+    void deriveBlockKey(const std::string& block_hash, uint32_t generation, uint8_t key[KEY_SIZE], uint8_t nonce[12]) const;
+
+    std::array<uint8_t, KEY_SIZE> master_key;
+};
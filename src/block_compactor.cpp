@@ -0,0 +1,167 @@
+#include "block_compactor.h"
+#include "block_cipher.h"
+#include "buffer_pool.h"
+#include "resource_governor.h"
+#include <atomic>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace {
+
+// CPU time consumed by the calling thread so far
+double threadCpuSeconds() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) return 0.0;
+    auto ticks = [](const FILETIME& t) { return uint64_t(t.dwHighDateTime) << 32 | t.dwLowDateTime; };
+    return (ticks(kernel) + ticks(user)) / 1e7;   // 100 ns units
+#else
+    timespec ts{};
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0.0;
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+BlockCompactor::BlockCompactor(
+    std::shared_ptr<MetadataDB> db,
+    std::shared_ptr<StorageManager> storage,
+    std::shared_ptr<HashEngine> hasher
+) : db(db), storage(storage), hasher(hasher) {}
+
+void BlockCompactor::setProgressCallback(ProgressCallback callback, std::chrono::milliseconds interval) {
+    progress_callback = std::move(callback);
+    progress_interval = interval;
+}
+
+BlockCompactor::Outcome BlockCompactor::recompress(DBBlock& block, int target_level) {
+    BufferPool& pool = *BufferPool::defaultPool();
+    uint32_t flags = 0;
+    PooledBuffer payload = storage->readBlock(block.block_hash, pool, &flags);
+    size_t stored_size = payload.size();
+
+    if (flags & BLOCK_FLAG_DELTA) return Outcome::Skipped;   // Candidates are whole blocks; the file disagrees
+    bool encrypted = (flags & BLOCK_FLAG_ENCRYPTED) != 0;
+    uint32_t generation = blockGeneration(flags);
+    if (encrypted && (!cipher || generation == BLOCK_GENERATION_MAX)) return Outcome::Skipped;
+    size_t compressed_size = encrypted
+        ? cipher->decrypt(block.block_hash, payload.data(), payload.size(), generation)
+        : payload.size();
+
+    // Never rewrite a block that no longer matches its hash; verify reports those
+    PooledBuffer data = pool.acquire(block.size > 0 ? static_cast<size_t>(block.size) : 0);
+    hasher->decompressBlockInto(payload.data(), compressed_size, data);
+    std::string actual = hasher->computeBlockHash(data.data(), data.size());
+    if (encrypted) actual = cipher->blockName(actual);
+    if (data.size() != static_cast<size_t>(block.size) || actual != block.block_hash) {
+        return Outcome::Skipped;
+    }
+    payload.reset();
+
+    size_t tag_room = encrypted ? BlockCipher::TAG_SIZE : 0;
+    PooledBuffer out = pool.acquire(HashEngine::compressBound(data.size()) + tag_room);
+    hasher->compressBlockInto(data.data(), data.size(), out, target_level);
+    block.compression_level = target_level;
+    if (out.size() + tag_room >= stored_size) return Outcome::Unchanged;
+
+    if (encrypted) {
+        size_t plain_size = out.size();
+        out.resize(plain_size + BlockCipher::TAG_SIZE);
+        cipher->encrypt(block.block_hash, out.data(), plain_size, generation + 1);
+        flags = withBlockGeneration(flags, generation + 1);
+    }
+
+    if (governor) governor->throttleWrite(out.size());
+    if (!storage->replaceBlock(block.block_hash, out.data(), out.size(), flags)) return Outcome::Skipped;
+    block.compressed_size = static_cast<int>(out.size());
+    return Outcome::Rewritten;
+}
+
+CompactionReport BlockCompactor::compact(const CompactionOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    CompactionReport report;
+    int64_t stored_before = static_cast<int64_t>(std::time(nullptr)) - options.min_age_seconds;
+    size_t workers = std::max<size_t>(1, options.workers);
+
+    std::unique_ptr<ProgressTracker> progress;
+    if (progress_callback) {
+        auto totals = db->getCompactionTotals(stored_before, options.target_level);
+        progress = std::make_unique<ProgressTracker>(progress_callback, progress_interval);
+        progress->addTotal(totals.second, totals.first);
+    }
+
+    std::mutex cpu_mutex;
+    uint64_t after_block_id = 0;
+    while (true) {
+        auto batch = db->listCompactionCandidates(after_block_id, stored_before, options.target_level,
+                                                  options.batch_blocks);
+        if (batch.empty()) break;
+        after_block_id = batch.back().block_id;
+
+        std::vector<Outcome> outcomes(batch.size(), Outcome::Skipped);
+        std::vector<int> before(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) before[i] = batch[i].compressed_size;
+
+        // Dedicated threads, so idle priority and affinity never leak into shared pools
+        std::atomic<size_t> next{0};
+        auto work = [&]() {
+            if (governor) governor->enterWorker();
+            double cpu_start = threadCpuSeconds();
+            for (size_t i; (i = next.fetch_add(1)) < batch.size();) {
+                if (governor) governor->throttleRead(before[i]);
+                {
+                    auto slot = governor ? governor->acquireCpu() : ResourceGovernor::CpuSlot();
+                    try {
+                        outcomes[i] = recompress(batch[i], options.target_level);
+                    } catch (const std::exception&) {
+                        outcomes[i] = Outcome::Skipped;   // Unreadable or damaged; left to verify
+                    }
+                }
+                if (progress) progress->addDone(before[i]);
+            }
+            std::lock_guard<std::mutex> lock(cpu_mutex);
+            report.cpu_seconds += threadCpuSeconds() - cpu_start;
+        };
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < std::min(workers, batch.size()); ++t) threads.emplace_back(work);
+        for (auto& thread : threads) thread.join();
+
+        std::vector<DBBlock> updated;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            report.blocks_scanned++;
+            switch (outcomes[i]) {
+                case Outcome::Rewritten:
+                    report.blocks_rewritten++;
+                    report.bytes_before += before[i];
+                    report.bytes_after += batch[i].compressed_size;
+                    updated.push_back(batch[i]);
+                    break;
+                case Outcome::Unchanged:
+                    report.blocks_unchanged++;
+                    updated.push_back(batch[i]);   // Recorded at the target level so it is not retried
+                    break;
+                case Outcome::Skipped:
+                    report.blocks_skipped++;
+                    break;
+            }
+        }
+        if (!updated.empty()) db->updateBlockCompression(updated);
+    }
+
+    if (progress) progress->finish();
+    report.elapsed_seconds = secondsSince(start);
+    return report;
+}
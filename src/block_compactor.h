@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <chrono>
+#include "metadata_db.h"
+#include "storage_manager.h"
+#include "hash_engine.h"
+#include "progress_reporter.h"
+
+class BlockCipher;
+class ResourceGovernor;
+
+struct CompactionOptions {
+    int64_t min_age_seconds = 7 * 24 * 3600;   // Only blocks stored at least this long ago
+    int target_level = 19;                    // Blocks below this zstd level are recompressed at it
+    size_t workers = 1;                       // Threads recompressing in parallel
+    size_t batch_blocks = 256;                // Blocks per catalog transaction
+};
+
+struct CompactionReport {
+    uint64_t blocks_scanned = 0;
+    uint64_t blocks_rewritten = 0;
+    uint64_t blocks_unchanged = 0;    // Recompressing did not make them smaller
+    uint64_t blocks_skipped = 0;      // Encrypted without a key, or could not be read/replaced
+    uint64_t bytes_before = 0;        // Stored bytes of the rewritten blocks, before and after
+    uint64_t bytes_after = 0;
+    double cpu_seconds = 0.0;         // Worker CPU time (read, decompress, hash, compress, encrypt)
+    double elapsed_seconds = 0.0;
+
+    uint64_t bytesSaved() const { return bytes_before - bytes_after; }
+};
+
+// Background recompression of blocks at rest. Backups store blocks at a fast
+// zstd level; this job revisits blocks older than a cut-off that are below
+// the target level, decodes them, checks their SHA-256, recompresses them and,
+// if that makes them smaller, renames the new payload over the old block file
+// (StorageManager::replaceBlock). Rows are updated per batch after the files;
+// if the job is killed in between, the rows still show the old level and the
+// next run redoes those blocks. Readers see either payload, both decode to
+// the same content.
+//
+// Workers run under the resource governor (idle priority, CPU and bandwidth
+// caps), so the job can share a host with backups and restores.
+// Encrypted blocks are re-encrypted under the next key generation of the
+// block, never under the key and nonce of the payload they replace.
+class BlockCompactor {
+public:
+    BlockCompactor(
+        std::shared_ptr<MetadataDB> db,
+        std::shared_ptr<StorageManager> storage,
+        std::shared_ptr<HashEngine> hasher
+    );
+
+    CompactionReport compact(const CompactionOptions& options);
+
+    // Key for encrypted blocks; without one they are skipped
+    void setCipher(std::shared_ptr<BlockCipher> block_cipher) { cipher = std::move(block_cipher); }
+
+    // Priority, CPU and bandwidth limits for the workers (nullptr = none)
+    void setResourceGovernor(std::shared_ptr<ResourceGovernor> resource_governor) { governor = std::move(resource_governor); }
+
+    // Receive progress snapshots while compact is running (called from a reporter thread)
+    void setProgressCallback(ProgressCallback callback,
+                             std::chrono::milliseconds interval = std::chrono::milliseconds(250));
+
+private:
+    enum class Outcome { Rewritten, Unchanged, Skipped };
+
+    // Recompress one block; on Rewritten/Unchanged `block` holds its new row values
+    Outcome recompress(DBBlock& block, int target_level);
+
+    std::shared_ptr<MetadataDB> db;
+    std::shared_ptr<StorageManager> storage;
+    std::shared_ptr<HashEngine> hasher;
+    std::shared_ptr<BlockCipher> cipher;
+    std::shared_ptr<ResourceGovernor> governor;
+    ProgressCallback progress_callback;
+    std::chrono::milliseconds progress_interval{250};
+};
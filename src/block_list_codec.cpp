@@ -0,0 +1,132 @@
+#include "block_list_codec.h"
+#include <zstd.h>
+#include <stdexcept>
+#include <string>
+#include <cstring>
+
+namespace {
+
+void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+uint64_t zigzag(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+int64_t unzigzag(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+constexpr size_t DECODE_BUFFER_SIZE = 64 * 1024;
+constexpr int LIST_COMPRESSION_LEVEL = 3;
+
+} // namespace
+
+std::vector<uint8_t> encodeBlockList(const std::vector<uint64_t>& block_ids, BlockListEncoding& encoding) {
+    std::vector<uint8_t> varints;
+    varints.reserve(block_ids.size() + 16);
+    uint64_t previous = 0;
+    for (uint64_t id : block_ids) {
+        putVarint(varints, zigzag(static_cast<int64_t>(id - previous)));
+        previous = id;
+    }
+
+    std::vector<uint8_t> compressed(ZSTD_compressBound(varints.size()));
+    size_t compressed_size = ZSTD_compress(compressed.data(), compressed.size(),
+                                           varints.data(), varints.size(), LIST_COMPRESSION_LEVEL);
+    if (!ZSTD_isError(compressed_size) && compressed_size < varints.size()) {
+        compressed.resize(compressed_size);
+        encoding = BlockListEncoding::DeltaVarintZstd;
+        return compressed;
+    }
+
+    encoding = BlockListEncoding::DeltaVarint;
+    return varints;
+}
+
+BlockListDecoder::BlockListDecoder(const uint8_t* data, size_t size, BlockListEncoding encoding)
+    : input(data), input_size(size), encoding(encoding)
+{
+    if (encoding == BlockListEncoding::DeltaVarintZstd) {
+        dctx = ZSTD_createDCtx();
+        if (!dctx) throw std::runtime_error("Failed to create decompression context");
+        buffer.resize(DECODE_BUFFER_SIZE);
+    } else if (encoding != BlockListEncoding::DeltaVarint) {
+        throw std::runtime_error("Unknown block list encoding");
+    }
+}
+
+BlockListDecoder::~BlockListDecoder() {
+    if (dctx) ZSTD_freeDCtx(dctx);
+}
+
+bool BlockListDecoder::refill() {
+    // Keep a partial varint at the end of the buffer
+    size_t leftover = buffer_end - buffer_pos;
+    std::memmove(buffer.data(), buffer.data() + buffer_pos, leftover);
+    buffer_pos = 0;
+    buffer_end = leftover;
+
+    if (input_done) return leftover > 0;
+
+    ZSTD_inBuffer in = {input, input_size, input_pos};
+    ZSTD_outBuffer out = {buffer.data(), buffer.size(), buffer_end};
+    size_t result = ZSTD_decompressStream(dctx, &out, &in);
+    if (ZSTD_isError(result)) {
+        throw std::runtime_error(std::string("Block list decompression failed: ") + ZSTD_getErrorName(result));
+    }
+    if (result == 0 || (in.pos == in.size && out.pos == buffer_end)) input_done = true;
+    input_pos = in.pos;
+    buffer_end = out.pos;
+    return buffer_end > buffer_pos;
+}
+
+size_t BlockListDecoder::next(uint64_t* out, size_t max) {
+    size_t count = 0;
+    while (count < max) {
+        const uint8_t* src;
+        size_t avail;
+        size_t* pos;
+        if (encoding == BlockListEncoding::DeltaVarint) {
+            src = input;
+            avail = input_size;
+            pos = &input_pos;
+        } else {
+            // Make sure a whole varint (at most 10 bytes) is buffered
+            if (buffer_end - buffer_pos < 10 && !input_done) refill();
+            src = buffer.data();
+            avail = buffer_end;
+            pos = &buffer_pos;
+        }
+        if (*pos >= avail) break;
+
+        uint64_t value = 0;
+        int shift = 0;
+        while (true) {
+            if (*pos >= avail || shift > 63) throw std::runtime_error("Corrupt block list");
+            uint8_t byte = src[(*pos)++];
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+            shift += 7;
+        }
+        previous += static_cast<uint64_t>(unzigzag(value));
+        out[count++] = previous;
+    }
+    return count;
+}
+
+std::vector<uint64_t> decodeBlockList(const uint8_t* data, size_t size, BlockListEncoding encoding) {
+    std::vector<uint64_t> ids;
+    BlockListDecoder decoder(data, size, encoding);
+    uint64_t chunk[1024];
+    size_t n;
+    while ((n = decoder.next(chunk, 1024)) > 0) {
+        ids.insert(ids.end(), chunk, chunk + n);
+    }
+    return ids;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct ZSTD_DCtx_s;
+
+// Compact encoding of a version's ordered block id list:
+// each id is stored as the zigzag LEB128 varint of its delta to the previous id
+// (runs of freshly stored blocks encode as one byte each), optionally zstd-compressed.
+enum class BlockListEncoding : int {
+    DeltaVarint = 0,
+    DeltaVarintZstd = 1
+};
+
+// Picks the smaller of the plain and zstd-compressed forms
+std::vector<uint8_t> encodeBlockList(const std::vector<uint64_t>& block_ids, BlockListEncoding& encoding);
+
+// Streaming decoder: hands out ids in order without materializing the whole list
+class BlockListDecoder {
+public:
+    BlockListDecoder(const uint8_t* data, size_t size, BlockListEncoding encoding);
+    ~BlockListDecoder();
+
+    BlockListDecoder(const BlockListDecoder&) = delete;
+    BlockListDecoder& operator=(const BlockListDecoder&) = delete;
+
+    // Decode up to `max` ids into `out`; returns how many were written (0 at the end)
+    size_t next(uint64_t* out, size_t max);
+
+private:
+    bool refill();
+
+    const uint8_t* input;
+    size_t input_size;
+    size_t input_pos = 0;
+    BlockListEncoding encoding;
+    ZSTD_DCtx_s* dctx = nullptr;
+
+    std::vector<uint8_t> buffer;   // Decompressed varint bytes (zstd encoding only)
+    size_t buffer_pos = 0;
+    size_t buffer_end = 0;
+    bool input_done = false;
+
+    uint64_t previous = 0;
+};
+
+// Convenience: decode everything
+std::vector<uint64_t> decodeBlockList(const uint8_t* data, size_t size, BlockListEncoding encoding);
@@ -0,0 +1,88 @@
+#include "block_reader.h"
+#include "block_cipher.h"
+#include <stdexcept>
+
+namespace {
+
+// Far above any configured delta depth; only a damaged repository gets here
+constexpr unsigned MAX_DELTA_CHAIN = 64;
+
+} // namespace
+
+BlockReader::BlockReader(
+    std::shared_ptr<StorageManager> storage,
+    std::shared_ptr<HashEngine> hasher,
+    std::shared_ptr<BlockCache> cache
+) : storage(storage), hasher(hasher), cache(cache), pool(BufferPool::defaultPool()) {}
+
+BlockReader::Frame BlockReader::openPayload(const std::string& block_hash, uint8_t* payload, size_t size, uint32_t flags) {
+    Frame frame;
+    if (flags & BLOCK_FLAG_DELTA) {
+        frame.base_hash = deltaBaseHash(payload, size);
+        payload += DELTA_BASE_SIZE;
+        size -= DELTA_BASE_SIZE;
+    }
+    frame.data = payload;
+    frame.size = size;
+    if (!(flags & BLOCK_FLAG_ENCRYPTED)) return frame;
+    if (!cipher) {
+        throw std::runtime_error("Block is encrypted; a key is required to read it: " + block_hash);
+    }
+    // The base reference precedes the frame; sealed deltas authenticate it
+    size_t aad_size = (flags & BLOCK_FLAG_BASE_SEALED) ? DELTA_BASE_SIZE : 0;
+    frame.size = cipher->decrypt(block_hash, payload, size, blockGeneration(flags), payload - aad_size, aad_size);
+    return frame;
+}
+
+std::vector<uint8_t> BlockReader::decodeFrame(const Frame& frame, unsigned depth) {
+    if (frame.base_hash.empty()) return hasher->decompressBlock(frame.data, frame.size);
+    if (depth >= MAX_DELTA_CHAIN) throw std::runtime_error("Delta chain too long at base " + frame.base_hash);
+    // A base usually has several deltas pointing at it, so offer it to the cache as shared
+    BlockBuffer base = readAt(frame.base_hash, 2, depth + 1);
+    return hasher->decompressDelta(frame.data, frame.size, base->data(), base->size());
+}
+
+BlockBuffer BlockReader::read(const std::string& block_hash, uint64_t ref_count) {
+    return readAt(block_hash, ref_count, 0);
+}
+
+BlockBuffer BlockReader::readAt(const std::string& block_hash, uint64_t ref_count, unsigned depth) {
+    if (cache) {
+        if (auto cached = cache->get(block_hash)) return cached;
+    }
+
+    // Concurrent misses on the same block each decode it; the first put wins
+    // The compressed payload only lives until it is decoded, so it comes from the pool;
+    // the decoded block may be cached and shared, so it stays a plain vector
+    uint32_t flags = 0;
+    PooledBuffer payload = storage->readBlock(block_hash, *pool, &flags);
+    auto block_data = std::make_shared<std::vector<uint8_t>>(
+        decodeFrame(openPayload(block_hash, payload.data(), payload.size(), flags), depth));
+    payload.reset();
+    if (verify_hashes) {
+        // An encrypted block is named by the keyed hash; openPayload has checked there is a cipher
+        std::string actual = hasher->computeBlockHash(*block_data);
+        if (flags & BLOCK_FLAG_ENCRYPTED) actual = cipher->blockName(actual);
+        if (actual != block_hash) throw std::runtime_error("Block content does not match its hash: " + block_hash);
+    }
+
+    BlockBuffer buffer = std::move(block_data);
+    if (cache) cache->put(block_hash, buffer, ref_count);
+    return buffer;
+}
+
+BlockBuffer BlockReader::readPrefix(const std::string& block_hash, size_t length, uint64_t ref_count) {
+    if (verify_hashes || (cache && ref_count > 1)) {
+        return read(block_hash, ref_count);
+    }
+    if (cache) {
+        if (auto cached = cache->get(block_hash)) return cached;
+    }
+    uint32_t flags = 0;
+    PooledBuffer payload = storage->readBlock(block_hash, *pool, &flags);
+    Frame frame = openPayload(block_hash, payload.data(), payload.size(), flags);
+    // A delta's prefix can reference any part of its base, so it is decoded whole
+    if (!frame.base_hash.empty()) return std::make_shared<const std::vector<uint8_t>>(decodeFrame(frame, 0));
+    return std::make_shared<const std::vector<uint8_t>>(
+        hasher->decompressBlockPrefix(frame.data, frame.size, length));
+}
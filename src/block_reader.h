@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include "storage_manager.h"
+#include "hash_engine.h"
+#include "block_cache.h"
+#include "buffer_pool.h"
+
+class BlockCipher;
+
+// Reads and decompresses stored blocks for restores and random-access reads,
+// going through an optional shared BlockCache. Safe to use from several threads.
+// A delta block is decoded against its base, which is read (and cached) the same way.
+class BlockReader {
+public:
+    BlockReader(
+        std::shared_ptr<StorageManager> storage,
+        std::shared_ptr<HashEngine> hasher,
+        std::shared_ptr<BlockCache> cache = nullptr
+    );
+
+    // Whole decompressed block. `ref_count` (blocks.ref_count) drives cache admission.
+    BlockBuffer read(const std::string& block_hash, uint64_t ref_count = 0);
+
+    // At least the first `length` bytes of a block. Only that prefix is decoded
+    // unless the block is cacheable or must be hashed, in which case it is read whole.
+    BlockBuffer readPrefix(const std::string& block_hash, size_t length, uint64_t ref_count = 0);
+
+    // Check each decompressed block against its SHA-256 (CRC-32C is always checked)
+    void setVerifyHashes(bool enabled) { verify_hashes = enabled; }
+
+    void setCache(std::shared_ptr<BlockCache> block_cache) { cache = std::move(block_cache); }
+    std::shared_ptr<BlockCache> getCache() const { return cache; }
+
+    // Pool for compressed payloads (default: BufferPool::defaultPool())
+    void setBufferPool(std::shared_ptr<BufferPool> buffer_pool) { pool = std::move(buffer_pool); }
+
+    // Key for encrypted blocks; reading one without a cipher throws
+    void setCipher(std::shared_ptr<BlockCipher> block_cipher) { cipher = std::move(block_cipher); }
+
+private:
+    // The zstd frame inside a stored payload
+    struct Frame {
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+        std::string base_hash;   // Delta payloads only
+    };
+
+    // Decrypt a stored payload in place if needed and locate its frame
+    Frame openPayload(const std::string& block_hash, uint8_t* payload, size_t size, uint32_t flags);
+
+    // `depth` counts the deltas being decoded above this block, to stop on a cycle
+    BlockBuffer readAt(const std::string& block_hash, uint64_t ref_count, unsigned depth);
+    std::vector<uint8_t> decodeFrame(const Frame& frame, unsigned depth);
+
+    std::shared_ptr<StorageManager> storage;
+    std::shared_ptr<HashEngine> hasher;
+    std::shared_ptr<BlockCache> cache;
+    std::shared_ptr<BufferPool> pool;
+    std::shared_ptr<BlockCipher> cipher;
+    bool verify_hashes = false;
+};
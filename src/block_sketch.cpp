@@ -0,0 +1,66 @@
+#include "block_sketch.h"
+
+namespace {
+
+constexpr uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+constexpr std::array<uint64_t, 256> makeGearTable() {
+    std::array<uint64_t, 256> table{};
+    for (size_t i = 0; i < table.size(); ++i) table[i] = splitmix64(0x4765617254616231ULL + i);
+    return table;
+}
+
+// Transform i maps a sample h to h * multiplier[i] + addend[i] (mod 2^64)
+struct Transform {
+    uint64_t multiplier;
+    uint64_t addend;
+};
+
+constexpr std::array<Transform, SKETCH_FEATURES> makeTransforms() {
+    std::array<Transform, SKETCH_FEATURES> transforms{};
+    for (size_t i = 0; i < transforms.size(); ++i) {
+        transforms[i].multiplier = splitmix64(0x536b657463684d00ULL + 2 * i) | 1;   // Odd: a permutation
+        transforms[i].addend = splitmix64(0x536b657463684d00ULL + 2 * i + 1);
+    }
+    return transforms;
+}
+
+constexpr std::array<uint64_t, 256> GEAR = makeGearTable();
+constexpr std::array<Transform, SKETCH_FEATURES> TRANSFORMS = makeTransforms();
+
+// The top bits of a Gear hash depend on the whole window; the low bits only on the last bytes
+constexpr unsigned SAMPLE_SHIFT = 59;   // Sample when the top 5 bits are zero: 1 in 32
+
+} // namespace
+
+BlockSketch computeBlockSketch(const uint8_t* data, size_t size) {
+    std::array<uint64_t, SKETCH_FEATURES> features{};
+    bool sampled = false;
+    uint64_t h = 0;
+    for (size_t i = 0; i < size; ++i) {
+        h = (h << 1) + GEAR[data[i]];
+        if (i < 64 || (h >> SAMPLE_SHIFT) != 0) continue;
+        sampled = true;
+        for (size_t f = 0; f < SKETCH_FEATURES; ++f) {
+            uint64_t value = h * TRANSFORMS[f].multiplier + TRANSFORMS[f].addend;
+            if (value > features[f]) features[f] = value;
+        }
+    }
+
+    BlockSketch sketch;
+    if (!sampled) return sketch;
+    for (size_t s = 0; s < SKETCH_SUPER_FEATURES; ++s) {
+        uint64_t super = splitmix64(s);
+        for (size_t f = 0; f < SKETCH_FEATURES_PER_SUPER; ++f) {
+            super = splitmix64(super ^ features[s * SKETCH_FEATURES_PER_SUPER + f]);
+        }
+        // Low bits carry the slot (so slots never match each other), the top bit is clear
+        sketch.super_features[s] = static_cast<int64_t>((super >> 5) << 4 | (s + 1));
+    }
+    return sketch;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+// Resemblance sketch of a block, for storing near-duplicates as deltas.
+//
+// A Gear rolling hash (64-byte window) runs over the block and about one
+// position in 32 is sampled. Each sample goes through SKETCH_FEATURES
+// independent linear transforms, keeping the maximum of each, so a feature
+// only changes when an edit hits the sampled window that wins it. Groups of
+// SKETCH_FEATURES_PER_SUPER features are hashed into super-features; two
+// blocks sharing one super-feature very likely share most of their content,
+// while unrelated blocks almost never do.
+constexpr size_t SKETCH_SUPER_FEATURES = 3;
+constexpr size_t SKETCH_FEATURES_PER_SUPER = 4;
+constexpr size_t SKETCH_FEATURES = SKETCH_SUPER_FEATURES * SKETCH_FEATURES_PER_SUPER;
+
+// Indexed blocks considered per super-feature when looking for a base (the
+// first ones in the index). Common content, such as zero-filled regions, gives
+// thousands of blocks one super-feature, and any of them serves as a base.
+constexpr size_t SKETCH_CANDIDATES_PER_FEATURE = 16;
+
+struct BlockSketch {
+    // Distinct per slot, and positive so they store as SQLite integers as they are
+    std::array<int64_t, SKETCH_SUPER_FEATURES> super_features{};
+
+    // No window was sampled (tiny or uniform block): nothing to match on
+    bool empty() const { return super_features[0] == 0; }
+};
+
+BlockSketch computeBlockSketch(const uint8_t* data, size_t size);
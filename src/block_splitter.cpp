@@ -28,6 +28,33 @@ std::vector<std::vector<uint8_t>> BlockSplitter::splitFile(const std::string& fi
     return blocks;
 }
 
+bool BlockSplitter::forEachBlock(
+    const std::string& file_path,
+    BufferPool& pool,
+    const std::function<bool(PooledBuffer&& block)>& callback,
+    uint64_t start_offset
+) {
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open file: " << file_path << std::endl;
+        return false;
+    }
+    if (start_offset > 0) {
+        file.seekg(static_cast<std::streamoff>(start_offset));
+    }
+
+    while (true) {
+        PooledBuffer block = pool.acquire(BLOCK_SIZE);
+        file.read(reinterpret_cast<char*>(block.data()), BLOCK_SIZE);
+        size_t got = static_cast<size_t>(file.gcount());
+        if (got == 0) break;
+        block.resize(got);
+        if (!callback(std::move(block))) break;
+        if (got < BLOCK_SIZE) break;
+    }
+    return true;
+}
+
 size_t BlockSplitter::getBlockCount(size_t file_size) {
     if (file_size == 0) return 0;
     return (file_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
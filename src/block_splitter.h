@@ -3,6 +3,8 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <functional>
+#include "buffer_pool.h"
 
 class BlockSplitter {
 public:
@@ -14,6 +16,14 @@ public:
     // Implementing basic version for Phase 1 as requested.
     std::vector<std::vector<uint8_t>> splitFile(const std::string& file_path);
 
+    // Stream a file block by block without holding it in memory; blocks are
+    // borrowed from `pool`. Reading starts at `start_offset` (a block boundary
+    // when resuming). The callback may return false to stop early.
+    // Returns false if the file cannot be opened.
+    bool forEachBlock(const std::string& file_path, BufferPool& pool,
+                      const std::function<bool(PooledBuffer&& block)>& callback,
+                      uint64_t start_offset = 0);
+
     // Get block count for a file
     size_t getBlockCount(size_t file_size);
 };
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded multi-producer/multi-consumer queue (Dmitry Vyukov's array queue).
+// Each cell carries a sequence number; producers and consumers claim positions
+// with a CAS on their own cursor and never take a lock. Capacity is rounded up
+// to a power of two.
+//
+// push/pop block with a spin -> yield -> short sleep backoff, which keeps hand-offs
+// cheap when stages are busy without burning a core when they are idle.
+// close() wakes everyone: pop drains what is left, then returns false.
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        mask = size - 1;
+        cells = std::make_unique<Cell[]>(size);
+        for (size_t i = 0; i < size; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool tryPush(T& value) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;   // Full
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& value) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;   // Empty
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->data);
+        cell->sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue was closed before the value could be queued
+    bool push(T value) {
+        Backoff backoff;
+        while (!tryPush(value)) {
+            if (closed.load(std::memory_order_acquire)) return false;
+            backoff.pause();
+        }
+        return true;
+    }
+
+    // Returns false once the queue is closed and empty
+    bool pop(T& value) {
+        Backoff backoff;
+        while (!tryPop(value)) {
+            if (closed.load(std::memory_order_acquire)) {
+                return tryPop(value);
+            }
+            backoff.pause();
+        }
+        return true;
+    }
+
+    void close() { closed.store(true, std::memory_order_release); }
+    bool isClosed() const { return closed.load(std::memory_order_acquire); }
+    size_t capacity() const { return mask + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    struct Backoff {
+        unsigned spins = 0;
+        void pause() {
+            if (spins < 64) {
+                spins++;
+            } else if (spins < 128) {
+                spins++;
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+    alignas(64) std::atomic<bool> closed{false};
+};
@@ -0,0 +1,177 @@
+#include "buffer_pool.h"
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+void PooledBuffer::resize(size_t new_size) {
+    if (new_size > cap) {
+        auto owner = pool ? pool : BufferPool::defaultPool();
+        PooledBuffer larger = owner->acquire(new_size);
+        if (length > 0) std::memcpy(larger.ptr, ptr, length);
+        *this = std::move(larger);
+    }
+    length = new_size;
+}
+
+void PooledBuffer::append(const uint8_t* bytes, size_t count) {
+    size_t offset = length;
+    resize(length + count);
+    if (count > 0) std::memcpy(ptr + offset, bytes, count);
+}
+
+void PooledBuffer::reset() {
+    if (ptr) pool->release(ptr, cap);
+    pool.reset();
+    ptr = nullptr;
+    length = 0;
+    cap = 0;
+}
+
+std::string BufferPoolStats::toString() const {
+    std::ostringstream out;
+    out << "Buffer pool: " << acquires << " acquires, " << reuses << " reused, "
+        << allocations << " allocated";
+    if (oversize > 0) out << " (" << oversize << " oversize)";
+    out << std::fixed << std::setprecision(1)
+        << ", " << reserved_bytes / (1024.0 * 1024.0) << " MB reserved"
+        << ", peak " << peak_in_use_bytes / (1024.0 * 1024.0) << " MB in use"
+        << (huge_pages ? ", huge pages" : "");
+    return out.str();
+}
+
+BufferPool::BufferPool(bool use_huge_pages) : huge_pages(use_huge_pages) {
+#if !defined(__linux__)
+    huge_pages = false;
+#endif
+}
+
+BufferPool::~BufferPool() {
+    // Handles hold a reference to the pool, so every buffer is back by now
+    for (uint8_t* slab : slabs) {
+#if defined(__linux__)
+        if (huge_pages) {
+            munmap(slab, SLAB_SIZE);
+            continue;
+        }
+#endif
+        ::operator delete(slab, std::align_val_t(64));
+    }
+}
+
+std::shared_ptr<BufferPool> BufferPool::defaultPool() {
+    static std::shared_ptr<BufferPool> pool = std::make_shared<BufferPool>();
+    return pool;
+}
+
+size_t BufferPool::classIndex(size_t size) {
+    size_t index = 0;
+    while (classSize(index) < size) ++index;
+    return index;
+}
+
+PooledBuffer BufferPool::acquire(size_t size) {
+    acquires.fetch_add(1, std::memory_order_relaxed);
+
+    PooledBuffer buffer;
+    if (size > MAX_CLASS_SIZE) {
+        oversize.fetch_add(1, std::memory_order_relaxed);
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        buffer.ptr = new uint8_t[size];
+        buffer.cap = size;
+    } else {
+        size_t index = classIndex(size);
+        SizeClass& size_class = classes[index];
+        {
+            std::lock_guard<std::mutex> lock(size_class.mutex);
+            if (!size_class.free_list.empty()) {
+                buffer.ptr = size_class.free_list.back();
+                size_class.free_list.pop_back();
+            }
+        }
+        if (buffer.ptr) {
+            reuses.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            allocations.fetch_add(1, std::memory_order_relaxed);
+            buffer.ptr = carve(index);
+        }
+        buffer.cap = classSize(index);
+    }
+
+    buffer.pool = shared_from_this();
+    buffer.length = size;
+
+    uint64_t in_use = in_use_bytes.fetch_add(buffer.cap, std::memory_order_relaxed) + buffer.cap;
+    uint64_t peak = peak_in_use_bytes.load(std::memory_order_relaxed);
+    while (in_use > peak && !peak_in_use_bytes.compare_exchange_weak(peak, in_use, std::memory_order_relaxed)) {}
+    return buffer;
+}
+
+void BufferPool::release(uint8_t* ptr, size_t capacity) {
+    in_use_bytes.fetch_sub(capacity, std::memory_order_relaxed);
+    if (capacity > MAX_CLASS_SIZE) {
+        delete[] ptr;
+        return;
+    }
+    SizeClass& size_class = classes[classIndex(capacity)];
+    std::lock_guard<std::mutex> lock(size_class.mutex);
+    size_class.free_list.push_back(ptr);
+}
+
+// Split a fresh slab into buffers of one class: return the first, shelve the rest
+uint8_t* BufferPool::carve(size_t index) {
+    uint8_t* slab = allocateSlab();
+    size_t buffer_size = classSize(index);
+
+    SizeClass& size_class = classes[index];
+    std::lock_guard<std::mutex> lock(size_class.mutex);
+    for (size_t offset = buffer_size; offset + buffer_size <= SLAB_SIZE; offset += buffer_size) {
+        size_class.free_list.push_back(slab + offset);
+    }
+    return slab;
+}
+
+uint8_t* BufferPool::allocateSlab() {
+    uint8_t* slab = nullptr;
+#if defined(__linux__)
+    if (huge_pages) {
+        // Over-allocate so the slab can start on a 2 MiB boundary, then trim
+        size_t span = SLAB_SIZE * 2;
+        void* raw = mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) throw std::bad_alloc();
+        uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+        uintptr_t aligned = (start + SLAB_SIZE - 1) & ~(uintptr_t(SLAB_SIZE) - 1);
+        if (aligned > start) munmap(raw, aligned - start);
+        size_t tail = (start + span) - (aligned + SLAB_SIZE);
+        if (tail > 0) munmap(reinterpret_cast<void*>(aligned + SLAB_SIZE), tail);
+        slab = reinterpret_cast<uint8_t*>(aligned);
+        madvise(slab, SLAB_SIZE, MADV_HUGEPAGE);
+    }
+#endif
+    if (!slab) {
+        slab = static_cast<uint8_t*>(::operator new(SLAB_SIZE, std::align_val_t(64)));
+    }
+
+    reserved_bytes.fetch_add(SLAB_SIZE, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(slab_mutex);
+    slabs.push_back(slab);
+    return slab;
+}
+
+BufferPoolStats BufferPool::stats() const {
+    BufferPoolStats s;
+    s.acquires = acquires.load(std::memory_order_relaxed);
+    s.reuses = reuses.load(std::memory_order_relaxed);
+    s.allocations = allocations.load(std::memory_order_relaxed);
+    s.oversize = oversize.load(std::memory_order_relaxed);
+    s.reserved_bytes = reserved_bytes.load(std::memory_order_relaxed);
+    s.in_use_bytes = in_use_bytes.load(std::memory_order_relaxed);
+    s.peak_in_use_bytes = peak_in_use_bytes.load(std::memory_order_relaxed);
+    s.huge_pages = huge_pages;
+    return s;
+}
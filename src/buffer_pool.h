@@ -0,0 +1,142 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class BufferPool;
+
+// Byte buffer borrowed from a BufferPool and handed back when the handle is
+// destroyed (or reset). Move-only. Contents are not zeroed on acquire.
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+    ~PooledBuffer() { reset(); }
+
+    PooledBuffer(PooledBuffer&& other) noexcept { swap(other); }
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept {
+        if (this != &other) {
+            reset();
+            swap(other);
+        }
+        return *this;
+    }
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    uint8_t* data() { return ptr; }
+    const uint8_t* data() const { return ptr; }
+    size_t size() const { return length; }
+    size_t capacity() const { return cap; }
+    bool empty() const { return length == 0; }
+
+    // Sets the logical size; growing past capacity moves the contents to a
+    // buffer of a larger class from the same pool
+    void resize(size_t new_size);
+
+    // Append bytes, growing like resize
+    void append(const uint8_t* bytes, size_t count);
+
+    std::vector<uint8_t> toVector() const { return std::vector<uint8_t>(ptr, ptr + length); }
+
+    // Return the memory to the pool now; the handle becomes empty
+    void reset();
+
+private:
+    friend class BufferPool;
+
+    void swap(PooledBuffer& other) noexcept {
+        std::swap(pool, other.pool);
+        std::swap(ptr, other.ptr);
+        std::swap(length, other.length);
+        std::swap(cap, other.cap);
+    }
+
+    std::shared_ptr<BufferPool> pool;
+    uint8_t* ptr = nullptr;
+    size_t length = 0;
+    size_t cap = 0;
+};
+
+struct BufferPoolStats {
+    uint64_t acquires = 0;
+    uint64_t reuses = 0;              // Acquires served from a free list
+    uint64_t allocations = 0;         // Acquires that needed fresh memory
+    uint64_t oversize = 0;            // Requests above the largest class (never pooled)
+    uint64_t reserved_bytes = 0;      // Memory held by the pool, free or in use
+    uint64_t in_use_bytes = 0;
+    uint64_t peak_in_use_bytes = 0;
+    bool huge_pages = false;
+
+    std::string toString() const;
+};
+
+// Recycles block-sized buffers so the pipeline stages stop hitting the heap
+// (and page-faulting fresh memory) for every block.
+//
+// Requests are rounded up to a power-of-two size class between 4 KiB and
+// 1 MiB, plus CLASS_SLACK so that a block and the compressBound-sized output
+// buffer for it land in the same class. Buffers are carved from 2 MiB slabs
+// that stay with the pool until it is destroyed, so a steady workload settles
+// at a fixed footprint. With huge pages enabled (Linux only), slabs are 2 MiB
+// aligned and madvise'd for transparent huge pages. Larger requests are plain
+// allocations freed on release.
+//
+// Create with std::make_shared: handles keep their pool alive.
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+public:
+    static constexpr size_t MIN_CLASS_SIZE = 4 * 1024;
+    static constexpr size_t CLASS_SLACK = 4 * 1024;
+    static constexpr size_t MAX_CLASS_SIZE = 1024 * 1024 + CLASS_SLACK;
+    static constexpr size_t SLAB_SIZE = 2 * 1024 * 1024;
+
+    explicit BufferPool(bool use_huge_pages = false);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Buffer with capacity >= size and size() == size
+    PooledBuffer acquire(size_t size);
+
+    BufferPoolStats stats() const;
+
+    // Pool shared by components that are not given one explicitly
+    static std::shared_ptr<BufferPool> defaultPool();
+
+private:
+    friend class PooledBuffer;
+
+    static constexpr size_t CLASS_COUNT = 9;   // 4 KiB .. 1 MiB
+
+    struct SizeClass {
+        std::mutex mutex;
+        std::vector<uint8_t*> free_list;
+    };
+
+    static size_t classIndex(size_t size);
+    static size_t classSize(size_t index) { return (MIN_CLASS_SIZE << index) + CLASS_SLACK; }
+
+    void release(uint8_t* ptr, size_t capacity);
+    uint8_t* carve(size_t index);
+    uint8_t* allocateSlab();
+
+    bool huge_pages;
+    std::array<SizeClass, CLASS_COUNT> classes;
+
+    std::mutex slab_mutex;
+    std::vector<uint8_t*> slabs;
+
+    std::atomic<uint64_t> acquires{0};
+    std::atomic<uint64_t> reuses{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> oversize{0};
+    std::atomic<uint64_t> reserved_bytes{0};
+    std::atomic<uint64_t> in_use_bytes{0};
+    std::atomic<uint64_t> peak_in_use_bytes{0};
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <atomic>
+#include <stdexcept>
+
+// Thrown out of a backup, restore or pool task that stopped because its
+// token was canceled. Work already stored stays stored (backups keep their
+// checkpoints), so a later run picks up from there.
+class OperationCanceled : public std::runtime_error {
+public:
+    OperationCanceled() : std::runtime_error("Operation canceled") {}
+};
+
+// Shared between whoever may cancel an operation (e.g. a UI thread) and the
+// workers running it. Workers poll isCanceled() between blocks, so canceling
+// takes effect within about one block per worker; cancel() never blocks.
+class CancellationToken {
+public:
+    void cancel() { canceled.store(true, std::memory_order_relaxed); }
+    bool isCanceled() const { return canceled.load(std::memory_order_relaxed); }
+
+    void throwIfCanceled() const {
+        if (isCanceled()) throw OperationCanceled();
+    }
+
+private:
+    std::atomic<bool> canceled{false};
+};
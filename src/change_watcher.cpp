@@ -0,0 +1,212 @@
+#include "change_watcher.h"
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+#ifdef __linux__
+// Writes, metadata changes and names appearing or going away. Directory moves
+// are also needed to keep the watch -> path map current.
+constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_MOVED_TO |
+                                IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+#endif
+
+bool isBelow(const std::string& path, const std::string& dir) {
+    return path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 &&
+           path[dir.size()] == fs::path::preferred_separator;
+}
+
+} // namespace
+
+ChangeWatcher::ChangeWatcher(const std::string& root) : root(fs::path(root).lexically_normal().string()) {
+    if (this->root.size() > 1 && this->root.back() == fs::path::preferred_separator) this->root.pop_back();
+}
+
+ChangeWatcher::~ChangeWatcher() {
+#ifdef __linux__
+    if (fd >= 0) close(fd);
+#endif
+}
+
+void ChangeWatcher::exclude(const std::string& dir) {
+    exclusions.push_back(fs::path(dir).lexically_normal().string());
+}
+
+bool ChangeWatcher::excluded(const std::string& path) const {
+    for (const auto& dir : exclusions) {
+        if (path == dir || isBelow(path, dir)) return true;
+    }
+    return false;
+}
+
+bool ChangeWatcher::start() {
+#ifdef __linux__
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        watch_error = std::string("inotify unavailable: ") + std::strerror(errno);
+        return false;
+    }
+    if (!addWatches(root, false)) {
+        stopWatching(watch_error);
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool ChangeWatcher::addWatches(const std::string& dir, bool mark_files) {
+#ifdef __linux__
+    // Watch first, then list, so nothing created in between goes unseen
+    auto watch = [&](const std::string& path) {
+        int wd = inotify_add_watch(fd, path.c_str(), WATCH_MASK);
+        if (wd >= 0) {
+            watches[wd] = path;
+            return true;
+        }
+        // Gone already, or unreadable: nothing below it to back up either
+        if (errno == ENOENT || errno == EACCES || errno == ENOTDIR) return true;
+        watch_error = "Cannot watch " + path + ": " +
+                      (errno == ENOSPC ? std::string("inotify watch limit reached") : std::strerror(errno));
+        return false;
+    };
+    if (excluded(dir)) return true;
+    if (!watch(dir)) return false;
+
+    std::error_code ec;
+    fs::recursive_directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        std::string path = it->path().string();
+        std::error_code type_ec;
+        if (it->is_directory(type_ec) && !it->is_symlink(type_ec)) {
+            if (excluded(path)) {
+                it.disable_recursion_pending();
+            } else if (!watch(path)) {
+                return false;
+            }
+        } else if (mark_files && it->is_regular_file(type_ec)) {
+            markDirty(path);
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void ChangeWatcher::wait(std::chrono::milliseconds timeout) {
+#ifdef __linux__
+    if (fd >= 0) {
+        pollfd p{fd, POLLIN, 0};
+        if (poll(&p, 1, static_cast<int>(timeout.count())) > 0) readEvents();
+        return;
+    }
+#endif
+    std::this_thread::sleep_for(timeout);
+}
+
+void ChangeWatcher::readEvents() {
+#ifdef __linux__
+    alignas(inotify_event) char buffer[64 * 1024];
+    while (fd >= 0) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) break;   // EAGAIN: drained
+
+        for (char* p = buffer; p < buffer + n;) {
+            const auto* event = reinterpret_cast<const inotify_event*>(p);
+            p += sizeof(inotify_event) + event->len;
+            events++;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watches.erase(event->wd);
+                continue;
+            }
+            auto dir = watches.find(event->wd);
+            if (dir == watches.end() || event->len == 0) continue;
+            std::string path = (fs::path(dir->second) / event->name).string();
+            if (excluded(path)) continue;
+
+            if (!(event->mask & IN_ISDIR)) {
+                markDirty(path);
+                continue;
+            }
+            if (event->mask & IN_MOVED_FROM) {
+                markDirty(path);   // Everything that was below it is gone from the tree
+                // The subtree's watches now point elsewhere; its new place (if
+                // inside the tree) reports IN_MOVED_TO and is watched afresh
+                for (auto w = watches.begin(); w != watches.end();) {
+                    if (w->second == path || isBelow(w->second, path)) {
+                        inotify_rm_watch(fd, w->first);
+                        w = watches.erase(w);
+                    } else {
+                        ++w;
+                    }
+                }
+            } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                if (!addWatches(path, true)) {
+                    // Out of watches: stop using events altogether; the caller polls
+                    stopWatching(watch_error);
+                    overflow = true;
+                    return;
+                }
+            }
+        }
+    }
+#endif
+}
+
+void ChangeWatcher::stopWatching(const std::string& error) {
+#ifdef __linux__
+    if (fd >= 0) close(fd);
+#endif
+    fd = -1;
+    watches.clear();
+    watch_error = error;
+}
+
+void ChangeWatcher::markDirty(const std::string& path) {
+    auto now = std::chrono::steady_clock::now();
+    auto [entry, inserted] = dirty.try_emplace(path, DirtyEntry{now, now});
+    entry->second.last = now;
+}
+
+void ChangeWatcher::markDirty(const std::vector<std::string>& paths) {
+    for (const auto& path : paths) markDirty(path);
+}
+
+std::vector<std::string> ChangeWatcher::takeSettled(std::chrono::milliseconds settle,
+                                                    std::chrono::milliseconds max_deferral) {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::string> settled;
+    for (auto it = dirty.begin(); it != dirty.end();) {
+        // A file written without pause would never settle; it is taken as it is once overdue
+        if (it->second.last <= now - settle || it->second.first <= now - max_deferral) {
+            settled.push_back(it->first);
+            it = dirty.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return settled;
+}
+
+bool ChangeWatcher::takeOverflow() {
+    bool lost = overflow;
+    overflow = false;
+    return lost;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Collects the paths below a directory tree that changed, from kernel change
+// events (inotify on Linux; one watch per directory). Bursts of events for a
+// path collapse into one dirty entry that remembers the first and latest
+// event, so a file being written is only handed out once it has been quiet for
+// a while (or has been changing for too long). Deleted files and directories
+// moved out of the tree are reported too, so callers can drop them.
+//
+// Events can be lost: the kernel queue overflows under heavy churn, and
+// directories created before their watch was added may have changed unseen.
+// takeOverflow() reports that, and the caller falls back to a full rescan.
+// Without inotify (other platforms, or the per-user watch limit reached)
+// start() fails and the caller has to poll; error() says why.
+//
+// Not thread-safe: one thread calls wait(), then takes the results.
+class ChangeWatcher {
+public:
+    explicit ChangeWatcher(const std::string& root);
+    ~ChangeWatcher();
+
+    ChangeWatcher(const ChangeWatcher&) = delete;
+    ChangeWatcher& operator=(const ChangeWatcher&) = delete;
+
+    // Directories below root that are neither watched nor reported (e.g. the repository)
+    void exclude(const std::string& dir);
+
+    // Add watches for the whole tree. Returns false if events are unavailable.
+    bool start();
+    bool isWatching() const { return fd >= 0; }
+
+    // Why events became unavailable ("" while watching, or if inotify does not exist here)
+    const std::string& error() const { return watch_error; }
+
+    // Block until events arrive or `timeout` passes, then fold them into the dirty set
+    void wait(std::chrono::milliseconds timeout);
+
+    // Dirty paths with no event for at least `settle`, or first changed at least
+    // `max_deferral` ago, removed from the set. They may have been deleted since,
+    // or be directories that were moved away with everything below them.
+    std::vector<std::string> takeSettled(std::chrono::milliseconds settle, std::chrono::milliseconds max_deferral);
+
+    // Put paths back into the dirty set, e.g. after their backup failed
+    void markDirty(const std::vector<std::string>& paths);
+
+    // True if events were lost since the last call
+    bool takeOverflow();
+
+    size_t dirtyCount() const { return dirty.size(); }
+    size_t watchCount() const { return watches.size(); }
+    uint64_t eventCount() const { return events; }
+
+private:
+    bool excluded(const std::string& path) const;
+    bool addWatches(const std::string& dir, bool mark_files);
+    void readEvents();
+    void markDirty(const std::string& path);
+    void stopWatching(const std::string& error);
+
+    struct DirtyEntry {
+        std::chrono::steady_clock::time_point first;
+        std::chrono::steady_clock::time_point last;
+    };
+
+    std::string root;
+    std::vector<std::string> exclusions;
+    int fd = -1;
+    std::unordered_map<int, std::string> watches;   // Watch descriptor -> directory
+    std::unordered_map<std::string, DirtyEntry> dirty;
+    std::string watch_error;
+    bool overflow = false;
+    uint64_t events = 0;
+};
@@ -0,0 +1,120 @@
+#include "checksum.h"
+#include <array>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define DELTAVAULT_CRC32C_SSE42 1
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace {
+
+// Slicing-by-8 lookup tables for the reflected Castagnoli polynomial
+struct Crc32cTables {
+    std::array<std::array<uint32_t, 256>, 8> t;
+
+    Crc32cTables() {
+        const uint32_t poly = 0x82F63B78u;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? (c >> 1) ^ poly : c >> 1;
+            }
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (size_t s = 1; s < 8; ++s) {
+                t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+const Crc32cTables& tables() {
+    static const Crc32cTables instance;
+    return instance;
+}
+
+uint32_t crc32cSoftware(const void* data, size_t size, uint32_t crc) {
+    const auto& t = tables().t;
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+
+    while (size >= 8) {
+        uint32_t lo = crc ^ (uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24);
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+        p += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    }
+    return ~crc;
+}
+
+#ifdef DELTAVAULT_CRC32C_SSE42
+
+bool cpuHasSse42() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+    return (ecx & bit_SSE4_2) != 0;
+#endif
+}
+
+// The CRC32 instruction implements exactly the Castagnoli polynomial
+#ifndef _MSC_VER
+__attribute__((target("sse4.2")))
+#endif
+uint32_t crc32cHardware(const void* data, size_t size, uint32_t crc) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t c = ~crc;
+    while (size >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        c = _mm_crc32_u64(c, word);
+        p += 8;
+        size -= 8;
+    }
+    uint32_t c32 = static_cast<uint32_t>(c);
+    while (size--) {
+        c32 = _mm_crc32_u8(c32, *p++);
+    }
+    return ~c32;
+}
+
+#endif
+
+using Crc32cFn = uint32_t (*)(const void*, size_t, uint32_t);
+
+Crc32cFn selectCrc32c() {
+#ifdef DELTAVAULT_CRC32C_SSE42
+    if (cpuHasSse42()) return crc32cHardware;
+#endif
+    return crc32cSoftware;
+}
+
+} // namespace
+
+uint32_t crc32c(const void* data, size_t size, uint32_t crc) {
+    static const Crc32cFn impl = selectCrc32c();
+    return impl(data, size, crc);
+}
+
+bool crc32cIsHardwareAccelerated() {
+#ifdef DELTAVAULT_CRC32C_SSE42
+    return cpuHasSse42();
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli). Pass the previous result as `crc` to checksum data in pieces.
+// Uses the SSE4.2 CRC32 instruction when the CPU has it, slicing-by-8 tables otherwise.
+uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0);
+
+// True if crc32c runs on the hardware instruction
+bool crc32cIsHardwareAccelerated();
@@ -24,6 +24,76 @@ std::vector<std::string> FileScanner::scanDirectory(const std::string& path) {
     return files;
 }
 
+std::vector<std::string> FileScanner::scanChangedFiles(const std::string& path, std::vector<std::string>* removed) {
+    std::vector<std::string> changed;
+    std::lock_guard<std::mutex> lock(scan_mutex);
+    uint64_t scan = ++scan_count;
+
+    std::error_code ec;
+    fs::recursive_directory_iterator it(path, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        // The iterator caches what readdir returned; size and mtime cost one stat
+        const auto& entry = *it;
+        std::error_code stat_ec;
+        if (!entry.is_regular_file(stat_ec)) continue;
+        uint64_t size = entry.file_size(stat_ec);
+        auto mtime = entry.last_write_time(stat_ec);
+        if (stat_ec) continue;   // Removed while scanning
+
+        auto [known, inserted] = file_manifest.try_emplace(entry.path().string());
+        ManifestEntry& m = known->second;
+        if (inserted || m.size != size || m.mtime != mtime) changed.push_back(known->first);
+        m.size = size;
+        m.mtime = mtime;
+        m.scan = scan;
+    }
+    if (ec) std::cerr << "Filesystem error: " << ec.message() << " (" << path << ")" << std::endl;
+
+    // Forget files below `path` this scan did not see
+    std::string prefix = fs::path(path).string();
+    if (!prefix.empty() && prefix.back() != fs::path::preferred_separator) prefix += fs::path::preferred_separator;
+    for (auto m = file_manifest.begin(); m != file_manifest.end();) {
+        bool below = m->first.compare(0, prefix.size(), prefix) == 0;
+        if (below && m->second.scan != scan) {
+            if (removed) removed->push_back(m->first);
+            m = file_manifest.erase(m);
+        } else {
+            ++m;
+        }
+    }
+    return changed;
+}
+
+void FileScanner::updateManifest(const std::vector<std::string>& paths) {
+    std::lock_guard<std::mutex> lock(scan_mutex);
+    for (const auto& path : paths) {
+        std::error_code ec;
+        fs::directory_entry entry(path, ec);
+        uint64_t size = ec ? 0 : entry.file_size(ec);
+        auto mtime = ec ? fs::file_time_type() : entry.last_write_time(ec);
+        if (ec) {
+            file_manifest.erase(path);
+            if (!fs::exists(path, ec)) {
+                // A directory that was deleted or moved away takes its files along
+                std::string prefix = path + static_cast<char>(fs::path::preferred_separator);
+                for (auto m = file_manifest.begin(); m != file_manifest.end();) {
+                    m = m->first.compare(0, prefix.size(), prefix) == 0 ? file_manifest.erase(m) : std::next(m);
+                }
+            }
+            continue;
+        }
+        ManifestEntry& m = file_manifest[path];
+        m.size = size;
+        m.mtime = mtime;
+        m.scan = scan_count;
+    }
+}
+
+void FileScanner::forgetFiles(const std::vector<std::string>& paths) {
+    std::lock_guard<std::mutex> lock(scan_mutex);
+    for (const auto& path : paths) file_manifest.erase(path);
+}
+
 std::string FileScanner::hashFile(const std::string& file_path) {
     std::ifstream file(file_path, std::ios::binary);
     if (!file) {
@@ -59,14 +129,12 @@ FileMetadata FileScanner::getFileMetadata(const std::string& path) {
     try {
         if (fs::exists(path)) {
             metadata.file_size = fs::file_size(path);
+            // file_clock has no portable epoch (and clock_cast is missing from some
+            // standard libraries), so shift by the offset between the two clocks' "now"
             auto ftime = fs::last_write_time(path);
-            // Convert file_time_type to system_clock::time_point roughly
-            // This conversion is non-trivial across platforms in C++20, keeping it simple for now or just storing it
-            // For C++20 we can use clock_cast if available or simplified approach
-            // metadata.mtime = std::chrono::clock_cast<std::chrono::system_clock>(ftime); 
-            // Fallback for visual simplicity:
-             metadata.mtime = std::chrono::system_clock::now(); // Placeholder until precise conversion implemented
-            
+            metadata.mtime = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
+                ftime - fs::file_time_type::clock::now() + std::chrono::system_clock::now());
+
             metadata.permissions = fs::status(path).permissions();
         }
     } catch (...) {
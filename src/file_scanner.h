@@ -15,7 +15,7 @@ struct FileMetadata {
     std::string file_hash; // SHA256
     std::chrono::system_clock::time_point mtime;
     // Simple permission representation for now
-    std::filesystem::perms permissions;
+    std::filesystem::perms permissions = std::filesystem::perms::unknown;
 };
 
 class FileScanner {
@@ -32,7 +32,28 @@ public:
     // Check if file is locked/in-use
     bool isFileLocked(const std::string& path);
 
+    // Regular files below `path` that are new, or whose size or mtime changed since
+    // the previous scan (all of them on the first). Files that are gone are dropped
+    // from the manifest and added to `removed` if given. Only stats files, never reads them.
+    std::vector<std::string> scanChangedFiles(const std::string& path, std::vector<std::string>* removed = nullptr);
+
+    // Record the current size and mtime of `paths`, e.g. files found changed by other
+    // means and backed up, so the next scanChangedFiles does not report them again.
+    // A path that no longer exists is dropped along with everything below it.
+    void updateManifest(const std::vector<std::string>& paths);
+
+    // Drop `paths` from the manifest, so the next scanChangedFiles reports them
+    // (e.g. after their backup failed)
+    void forgetFiles(const std::vector<std::string>& paths);
+
 private:
-    std::unordered_map<std::string, FileMetadata> file_manifest;
+    struct ManifestEntry {
+        uint64_t size = 0;
+        fs::file_time_type mtime;
+        uint64_t scan = 0;   // Last scan that saw the file
+    };
+
+    std::unordered_map<std::string, ManifestEntry> file_manifest;
+    uint64_t scan_count = 0;
     std::mutex scan_mutex;
 };
@@ -1,24 +1,118 @@
 #include "hash_engine.h"
 #include <openssl/sha.h>
 #include <zstd.h>
-#include <sstream>
-#include <iomanip>
 #include <stdexcept>
+#include <cstring>
 #include <vector>
 
+namespace {
+
+std::string toHex(const unsigned char* digest, size_t size) {
+    static const char* digits = "0123456789abcdef";
+    std::string hex(size * 2, '0');
+    for (size_t i = 0; i < size; i++) {
+        hex[2 * i] = digits[digest[i] >> 4];
+        hex[2 * i + 1] = digits[digest[i] & 0x0f];
+    }
+    return hex;
+}
+
+// zstd contexts are reused per thread instead of being set up for every block
+struct ZstdContexts {
+    ZSTD_CCtx* cctx = nullptr;
+    ZSTD_DCtx* dctx = nullptr;
+    ~ZstdContexts() {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+};
+
+thread_local ZstdContexts zstd_contexts;
+
+ZSTD_CCtx* threadCCtx() {
+    if (!zstd_contexts.cctx) {
+        zstd_contexts.cctx = ZSTD_createCCtx();
+        if (!zstd_contexts.cctx) throw std::runtime_error("Failed to create compression context");
+    }
+    return zstd_contexts.cctx;
+}
+
+ZSTD_DCtx* threadDCtx() {
+    if (!zstd_contexts.dctx) {
+        zstd_contexts.dctx = ZSTD_createDCtx();
+        if (!zstd_contexts.dctx) throw std::runtime_error("Failed to create decompression context");
+    }
+    return zstd_contexts.dctx;
+}
+
+size_t originalSize(const uint8_t* compressed_data, size_t compressed_size) {
+    unsigned long long decompressed_size = ZSTD_getFrameContentSize(compressed_data, compressed_size);
+
+    if (decompressed_size == ZSTD_CONTENTSIZE_ERROR) {
+        throw std::runtime_error("Not compressed by zstd");
+    }
+    if (decompressed_size == ZSTD_CONTENTSIZE_UNKNOWN) {
+        throw std::runtime_error("Original size unknown");
+    }
+    return static_cast<size_t>(decompressed_size);
+}
+
+void decompressExact(const uint8_t* compressed_data, size_t compressed_size, uint8_t* out, size_t out_size) {
+    size_t result = ZSTD_decompressDCtx(threadDCtx(), out, out_size, compressed_data, compressed_size);
+    if (ZSTD_isError(result)) {
+        throw std::runtime_error(std::string("Decompression failed: ") + ZSTD_getErrorName(result));
+    }
+}
+
+void decompressWithPrefix(const uint8_t* compressed_data, size_t compressed_size,
+                          const uint8_t* base, size_t base_size, uint8_t* out, size_t out_size) {
+    ZSTD_DCtx* dctx = threadDCtx();
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+    // The prefix only applies to the next frame
+    size_t result = ZSTD_DCtx_refPrefix(dctx, base, base_size);
+    if (ZSTD_isError(result)) {
+        throw std::runtime_error(std::string("Delta base rejected: ") + ZSTD_getErrorName(result));
+    }
+    decompressExact(compressed_data, compressed_size, out, out_size);
+}
+
+} // namespace
+
+StreamHash::StreamHash() {
+    SHA256_Init(&ctx);
+}
+
+void StreamHash::update(const uint8_t* data, size_t size) {
+    SHA256_Update(&ctx, data, size);
+}
+
+std::string StreamHash::saveState() const {
+    return std::string(reinterpret_cast<const char*>(&ctx), sizeof(ctx));
+}
+
+bool StreamHash::loadState(const std::string& state) {
+    if (state.size() != sizeof(ctx)) return false;
+    std::memcpy(&ctx, state.data(), sizeof(ctx));
+    return true;
+}
+
+std::string StreamHash::finalize() {
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256_Final(hash, &ctx);
+    return toHex(hash, SHA256_DIGEST_LENGTH);
+}
+
 std::string HashEngine::computeBlockHash(const std::vector<uint8_t>& block_data) {
+    return computeBlockHash(block_data.data(), block_data.size());
+}
+
+std::string HashEngine::computeBlockHash(const uint8_t* data, size_t size) {
     unsigned char hash[SHA256_DIGEST_LENGTH];
     SHA256_CTX sha256_ctx;
     SHA256_Init(&sha256_ctx);
-    SHA256_Update(&sha256_ctx, block_data.data(), block_data.size());
+    SHA256_Update(&sha256_ctx, data, size);
     SHA256_Final(hash, &sha256_ctx);
-
-    // Convert to hex string
-    std::stringstream ss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-    }
-    return ss.str();
+    return toHex(hash, SHA256_DIGEST_LENGTH);
 }
 
 std::pair<std::vector<uint8_t>, size_t> HashEngine::compressBlock(
@@ -28,7 +122,8 @@ std::pair<std::vector<uint8_t>, size_t> HashEngine::compressBlock(
     size_t max_compressed_size = ZSTD_compressBound(block_data.size());
     std::vector<uint8_t> compressed(max_compressed_size);
 
-    size_t compressed_size = ZSTD_compress(
+    size_t compressed_size = ZSTD_compressCCtx(
+        threadCCtx(),
         compressed.data(),
         max_compressed_size,
         block_data.data(),
@@ -44,30 +139,100 @@ std::pair<std::vector<uint8_t>, size_t> HashEngine::compressBlock(
     return {compressed, block_data.size()};
 }
 
-std::vector<uint8_t> HashEngine::decompressBlock(const std::vector<uint8_t>& compressed_data) {
-    unsigned long long decompressed_size = ZSTD_getFrameContentSize(
-        compressed_data.data(),
-        compressed_data.size()
-    );
+size_t HashEngine::compressBound(size_t size) {
+    return ZSTD_compressBound(size);
+}
 
-    if (decompressed_size == ZSTD_CONTENTSIZE_ERROR) {
-        throw std::runtime_error("Not compressed by zstd");
-    }
-    if (decompressed_size == ZSTD_CONTENTSIZE_UNKNOWN) {
-        throw std::runtime_error("Original size unknown");
+void HashEngine::compressBlockInto(const uint8_t* data, size_t size, PooledBuffer& out, int compression_level) {
+    size_t max_compressed_size = ZSTD_compressBound(size);
+    out.resize(max_compressed_size);
+
+    size_t compressed_size = ZSTD_compressCCtx(threadCCtx(), out.data(), max_compressed_size, data, size, compression_level);
+    if (ZSTD_isError(compressed_size)) {
+        throw std::runtime_error(std::string("Compression failed: ") + ZSTD_getErrorName(compressed_size));
     }
+    out.resize(compressed_size);
+}
 
-    std::vector<uint8_t> decompressed(decompressed_size);
-    size_t result = ZSTD_decompress(
-        decompressed.data(),
-        decompressed_size,
-        compressed_data.data(),
-        compressed_data.size()
-    );
+void HashEngine::compressDeltaInto(const uint8_t* data, size_t size, const uint8_t* base, size_t base_size,
+                                   PooledBuffer& out, int compression_level) {
+    size_t max_compressed_size = ZSTD_compressBound(size);
+    out.resize(max_compressed_size);
 
+    // Parameters set here stay on the context; ZSTD_compressCCtx ignores them
+    ZSTD_CCtx* cctx = threadCCtx();
+    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, compression_level);
+    // Fast levels hash too few positions to find matches across a 256 KiB base;
+    // long-distance matching finds them at any level for little extra work
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1);
+    size_t result = ZSTD_CCtx_refPrefix(cctx, base, base_size);
     if (ZSTD_isError(result)) {
-        throw std::runtime_error(std::string("Decompression failed: ") + ZSTD_getErrorName(result));
+        throw std::runtime_error(std::string("Delta base rejected: ") + ZSTD_getErrorName(result));
     }
 
+    size_t compressed_size = ZSTD_compress2(cctx, out.data(), max_compressed_size, data, size);
+    if (ZSTD_isError(compressed_size)) {
+        throw std::runtime_error(std::string("Compression failed: ") + ZSTD_getErrorName(compressed_size));
+    }
+    out.resize(compressed_size);
+}
+
+std::vector<uint8_t> HashEngine::decompressDelta(const uint8_t* compressed_data, size_t compressed_size,
+                                                 const uint8_t* base, size_t base_size) {
+    std::vector<uint8_t> decompressed(originalSize(compressed_data, compressed_size));
+    decompressWithPrefix(compressed_data, compressed_size, base, base_size, decompressed.data(), decompressed.size());
+    return decompressed;
+}
+
+void HashEngine::decompressDeltaInto(const uint8_t* compressed_data, size_t compressed_size,
+                                     const uint8_t* base, size_t base_size, PooledBuffer& out) {
+    out.resize(originalSize(compressed_data, compressed_size));
+    decompressWithPrefix(compressed_data, compressed_size, base, base_size, out.data(), out.size());
+}
+
+std::vector<uint8_t> HashEngine::decompressBlock(const std::vector<uint8_t>& compressed_data) {
+    return decompressBlock(compressed_data.data(), compressed_data.size());
+}
+
+std::vector<uint8_t> HashEngine::decompressBlock(const uint8_t* compressed_data, size_t compressed_size) {
+    std::vector<uint8_t> decompressed(originalSize(compressed_data, compressed_size));
+    decompressExact(compressed_data, compressed_size, decompressed.data(), decompressed.size());
+    return decompressed;
+}
+
+void HashEngine::decompressBlockInto(const uint8_t* compressed_data, size_t compressed_size, PooledBuffer& out) {
+    out.resize(originalSize(compressed_data, compressed_size));
+    decompressExact(compressed_data, compressed_size, out.data(), out.size());
+}
+
+std::vector<uint8_t> HashEngine::decompressBlockPrefix(const std::vector<uint8_t>& compressed_data, size_t length) {
+    return decompressBlockPrefix(compressed_data.data(), compressed_data.size(), length);
+}
+
+std::vector<uint8_t> HashEngine::decompressBlockPrefix(const uint8_t* compressed_data, size_t compressed_size, size_t length) {
+    std::vector<uint8_t> decompressed(length);
+    if (length == 0) return decompressed;
+
+    ZSTD_DCtx* dctx = threadDCtx();
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+
+    ZSTD_inBuffer input = {compressed_data, compressed_size, 0};
+    ZSTD_outBuffer output = {decompressed.data(), length, 0};
+
+    while (output.pos < output.size) {
+        size_t in_before = input.pos;
+        size_t out_before = output.pos;
+        size_t result = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(result)) {
+            throw std::runtime_error(std::string("Decompression failed: ") + ZSTD_getErrorName(result));
+        }
+        // Frame finished, or no more progress possible
+        if (result == 0 || (input.pos == in_before && output.pos == out_before)) break;
+    }
+
+    if (output.pos < length) {
+        throw std::runtime_error("Block is shorter than the requested range");
+    }
     return decompressed;
 }
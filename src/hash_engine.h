@@ -3,11 +3,34 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <cstdint>
+#include <openssl/sha.h>
+#include "buffer_pool.h"
+
+// Incremental SHA-256 for data that arrives in pieces (e.g. a file read block by block)
+class StreamHash {
+public:
+    StreamHash();
+    void update(const uint8_t* data, size_t size);
+    void update(const std::vector<uint8_t>& data) { update(data.data(), data.size()); }
+
+    // Hex digest; the object must not be updated afterwards
+    std::string finalize();
+
+    // Opaque copy of the running state, and restoring it (false if `state` is not
+    // one produced by saveState in this build). Used to resume a file hash.
+    std::string saveState() const;
+    bool loadState(const std::string& state);
+
+private:
+    SHA256_CTX ctx;
+};
 
 class HashEngine {
 public:
     // Compute SHA-256 hash of block data, returning hex string
     std::string computeBlockHash(const std::vector<uint8_t>& block_data);
+    std::string computeBlockHash(const uint8_t* data, size_t size);
 
     // Compress block using zstd (return compressed data + original size for reference)
     // Default compression level 3 is a good balance
@@ -16,6 +39,31 @@ public:
         int compression_level = 3
     );
 
+    // Largest possible compressBlock output for `size` input bytes
+    static size_t compressBound(size_t size);
+
+    // Compress into a pooled buffer (resized to the compressed size)
+    void compressBlockInto(const uint8_t* data, size_t size, PooledBuffer& out, int compression_level = 3);
+
     // Decompress block
     std::vector<uint8_t> decompressBlock(const std::vector<uint8_t>& compressed_data);
+    std::vector<uint8_t> decompressBlock(const uint8_t* compressed_data, size_t compressed_size);
+
+    // Decompress into a pooled buffer (resized to the original size)
+    void decompressBlockInto(const uint8_t* compressed_data, size_t compressed_size, PooledBuffer& out);
+
+    // Compress `data` as a delta: zstd with `base` (a similar block) as its prefix,
+    // so regions shared with the base become back-references into it
+    void compressDeltaInto(const uint8_t* data, size_t size, const uint8_t* base, size_t base_size,
+                           PooledBuffer& out, int compression_level = 3);
+
+    // Decompress a compressDeltaInto frame; needs the same base
+    std::vector<uint8_t> decompressDelta(const uint8_t* compressed_data, size_t compressed_size,
+                                         const uint8_t* base, size_t base_size);
+    void decompressDeltaInto(const uint8_t* compressed_data, size_t compressed_size,
+                             const uint8_t* base, size_t base_size, PooledBuffer& out);
+
+    // Decompress only the first `length` bytes of a block (stops decoding there)
+    std::vector<uint8_t> decompressBlockPrefix(const std::vector<uint8_t>& compressed_data, size_t length);
+    std::vector<uint8_t> decompressBlockPrefix(const uint8_t* compressed_data, size_t compressed_size, size_t length);
 };
@@ -0,0 +1,1121 @@
+#include "lsm_metadata_db.h"
+#include "block_list_codec.h"
+#include <algorithm>
+#include <ctime>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+// Batch with read-your-writes: gets see the batch's own puts and erases
+// before the store, so one batch can create rows and refer to them
+class LsmTransaction {
+public:
+    explicit LsmTransaction(LsmStore& store) : store(store) {}
+
+    bool get(const std::string& key, std::string& value) {
+        auto it = overlay.find(key);
+        if (it == overlay.end()) return store.get(key, value);
+        if (!it->second) return false;
+        value = *it->second;
+        return true;
+    }
+
+    bool contains(const std::string& key) {
+        std::string ignored;
+        return get(key, ignored);
+    }
+
+    void put(const std::string& key, const std::string& value) {
+        batch.put(key, value);
+        overlay[key] = value;
+    }
+
+    void erase(const std::string& key) {
+        batch.erase(key);
+        overlay[key] = std::nullopt;
+    }
+
+    void commit(bool sync = false) { store.apply(batch, sync); }
+
+private:
+    LsmStore& store;
+    LsmWriteBatch batch;
+    std::unordered_map<std::string, std::optional<std::string>> overlay;
+};
+
+namespace {
+
+// Table prefixes. Ids in keys are big-endian so that they sort numerically.
+const char BLOCKS = 'b';             // block_id -> BlockRecord
+const char BLOCK_HASHES = 'h';       // block_hash -> block_id
+const char BLOCK_FEATURES = 'x';     // feature, block_id -> ""
+const char FILES = 'f';              // file_id -> path, created_at
+const char FILE_PATHS = 'p';         // path -> file_id
+const char VERSIONS = 'v';           // version_id -> VersionRecord
+const char BLOCK_LISTS = 'l';        // version_id -> block count, encoding, encoded ids
+const char FILE_VERSIONS = 'w';      // file_id, version_id -> ""
+const char CLONES = 'z';             // source_version_id, version_id -> ""
+const char CONTENTS = 'c';           // file_size, file_hash -> version_id
+const char SNAPSHOTS = 's';          // snapshot_id -> root_path, created_at, version ids
+const char CHECKPOINTS = 'k';        // file_path -> checkpoint
+const char MERKLE_NODES = 'm';       // node_hash -> level, byte_count, children
+const char REPLICA_VERSIONS = 'r';   // source, 0, source_id -> version_id
+const char REPLICA_SNAPSHOTS = 'R';  // source, 0, source_id -> snapshot_id
+const char REPLICA_CURSORS = 'q';    // source -> highest source version id, snapshot id
+const std::string COUNTERS = "#";    // -> next file, block, version, snapshot id
+
+void putVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+// Record values: varints and length-prefixed strings in a fixed order
+class FieldWriter {
+public:
+    FieldWriter& num(uint64_t v) {
+        putVarint(out, v);
+        return *this;
+    }
+    FieldWriter& str(const std::string& s) {
+        putVarint(out, s.size());
+        out += s;
+        return *this;
+    }
+    FieldWriter& raw(const void* data, size_t size) {
+        out.append(static_cast<const char*>(data), size);
+        return *this;
+    }
+
+    std::string out;
+};
+
+class FieldReader {
+public:
+    explicit FieldReader(const std::string& data) : p(data.data()), end(data.data() + data.size()) {}
+
+    bool atEnd() const { return p == end; }
+
+    uint64_t num() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p >= end) throw std::runtime_error("Corrupt catalog record");
+            uint8_t byte = static_cast<uint8_t>(*p++);
+            v |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return v;
+        }
+        throw std::runtime_error("Corrupt catalog record");
+    }
+    std::string str() {
+        uint64_t size = num();
+        if (size > static_cast<uint64_t>(end - p)) throw std::runtime_error("Corrupt catalog record");
+        std::string s(p, size);
+        p += size;
+        return s;
+    }
+    // Everything after the fields read so far
+    std::pair<const uint8_t*, size_t> rest() const {
+        return {reinterpret_cast<const uint8_t*>(p), static_cast<size_t>(end - p)};
+    }
+
+private:
+    const char* p;
+    const char* end;
+};
+
+std::string be64(uint64_t v) {
+    std::string out(8, '\0');
+    for (int i = 7; i >= 0; --i) {
+        out[i] = static_cast<char>(v & 0xff);
+        v >>= 8;
+    }
+    return out;
+}
+
+uint64_t readBe64(const std::string& s, size_t pos) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < 8; ++i) v = v << 8 | static_cast<uint8_t>(s[pos + i]);
+    return v;
+}
+
+std::string key(char table, uint64_t id) { return std::string(1, table) + be64(id); }
+std::string key(char table, uint64_t a, uint64_t b) { return std::string(1, table) + be64(a) + be64(b); }
+std::string key(char table, const std::string& name) { return std::string(1, table) + name; }
+
+std::string replicaKey(char table, const std::string& source, uint64_t source_id) {
+    return std::string(1, table) + source + std::string(1, '\0') + be64(source_id);
+}
+
+std::string idValue(uint64_t id) { return FieldWriter().num(id).out; }
+
+uint64_t getId(LsmStore& store, const std::string& k) {
+    std::string value;
+    return store.get(k, value) ? FieldReader(value).num() : 0;
+}
+
+uint64_t getId(LsmTransaction& txn, const std::string& k) {
+    std::string value;
+    return txn.get(k, value) ? FieldReader(value).num() : 0;
+}
+
+// All keys with `prefix`, in order
+void scanPrefix(LsmStore& store, const std::string& prefix, const LsmStore::ScanCallback& callback) {
+    store.scan(prefix, LsmStore::prefixEnd(prefix), callback);
+}
+
+// Keys of `table` with ids in [first, last]
+void scanIds(LsmStore& store, char table, uint64_t first, uint64_t last, const LsmStore::ScanCallback& callback) {
+    if (first > last) return;
+    std::string end = last == UINT64_MAX ? LsmStore::prefixEnd(std::string(1, table)) : key(table, last + 1);
+    store.scan(key(table, first), end, callback);
+}
+
+struct BlockRecord {
+    std::string hash;
+    uint64_t size = 0;
+    uint64_t compressed_size = 0;
+    uint64_t compression_level = 3;
+    uint64_t created_at = 0;
+    uint64_t ref_count = 0;
+    std::string delta_base;
+    uint64_t delta_depth = 0;
+};
+
+std::string encodeBlock(const BlockRecord& b) {
+    return FieldWriter().str(b.hash).num(b.size).num(b.compressed_size).num(b.compression_level)
+        .num(b.created_at).num(b.ref_count).str(b.delta_base).num(b.delta_depth).out;
+}
+
+BlockRecord decodeBlock(const std::string& value) {
+    FieldReader r(value);
+    BlockRecord b;
+    b.hash = r.str();
+    b.size = r.num();
+    b.compressed_size = r.num();
+    b.compression_level = r.num();
+    b.created_at = r.num();
+    b.ref_count = r.num();
+    b.delta_base = r.str();
+    b.delta_depth = r.num();
+    return b;
+}
+
+DBBlock toDBBlock(uint64_t block_id, const BlockRecord& b) {
+    DBBlock block;
+    block.block_id = block_id;
+    block.block_hash = b.hash;
+    block.size = static_cast<int>(b.size);
+    block.compressed_size = static_cast<int>(b.compressed_size);
+    block.compression_level = static_cast<int>(b.compression_level);
+    block.delta_base = b.delta_base;
+    block.delta_depth = static_cast<int>(b.delta_depth);
+    return block;
+}
+
+DBBlockRef toBlockRef(uint64_t block_id, const BlockRecord& b) {
+    return {block_id, b.hash, b.size, b.compressed_size, b.ref_count};
+}
+
+struct VersionRecord {
+    uint64_t file_id = 0;
+    uint64_t parent_id = 0;
+    std::string file_hash;
+    uint64_t created_at = 0;
+    uint64_t file_size = 0;
+    uint64_t source_version_id = 0;   // Whole-file clone of this version (0 = owns its content)
+    std::string merkle_root;
+    bool packed = false;              // Content is a slice of an aggregate block
+    uint64_t packed_block = 0;
+    uint64_t packed_offset = 0;
+    uint32_t mode = FILE_MODE_UNKNOWN;
+};
+
+std::string encodeVersion(const VersionRecord& v) {
+    FieldWriter w;
+    w.num(v.file_id).num(v.parent_id).str(v.file_hash).num(v.created_at).num(v.file_size)
+        .num(v.source_version_id).str(v.merkle_root).num(v.packed ? 1 : 0);
+    if (v.packed) w.num(v.packed_block).num(v.packed_offset);
+    w.num(v.mode == FILE_MODE_UNKNOWN ? 0 : uint64_t(v.mode) + 1);
+    return w.out;
+}
+
+VersionRecord decodeVersion(const std::string& value) {
+    FieldReader r(value);
+    VersionRecord v;
+    v.file_id = r.num();
+    v.parent_id = r.num();
+    v.file_hash = r.str();
+    v.created_at = r.num();
+    v.file_size = r.num();
+    v.source_version_id = r.num();
+    v.merkle_root = r.str();
+    v.packed = r.num() != 0;
+    if (v.packed) {
+        v.packed_block = r.num();
+        v.packed_offset = r.num();
+    }
+    // Records written before modes were kept end here
+    if (!r.atEnd()) {
+        uint64_t mode = r.num();
+        if (mode != 0) v.mode = static_cast<uint32_t>(mode - 1);
+    }
+    return v;
+}
+
+bool loadVersion(LsmStore& store, uint64_t version_id, VersionRecord& version) {
+    std::string value;
+    if (!store.get(key(VERSIONS, version_id), value)) return false;
+    version = decodeVersion(value);
+    return true;
+}
+
+std::string encodeBlockListValue(const std::vector<uint64_t>& block_ids) {
+    BlockListEncoding encoding;
+    auto encoded = encodeBlockList(block_ids, encoding);
+    return FieldWriter().num(block_ids.size()).num(static_cast<uint64_t>(encoding)).raw(encoded.data(), encoded.size()).out;
+}
+
+std::string filePath(LsmStore& store, uint64_t file_id) {
+    std::string value;
+    return store.get(key(FILES, file_id), value) ? FieldReader(value).str() : "";
+}
+
+// Collapse sorted, distinct ids into [first, last] runs of consecutive ids
+std::vector<std::pair<uint64_t, uint64_t>> idRuns(const std::vector<uint64_t>& sorted_ids) {
+    std::vector<std::pair<uint64_t, uint64_t>> runs;
+    for (uint64_t id : sorted_ids) {
+        if (!runs.empty() && runs.back().second + 1 == id) {
+            runs.back().second = id;
+        } else {
+            runs.emplace_back(id, id);
+        }
+    }
+    return runs;
+}
+
+} // namespace
+
+void LsmMetadataDB::initialize(const std::string& dir) {
+    store = std::make_unique<LsmStore>(dir);
+    std::string value;
+    if (store->get(COUNTERS, value)) {
+        FieldReader r(value);
+        next_file_id = r.num();
+        next_block_id = r.num();
+        next_version_id = r.num();
+        next_snapshot_id = r.num();
+    }
+}
+
+LsmStats LsmMetadataDB::storeStats() {
+    return store->stats();
+}
+
+uint64_t LsmMetadataDB::allocateId(LsmTransaction& txn, uint64_t& counter) {
+    uint64_t id = counter++;
+    txn.put(COUNTERS, FieldWriter().num(next_file_id).num(next_block_id).num(next_version_id).num(next_snapshot_id).out);
+    return id;
+}
+
+uint64_t LsmMetadataDB::getOrCreateFile(LsmTransaction& txn, const std::string& path, uint64_t created_at) {
+    uint64_t id = getId(txn, key(FILE_PATHS, path));
+    if (id != 0) return id;
+    id = allocateId(txn, next_file_id);
+    txn.put(key(FILE_PATHS, path), idValue(id));
+    txn.put(key(FILES, id), FieldWriter().str(path).num(created_at).out);
+    return id;
+}
+
+uint64_t LsmMetadataDB::getOrCreateFile(const std::string& path) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    LsmTransaction txn(*store);
+    uint64_t id = getOrCreateFile(txn, path, std::time(nullptr));
+    txn.commit();
+    return id;
+}
+
+uint64_t LsmMetadataDB::storeBlock(const std::string& hash, int size, int compressed_size, int compression_level,
+                                   const std::string& delta_base, int delta_depth) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    LsmTransaction txn(*store);
+    uint64_t id = getId(txn, key(BLOCK_HASHES, hash));
+    if (id != 0) return id;
+
+    BlockRecord block;
+    block.hash = hash;
+    block.size = size;
+    block.compressed_size = compressed_size;
+    block.compression_level = compression_level;
+    block.created_at = std::time(nullptr);
+    block.delta_base = delta_base;
+    block.delta_depth = delta_depth;
+    id = allocateId(txn, next_block_id);
+    txn.put(key(BLOCKS, id), encodeBlock(block));
+    txn.put(key(BLOCK_HASHES, hash), idValue(id));
+    txn.commit();
+    return id;
+}
+
+uint64_t LsmMetadataDB::findBlock(const std::string& hash) {
+    return getId(*store, key(BLOCK_HASHES, hash));
+}
+
+bool LsmMetadataDB::getBlock(const std::string& hash, DBBlock& block) {
+    uint64_t id = findBlock(hash);
+    std::string value;
+    if (id == 0 || !store->get(key(BLOCKS, id), value)) return false;
+    block = toDBBlock(id, decodeBlock(value));
+    return true;
+}
+
+void LsmMetadataDB::addBlockFeatures(uint64_t block_id, const BlockSketch& sketch) {
+    if (sketch.empty()) return;
+    LsmWriteBatch batch;
+    for (size_t i = 0; i < SKETCH_SUPER_FEATURES; ++i) {
+        batch.put(key(BLOCK_FEATURES, sketch.super_features[i], block_id), "");
+    }
+    store->apply(batch);
+}
+
+bool LsmMetadataDB::findSimilarBlock(const BlockSketch& sketch, int max_depth, DBBlock& base) {
+    if (sketch.empty()) return false;
+    std::map<uint64_t, unsigned> matches;   // block_id -> shared super-features
+    for (size_t i = 0; i < SKETCH_SUPER_FEATURES; ++i) {
+        size_t candidates = 0;
+        scanPrefix(*store, key(BLOCK_FEATURES, sketch.super_features[i]), [&](const std::string& k, const std::string&) {
+            matches[readBe64(k, 9)]++;
+            return ++candidates < SKETCH_CANDIDATES_PER_FEATURE;
+        });
+    }
+
+    // Most matches first, newest first on ties; the first shallow enough wins
+    std::vector<std::pair<unsigned, uint64_t>> ranked;
+    for (const auto& [block_id, count] : matches) ranked.emplace_back(count, block_id);
+    std::sort(ranked.begin(), ranked.end(), std::greater<>());
+    for (const auto& [count, block_id] : ranked) {
+        std::string value;
+        if (!store->get(key(BLOCKS, block_id), value)) continue;
+        BlockRecord block = decodeBlock(value);
+        if (static_cast<int>(block.delta_depth) < max_depth) {
+            base = toDBBlock(block_id, block);
+            return true;
+        }
+    }
+    return false;
+}
+
+void LsmMetadataDB::addBlockRefs(LsmTransaction& txn, std::vector<uint64_t> block_ids, int64_t delta) {
+    std::sort(block_ids.begin(), block_ids.end());
+    block_ids.erase(std::unique(block_ids.begin(), block_ids.end()), block_ids.end());
+    for (uint64_t id : block_ids) {
+        std::string value;
+        if (!txn.get(key(BLOCKS, id), value)) throw std::runtime_error("Block list references missing block " + std::to_string(id));
+        BlockRecord block = decodeBlock(value);
+        block.ref_count += delta;
+        txn.put(key(BLOCKS, id), encodeBlock(block));
+    }
+}
+
+void LsmMetadataDB::storeMerkleNode(LsmTransaction& txn, const MerkleNode& node) {
+    std::string k = key(MERKLE_NODES, node.hash);
+    if (txn.contains(k)) return;
+    auto children = encodeMerkleChildren(node);
+    txn.put(k, FieldWriter().num(node.level).num(node.byte_count).raw(children.data(), children.size()).out);
+}
+
+uint64_t LsmMetadataDB::createVersion(
+    uint64_t file_id,
+    const std::string& file_hash,
+    uint64_t file_size,
+    const std::vector<uint64_t>& block_ids,
+    uint64_t parent_id,
+    uint32_t mode
+) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    LsmTransaction txn(*store);
+
+    // Nodes shared with earlier versions are already stored and skipped
+    MerkleTreeBuilder tree([&](const MerkleNode& node) { storeMerkleNode(txn, node); });
+    for (size_t first = 0; first < block_ids.size(); first += BLOCK_REF_CHUNK) {
+        size_t count = std::min(BLOCK_REF_CHUNK, block_ids.size() - first);
+        for (const auto& ref : lookupBlockRefs(block_ids.data() + first, count)) {
+            tree.addBlock(ref.block_hash, ref.block_id, ref.size);
+        }
+    }
+
+    VersionRecord version;
+    version.file_id = file_id;
+    version.parent_id = parent_id;
+    version.file_hash = file_hash;
+    version.created_at = std::time(nullptr);
+    version.file_size = file_size;
+    version.merkle_root = tree.finish();
+    version.mode = mode;
+
+    uint64_t version_id = allocateId(txn, next_version_id);
+    txn.put(key(VERSIONS, version_id), encodeVersion(version));
+    txn.put(key(BLOCK_LISTS, version_id), encodeBlockListValue(block_ids));
+    txn.put(key(FILE_VERSIONS, file_id, version_id), "");
+    addBlockRefs(txn, block_ids, 1);
+
+    std::string content = key(CONTENTS, file_size) + file_hash;
+    if (!txn.contains(content)) txn.put(content, idValue(version_id));
+    txn.commit();
+    return version_id;
+}
+
+uint64_t LsmMetadataDB::getLatestVersionId(uint64_t file_id) {
+    // A file's versions are keyed in id order; the last one is the newest
+    uint64_t latest = 0;
+    scanPrefix(*store, key(FILE_VERSIONS, file_id), [&latest](const std::string& k, const std::string&) {
+        latest = readBe64(k, 9);
+        return true;
+    });
+    return latest;
+}
+
+bool LsmMetadataDB::hasContentOfSize(uint64_t file_size) {
+    // Content keys start with the size
+    bool found = false;
+    scanPrefix(*store, key(CONTENTS, file_size), [&found](const std::string&, const std::string&) {
+        found = true;
+        return false;
+    });
+    return found;
+}
+
+uint64_t LsmMetadataDB::findVersionByContent(const std::string& file_hash, uint64_t file_size) {
+    return getId(*store, key(CONTENTS, file_size) + file_hash);
+}
+
+uint64_t LsmMetadataDB::createVersionFromContent(
+    uint64_t file_id,
+    const std::string& file_hash,
+    uint64_t file_size,
+    uint64_t source_version_id,
+    uint64_t parent_id,
+    uint32_t mode
+) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    LsmTransaction txn(*store);
+    VersionRecord version;
+    version.file_id = file_id;
+    version.parent_id = parent_id;
+    version.file_hash = file_hash;
+    version.created_at = std::time(nullptr);
+    version.file_size = file_size;
+    version.source_version_id = resolveContentVersion(source_version_id);
+    version.mode = mode;
+
+    uint64_t version_id = allocateId(txn, next_version_id);
+    txn.put(key(VERSIONS, version_id), encodeVersion(version));
+    txn.put(key(FILE_VERSIONS, file_id, version_id), "");
+    txn.put(key(CLONES, version.source_version_id, version_id), "");
+    txn.commit();
+    return version_id;
+}
+
+std::vector<uint64_t> LsmMetadataDB::createPackedVersions(
+    uint64_t block_id,
+    const std::vector<PackedFileEntry>& entries
+) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    LsmTransaction txn(*store);
+    std::vector<uint64_t> version_ids;
+    version_ids.reserve(entries.size());
+    uint64_t now = std::time(nullptr);
+
+    for (const auto& entry : entries) {
+        VersionRecord version;
+        version.file_id = entry.file_id;
+        version.parent_id = entry.parent_id;
+        version.file_hash = entry.file_hash;
+        version.created_at = now;
+        version.file_size = entry.length;
+        version.packed = true;
+        version.packed_block = block_id;
+        version.packed_offset = entry.offset;
+        version.mode = entry.mode;
+
+        uint64_t version_id = allocateId(txn, next_version_id);
+        txn.put(key(VERSIONS, version_id), encodeVersion(version));
+        txn.put(key(FILE_VERSIONS, entry.file_id, version_id), "");
+        std::string content = key(CONTENTS, entry.length) + entry.file_hash;
+        if (!txn.contains(content)) txn.put(content, idValue(version_id));
+        version_ids.push_back(version_id);
+    }
+
+    // Every packed file counts as one reference to the aggregate block
+    if (!entries.empty()) addBlockRefs(txn, {block_id}, static_cast<int64_t>(entries.size()));
+    txn.commit();
+    return version_ids;
+}
+
+uint64_t LsmMetadataDB::createSnapshot(const std::string& root_path, const std::vector<uint64_t>& version_ids) {
+    std::vector<uint64_t> members(version_ids);
+    std::sort(members.begin(), members.end());
+    members.erase(std::unique(members.begin(), members.end()), members.end());
+
+    std::lock_guard<std::mutex> lock(db_mutex);
+    LsmTransaction txn(*store);
+    uint64_t snapshot_id = allocateId(txn, next_snapshot_id);
+    FieldWriter w;
+    w.str(root_path).num(std::time(nullptr)).num(members.size());
+    for (uint64_t id : members) w.num(id);
+    txn.put(key(SNAPSHOTS, snapshot_id), w.out);
+
+    // A finished snapshot is what a backup reports as done: make it durable
+    txn.commit(true);
+    return snapshot_id;
+}
+
+void LsmMetadataDB::saveCheckpoint(const BackupCheckpoint& checkpoint) {
+    BlockListEncoding encoding;
+    auto encoded = encodeBlockList(checkpoint.block_ids, encoding);
+
+    std::lock_guard<std::mutex> lock(db_mutex);
+    BackupCheckpoint stored;
+    if (loadCheckpoint(checkpoint.file_path, stored) &&
+        checkpoint.block_ids.size() <= stored.block_ids.size() &&
+        checkpoint.file_size == stored.file_size && checkpoint.mtime == stored.mtime) {
+        return;
+    }
+
+    FieldWriter w;
+    w.num(checkpoint.file_size).num(static_cast<uint64_t>(checkpoint.mtime)).str(checkpoint.hash_state)
+        .num(static_cast<uint64_t>(encoding)).raw(encoded.data(), encoded.size());
+    LsmWriteBatch batch;
+    batch.put(key(CHECKPOINTS, checkpoint.file_path), w.out);
+    store->apply(batch);
+}
+
+bool LsmMetadataDB::loadCheckpoint(const std::string& file_path, BackupCheckpoint& checkpoint) {
+    std::string value;
+    if (!store->get(key(CHECKPOINTS, file_path), value)) return false;
+    FieldReader r(value);
+    checkpoint.file_path = file_path;
+    checkpoint.file_size = r.num();
+    checkpoint.mtime = static_cast<int64_t>(r.num());
+    checkpoint.hash_state = r.str();
+    auto encoding = static_cast<BlockListEncoding>(r.num());
+    auto [ids, size] = r.rest();
+    checkpoint.block_ids = decodeBlockList(ids, size, encoding);
+    return true;
+}
+
+void LsmMetadataDB::clearCheckpoint(const std::string& file_path) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    LsmWriteBatch batch;
+    batch.erase(key(CHECKPOINTS, file_path));
+    store->apply(batch);
+}
+
+std::vector<DBSnapshotEntry> LsmMetadataDB::getSnapshotFiles(uint64_t snapshot_id) {
+    std::vector<DBSnapshotEntry> files;
+    std::string value;
+    if (!store->get(key(SNAPSHOTS, snapshot_id), value)) return files;
+    FieldReader r(value);
+    r.str();
+    r.num();
+    uint64_t count = r.num();
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t version_id = r.num();
+        VersionRecord version;
+        if (loadVersion(*store, version_id, version)) {
+            files.push_back({version_id, filePath(*store, version.file_id), version.file_size, version.mode});
+        }
+    }
+    std::stable_sort(files.begin(), files.end(),
+                     [](const DBSnapshotEntry& a, const DBSnapshotEntry& b) { return a.file_path < b.file_path; });
+    return files;
+}
+
+bool LsmMetadataDB::getPackedExtent(uint64_t version_id, DBPackedExtent& extent) {
+    VersionRecord version;
+    if (!loadVersion(*store, resolveContentVersion(version_id), version) || !version.packed) return false;
+    std::string value;
+    if (!store->get(key(BLOCKS, version.packed_block), value)) return false;
+    BlockRecord block = decodeBlock(value);
+    extent.block_id = version.packed_block;
+    extent.block_hash = block.hash;
+    extent.offset = version.packed_offset;
+    extent.length = version.file_size;
+    extent.ref_count = block.ref_count;
+    return true;
+}
+
+uint64_t LsmMetadataDB::resolveContentVersion(uint64_t version_id) {
+    VersionRecord version;
+    if (loadVersion(*store, version_id, version) && version.source_version_id != 0) return version.source_version_id;
+    return version_id;
+}
+
+bool LsmMetadataDB::hasContentClones(uint64_t version_id) {
+    bool found = false;
+    scanPrefix(*store, key(CLONES, version_id), [&found](const std::string&, const std::string&) {
+        found = true;
+        return false;
+    });
+    return found;
+}
+
+void LsmMetadataDB::readVersionBlockIds(
+    uint64_t version_id,
+    const std::function<void(const uint64_t* ids, size_t count)>& sink
+) {
+    std::string value;
+    if (!store->get(key(BLOCK_LISTS, version_id), value)) return;
+    FieldReader r(value);
+    r.num();
+    auto encoding = static_cast<BlockListEncoding>(r.num());
+    auto [data, size] = r.rest();
+    BlockListDecoder decoder(data, size, encoding);
+    uint64_t ids[BLOCK_REF_CHUNK];
+    size_t n;
+    while ((n = decoder.next(ids, BLOCK_REF_CHUNK)) > 0) {
+        sink(ids, n);
+    }
+}
+
+std::vector<DBBlockRef> LsmMetadataDB::lookupBlockRefs(const uint64_t* block_ids, size_t count) {
+    std::vector<uint64_t> sorted(block_ids, block_ids + count);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    // Consecutive ids (blocks stored together) come from one range scan
+    std::unordered_map<uint64_t, DBBlockRef> found;
+    for (const auto& [first, last] : idRuns(sorted)) {
+        if (first == last) {
+            std::string value;
+            if (store->get(key(BLOCKS, first), value)) found.emplace(first, toBlockRef(first, decodeBlock(value)));
+            continue;
+        }
+        scanIds(*store, BLOCKS, first, last, [&found](const std::string& k, const std::string& value) {
+            uint64_t id = readBe64(k, 1);
+            found.emplace(id, toBlockRef(id, decodeBlock(value)));
+            return true;
+        });
+    }
+
+    std::vector<DBBlockRef> refs;
+    refs.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        auto it = found.find(block_ids[i]);
+        if (it == found.end()) throw std::runtime_error("Block list references missing block " + std::to_string(block_ids[i]));
+        refs.push_back(it->second);
+    }
+    return refs;
+}
+
+bool LsmMetadataDB::getBlockRef(uint64_t block_id, DBBlockRef& ref) {
+    std::string value;
+    if (!store->get(key(BLOCKS, block_id), value)) return false;
+    ref = toBlockRef(block_id, decodeBlock(value));
+    return true;
+}
+
+uint64_t LsmMetadataDB::getVersionBlockCount(uint64_t version_id) {
+    std::string value;
+    if (!store->get(key(BLOCK_LISTS, resolveContentVersion(version_id)), value)) return 0;
+    return FieldReader(value).num();
+}
+
+uint64_t LsmMetadataDB::getVersionSize(uint64_t version_id) {
+    VersionRecord version;
+    return loadVersion(*store, version_id, version) ? version.file_size : 0;
+}
+
+std::vector<DBBlock> LsmMetadataDB::listBlocks(uint64_t after_block_id, size_t limit) {
+    std::vector<DBBlock> blocks;
+    if (limit == 0 || after_block_id == UINT64_MAX) return blocks;
+    scanIds(*store, BLOCKS, after_block_id + 1, UINT64_MAX, [&](const std::string& k, const std::string& value) {
+        blocks.push_back(toDBBlock(readBe64(k, 1), decodeBlock(value)));
+        return blocks.size() < limit;
+    });
+    return blocks;
+}
+
+std::pair<uint64_t, uint64_t> LsmMetadataDB::getBlockTotals(uint64_t after_block_id) {
+    std::pair<uint64_t, uint64_t> totals{0, 0};
+    if (after_block_id == UINT64_MAX) return totals;
+    scanIds(*store, BLOCKS, after_block_id + 1, UINT64_MAX, [&totals](const std::string&, const std::string& value) {
+        totals.first++;
+        totals.second += decodeBlock(value).compressed_size;
+        return true;
+    });
+    return totals;
+}
+
+std::vector<uint64_t> LsmMetadataDB::findVersionsUsingBlocks(const std::vector<uint64_t>& block_ids) {
+    std::unordered_set<uint64_t> wanted(block_ids.begin(), block_ids.end());
+    std::set<uint64_t> versions;
+    if (wanted.empty()) return {};
+
+    // Block lists
+    scanPrefix(*store, std::string(1, BLOCK_LISTS), [&](const std::string& k, const std::string& value) {
+        FieldReader r(value);
+        r.num();
+        auto encoding = static_cast<BlockListEncoding>(r.num());
+        auto [data, size] = r.rest();
+        BlockListDecoder decoder(data, size, encoding);
+        uint64_t ids[BLOCK_REF_CHUNK];
+        size_t n;
+        bool hit = false;
+        while (!hit && (n = decoder.next(ids, BLOCK_REF_CHUNK)) > 0) {
+            for (size_t i = 0; i < n && !hit; ++i) hit = wanted.count(ids[i]) > 0;
+        }
+        if (hit) versions.insert(readBe64(k, 1));
+        return true;
+    });
+
+    // Aggregate blocks of small files
+    scanPrefix(*store, std::string(1, VERSIONS), [&](const std::string& k, const std::string& value) {
+        VersionRecord version = decodeVersion(value);
+        if (version.packed && wanted.count(version.packed_block)) versions.insert(readBe64(k, 1));
+        return true;
+    });
+
+    // Whole-file clones share the damaged content
+    std::vector<uint64_t> owners(versions.begin(), versions.end());
+    for (uint64_t owner : owners) {
+        scanPrefix(*store, key(CLONES, owner), [&versions](const std::string& k, const std::string&) {
+            versions.insert(readBe64(k, 9));
+            return true;
+        });
+    }
+    return std::vector<uint64_t>(versions.begin(), versions.end());
+}
+
+bool LsmMetadataDB::versionExists(uint64_t version_id) {
+    std::string value;
+    return store->get(key(VERSIONS, version_id), value);
+}
+
+std::vector<DBBlock> LsmMetadataDB::listCompactionCandidates(uint64_t after_block_id, int64_t stored_before,
+                                                             int below_level, size_t limit) {
+    std::vector<DBBlock> blocks;
+    if (limit == 0 || after_block_id == UINT64_MAX) return blocks;
+    scanIds(*store, BLOCKS, after_block_id + 1, UINT64_MAX, [&](const std::string& k, const std::string& value) {
+        BlockRecord block = decodeBlock(value);
+        if (static_cast<int>(block.compression_level) < below_level &&
+            static_cast<int64_t>(block.created_at) <= stored_before && block.delta_base.empty()) {
+            blocks.push_back(toDBBlock(readBe64(k, 1), block));
+        }
+        return blocks.size() < limit;
+    });
+    return blocks;
+}
+
+std::pair<uint64_t, uint64_t> LsmMetadataDB::getCompactionTotals(int64_t stored_before, int below_level) {
+    std::pair<uint64_t, uint64_t> totals{0, 0};
+    scanPrefix(*store, std::string(1, BLOCKS), [&](const std::string&, const std::string& value) {
+        BlockRecord block = decodeBlock(value);
+        if (static_cast<int>(block.compression_level) < below_level &&
+            static_cast<int64_t>(block.created_at) <= stored_before && block.delta_base.empty()) {
+            totals.first++;
+            totals.second += block.compressed_size;
+        }
+        return true;
+    });
+    return totals;
+}
+
+void LsmMetadataDB::updateBlockCompression(const std::vector<DBBlock>& blocks) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    LsmTransaction txn(*store);
+    for (const auto& update : blocks) {
+        std::string value;
+        if (!txn.get(key(BLOCKS, update.block_id), value)) continue;
+        BlockRecord block = decodeBlock(value);
+        block.compressed_size = update.compressed_size;
+        block.compression_level = update.compression_level;
+        txn.put(key(BLOCKS, update.block_id), encodeBlock(block));
+    }
+    txn.commit();
+}
+
+std::vector<DBVersion> LsmMetadataDB::listVersions(const std::string& file_path) {
+    std::vector<DBVersion> versions;
+    uint64_t file_id = getId(*store, key(FILE_PATHS, file_path));
+    if (file_id == 0) return versions;
+    scanPrefix(*store, key(FILE_VERSIONS, file_id), [&](const std::string& k, const std::string&) {
+        uint64_t version_id = readBe64(k, 9);
+        VersionRecord record;
+        if (loadVersion(*store, version_id, record)) {
+            versions.push_back({version_id, record.file_id, record.parent_id, record.file_hash,
+                                record.created_at, record.file_size});
+        }
+        return true;
+    });
+    return versions;
+}
+
+std::string LsmMetadataDB::getMerkleRoot(uint64_t version_id) {
+    VersionRecord version;
+    if (!loadVersion(*store, resolveContentVersion(version_id), version)) {
+        throw std::runtime_error("No such version: " + std::to_string(version_id));
+    }
+    return version.merkle_root;
+}
+
+bool LsmMetadataDB::getMerkleNode(const std::string& node_hash, MerkleNode& node) {
+    std::string value;
+    if (!store->get(key(MERKLE_NODES, node_hash), value)) return false;
+    FieldReader r(value);
+    node.hash = node_hash;
+    node.level = static_cast<unsigned>(r.num());
+    node.byte_count = r.num();
+    auto [data, size] = r.rest();
+    node.children = decodeMerkleChildren(node.level, data, size);
+    return true;
+}
+
+// --- Replication ---
+
+void LsmMetadataDB::forEachBlockInRange(const std::string& first_hash, const std::string& end_hash,
+                                        const std::function<void(const DBBlock&)>& callback) {
+    std::string end = end_hash.empty() ? LsmStore::prefixEnd(std::string(1, BLOCK_HASHES)) : key(BLOCK_HASHES, end_hash);
+    store->scan(key(BLOCK_HASHES, first_hash), end, [&](const std::string&, const std::string& id_value) {
+        uint64_t id = FieldReader(id_value).num();
+        std::string value;
+        if (store->get(key(BLOCKS, id), value)) callback(toDBBlock(id, decodeBlock(value)));
+        return true;
+    });
+}
+
+void LsmMetadataDB::storeBlocks(const std::vector<DBBlock>& blocks) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    LsmTransaction txn(*store);
+    uint64_t now = std::time(nullptr);
+    for (const auto& b : blocks) {
+        if (txn.contains(key(BLOCK_HASHES, b.block_hash))) continue;
+        BlockRecord block;
+        block.hash = b.block_hash;
+        block.size = b.size;
+        block.compressed_size = b.compressed_size;
+        block.compression_level = b.compression_level;
+        block.created_at = now;
+        block.delta_base = b.delta_base;
+        block.delta_depth = b.delta_depth;
+        uint64_t id = allocateId(txn, next_block_id);
+        txn.put(key(BLOCKS, id), encodeBlock(block));
+        txn.put(key(BLOCK_HASHES, b.block_hash), idValue(id));
+    }
+    txn.commit();
+}
+
+uint64_t LsmMetadataDB::getMaxVersionId() {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    return next_version_id - 1;
+}
+
+uint64_t LsmMetadataDB::getMaxSnapshotId() {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    return next_snapshot_id - 1;
+}
+
+uint64_t LsmMetadataDB::getReplicaVersionCursor(const std::string& source) {
+    std::string value;
+    return store->get(key(REPLICA_CURSORS, source), value) ? FieldReader(value).num() : 0;
+}
+
+uint64_t LsmMetadataDB::getReplicaSnapshotCursor(const std::string& source) {
+    std::string value;
+    if (!store->get(key(REPLICA_CURSORS, source), value)) return 0;
+    FieldReader r(value);
+    r.num();
+    return r.num();
+}
+
+std::vector<DBVersionRecord> LsmMetadataDB::listVersionRecords(uint64_t after_id, uint64_t last_id, size_t limit) {
+    std::vector<DBVersionRecord> records;
+    if (limit == 0 || after_id == UINT64_MAX) return records;
+    scanIds(*store, VERSIONS, after_id + 1, last_id, [&](const std::string& k, const std::string& value) {
+        VersionRecord version = decodeVersion(value);
+        DBVersionRecord r;
+        r.version_id = readBe64(k, 1);
+        r.file_path = filePath(*store, version.file_id);
+        r.parent_id = version.parent_id;
+        r.file_hash = version.file_hash;
+        r.created_at = version.created_at;
+        r.file_size = version.file_size;
+        r.source_version_id = version.source_version_id;
+        r.mode = version.mode;
+        records.push_back(std::move(r));
+        return records.size() < limit;
+    });
+    return records;
+}
+
+std::vector<DBSnapshot> LsmMetadataDB::listSnapshots(uint64_t after_id, uint64_t last_id, size_t limit) {
+    std::vector<DBSnapshot> snapshots;
+    if (limit == 0 || after_id == UINT64_MAX) return snapshots;
+    scanIds(*store, SNAPSHOTS, after_id + 1, last_id, [&](const std::string& k, const std::string& value) {
+        FieldReader r(value);
+        DBSnapshot snapshot;
+        snapshot.snapshot_id = readBe64(k, 1);
+        snapshot.root_path = r.str();
+        snapshot.created_at = r.num();
+        uint64_t count = r.num();
+        for (uint64_t i = 0; i < count; ++i) snapshot.version_ids.push_back(r.num());
+        snapshots.push_back(std::move(snapshot));
+        return snapshots.size() < limit;
+    });
+    return snapshots;
+}
+
+void LsmMetadataDB::importVersions(const std::string& source, const std::vector<ReplicaVersion>& versions) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    LsmTransaction txn(*store);
+
+    std::string cursors;
+    uint64_t version_cursor = 0, snapshot_cursor = 0;
+    if (txn.get(key(REPLICA_CURSORS, source), cursors)) {
+        FieldReader r(cursors);
+        version_cursor = r.num();
+        snapshot_cursor = r.num();
+    }
+
+    auto mapVersion = [&](uint64_t source_id) -> uint64_t {
+        return source_id == 0 ? 0 : getId(txn, replicaKey(REPLICA_VERSIONS, source, source_id));
+    };
+
+    std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> block_ids;   // Hash -> local (id, size), per batch
+    auto findBlock = [&](const std::string& hash) -> std::pair<uint64_t, uint64_t> {
+        auto it = block_ids.find(hash);
+        if (it != block_ids.end()) return it->second;
+        uint64_t id = getId(txn, key(BLOCK_HASHES, hash));
+        std::string value;
+        if (id == 0 || !txn.get(key(BLOCKS, id), value)) {
+            throw std::runtime_error("Replicated version references a block that is not stored: " + hash);
+        }
+        std::pair<uint64_t, uint64_t> block{id, decodeBlock(value).size};
+        block_ids.emplace(hash, block);
+        return block;
+    };
+
+    // A level-1 node already stored here resolves its whole run of blocks in
+    // one lookup, so a version that mostly matches an earlier one costs work
+    // in proportion to the runs that changed
+    auto findLeaf = [&](const std::vector<MerkleChild>& leaf, std::vector<MerkleChild>& stored) -> bool {
+        std::string value;
+        if (!txn.get(key(MERKLE_NODES, merkleNodeHash(1, leaf)), value)) return false;
+        FieldReader r(value);
+        if (r.num() != 1) return false;
+        r.num();
+        auto [data, size] = r.rest();
+        stored = decodeMerkleChildren(1, data, size);
+        return stored.size() == leaf.size();
+    };
+
+    for (const auto& replica : versions) {
+        const auto& r = replica.record;
+        if (mapVersion(r.version_id) != 0) continue;   // Imported before
+
+        VersionRecord version;
+        version.file_id = getOrCreateFile(txn, r.file_path, r.created_at);
+        version.parent_id = mapVersion(r.parent_id);
+        version.file_hash = r.file_hash;
+        version.created_at = r.created_at;
+        version.file_size = r.file_size;
+        version.mode = r.mode;
+
+        if (r.source_version_id != 0) {
+            version.source_version_id = mapVersion(r.source_version_id);
+            if (version.source_version_id == 0) {
+                throw std::runtime_error("Clone source not replicated: version " + std::to_string(r.source_version_id));
+            }
+        }
+
+        std::vector<uint64_t> ids;
+        if (version.source_version_id == 0 && replica.packed) {
+            if (replica.block_hashes.size() != 1) throw std::runtime_error("Packed version needs exactly one block");
+            version.packed = true;
+            version.packed_block = findBlock(replica.block_hashes[0]).first;
+            version.packed_offset = replica.packed_offset;
+            ids.push_back(version.packed_block);
+        } else if (version.source_version_id == 0) {
+            const auto& hashes = replica.block_hashes;
+            ids.reserve(hashes.size());
+            MerkleTreeBuilder tree([&](const MerkleNode& node) { storeMerkleNode(txn, node); });
+            std::vector<MerkleChild> leaf, stored;
+            for (size_t first = 0; first < hashes.size(); first += MERKLE_FANOUT) {
+                size_t count = std::min(MERKLE_FANOUT, hashes.size() - first);
+                leaf.assign(count, MerkleChild{});
+                for (size_t i = 0; i < count; ++i) leaf[i].digest = hashes[first + i];
+                if (!findLeaf(leaf, stored)) {
+                    stored.assign(count, MerkleChild{});
+                    for (size_t i = 0; i < count; ++i) {
+                        auto [id, size] = findBlock(leaf[i].digest);
+                        stored[i].block_id = id;
+                        stored[i].bytes = size;
+                    }
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    ids.push_back(stored[i].block_id);
+                    tree.addBlock(leaf[i].digest, stored[i].block_id, stored[i].bytes);
+                }
+            }
+            version.merkle_root = tree.finish();
+        }
+
+        uint64_t version_id = allocateId(txn, next_version_id);
+        txn.put(key(VERSIONS, version_id), encodeVersion(version));
+        txn.put(key(FILE_VERSIONS, version.file_id, version_id), "");
+        if (version.source_version_id != 0) {
+            txn.put(key(CLONES, version.source_version_id, version_id), "");
+        } else {
+            if (!version.packed) txn.put(key(BLOCK_LISTS, version_id), encodeBlockListValue(ids));
+            addBlockRefs(txn, ids, 1);
+            std::string content = key(CONTENTS, r.file_size) + r.file_hash;
+            if (!txn.contains(content)) txn.put(content, idValue(version_id));
+        }
+
+        txn.put(replicaKey(REPLICA_VERSIONS, source, r.version_id), idValue(version_id));
+        version_cursor = std::max(version_cursor, r.version_id);
+    }
+
+    txn.put(key(REPLICA_CURSORS, source), FieldWriter().num(version_cursor).num(snapshot_cursor).out);
+    txn.commit();
+}
+
+void LsmMetadataDB::importSnapshots(const std::string& source, const std::vector<DBSnapshot>& snapshots) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    LsmTransaction txn(*store);
+
+    std::string cursors;
+    uint64_t version_cursor = 0, snapshot_cursor = 0;
+    if (txn.get(key(REPLICA_CURSORS, source), cursors)) {
+        FieldReader r(cursors);
+        version_cursor = r.num();
+        snapshot_cursor = r.num();
+    }
+
+    for (const auto& snapshot : snapshots) {
+        if (txn.contains(replicaKey(REPLICA_SNAPSHOTS, source, snapshot.snapshot_id))) continue;   // Imported before
+
+        std::vector<uint64_t> members;
+        for (uint64_t source_vid : snapshot.version_ids) {
+            uint64_t vid = getId(txn, replicaKey(REPLICA_VERSIONS, source, source_vid));
+            if (vid == 0) throw std::runtime_error("Snapshot version not replicated: " + std::to_string(source_vid));
+            members.push_back(vid);
+        }
+        std::sort(members.begin(), members.end());
+        members.erase(std::unique(members.begin(), members.end()), members.end());
+
+        uint64_t snapshot_id = allocateId(txn, next_snapshot_id);
+        FieldWriter w;
+        w.str(snapshot.root_path).num(snapshot.created_at).num(members.size());
+        for (uint64_t id : members) w.num(id);
+        txn.put(key(SNAPSHOTS, snapshot_id), w.out);
+        txn.put(replicaKey(REPLICA_SNAPSHOTS, source, snapshot.snapshot_id), idValue(snapshot_id));
+        snapshot_cursor = std::max(snapshot_cursor, snapshot.snapshot_id);
+    }
+
+    txn.put(key(REPLICA_CURSORS, source), FieldWriter().num(version_cursor).num(snapshot_cursor).out);
+    txn.commit(true);
+}
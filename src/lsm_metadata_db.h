@@ -0,0 +1,128 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include "lsm_store.h"
+#include "metadata_db.h"
+
+class LsmTransaction;
+
+// Catalog in an LsmStore (metadata.lsm/), for ingest rates a single SQLite
+// writer cannot sustain: storing a block appends one log record instead of
+// committing a transaction.
+//
+// Every catalog row is a key under a one-letter table prefix followed by
+// big-endian ids, so id ranges scan in order; secondary indexes (hash ->
+// block, path -> file, file -> versions, ...) are keys of their own, written
+// in the same batch as the row. Each write operation is one batch applied
+// under db_mutex, so read-modify-writes (reference counts, id counters) do not
+// race. Id counters are stored with the batches that advance them. Snapshots
+// flush the log to disk; everything else reaches the OS when it returns.
+class LsmMetadataDB : public MetadataDB {
+public:
+    // Open (or create) the store in directory `dir`
+    void initialize(const std::string& dir);
+
+    // Runs, log size and compaction counters of the underlying store
+    LsmStats storeStats();
+
+    uint64_t getOrCreateFile(const std::string& path) override;
+
+    uint64_t storeBlock(const std::string& hash, int size, int compressed_size, int compression_level = 3,
+                        const std::string& delta_base = "", int delta_depth = 0) override;
+    uint64_t findBlock(const std::string& hash) override;
+    bool getBlock(const std::string& hash, DBBlock& block) override;
+
+    void addBlockFeatures(uint64_t block_id, const BlockSketch& sketch) override;
+    bool findSimilarBlock(const BlockSketch& sketch, int max_depth, DBBlock& base) override;
+
+    uint64_t createVersion(
+        uint64_t file_id,
+        const std::string& file_hash,
+        uint64_t file_size,
+        const std::vector<uint64_t>& block_ids,
+        uint64_t parent_id = 0,
+        uint32_t mode = FILE_MODE_UNKNOWN
+    ) override;
+    uint64_t getLatestVersionId(uint64_t file_id) override;
+    bool hasContentOfSize(uint64_t file_size) override;
+    uint64_t findVersionByContent(const std::string& file_hash, uint64_t file_size) override;
+    uint64_t createVersionFromContent(
+        uint64_t file_id,
+        const std::string& file_hash,
+        uint64_t file_size,
+        uint64_t source_version_id,
+        uint64_t parent_id = 0,
+        uint32_t mode = FILE_MODE_UNKNOWN
+    ) override;
+    std::vector<uint64_t> createPackedVersions(
+        uint64_t block_id,
+        const std::vector<PackedFileEntry>& entries
+    ) override;
+
+    void saveCheckpoint(const BackupCheckpoint& checkpoint) override;
+    bool loadCheckpoint(const std::string& file_path, BackupCheckpoint& checkpoint) override;
+    void clearCheckpoint(const std::string& file_path) override;
+
+    uint64_t createSnapshot(const std::string& root_path, const std::vector<uint64_t>& version_ids) override;
+    std::vector<DBSnapshotEntry> getSnapshotFiles(uint64_t snapshot_id) override;
+
+    bool getBlockRef(uint64_t block_id, DBBlockRef& ref) override;
+    uint64_t getVersionBlockCount(uint64_t version_id) override;
+    bool getPackedExtent(uint64_t version_id, DBPackedExtent& extent) override;
+    uint64_t getVersionSize(uint64_t version_id) override;
+    std::vector<DBBlock> listBlocks(uint64_t after_block_id, size_t limit) override;
+    std::pair<uint64_t, uint64_t> getBlockTotals(uint64_t after_block_id) override;
+    std::vector<uint64_t> findVersionsUsingBlocks(const std::vector<uint64_t>& block_ids) override;
+    bool versionExists(uint64_t version_id) override;
+
+    std::vector<DBBlock> listCompactionCandidates(uint64_t after_block_id, int64_t stored_before,
+                                                  int below_level, size_t limit) override;
+    std::pair<uint64_t, uint64_t> getCompactionTotals(int64_t stored_before, int below_level) override;
+    void updateBlockCompression(const std::vector<DBBlock>& blocks) override;
+
+    void forEachBlockInRange(const std::string& first_hash, const std::string& end_hash,
+                             const std::function<void(const DBBlock&)>& callback) override;
+    void storeBlocks(const std::vector<DBBlock>& blocks) override;
+    uint64_t getMaxVersionId() override;
+    uint64_t getMaxSnapshotId() override;
+    std::vector<DBVersionRecord> listVersionRecords(uint64_t after_id, uint64_t last_id, size_t limit) override;
+    std::vector<DBSnapshot> listSnapshots(uint64_t after_id, uint64_t last_id, size_t limit) override;
+    uint64_t getReplicaVersionCursor(const std::string& source) override;
+    uint64_t getReplicaSnapshotCursor(const std::string& source) override;
+    void importVersions(const std::string& source, const std::vector<ReplicaVersion>& versions) override;
+    void importSnapshots(const std::string& source, const std::vector<DBSnapshot>& snapshots) override;
+
+    std::vector<DBVersion> listVersions(const std::string& file_path) override;
+
+    std::string getMerkleRoot(uint64_t version_id) override;
+    bool getMerkleNode(const std::string& node_hash, MerkleNode& node) override;
+
+protected:
+    uint64_t resolveContentVersion(uint64_t version_id) override;
+    bool hasContentClones(uint64_t version_id) override;
+    void readVersionBlockIds(uint64_t version_id,
+                             const std::function<void(const uint64_t* ids, size_t count)>& sink) override;
+    std::vector<DBBlockRef> lookupBlockRefs(const uint64_t* block_ids, size_t count) override;
+
+private:
+    std::unique_ptr<LsmStore> store;
+    std::mutex db_mutex;
+
+    // Next ids to hand out (guarded by db_mutex)
+    uint64_t next_file_id = 1;
+    uint64_t next_block_id = 1;
+    uint64_t next_version_id = 1;
+    uint64_t next_snapshot_id = 1;
+
+    // Take the next id from `counter` and record the counters in `txn`
+    uint64_t allocateId(LsmTransaction& txn, uint64_t& counter);
+
+    uint64_t getOrCreateFile(LsmTransaction& txn, const std::string& path, uint64_t created_at);
+
+    // Add `delta` to the ref_count of each distinct block in `block_ids`
+    void addBlockRefs(LsmTransaction& txn, std::vector<uint64_t> block_ids, int64_t delta);
+
+    // Store a tree node unless one with its digest is stored already
+    void storeMerkleNode(LsmTransaction& txn, const MerkleNode& node);
+};
@@ -0,0 +1,795 @@
+#include "lsm_store.h"
+#include "checksum.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const uint64_t RUN_MAGIC = 0x314E55524D534C44ull;   // "DLSMRUN1", little-endian
+constexpr size_t RUN_BLOCK_SIZE = 4096;
+constexpr size_t FOOTER_SIZE = 6 * 8;               // index offset/size, filter offset/size, entries, magic
+constexpr size_t CRC_SIZE = 4;
+constexpr size_t LOG_HEADER_SIZE = 8;               // Payload length, CRC-32C of the payload
+constexpr uint64_t BLOOM_BITS_PER_KEY = 10;
+constexpr unsigned BLOOM_PROBES = 7;                // ~1% false positives at 10 bits per key
+
+const char* LOG_NAME = "wal.log";
+const char* MANIFEST_NAME = "MANIFEST";
+
+void putVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+bool getVarint(const char*& p, const char* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        v |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void putFixed(std::string& out, uint64_t v, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) out.push_back(static_cast<char>(v >> (8 * i)));
+}
+
+uint64_t getFixed(const char* p, size_t bytes) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < bytes; ++i) v |= uint64_t(static_cast<uint8_t>(p[i])) << (8 * i);
+    return v;
+}
+
+// Entry encoding shared by log records and run blocks: key length, key, then
+// value length + 1 (0 = deleted) and the value
+void putEntry(std::string& out, const std::string& key, const std::optional<std::string>& value) {
+    putVarint(out, key.size());
+    out += key;
+    putVarint(out, value ? value->size() + 1 : 0);
+    if (value) out += *value;
+}
+
+bool getEntry(const char*& p, const char* end, std::string& key, std::optional<std::string>& value) {
+    uint64_t key_size, value_tag;
+    if (!getVarint(p, end, key_size) || key_size > static_cast<uint64_t>(end - p)) return false;
+    key.assign(p, key_size);
+    p += key_size;
+    if (!getVarint(p, end, value_tag) || (value_tag > 0 && value_tag - 1 > static_cast<uint64_t>(end - p))) return false;
+    if (value_tag == 0) {
+        value.reset();
+    } else {
+        value.emplace(p, value_tag - 1);
+        p += value_tag - 1;
+    }
+    return true;
+}
+
+// FNV-1a; filters are stored, so the hash must not depend on the build
+uint64_t keyHash(const std::string& key) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// Bit positions of a key in a filter of `bits` bits (double hashing)
+template <typename Visit>
+void bloomProbes(uint64_t hash, uint64_t bits, Visit visit) {
+    uint64_t delta = (hash >> 17) | (hash << 47);
+    for (unsigned i = 0; i < BLOOM_PROBES; ++i) {
+        if (!visit(hash % bits)) return;
+        hash += delta;
+    }
+}
+
+bool seekFile(std::FILE* f, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(f, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+    return fseeko(f, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+void syncFile(std::FILE* f) {
+    if (std::fflush(f) != 0) throw std::runtime_error("Flushing metadata file failed");
+#ifdef _WIN32
+    _commit(_fileno(f));
+#else
+    fsync(fileno(f));
+#endif
+}
+
+// Make renames in `dir` durable
+void syncDirectory(const std::string& dir) {
+#ifndef _WIN32
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+#endif
+}
+
+std::string runName(uint64_t seq) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "run-%08llu.sst", static_cast<unsigned long long>(seq));
+    return name;
+}
+
+} // namespace
+
+// --- Sorted runs ---------------------------------------------------------
+//
+// Layout: data blocks of encoded entries (each followed by its CRC-32C), the
+// index (count, then first key, offset and size of every block), the Bloom
+// filter, each section followed by its CRC, and a fixed footer.
+
+class LsmStore::Run {
+public:
+    struct BlockHandle {
+        std::string first_key;
+        uint64_t offset;
+        uint64_t size;      // Including the CRC
+    };
+
+    Run(const std::string& path, uint64_t seq, int level) : path(path), seq(seq), level(level) {
+        file = std::fopen(path.c_str(), "rb");
+        if (!file) throw std::runtime_error("Cannot open metadata run " + path);
+        try {
+            load();
+        } catch (...) {
+            std::fclose(file);
+            throw;
+        }
+    }
+
+    ~Run() {
+        std::fclose(file);
+        // Merged away: deleted once the last scan reading it is done
+        if (obsolete) {
+            std::error_code ec;
+            fs::remove(path, ec);
+        }
+    }
+
+    // True if the run holds `key`; `value` is nullopt for a tombstone
+    bool get(const std::string& key, uint64_t hash, std::optional<std::string>& value) {
+        if (!mayContain(hash) || index.empty() || key < index.front().first_key) return false;
+        std::string data = readBlock(findBlock(key));
+        const char* p = data.data();
+        const char* end = p + data.size();
+        std::string k;
+        while (p < end) {
+            if (!getEntry(p, end, k, value)) throw std::runtime_error("Corrupt metadata run " + path);
+            if (k == key) return true;
+            if (k > key) break;
+        }
+        return false;
+    }
+
+    // Last block whose first key is <= key (0 if key precedes them all)
+    size_t findBlock(const std::string& key) const {
+        auto it = std::upper_bound(index.begin(), index.end(), key,
+                                   [](const std::string& k, const BlockHandle& b) { return k < b.first_key; });
+        return it == index.begin() ? 0 : static_cast<size_t>(it - index.begin() - 1);
+    }
+
+    std::string readBlock(size_t i) { return readSection(index[i].offset, index[i].size); }
+
+    const std::string path;
+    const uint64_t seq;
+    const int level;
+    uint64_t bytes = 0;
+    uint64_t entries = 0;
+    std::vector<BlockHandle> index;
+    std::atomic<bool> obsolete{false};
+
+private:
+    bool mayContain(uint64_t hash) const {
+        if (filter.empty()) return true;
+        bool present = true;
+        bloomProbes(hash, filter.size() * 8, [&](uint64_t bit) {
+            present = (static_cast<uint8_t>(filter[bit / 8]) >> (bit % 8)) & 1;
+            return present;
+        });
+        return present;
+    }
+
+    // Read `size` bytes (section + CRC) at `offset` and return the verified section
+    std::string readSection(uint64_t offset, uint64_t size) {
+        if (size < CRC_SIZE || offset + size > bytes) throw std::runtime_error("Corrupt metadata run " + path);
+        std::string data(size, '\0');
+        {
+            std::lock_guard<std::mutex> lock(file_mutex);
+            if (!seekFile(file, offset) || std::fread(data.data(), 1, size, file) != size) {
+                throw std::runtime_error("Reading metadata run " + path + " failed");
+            }
+        }
+        size_t body = size - CRC_SIZE;
+        if (crc32c(data.data(), body) != static_cast<uint32_t>(getFixed(data.data() + body, CRC_SIZE))) {
+            throw std::runtime_error("Checksum mismatch in metadata run " + path);
+        }
+        data.resize(body);
+        return data;
+    }
+
+    void load() {
+        bytes = fs::file_size(path);
+        if (bytes < FOOTER_SIZE) throw std::runtime_error("Truncated metadata run " + path);
+        std::string footer(FOOTER_SIZE, '\0');
+        if (!seekFile(file, bytes - FOOTER_SIZE) || std::fread(footer.data(), 1, FOOTER_SIZE, file) != FOOTER_SIZE) {
+            throw std::runtime_error("Reading metadata run " + path + " failed");
+        }
+        if (getFixed(footer.data() + 40, 8) != RUN_MAGIC) throw std::runtime_error("Not a metadata run: " + path);
+        entries = getFixed(footer.data() + 32, 8);
+
+        std::string data = readSection(getFixed(footer.data(), 8), getFixed(footer.data() + 8, 8));
+        const char* p = data.data();
+        const char* end = p + data.size();
+        uint64_t count;
+        if (!getVarint(p, end, count)) throw std::runtime_error("Corrupt metadata run index " + path);
+        index.reserve(count);
+        for (uint64_t i = 0; i < count; ++i) {
+            BlockHandle block;
+            uint64_t key_size;
+            if (!getVarint(p, end, key_size) || key_size > static_cast<uint64_t>(end - p)) {
+                throw std::runtime_error("Corrupt metadata run index " + path);
+            }
+            block.first_key.assign(p, key_size);
+            p += key_size;
+            if (!getVarint(p, end, block.offset) || !getVarint(p, end, block.size)) {
+                throw std::runtime_error("Corrupt metadata run index " + path);
+            }
+            index.push_back(std::move(block));
+        }
+        filter = readSection(getFixed(footer.data() + 16, 8), getFixed(footer.data() + 24, 8));
+    }
+
+    std::FILE* file = nullptr;
+    std::mutex file_mutex;
+    std::string filter;
+};
+
+// --- Merging -------------------------------------------------------------
+
+// Walks one source in key order: a memtable, or a run block by block
+struct LsmStore::Cursor {
+    // Memtable source; each step copies the entry under the store's shared lock
+    std::shared_ptr<Memtable> table;
+    Memtable::const_iterator it;
+    std::shared_mutex* mutex = nullptr;
+
+    // Run source
+    std::shared_ptr<Run> run;
+    size_t block = 0;
+    std::string data;
+    const char* p = nullptr;
+    const char* end = nullptr;
+
+    bool valid = false;
+    std::string key;
+    std::optional<std::string> value;
+
+    void seek(const std::string& first) {
+        if (table) {
+            std::shared_lock<std::shared_mutex> lock(*mutex);
+            it = table->lower_bound(first);
+            loadMemtable();
+            return;
+        }
+        valid = false;
+        if (run->index.empty()) return;
+        loadBlock(run->findBlock(first));
+        while (valid && key < first) next();
+    }
+
+    void next() {
+        if (table) {
+            std::shared_lock<std::shared_mutex> lock(*mutex);
+            ++it;
+            loadMemtable();
+            return;
+        }
+        if (p < end) {
+            if (!getEntry(p, end, key, value)) throw std::runtime_error("Corrupt metadata run " + run->path);
+            return;
+        }
+        valid = false;
+        if (block + 1 < run->index.size()) loadBlock(block + 1);
+    }
+
+private:
+    void loadMemtable() {
+        valid = it != table->end();
+        if (valid) {
+            key = it->first;
+            value = it->second;
+        }
+    }
+
+    void loadBlock(size_t i) {
+        block = i;
+        data = run->readBlock(i);
+        p = data.data();
+        end = p + data.size();
+        valid = true;
+        next();
+    }
+};
+
+bool LsmStore::nextMerged(std::vector<Cursor>& cursors, Entry& entry) {
+    const std::string* smallest = nullptr;
+    for (const auto& c : cursors) {
+        if (c.valid && (!smallest || c.key < *smallest)) smallest = &c.key;
+    }
+    if (!smallest) return false;
+    entry.first = *smallest;
+
+    // The first (newest) source holding the key wins; older copies are skipped
+    bool taken = false;
+    for (auto& c : cursors) {
+        if (!c.valid || c.key != entry.first) continue;
+        if (!taken) {
+            entry.second = std::move(c.value);
+            taken = true;
+        }
+        c.next();
+    }
+    return true;
+}
+
+std::shared_ptr<LsmStore::Run> LsmStore::writeRun(const std::string& dir, uint64_t seq, int level,
+                                                  const std::function<bool(Entry&)>& next) {
+    std::string path = dir + "/" + runName(seq);
+    std::string temp = path + ".tmp";
+    std::FILE* out = std::fopen(temp.c_str(), "wb");
+    if (!out) throw std::runtime_error("Cannot create metadata run " + temp);
+
+    try {
+        uint64_t offset = 0;
+        auto write = [&](const std::string& bytes) {
+            if (std::fwrite(bytes.data(), 1, bytes.size(), out) != bytes.size()) {
+                throw std::runtime_error("Writing metadata run " + temp + " failed");
+            }
+            offset += bytes.size();
+        };
+        auto seal = [](std::string& section) {
+            putFixed(section, crc32c(section.data(), section.size()), CRC_SIZE);
+        };
+
+        std::string block, index, first_key;
+        std::vector<uint64_t> hashes;
+        uint64_t block_count = 0;
+        auto emitBlock = [&]() {
+            seal(block);
+            putVarint(index, first_key.size());
+            index += first_key;
+            putVarint(index, offset);
+            putVarint(index, block.size());
+            write(block);
+            block.clear();
+            block_count++;
+        };
+
+        Entry entry;
+        while (next(entry)) {
+            if (block.empty()) first_key = entry.first;
+            putEntry(block, entry.first, entry.second);
+            hashes.push_back(keyHash(entry.first));
+            if (block.size() >= RUN_BLOCK_SIZE) emitBlock();
+        }
+        if (!block.empty()) emitBlock();
+
+        if (hashes.empty()) {
+            std::fclose(out);
+            fs::remove(temp);
+            return nullptr;
+        }
+
+        std::string index_section;
+        putVarint(index_section, block_count);
+        index_section += index;
+        seal(index_section);
+        uint64_t index_offset = offset;
+        write(index_section);
+
+        uint64_t filter_bits = std::max<uint64_t>(64, hashes.size() * BLOOM_BITS_PER_KEY);
+        std::string filter((filter_bits + 7) / 8, '\0');
+        filter_bits = filter.size() * 8;
+        for (uint64_t hash : hashes) {
+            bloomProbes(hash, filter_bits, [&](uint64_t bit) {
+                filter[bit / 8] = static_cast<char>(filter[bit / 8] | (1 << (bit % 8)));
+                return true;
+            });
+        }
+        seal(filter);
+        uint64_t filter_offset = offset;
+        write(filter);
+
+        std::string footer;
+        putFixed(footer, index_offset, 8);
+        putFixed(footer, index_section.size(), 8);
+        putFixed(footer, filter_offset, 8);
+        putFixed(footer, filter.size(), 8);
+        putFixed(footer, hashes.size(), 8);
+        putFixed(footer, RUN_MAGIC, 8);
+        write(footer);
+
+        syncFile(out);
+        std::fclose(out);
+        out = nullptr;
+        fs::rename(temp, path);
+    } catch (...) {
+        if (out) std::fclose(out);
+        std::error_code ec;
+        fs::remove(temp, ec);
+        throw;
+    }
+    return std::make_shared<Run>(path, seq, level);
+}
+
+// --- Store ---------------------------------------------------------------
+
+LsmStore::LsmStore(const std::string& dir) : dir(dir), memtable(std::make_shared<Memtable>()) {
+    fs::create_directories(dir);
+#ifndef _WIN32
+    lock_fd = ::open((dir + "/LOCK").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        if (lock_fd >= 0) ::close(lock_fd);
+        throw std::runtime_error("Metadata store " + dir + " is in use by another process");
+    }
+#endif
+
+    try {
+        std::vector<std::string> live;
+        if (std::ifstream manifest{dir + "/" + MANIFEST_NAME}) {
+            std::string word;
+            while (manifest >> word) {
+                if (word == "next") {
+                    manifest >> next_seq;
+                } else if (word == "run") {
+                    uint64_t seq;
+                    int level;
+                    if (!(manifest >> seq >> level)) throw std::runtime_error("Corrupt metadata manifest in " + dir);
+                    runs.push_back(std::make_shared<Run>(dir + "/" + runName(seq), seq, level));
+                    live.push_back(runName(seq));
+                }
+            }
+        }
+
+        // Runs of a flush or merge that never reached the manifest: their
+        // entries are still in the log or in the runs they were merged from
+        for (const auto& file : fs::directory_iterator(dir)) {
+            std::string name = file.path().filename().string();
+            if (name.rfind("run-", 0) == 0 && std::find(live.begin(), live.end(), name) == live.end()) {
+                fs::remove(file.path());
+            }
+        }
+
+        replayLog();
+        openLog();
+    } catch (...) {
+#ifndef _WIN32
+        ::close(lock_fd);
+#endif
+        throw;
+    }
+
+    compaction_wanted = true;   // Runs may have piled up before the last exit
+    compactor = std::thread(&LsmStore::compactionLoop, this);
+}
+
+LsmStore::~LsmStore() {
+    {
+        std::lock_guard<std::mutex> lock(compaction_mutex);
+        stopping = true;
+    }
+    compaction_cv.notify_all();
+    if (compactor.joinable()) compactor.join();
+
+    // Leave a run behind so the next open does not replay the log
+    try {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (!memtable->empty()) flushLocked();
+    } catch (const std::exception& e) {
+        std::cerr << "Flushing metadata store " << dir << " failed: " << e.what() << std::endl;
+    }
+    if (log) std::fclose(log);
+    runs.clear();
+#ifndef _WIN32
+    ::close(lock_fd);
+#endif
+}
+
+void LsmStore::replayLog() {
+    std::string path = dir + "/" + LOG_NAME;
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return;
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+
+    size_t pos = 0;
+    std::string key;
+    std::optional<std::string> value;
+    while (data.size() - pos >= LOG_HEADER_SIZE) {
+        uint64_t size = getFixed(data.data() + pos, 4);
+        uint32_t crc = static_cast<uint32_t>(getFixed(data.data() + pos + 4, 4));
+        if (size > data.size() - pos - LOG_HEADER_SIZE) break;   // Torn by a crash mid-write
+        const char* p = data.data() + pos + LOG_HEADER_SIZE;
+        const char* end = p + size;
+        if (crc32c(p, size) != crc) break;
+
+        uint64_t count;
+        if (!getVarint(p, end, count)) break;
+        for (uint64_t i = 0; i < count && getEntry(p, end, key, value); ++i) {
+            (*memtable)[key] = std::move(value);
+        }
+        pos += LOG_HEADER_SIZE + size;
+    }
+    log_bytes = pos;
+
+    // Drop the torn tail, so later records are not appended behind it
+    if (pos < data.size()) fs::resize_file(path, pos);
+}
+
+void LsmStore::openLog() {
+    std::string path = dir + "/" + LOG_NAME;
+    log = std::fopen(path.c_str(), "ab");
+    if (!log) throw std::runtime_error("Cannot open metadata log " + path);
+}
+
+void LsmStore::writeManifest() {
+    std::string path = dir + "/" + MANIFEST_NAME;
+    std::string temp = path + ".tmp";
+    std::string text = "next " + std::to_string(next_seq) + "\n";
+    for (const auto& run : runs) {
+        text += "run " + std::to_string(run->seq) + " " + std::to_string(run->level) + "\n";
+    }
+
+    std::FILE* out = std::fopen(temp.c_str(), "wb");
+    if (!out) throw std::runtime_error("Cannot write metadata manifest " + temp);
+    bool ok = std::fwrite(text.data(), 1, text.size(), out) == text.size();
+    try {
+        syncFile(out);
+    } catch (...) {
+        ok = false;
+    }
+    std::fclose(out);
+    if (!ok) throw std::runtime_error("Writing metadata manifest " + temp + " failed");
+    fs::rename(temp, path);
+    syncDirectory(dir);
+}
+
+void LsmStore::apply(const LsmWriteBatch& batch, bool sync) {
+    if (batch.empty()) return;
+    std::string record(LOG_HEADER_SIZE, '\0');
+    putVarint(record, batch.ops.size());
+    for (const auto& [key, value] : batch.ops) putEntry(record, key, value);
+    size_t size = record.size() - LOG_HEADER_SIZE;
+    std::string header;
+    putFixed(header, size, 4);
+    putFixed(header, crc32c(record.data() + LOG_HEADER_SIZE, size), 4);
+    record.replace(0, LOG_HEADER_SIZE, header);
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (std::fwrite(record.data(), 1, record.size(), log) != record.size() || std::fflush(log) != 0) {
+        throw std::runtime_error("Writing metadata log in " + dir + " failed");
+    }
+    if (sync) syncFile(log);
+    for (const auto& [key, value] : batch.ops) (*memtable)[key] = value;
+    log_bytes += record.size();
+    if (log_bytes >= MEMTABLE_LIMIT) flushLocked();
+}
+
+bool LsmStore::get(const std::string& key, std::string& value) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = memtable->find(key);
+    if (it != memtable->end()) {
+        if (!it->second) return false;
+        value = *it->second;
+        return true;
+    }
+
+    uint64_t hash = keyHash(key);
+    std::optional<std::string> found;
+    for (auto run = runs.rbegin(); run != runs.rend(); ++run) {
+        if ((*run)->get(key, hash, found)) {
+            if (!found) return false;
+            value = std::move(*found);
+            return true;
+        }
+    }
+    return false;
+}
+
+void LsmStore::scan(const std::string& first, const std::string& end, const ScanCallback& callback) {
+    std::vector<Cursor> cursors(1);
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        cursors[0].table = memtable;
+        cursors[0].mutex = &mutex;
+        for (auto run = runs.rbegin(); run != runs.rend(); ++run) {
+            cursors.emplace_back();
+            cursors.back().run = *run;
+        }
+    }
+    for (auto& cursor : cursors) cursor.seek(first);
+
+    Entry entry;
+    while (nextMerged(cursors, entry)) {
+        if (!end.empty() && entry.first >= end) break;
+        if (entry.second && !callback(entry.first, *entry.second)) break;
+    }
+}
+
+void LsmStore::sync() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    syncFile(log);
+}
+
+void LsmStore::flush() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    flushLocked();
+}
+
+void LsmStore::flushLocked() {
+    if (!memtable->empty()) {
+        // The oldest run has nothing older for a tombstone to hide
+        bool oldest = runs.empty();
+        auto it = memtable->cbegin();
+        auto run = writeRun(dir, next_seq++, 0, [&](Entry& entry) {
+            for (; it != memtable->cend(); ++it) {
+                if (oldest && !it->second) continue;
+                entry = *it++;
+                return true;
+            }
+            return false;
+        });
+        if (run) runs.push_back(run);
+        writeManifest();
+        flushes++;
+    }
+
+    // Everything in the log is in a run now
+    std::fclose(log);
+    log = std::fopen((dir + "/" + LOG_NAME).c_str(), "wb");
+    if (!log) throw std::runtime_error("Cannot reset metadata log in " + dir);
+    log_bytes = 0;
+    memtable = std::make_shared<Memtable>();
+
+    {
+        std::lock_guard<std::mutex> compaction_lock(compaction_mutex);
+        compaction_wanted = true;
+    }
+    compaction_cv.notify_all();
+}
+
+bool LsmStore::compactOnce() {
+    std::vector<std::shared_ptr<Run>> inputs;
+    bool oldest = false;
+    int level = 0;
+    uint64_t seq = 0;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        // Levels never increase from oldest to newest, so the runs of a level are adjacent
+        for (size_t i = 0; i < runs.size() && inputs.empty();) {
+            size_t j = i;
+            while (j < runs.size() && runs[j]->level == runs[i]->level) ++j;
+            if (j - i >= COMPACTION_FANOUT) {
+                inputs.assign(runs.begin() + i, runs.begin() + j);
+                oldest = i == 0;
+                level = runs[i]->level;
+            }
+            i = j;
+        }
+        if (inputs.empty()) return false;
+        seq = next_seq++;
+    }
+
+    // Inputs are immutable, so the merge runs without the lock; flushes only append newer runs
+    struct Abandoned {};
+    std::vector<Cursor> cursors(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        cursors[i].run = inputs[inputs.size() - 1 - i];
+        cursors[i].seek("");
+    }
+    std::shared_ptr<Run> merged;
+    try {
+        merged = writeRun(dir, seq, level + 1, [&](Entry& entry) {
+            while (nextMerged(cursors, entry)) {
+                if (stopping) throw Abandoned{};
+                if (oldest && !entry.second) continue;
+                return true;
+            }
+            return false;
+        });
+    } catch (const Abandoned&) {
+        return false;
+    }
+
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        auto first = std::find(runs.begin(), runs.end(), inputs.front());
+        auto position = runs.erase(first, first + inputs.size());
+        if (merged) runs.insert(position, merged);
+        writeManifest();
+        for (auto& run : inputs) run->obsolete = true;
+    }
+    compactions++;
+    if (merged) compacted_bytes += merged->bytes;
+    return true;
+}
+
+void LsmStore::compactionLoop() {
+    std::unique_lock<std::mutex> lock(compaction_mutex);
+    while (true) {
+        compaction_cv.wait(lock, [this] { return stopping || compaction_wanted; });
+        if (stopping) break;
+        compaction_wanted = false;
+        compaction_running = true;
+        lock.unlock();
+        try {
+            while (!stopping && compactOnce()) {}
+        } catch (const std::exception& e) {
+            // Lookups stay correct with unmerged runs, only slower
+            std::cerr << "Metadata compaction in " << dir << " failed: " << e.what() << std::endl;
+        }
+        lock.lock();
+        compaction_running = false;
+        compaction_cv.notify_all();
+    }
+    compaction_running = false;
+    compaction_cv.notify_all();
+}
+
+void LsmStore::waitForCompaction() {
+    std::unique_lock<std::mutex> lock(compaction_mutex);
+    compaction_cv.wait(lock, [this] { return stopping || (!compaction_wanted && !compaction_running); });
+}
+
+LsmStats LsmStore::stats() {
+    LsmStats stats;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        stats.runs = runs.size();
+        for (const auto& run : runs) stats.run_bytes += run->bytes;
+        stats.memtable_bytes = log_bytes;
+    }
+    stats.flushes = flushes;
+    stats.compactions = compactions;
+    stats.compacted_bytes = compacted_bytes;
+    return stats;
+}
+
+std::string LsmStore::prefixEnd(const std::string& prefix) {
+    std::string end = prefix;
+    while (!end.empty()) {
+        if (static_cast<uint8_t>(end.back()) != 0xff) {
+            end.back() = static_cast<char>(static_cast<uint8_t>(end.back()) + 1);
+            return end;
+        }
+        end.pop_back();
+    }
+    return end;
+}
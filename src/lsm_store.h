@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Puts and deletes that LsmStore::apply() makes visible (and durable) together
+class LsmWriteBatch {
+public:
+    void put(const std::string& key, const std::string& value) { ops.emplace_back(key, value); }
+    void erase(const std::string& key) { ops.emplace_back(key, std::nullopt); }
+    bool empty() const { return ops.empty(); }
+    size_t size() const { return ops.size(); }
+
+private:
+    friend class LsmStore;
+    std::vector<std::pair<std::string, std::optional<std::string>>> ops;   // nullopt = delete
+};
+
+struct LsmStats {
+    size_t runs = 0;
+    uint64_t run_bytes = 0;
+    uint64_t memtable_bytes = 0;     // Log bytes since the last flush
+    uint64_t flushes = 0;
+    uint64_t compactions = 0;
+    uint64_t compacted_bytes = 0;    // Bytes written by compactions
+};
+
+// Embedded log-structured key-value store with byte-wise ordered keys, kept
+// in one directory.
+//
+// apply() appends the batch to a write-ahead log as one checksummed record and
+// inserts it into a sorted in-memory memtable. Once the log grows past
+// MEMTABLE_LIMIT the memtable is written out as an immutable sorted run: 4 KiB
+// data blocks, a sparse index of each block's first key, and a Bloom filter so
+// that lookups of absent keys (most block hashes during ingest) rarely touch
+// the disk. The set of live runs is a MANIFEST replaced by rename, so a crash
+// leaves either the old or the new set, and the log is replayed on open.
+//
+// Runs carry a level: a flush makes a level-0 run, and a background thread
+// merges COMPACTION_FANOUT runs of one level into a run of the next, so each
+// entry is rewritten a logarithmic number of times and a lookup checks a
+// logarithmic number of runs. Deletes are tombstones until a merge reaches
+// the oldest run.
+//
+// Readers see the newest value of a key across the memtable and the runs. A
+// scan sees everything applied before it started and holds no lock while its
+// callback runs, so the callback may call back into the store. Only one
+// process may open the directory at a time.
+class LsmStore {
+public:
+    explicit LsmStore(const std::string& dir);
+    ~LsmStore();
+
+    LsmStore(const LsmStore&) = delete;
+    LsmStore& operator=(const LsmStore&) = delete;
+
+    // Apply a batch atomically. The log record reaches the OS before this
+    // returns (it survives the process crashing); `sync` also flushes it to disk.
+    void apply(const LsmWriteBatch& batch, bool sync = false);
+
+    // Newest value of `key`; false if it is absent or deleted
+    bool get(const std::string& key, std::string& value);
+
+    // Live keys with first <= key < end in key order (empty end = no upper
+    // bound). Return false from the callback to stop.
+    using ScanCallback = std::function<bool(const std::string& key, const std::string& value)>;
+    void scan(const std::string& first, const std::string& end, const ScanCallback& callback);
+
+    // Flush the log to disk
+    void sync();
+
+    // Write the memtable out as a run now
+    void flush();
+
+    // Wait until no merge is pending (benchmarks, tests)
+    void waitForCompaction();
+
+    LsmStats stats();
+
+    // Smallest key greater than every key starting with `prefix` ("" if none)
+    static std::string prefixEnd(const std::string& prefix);
+
+    static constexpr uint64_t MEMTABLE_LIMIT = 8ull * 1024 * 1024;
+    static constexpr size_t COMPACTION_FANOUT = 4;
+
+private:
+    class Run;
+    struct Cursor;
+    using Entry = std::pair<std::string, std::optional<std::string>>;
+    using Memtable = std::map<std::string, std::optional<std::string>, std::less<>>;   // nullopt = deleted
+
+    // Next key in merged order with its newest value (cursors newest first)
+    static bool nextMerged(std::vector<Cursor>& cursors, Entry& entry);
+
+    void replayLog();
+    void openLog();
+    void writeManifest();
+    void flushLocked();
+
+    // Merge the runs of one level if it is full; returns false if there was nothing to do
+    bool compactOnce();
+    void compactionLoop();
+
+    // Write the entries `next` hands out (in key order) as run `seq`; nullptr if there were none
+    static std::shared_ptr<Run> writeRun(const std::string& dir, uint64_t seq, int level,
+                                         const std::function<bool(Entry&)>& next);
+
+    std::string dir;
+    std::shared_mutex mutex;           // Guards memtable, runs, log and next_seq
+    std::shared_ptr<Memtable> memtable;   // Replaced, not cleared, by a flush: scans may still walk the old one
+    uint64_t log_bytes = 0;
+    std::FILE* log = nullptr;
+    std::vector<std::shared_ptr<Run>> runs;   // Oldest first
+    uint64_t next_seq = 1;
+    int lock_fd = -1;
+
+    std::mutex compaction_mutex;
+    std::condition_variable compaction_cv;
+    bool compaction_wanted = false;
+    bool compaction_running = false;
+    std::atomic<bool> stopping{false};
+    std::thread compactor;
+
+    std::atomic<uint64_t> flushes{0};
+    std::atomic<uint64_t> compactions{0};
+    std::atomic<uint64_t> compacted_bytes{0};
+};
@@ -1,7 +1,12 @@
 #include <iostream>
+#include <iomanip>
 #include <vector>
+#include <map>
 #include <memory>
+#include <csignal>
+#include <ctime>
 #include <filesystem>
+#include <fstream>
 #include "file_scanner.h"
 #include "block_splitter.h"
 #include "hash_engine.h"
@@ -10,61 +15,868 @@
 #include "restore_manager.h"
 #include "thread_pool.h"
 #include "backup_pipeline.h"
+#include "repository_verifier.h"
+#include "version_reader.h"
+#include "resource_governor.h"
+#include "block_cipher.h"
+#include "replicator.h"
+#include "snapshot_archive.h"
+#include "block_compactor.h"
+#include "cancellation.h"
+#include "watch_daemon.h"
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cout << "Usage: deltavault_cli <file_or_directory_path>" << std::endl;
-        return 1;
+namespace {
+
+// Parsed command line: "--key[=value]" options and positional arguments
+struct CliArgs {
+    std::map<std::string, std::string> options;
+    std::vector<std::string> positional;
+
+    bool has(const std::string& key) const { return options.count(key) > 0; }
+    std::string get(const std::string& key, const std::string& fallback = "") const {
+        auto it = options.find(key);
+        return it == options.end() ? fallback : it->second;
+    }
+};
+
+struct Repository {
+    std::string root;
+    std::shared_ptr<FileScanner> scanner;
+    std::shared_ptr<BlockSplitter> splitter;
+    std::shared_ptr<HashEngine> hasher;
+    std::shared_ptr<StorageManager> storage;
+    std::shared_ptr<MetadataDB> db;
+    std::shared_ptr<ThreadPool> tp;
+    std::shared_ptr<BlockCipher> cipher;   // From --encrypt-key, nullptr if not given
+    bool encrypted = false;                // Repository has a key id on file
+};
+
+CliArgs parseArgs(int argc, char* argv[]) {
+    CliArgs args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) == 0) {
+            auto eq = arg.find('=');
+            if (eq == std::string::npos) {
+                args.options[arg.substr(2)] = "";
+            } else {
+                args.options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+            }
+        } else {
+            args.positional.push_back(arg);
+        }
     }
+    return args;
+}
+
+// Key id recorded by the first encrypted backup ("" for unencrypted repositories)
+std::string readKeyId(const std::string& root) {
+    std::string key_id;
+    if (std::ifstream file{root + "/encryption.key-id"}) file >> key_id;
+    return key_id;
+}
 
-    std::string path = argv[1];
+// Blocks move between repositories as stored, so a target must be under the
+// source's key, or unencrypted like it. An encrypted source may only go into a
+// target without blocks, which then takes its key id (written by the caller).
+void checkTransferKey(const std::string& source_key_id, const std::string& target_root, const std::string& source) {
+    std::string target_key_id = readKeyId(target_root);
+    if (source_key_id == target_key_id) return;
+    if (source_key_id.empty()) {
+        throw std::runtime_error("Cannot copy unencrypted " + source + " into encrypted repository " + target_root);
+    }
+    if (!target_key_id.empty()) {
+        throw std::runtime_error("Cannot copy " + source + " into repository " + target_root +
+                                 ": they are encrypted with different keys");
+    }
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(target_root + "/blocks", ec)) {
+        if (entry.path().extension() == ".bin") {
+            throw std::runtime_error("Cannot copy encrypted " + source + " into unencrypted repository " +
+                                     target_root + ", which already has blocks");
+        }
+    }
+}
 
-    if (std::filesystem::is_directory(path)) {
-       std::cout << "Directory scanning not yet fully supported in pipeline. Please pass a file." << std::endl;
-       return 1;
-    } 
+Repository openRepository(const CliArgs& args, const std::string& root_override = "") {
+    std::string root = root_override.empty() ? args.get("repo", "./.deltavault_test") : root_override;
 
-    std::cout << "Processing file: " << path << std::endl;
-    
     // Initialize Components
-    auto scanner = std::make_shared<FileScanner>();
-    auto splitter = std::make_shared<BlockSplitter>();
-    auto hasher = std::make_shared<HashEngine>();
-    auto storage = std::make_shared<StorageManager>();
-    auto db = std::make_shared<MetadataDB>();
-    auto tp = std::make_shared<ThreadPool>(4); // Use 4 threads
+    Repository repo;
+    repo.root = root;
+    repo.scanner = std::make_shared<FileScanner>();
+    repo.splitter = std::make_shared<BlockSplitter>();
+    repo.hasher = std::make_shared<HashEngine>();
+    repo.storage = std::make_shared<StorageManager>();
+    repo.tp = std::make_shared<ThreadPool>(4); // Use 4 threads
 
     // Configure
-    storage->initialize("./.deltavault_test");
-    db->initialize("./.deltavault_test/metadata.db");
+    repo.storage->initialize(root);
+    repo.db = MetadataDB::open(root, args.get("metadata", ""));
+
+    // The key id of the repository key is kept next to the catalog so a wrong
+    // key is rejected up front instead of failing on the first block
+    std::string key_id_path = root + "/encryption.key-id";
+    std::string stored_key_id = readKeyId(root);
+    repo.encrypted = !stored_key_id.empty();
+    if (args.has("encrypt-key")) {
+        repo.cipher = BlockCipher::fromKeyFile(args.get("encrypt-key"));
+        if (!repo.encrypted) {
+            std::ofstream(key_id_path) << repo.cipher->keyId() << "\n";
+            repo.encrypted = true;
+        } else if (stored_key_id != repo.cipher->keyId()) {
+            throw std::runtime_error("Key " + args.get("encrypt-key") + " is not the key of repository " + root);
+        }
+    }
+    return repo;
+}
+
+void requireKey(const Repository& repo) {
+    if (repo.encrypted && !repo.cipher) {
+        throw std::runtime_error("Repository " + repo.root + " is encrypted; pass --encrypt-key=<key file>");
+    }
+}
+
+void printUsage() {
+    std::cout << "Usage:\n"
+              << "  deltavault_cli [--stats[=text|json]] [--trace=<trace.json>] [--no-progress] [--verify-sha256] <file_or_directory_path>\n"
+              << "      Back up a file or directory, then restore and verify it\n"
+              << "      (--verify-sha256 re-hashes every block during the restore,\n"
+              << "       --cache-mb=<n> sizes the decompressed block cache, default 256)\n"
+              << "      Resource limits for the backup workers:\n"
+              << "        --read-limit=<MB/s> --write-limit=<MB/s> --cpu-threads=<n>\n"
+              << "        --idle (lowest CPU and I/O priority) --cpu-affinity=<list, e.g. 0-3,6>\n"
+              << "        --adaptive [--max-load=<per CPU, default 1.0>] [--max-latency-ms=<n, default 5>]\n"
+              << "      --encrypt-key=<key file> encrypts new blocks (AES-256-GCM)\n"
+              << "      --ingest-level=<n> zstd level of new blocks (default 1; negative is faster)\n"
+              << "      --delta [--delta-depth=<n>] stores blocks similar to stored ones as deltas\n"
+              << "       (chains of at most n deltas, default 2)\n"
+              << "  deltavault_cli versions <file_path>\n"
+              << "      List all versions of a file\n"
+              << "  deltavault_cli diff <old_version_id> <new_version_id>\n"
+              << "      Show the byte ranges that changed between two versions\n"
+              << "  deltavault_cli version-stats <version_id>\n"
+              << "      Show unique vs shared size of a version\n"
+              << "  deltavault_cli cat <version_id> [--offset=<bytes>] [--length=<bytes>]\n"
+              << "      Write a byte range of a version to stdout without restoring the file\n"
+              << "  deltavault_cli restore --snapshot=<id> <output_dir> [--workers=<n>] [--no-permissions] [--no-progress]\n"
+              << "      Recreate the directory tree of a snapshot below output_dir, writing files in parallel\n"
+              << "      (n threads, default one per CPU) with the permissions they were backed up with\n"
+              << "  deltavault_cli verify [--sample=<fraction>] [--rate=<MB/s>] [--resume] [--no-progress]\n"
+              << "      Re-read stored blocks and check their size and SHA-256\n"
+              << "      (encrypted blocks need --encrypt-key, otherwise only their CRC-32C is checked)\n"
+              << "  deltavault_cli verify --version=<id> [--offset=<bytes>] [--length=<bytes>]\n"
+              << "      Check only the blocks of one version's byte range, found through its Merkle tree\n"
+              << "  deltavault_cli replicate <target_repo_dir> [--no-progress]\n"
+              << "      Copy new blocks and catalog entries of --repo into another repository\n"
+              << "  deltavault_cli export <version_id>... | --snapshot=<id> [--output=<file>] [--target=<repo_dir>]\n"
+              << "      Write versions or a snapshot as one archive stream (stdout by default),\n"
+              << "      leaving out blocks the --target repository already has\n"
+              << "  deltavault_cli import [<archive_file>]\n"
+              << "      Add the contents of an archive (stdin by default) to --repo\n"
+              << "  deltavault_cli compact [--min-age-days=<n, default 7>] [--level=<n, default 19>] [--workers=<n>] [--no-progress]\n"
+              << "      Recompress blocks stored longer than n days below the given zstd level,\n"
+              << "      at idle priority (the resource limit options apply)\n"
+              << "  deltavault_cli watch <directory> [--interval=<s, default 60>] [--settle=<s, default 2>]\n"
+              << "                      [--max-defer=<s, default 300>] [--rescan-interval=<s, default 600>]\n"
+              << "      Back up the directory, then keep backing up files as they change\n"
+              << "      (inotify change events; full rescans if they overflow or are unavailable)\n"
+              << "      until interrupted. Backup options such as --ingest-level, --delta,\n"
+              << "      --encrypt-key and the resource limits apply\n"
+              << "  deltavault_cli keygen <key_file>\n"
+              << "      Create a random repository key for --encrypt-key\n"
+              << "Options:\n"
+              << "  --repo=<dir>   Repository directory (default ./.deltavault_test)\n"
+              << "  --encrypt-key=<file>  Key of an encrypted repository (backup, restore, cat, verify)\n"
+              << "  --metadata=sqlite|lsm  Catalog backend of a new repository (default sqlite), fixed\n"
+              << "      once the repository exists\n";
+}
+
+// "0-3,6" -> {0, 1, 2, 3, 6}
+std::vector<int> parseCpuList(const std::string& text) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t comma = text.find(',', pos);
+        if (comma == std::string::npos) comma = text.size();
+        std::string item = text.substr(pos, comma - pos);
+        size_t dash = item.find('-');
+        int first = std::stoi(item.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        pos = comma + 1;
+    }
+    return cpus;
+}
+
+// Governor for the backup workers, or nullptr when no limit was given
+std::shared_ptr<ResourceGovernor> governorFromArgs(const CliArgs& args) {
+    GovernorLimits limits;
+    limits.read_bytes_per_second = args.has("read-limit")
+        ? static_cast<uint64_t>(std::stod(args.get("read-limit")) * 1024 * 1024) : 0;
+    limits.write_bytes_per_second = args.has("write-limit")
+        ? static_cast<uint64_t>(std::stod(args.get("write-limit")) * 1024 * 1024) : 0;
+    limits.max_cpu_threads = args.has("cpu-threads") ? std::stoull(args.get("cpu-threads")) : 0;
+    limits.idle_priority = args.has("idle");
+    if (args.has("cpu-affinity")) limits.cpu_affinity = parseCpuList(args.get("cpu-affinity"));
+
+    bool any_limit = limits.read_bytes_per_second || limits.write_bytes_per_second ||
+                     limits.max_cpu_threads || limits.idle_priority || !limits.cpu_affinity.empty();
+    if (!any_limit && !args.has("adaptive")) return nullptr;
+
+    auto governor = std::make_shared<ResourceGovernor>(limits);
+    if (args.has("adaptive")) {
+        AdaptiveConfig adaptive;
+        adaptive.enabled = true;
+        adaptive.max_load_per_cpu = std::stod(args.get("max-load", "1.0"));
+        adaptive.max_probe_latency = std::chrono::milliseconds(std::stoll(args.get("max-latency-ms", "5")));
+        governor->setAdaptive(adaptive);
+    }
+    return governor;
+}
+
+PipelineConfig pipelineConfigFromArgs(const CliArgs& args) {
+    PipelineConfig pipeline_config;
+    if (args.has("ingest-level")) pipeline_config.compression_level = std::stoi(args.get("ingest-level"));
+    pipeline_config.delta_compression = args.has("delta");
+    pipeline_config.delta_max_depth = std::stoi(args.get("delta-depth", "2"));
+    return pipeline_config;
+}
+
+void printStats(const BackupPipeline& pipeline, const std::string& stats_format) {
+    if (stats_format == "json") {
+        std::cout << pipeline.getStats().toJson() << std::endl;
+    } else if (stats_format == "text") {
+        std::cout << "\n--- Pipeline Stats ---\n" << pipeline.getStats().toText();
+    }
+}
+
+uint64_t parseId(const std::string& text) {
+    return std::stoull(text);
+}
+
+int cmdVersions(const CliArgs& args) {
+    if (args.positional.size() < 2) {
+        printUsage();
+        return 1;
+    }
+    auto repo = openRepository(args);
+    auto versions = repo.db->listVersions(args.positional[1]);
+    if (versions.empty()) {
+        std::cout << "No versions for: " << args.positional[1] << std::endl;
+        return 1;
+    }
+
+    std::cout << std::left << std::setw(12) << "version"
+              << std::setw(12) << "parent"
+              << std::setw(16) << "size"
+              << std::setw(22) << "created"
+              << "file_hash" << std::endl;
+    for (const auto& v : versions) {
+        std::time_t created = static_cast<std::time_t>(v.created_at);
+        char when[32] = "";
+        std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", std::localtime(&created));
+        std::cout << std::left << std::setw(12) << v.version_id
+                  << std::setw(12) << v.parent_id
+                  << std::setw(16) << v.file_size
+                  << std::setw(22) << when
+                  << v.file_hash << std::endl;
+    }
+    return 0;
+}
+
+int cmdDiff(const CliArgs& args) {
+    if (args.positional.size() < 3) {
+        printUsage();
+        return 1;
+    }
+    auto repo = openRepository(args);
+    auto diff = repo.db->diffVersions(parseId(args.positional[1]), parseId(args.positional[2]));
+
+    std::cout << "Old size: " << diff.old_size << "  New size: " << diff.new_size
+              << "  Changed bytes: " << diff.changed_bytes
+              << " in " << diff.changed.size() << " ranges" << std::endl;
+    for (const auto& r : diff.changed) {
+        std::cout << "  [" << r.offset << ", " << r.offset + r.length << ")  " << r.length << " bytes" << std::endl;
+    }
+    if (diff.new_size < diff.old_size) {
+        std::cout << "  truncated from " << diff.new_size << " to end of old version ("
+                  << diff.old_size - diff.new_size << " bytes removed)" << std::endl;
+    }
+    return 0;
+}
+
+int cmdVersionStats(const CliArgs& args) {
+    if (args.positional.size() < 2) {
+        printUsage();
+        return 1;
+    }
+    auto repo = openRepository(args);
+    auto stats = repo.db->getVersionStats(parseId(args.positional[1]));
+
+    std::cout << "Total:  " << stats.total_bytes << " bytes in " << stats.block_count << " block references" << std::endl;
+    std::cout << "Unique: " << stats.unique_bytes << " bytes (" << stats.unique_compressed_bytes
+              << " stored) in " << stats.unique_blocks << " blocks" << std::endl;
+    std::cout << "Shared: " << stats.shared_bytes << " bytes in " << stats.shared_blocks << " blocks" << std::endl;
+    return 0;
+}
+
+int cmdCat(const CliArgs& args) {
+    if (args.positional.size() < 2) {
+        printUsage();
+        return 1;
+    }
+    auto repo = openRepository(args);
+    requireKey(repo);
+    uint64_t vid = parseId(args.positional[1]);
+    if (!repo.db->versionExists(vid)) {
+        std::cerr << "No such version: " << vid << std::endl;
+        return 1;
+    }
+
+    auto block_reader = std::make_shared<BlockReader>(repo.storage, repo.hasher);
+    block_reader->setCipher(repo.cipher);
+    auto reader = std::make_shared<VersionReader>(repo.db, block_reader, vid);
+    uint64_t offset = std::stoull(args.get("offset", "0"));
+    uint64_t length = args.has("length") ? std::stoull(args.get("length")) : reader->size();
+
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    VersionReader::Stream stream(reader);
+    stream.seek(offset);
+    std::vector<uint8_t> buffer(BlockSplitter::BLOCK_SIZE);
+    while (length > 0) {
+        size_t n = stream.read(buffer.data(), static_cast<size_t>(std::min<uint64_t>(length, buffer.size())));
+        if (n == 0) break;
+        std::cout.write(reinterpret_cast<const char*>(buffer.data()), n);
+        length -= n;
+    }
+    std::cout.flush();
+    return 0;
+}
+
+int cmdRestore(const CliArgs& args) {
+    if (args.positional.size() != 2 || !args.has("snapshot")) {
+        printUsage();
+        return 1;
+    }
+    std::string output_dir = args.positional[1];
+    auto repo = openRepository(args);
+    requireKey(repo);
+
+    RestoreManager restorer(repo.db, repo.storage, repo.hasher);
+    restorer.setCipher(repo.cipher);
+    restorer.setVerifyHashes(args.has("verify-sha256"));
+    restorer.setBlockCache(std::make_shared<BlockCache>(std::stoull(args.get("cache-mb", "256")) * 1024 * 1024));
+    if (!args.has("no-progress")) {
+        restorer.setProgressCallback([](const ProgressSnapshot& p) {
+            std::cerr << "\r" << p.toString() << "   " << (p.finished ? "\n" : "") << std::flush;
+        });
+    }
+
+    SnapshotRestoreOptions options;
+    options.workers = std::stoull(args.get("workers", "0"));
+    options.restore_permissions = !args.has("no-permissions");
+    auto report = restorer.restoreSnapshot(parseId(args.get("snapshot")), output_dir, options);
+    std::cout << "Restored " << report.files << " files ("
+              << std::fixed << std::setprecision(1) << report.bytes / (1024.0 * 1024.0) << " MB, "
+              << report.batches << " batches) and " << report.directories << " directories to " << output_dir
+              << " in " << std::setprecision(2) << report.elapsed_seconds << "s" << std::endl;
+    return 0;
+}
+
+int cmdVerify(const CliArgs& args) {
+    auto repo = openRepository(args);
+
+    RepositoryVerifier verifier(repo.db, repo.storage, repo.hasher, repo.tp);
+    verifier.setCipher(repo.cipher);
+    if (repo.encrypted && !repo.cipher) {
+        std::cout << "No --encrypt-key: encrypted blocks are only checked against their CRC-32C" << std::endl;
+    }
+
+    VerifyReport report;
+    if (args.has("version")) {
+        // One byte range of one version, located through its Merkle tree
+        uint64_t vid = parseId(args.get("version"));
+        if (!repo.db->versionExists(vid)) {
+            std::cerr << "No such version: " << vid << std::endl;
+            return 1;
+        }
+        uint64_t offset = std::stoull(args.get("offset", "0"));
+        uint64_t length = args.has("length") ? std::stoull(args.get("length")) : UINT64_MAX;
+        report = verifier.verifyRange(vid, offset, length);
+        std::string root = repo.db->getMerkleRoot(vid);
+        if (!root.empty()) std::cout << "Merkle root " << root << " matches the tree path to the range" << std::endl;
+    } else {
+        VerifyOptions options;
+        options.sample_fraction = args.has("sample") ? std::stod(args.get("sample")) : 1.0;
+        options.max_bytes_per_second = args.has("rate")
+            ? static_cast<uint64_t>(std::stod(args.get("rate")) * 1024 * 1024) : 0;
+        options.checkpoint_path = repo.root + "/verify.checkpoint";
+        options.resume = args.has("resume");
+
+        if (!args.has("no-progress")) {
+            verifier.setProgressCallback([](const ProgressSnapshot& p) {
+                std::cerr << "\r" << p.toString() << "   " << (p.finished ? "\n" : "") << std::flush;
+            });
+        }
+
+        report = verifier.verify(options);
+        if (report.resumed_after_block > 0) {
+            std::cout << "Resumed after block " << report.resumed_after_block << std::endl;
+        }
+    }
+    double mbps = report.elapsed_seconds > 0 ? report.bytes_read / (1024.0 * 1024.0) / report.elapsed_seconds : 0.0;
+    std::cout << "Checked " << report.blocks_checked << " blocks (" << report.blocks_skipped << " skipped by sampling), "
+              << report.bytes_read << " bytes read in " << std::fixed << std::setprecision(2)
+              << report.elapsed_seconds << "s (" << mbps << " MB/s)" << std::endl;
+
+    if (report.ok()) {
+        std::cout << "OK: no corruption found" << std::endl;
+        return 0;
+    }
+
+    std::cout << "CORRUPT: " << report.corrupt.size() << " blocks" << std::endl;
+    for (const auto& c : report.corrupt) {
+        std::cout << "  block " << c.block_id << " " << c.block_hash << ": "
+                  << blockFaultName(c.fault) << " (" << c.detail << ")" << std::endl;
+    }
+    std::cout << "Affected versions:";
+    for (uint64_t vid : report.affected_versions) std::cout << " " << vid;
+    std::cout << std::endl;
+    return 2;
+}
+
+int cmdReplicate(const CliArgs& args) {
+    if (args.positional.size() < 2) {
+        printUsage();
+        return 1;
+    }
+    namespace fs = std::filesystem;
+    std::string source_root = args.get("repo", "./.deltavault_test");
+    std::string target_root = args.positional[1];
+    if (MetadataDB::backendOf(source_root).empty()) {
+        std::cerr << "No repository at " << source_root << std::endl;
+        return 1;
+    }
+    fs::create_directories(target_root);
+    if (fs::equivalent(source_root, target_root)) {
+        std::cerr << "Source and target are the same repository" << std::endl;
+        return 1;
+    }
+
+    std::string source_key_id = readKeyId(source_root);
+    std::string target_key_id = readKeyId(target_root);
+    checkTransferKey(source_key_id, target_root, "repository " + source_root);
+
+    // --metadata picks the catalog backend of a new target; the source keeps its own
+    CliArgs source_args = args;
+    source_args.options.erase("metadata");
+    CliArgs target_args;
+    if (args.has("metadata")) target_args.options["metadata"] = args.get("metadata");
+    auto source = openRepository(source_args, source_root);
+    auto target = openRepository(target_args, target_root);
+    if (source_key_id != target_key_id) {
+        std::ofstream(target_root + "/encryption.key-id") << source_key_id << "\n";
+    }
+
+    Replicator replicator(source.db, source.storage, target.db, target.storage, source.tp,
+                          fs::canonical(source_root).string());
+    if (!args.has("no-progress")) {
+        replicator.setProgressCallback([](const ProgressSnapshot& p) {
+            std::cerr << "\r" << p.toString() << "   " << (p.finished ? "\n" : "") << std::flush;
+        });
+    }
+
+    auto report = replicator.replicate();
+    std::cout << "Compared " << report.ranges_compared << " hash ranges, " << report.ranges_different << " differed" << std::endl;
+    std::cout << "Copied " << report.blocks_copied << " blocks (" << report.bytes_copied << " bytes), "
+              << report.versions_copied << " versions, " << report.snapshots_copied << " snapshots in "
+              << std::fixed << std::setprecision(2) << report.elapsed_seconds << "s" << std::endl;
+    return 0;
+}
+
+void printArchiveStats(const char* action, const ArchiveStats& stats) {
+    double mbps = stats.elapsed_seconds > 0 ? stats.bytes / (1024.0 * 1024.0) / stats.elapsed_seconds : 0.0;
+    std::cerr << action << " " << stats.blocks << " blocks (" << stats.blocks_skipped << " skipped), "
+              << stats.versions << " versions, " << stats.snapshots << " snapshots, "
+              << stats.bytes << " bytes in " << std::fixed << std::setprecision(2)
+              << stats.elapsed_seconds << "s (" << mbps << " MB/s)" << std::endl;
+}
+
+int cmdExport(const CliArgs& args) {
+    std::vector<uint64_t> version_ids;
+    for (size_t i = 1; i < args.positional.size(); ++i) version_ids.push_back(parseId(args.positional[i]));
+    if (version_ids.empty() == !args.has("snapshot")) {
+        printUsage();
+        return 1;
+    }
+
+    auto repo = openRepository(args);
+    ArchiveExporter exporter(repo.db, repo.storage);
+    Repository target;
+    if (args.has("target")) {
+        // Opening a mistyped path would create an empty repository and filter nothing out
+        if (MetadataDB::backendOf(args.get("target")).empty()) {
+            throw std::runtime_error("No repository at " + args.get("target"));
+        }
+        target = openRepository(CliArgs(), args.get("target"));
+        exporter.setBlockFilter([&target](const std::string& hash) { return target.db->findBlock(hash) != 0; });
+    }
+
+    // The archive goes to stdout unless --output is given, so all messages go to stderr
+    int fd = 1;
+    std::string output = args.get("output");
+    if (!output.empty()) {
+#ifdef _WIN32
+        fd = _open(output.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+        fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+        if (fd < 0) throw std::runtime_error("Cannot create archive: " + output);
+    } else {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    }
+
+    std::string source = std::filesystem::canonical(repo.root).string();
+    std::string key_id = readKeyId(repo.root);
+    ArchiveStats stats = args.has("snapshot")
+        ? exporter.exportSnapshot(parseId(args.get("snapshot")), fd, source, key_id)
+        : exporter.exportVersions(version_ids, fd, source, key_id);
+    if (!output.empty()) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+    }
+    printArchiveStats("Exported", stats);
+    return 0;
+}
+
+int cmdImport(const CliArgs& args) {
+    auto repo = openRepository(args);
+
+    int fd = 0;
+    std::string input = args.positional.size() > 1 ? args.positional[1] : "";
+    if (!input.empty()) {
+#ifdef _WIN32
+        fd = _open(input.c_str(), _O_RDONLY | _O_BINARY);
+#else
+        fd = ::open(input.c_str(), O_RDONLY);
+#endif
+        if (fd < 0) throw std::runtime_error("Cannot open archive: " + input);
+    } else {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    }
+
+    // Blocks are imported as stored, so the archive and the repository must share a key (or both have none)
+    ArchiveImporter importer(repo.db, repo.storage, repo.hasher, repo.tp);
+    importer.setKeyCheck([&repo](const std::string& key_id) {
+        checkTransferKey(key_id, repo.root, "archive");
+        if (key_id != readKeyId(repo.root)) {
+            std::ofstream(repo.root + "/encryption.key-id") << key_id << "\n";
+        }
+    });
+
+    ArchiveStats stats = importer.importArchive(fd);
+    if (!input.empty()) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+    }
+    printArchiveStats("Imported", stats);
+    return 0;
+}
+
+int cmdCompact(const CliArgs& args) {
+    auto repo = openRepository(args);
+
+    CompactionOptions options;
+    options.min_age_seconds = static_cast<int64_t>(std::stod(args.get("min-age-days", "7")) * 24 * 3600);
+    options.target_level = std::stoi(args.get("level", "19"));
+    options.workers = std::stoull(args.get("workers", "1"));
+
+    // Always a background job: idle priority, plus any limits given on the command line
+    auto governor = governorFromArgs(args);
+    if (!governor) governor = std::make_shared<ResourceGovernor>();
+    GovernorLimits limits = governor->getLimits();
+    limits.idle_priority = true;
+    governor->setLimits(limits);
+
+    BlockCompactor compactor(repo.db, repo.storage, repo.hasher);
+    compactor.setCipher(repo.cipher);
+    compactor.setResourceGovernor(governor);
+    if (repo.encrypted && !repo.cipher) {
+        std::cout << "No --encrypt-key: encrypted blocks are skipped" << std::endl;
+    }
+    if (!args.has("no-progress")) {
+        compactor.setProgressCallback([](const ProgressSnapshot& p) {
+            std::cerr << "\r" << p.toString() << "   " << (p.finished ? "\n" : "") << std::flush;
+        });
+    }
+
+    auto report = compactor.compact(options);
+    double saved_pct = report.bytes_before > 0 ? 100.0 * report.bytesSaved() / report.bytes_before : 0.0;
+    std::cout << "Scanned " << report.blocks_scanned << " blocks: " << report.blocks_rewritten << " recompressed, "
+              << report.blocks_unchanged << " no smaller, " << report.blocks_skipped << " skipped" << std::endl;
+    std::cout << "Saved " << report.bytesSaved() << " bytes (" << report.bytes_before << " -> " << report.bytes_after
+              << ", " << std::fixed << std::setprecision(1) << saved_pct << "%) using "
+              << std::setprecision(2) << report.cpu_seconds << "s CPU in " << report.elapsed_seconds << "s" << std::endl;
+    return 0;
+}
+
+// Set by cmdWatch while it runs; tripped by SIGINT/SIGTERM
+CancellationToken* watch_stop = nullptr;
+
+void requestWatchStop(int) {
+    if (watch_stop) watch_stop->cancel();   // A lock-free atomic store, safe in a signal handler
+}
+
+int cmdWatch(const CliArgs& args) {
+    if (args.positional.size() != 2 || !std::filesystem::is_directory(args.positional[1])) {
+        printUsage();
+        return 1;
+    }
+    std::string dir = args.positional[1];
+    auto repo = openRepository(args);
+    requireKey(repo);
+
+    auto pipeline = std::make_shared<BackupPipeline>(repo.scanner, repo.splitter, repo.hasher, repo.storage, repo.db);
+    pipeline->setResourceGovernor(governorFromArgs(args));
+    pipeline->setCipher(repo.cipher);
+    pipeline->setPipelineConfig(pipelineConfigFromArgs(args));
+
+    WatchOptions options;
+    auto seconds = [&](const char* key, const char* fallback) {
+        return std::chrono::milliseconds(static_cast<int64_t>(std::stod(args.get(key, fallback)) * 1000));
+    };
+    options.interval = seconds("interval", "60");
+    options.settle = seconds("settle", "2");
+    options.max_deferral = seconds("max-defer", "300");
+    options.rescan_interval = seconds("rescan-interval", "600");
+    options.exclude.push_back(repo.root);   // The backups' own writes are changes too
+
+    // Stopping cancels a running backup as well; its checkpoints survive for the next start
+    auto stop = std::make_shared<CancellationToken>();
+    pipeline->setCancellationToken(stop);
+    watch_stop = stop.get();
+    std::signal(SIGINT, requestWatchStop);
+    std::signal(SIGTERM, requestWatchStop);
+
+    std::cout << "Watching " << dir << " (Ctrl+C to stop)" << std::endl;
+    WatchDaemon daemon(repo.scanner, pipeline, repo.db, dir);
+    daemon.run(options, *stop, [](const WatchCycle& cycle) {
+        std::time_t now = std::time(nullptr);
+        if (!cycle.watch_error.empty()) {
+            std::cout << std::put_time(std::localtime(&now), "%Y-%m-%d %H:%M:%S") << " " << cycle.watch_error
+                      << "; polling every --rescan-interval instead" << std::endl;
+        }
+        if (cycle.snapshot_id == 0 && cycle.error.empty()) return;
+        std::cout << std::put_time(std::localtime(&now), "%Y-%m-%d %H:%M:%S") << " ";
+        if (!cycle.error.empty()) {
+            std::cout << "Backup of " << cycle.files << " files failed: " << cycle.error;
+        } else {
+            std::cout << "Snapshot " << cycle.snapshot_id << ": " << cycle.files << " files, "
+                      << std::fixed << std::setprecision(1) << cycle.bytes / (1024.0 * 1024.0) << " MB";
+            if (cycle.removed > 0) std::cout << ", " << cycle.removed << " removed";
+            std::cout << " in " << std::setprecision(2) << cycle.seconds << "s";
+        }
+        std::cout << " (" << (cycle.rescan ? "rescan" : "events")
+                  << (cycle.watching ? "" : ", polling") << ", " << cycle.pending << " pending)" << std::endl;
+    });
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    watch_stop = nullptr;
+    std::cout << "Stopped watching " << dir << std::endl;
+    return 0;
+}
+
+int cmdKeygen(const CliArgs& args) {
+    if (args.positional.size() < 2) {
+        printUsage();
+        return 1;
+    }
+    BlockCipher::generateKeyFile(args.positional[1]);
+    std::cout << "Key written to: " << args.positional[1] << std::endl;
+    std::cout << "Keep a copy somewhere safe: encrypted blocks cannot be read without it." << std::endl;
+    return 0;
+}
+
+int cmdBackupVerify(const CliArgs& args) {
+    std::string path = args.positional.empty() ? "" : args.positional[0];
+    std::string stats_format;   // "", "text" or "json"
+    if (args.has("stats")) {
+        stats_format = args.get("stats").empty() ? "text" : args.get("stats");
+    }
+    std::string trace_path = args.get("trace");
+    bool show_progress = !args.has("no-progress");
+
+    if (path.empty() || (!stats_format.empty() && stats_format != "text" && stats_format != "json")) {
+        printUsage();
+        return 1;
+    }
+
+    bool is_directory = std::filesystem::is_directory(path);
+    std::cout << (is_directory ? "Processing directory: " : "Processing file: ") << path << std::endl;
+
+    auto repo = openRepository(args);
+    requireKey(repo);
+    auto& scanner = repo.scanner;
+    auto& db = repo.db;
 
     // Initialize Pipeline
-    BackupPipeline pipeline(scanner, splitter, hasher, storage, db, tp);
+    BackupPipeline pipeline(repo.scanner, repo.splitter, repo.hasher, repo.storage, repo.db);
+
+    // Single progress line on stderr, rewritten in place
+    ProgressCallback print_progress = [](const ProgressSnapshot& p) {
+        std::cerr << "\r" << p.toString() << "   " << (p.finished ? "\n" : "") << std::flush;
+    };
+    if (show_progress) {
+        pipeline.setProgressCallback(print_progress);
+    }
+
+    auto governor = governorFromArgs(args);
+    pipeline.setResourceGovernor(governor);
+    pipeline.setCipher(repo.cipher);
+
+    pipeline.setPipelineConfig(pipelineConfigFromArgs(args));
+
+    std::shared_ptr<TraceRecorder> trace;
+    if (!trace_path.empty()) {
+        trace = std::make_shared<TraceRecorder>();
+        pipeline.setTraceRecorder(trace);
+    }
 
     // Run Backup
     std::cout << "Starting Parallel Backup..." << std::endl;
-    uint64_t vid = pipeline.runBackup(path);
-    std::cout << "Backup Pipeline Completed. Version ID: " << vid << std::endl;
+    uint64_t vid = 0;
+    uint64_t snapshot_id = 0;
+    if (is_directory) {
+        snapshot_id = pipeline.runBackupDirectory(path);
+        std::cout << "Backup Pipeline Completed. Snapshot ID: " << snapshot_id << std::endl;
+    } else {
+        vid = pipeline.runBackup(path);
+        std::cout << "Backup Pipeline Completed. Version ID: " << vid << std::endl;
+    }
+
+    if (trace) {
+        if (trace->writeChromeTrace(trace_path)) {
+            std::cout << "Trace written to: " << trace_path << std::endl;
+        } else {
+            std::cerr << "Failed to write trace: " << trace_path << std::endl;
+        }
+    }
 
     // --- Restore Verification ---
     std::cout << "\n--- Verifying Restore ---" << std::endl;
-    RestoreManager restorer(db, storage, hasher);
+    RestoreManager restorer(repo.db, repo.storage, repo.hasher);
+    restorer.setVerifyHashes(args.has("verify-sha256"));
+    restorer.setCipher(repo.cipher);
+    auto block_cache = std::make_shared<BlockCache>(std::stoull(args.get("cache-mb", "256")) * 1024 * 1024);
+    restorer.setBlockCache(block_cache);
+    if (show_progress) {
+        restorer.setProgressCallback(print_progress);
+    }
+
+    if (is_directory) {
+        // Restore every file of the snapshot below <dir>.restored/ and compare
+        auto root = std::filesystem::path(path);
+        auto restore_root = std::filesystem::path(path + ".restored");
+        size_t mismatches = 0;
+        auto restored = restorer.restoreSnapshot(snapshot_id, restore_root.string());
+        auto files = db->getSnapshotFiles(snapshot_id);
+        for (const auto& entry : files) {
+            auto target = restore_root / std::filesystem::path(entry.file_path).lexically_relative(root);
+            if (scanner->hashFile(target.string()) != scanner->hashFile(entry.file_path)) {
+                std::cout << "Mismatch: " << entry.file_path << std::endl;
+                mismatches++;
+            }
+        }
+        std::cout << "Restored " << restored.files << " files to: " << restore_root.string() << " in "
+                  << std::fixed << std::setprecision(2) << restored.elapsed_seconds << "s" << std::endl;
+        if (mismatches == 0) {
+            std::cout << "SUCCESS: Integration Test Passed!" << std::endl;
+        } else {
+            std::cout << "FAILURE: " << mismatches << " files do not match!" << std::endl;
+        }
+        printStats(pipeline, stats_format);
+        if (!stats_format.empty()) {
+            std::cout << "Block cache: " << block_cache->stats().toString() << std::endl;
+            std::cout << BufferPool::defaultPool()->stats().toString() << std::endl;
+            if (governor) std::cout << governor->stats().toString() << std::endl;
+        }
+        return mismatches == 0 ? 0 : 1;
+    }
+
     std::string restore_path = path + ".restored";
-    
+
     restorer.restoreFile(vid, restore_path);
     std::cout << "Restored to: " << restore_path << std::endl;
-    
+
     std::string restored_hash = scanner->hashFile(restore_path);
     std::string original_hash = scanner->hashFile(path);
-    
+
     std::cout << "Original Hash: " << original_hash << std::endl;
     std::cout << "Restored Hash: " << restored_hash << std::endl;
-    
+
     if (original_hash == restored_hash) {
         std::cout << "SUCCESS: Integration Test Passed!" << std::endl;
     } else {
         std::cout << "FAILURE: Hashes do not match!" << std::endl;
     }
 
+    printStats(pipeline, stats_format);
+    if (!stats_format.empty()) {
+        std::cout << "Block cache: " << block_cache->stats().toString() << std::endl;
+        std::cout << BufferPool::defaultPool()->stats().toString() << std::endl;
+        if (governor) std::cout << governor->stats().toString() << std::endl;
+    }
     return 0;
 }
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    CliArgs args = parseArgs(argc, argv);
+    if (args.positional.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    const std::string& command = args.positional[0];
+    try {
+        if (command == "versions") return cmdVersions(args);
+        if (command == "diff") return cmdDiff(args);
+        if (command == "version-stats") return cmdVersionStats(args);
+        if (command == "verify") return cmdVerify(args);
+        if (command == "restore") return cmdRestore(args);
+        if (command == "cat") return cmdCat(args);
+        if (command == "keygen") return cmdKeygen(args);
+        if (command == "replicate") return cmdReplicate(args);
+        if (command == "export") return cmdExport(args);
+        if (command == "import") return cmdImport(args);
+        if (command == "compact") return cmdCompact(args);
+        if (command == "watch") return cmdWatch(args);
+        return cmdBackupVerify(args);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,151 @@
+#include "merkle_tree.h"
+#include <openssl/sha.h>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t DIGEST_SIZE = SHA256_DIGEST_LENGTH;
+
+std::string toHex(const unsigned char* digest, size_t size) {
+    static const char* digits = "0123456789abcdef";
+    std::string hex(size * 2, '0');
+    for (size_t i = 0; i < size; i++) {
+        hex[2 * i] = digits[digest[i] >> 4];
+        hex[2 * i + 1] = digits[digest[i] & 0x0f];
+    }
+    return hex;
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+void fromHex(const std::string& hex, unsigned char out[DIGEST_SIZE]) {
+    if (hex.size() != DIGEST_SIZE * 2) throw std::runtime_error("Not a SHA-256 digest: " + hex);
+    for (size_t i = 0; i < DIGEST_SIZE; ++i) {
+        int hi = hexValue(hex[2 * i]);
+        int lo = hexValue(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) throw std::runtime_error("Not a SHA-256 digest: " + hex);
+        out[i] = static_cast<unsigned char>(hi << 4 | lo);
+    }
+}
+
+void putU64(std::vector<uint8_t>& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+uint64_t getU64(const uint8_t* p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) value = value << 8 | p[i];
+    return value;
+}
+
+} // namespace
+
+std::string merkleNodeHash(unsigned level, const std::vector<MerkleChild>& children) {
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    unsigned char level_byte = static_cast<unsigned char>(level);
+    SHA256_Update(&ctx, &level_byte, 1);
+    // A block's size follows from its hash; subtree sizes are covered explicitly
+    size_t entry_size = level == 1 ? DIGEST_SIZE : DIGEST_SIZE + 8;
+    for (const auto& child : children) {
+        unsigned char entry[DIGEST_SIZE + 8];
+        fromHex(child.digest, entry);
+        for (int i = 0; i < 8; ++i) entry[DIGEST_SIZE + i] = static_cast<unsigned char>(child.bytes >> (8 * i));
+        SHA256_Update(&ctx, entry, entry_size);
+    }
+    unsigned char digest[DIGEST_SIZE];
+    SHA256_Final(digest, &ctx);
+    return toHex(digest, DIGEST_SIZE);
+}
+
+std::vector<uint8_t> encodeMerkleChildren(const MerkleNode& node) {
+    std::vector<uint8_t> out;
+    if (node.level == 1) {
+        out.reserve(node.children.size() * 16);
+        for (const auto& child : node.children) {
+            putU64(out, child.block_id);
+            putU64(out, child.bytes);
+        }
+        return out;
+    }
+
+    out.reserve(node.children.size() * (DIGEST_SIZE + 8));
+    for (const auto& child : node.children) {
+        unsigned char digest[DIGEST_SIZE];
+        fromHex(child.digest, digest);
+        out.insert(out.end(), digest, digest + DIGEST_SIZE);
+        putU64(out, child.bytes);
+    }
+    return out;
+}
+
+std::vector<MerkleChild> decodeMerkleChildren(unsigned level, const uint8_t* data, size_t size) {
+    size_t entry_size = level == 1 ? 16 : DIGEST_SIZE + 8;
+    if (size % entry_size != 0 || size / entry_size > MERKLE_FANOUT) {
+        throw std::runtime_error("Malformed Merkle node");
+    }
+
+    std::vector<MerkleChild> children(size / entry_size);
+    for (size_t i = 0; i < children.size(); ++i) {
+        const uint8_t* p = data + i * entry_size;
+        if (level == 1) {
+            children[i].block_id = getU64(p);
+            children[i].bytes = getU64(p + 8);
+        } else {
+            children[i].digest = toHex(p, DIGEST_SIZE);
+            children[i].bytes = getU64(p + DIGEST_SIZE);
+        }
+    }
+    return children;
+}
+
+MerkleTreeBuilder::MerkleTreeBuilder(std::function<void(const MerkleNode&)> emit) : emit(std::move(emit)) {}
+
+void MerkleTreeBuilder::addBlock(const std::string& block_hash, uint64_t block_id, uint64_t size) {
+    if (pending.empty()) pending.emplace_back();
+    pending[0].push_back({block_hash, block_id, size});
+
+    // Close every level that just became full
+    for (size_t level = 0; level < pending.size() && pending[level].size() == MERKLE_FANOUT; ++level) {
+        flushLevel(level);
+    }
+}
+
+void MerkleTreeBuilder::flushLevel(size_t level) {
+    MerkleNode node;
+    node.level = static_cast<unsigned>(level + 1);
+    node.children = std::move(pending[level]);
+    pending[level].clear();
+    for (const auto& child : node.children) node.byte_count += child.bytes;
+    node.hash = merkleNodeHash(node.level, node.children);
+    emit(node);
+
+    if (pending.size() <= level + 1) pending.emplace_back();
+    pending[level + 1].push_back({node.hash, 0, node.byte_count});
+}
+
+std::string MerkleTreeBuilder::finish() {
+    if (pending.empty()) return "";
+
+    // Flush partial nodes bottom up until a single node is left on top. Level
+    // 0 always flushes, so even a one-block version has a level-1 root.
+    for (size_t level = 0; level < pending.size(); ++level) {
+        bool higher = false;
+        for (size_t above = level + 1; above < pending.size(); ++above) {
+            if (!pending[above].empty()) higher = true;
+        }
+        if (level > 0 && !higher && pending[level].size() == 1) {
+            std::string root = pending[level][0].digest;
+            pending.clear();
+            return root;
+        }
+        if (!pending[level].empty()) flushLevel(level);
+    }
+    pending.clear();
+    return "";
+}
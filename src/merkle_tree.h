@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// Per-version Merkle tree over the block list.
+//
+// A level-1 node covers MERKLE_FANOUT consecutive blocks, a level-n node
+// MERKLE_FANOUT level-(n-1) nodes; only the last node of each level is partial,
+// so child i of a level-n node always starts at block i * FANOUT^(n-1). A
+// node's digest is SHA-256 over its level and its children's digests (block
+// hashes at level 1), above level 1 each followed by the child's byte count.
+// Nodes are content-addressed, so versions that share a run of blocks share
+// the nodes above it.
+constexpr size_t MERKLE_FANOUT = 64;
+
+struct MerkleChild {
+    std::string digest;        // Hex child node digest, or block hash at level 1
+    uint64_t block_id = 0;     // Level 1 only
+    uint64_t bytes = 0;        // Uncompressed bytes under the child
+};
+
+struct MerkleNode {
+    std::string hash;          // Hex digest
+    unsigned level = 0;
+    uint64_t byte_count = 0;
+    std::vector<MerkleChild> children;
+};
+
+// Digest of a node from its children (level-1 children only need their block hash)
+std::string merkleNodeHash(unsigned level, const std::vector<MerkleChild>& children);
+
+// Stored form of a node's children. Level 1 keeps (block_id, bytes) and leaves
+// the block hashes to the blocks table; higher levels keep (digest, bytes).
+std::vector<uint8_t> encodeMerkleChildren(const MerkleNode& node);
+std::vector<MerkleChild> decodeMerkleChildren(unsigned level, const uint8_t* data, size_t size);
+
+// Builds a tree from blocks fed in file order, holding at most one partial
+// node per level. Every finished node is handed to `emit`, children first.
+class MerkleTreeBuilder {
+public:
+    explicit MerkleTreeBuilder(std::function<void(const MerkleNode&)> emit);
+
+    void addBlock(const std::string& block_hash, uint64_t block_id, uint64_t size);
+
+    // Flush the partial nodes; returns the root digest ("" if no blocks were added)
+    std::string finish();
+
+private:
+    void flushLevel(size_t level);
+
+    std::function<void(const MerkleNode&)> emit;
+    std::vector<std::vector<MerkleChild>> pending;   // pending[i]: children waiting for a level i+1 node
+};
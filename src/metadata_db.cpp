@@ -1,186 +1,241 @@
 #include "metadata_db.h"
+#include "lsm_metadata_db.h"
+#include "sqlite_metadata_db.h"
+#include <filesystem>
 #include <stdexcept>
-#include <iostream>
+#include <unordered_map>
 
-MetadataDB::~MetadataDB() {
-    if (db) {
-        sqlite3_close(db);
-    }
-}
+namespace {
 
-void MetadataDB::executeSQL(const std::string& sql) {
-    char* errMsg = nullptr;
-    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
-        std::string err = errMsg;
-        sqlite3_free(errMsg);
-        throw std::runtime_error("SQL Error: " + err);
-    }
+MerkleNode requireMerkleNode(MetadataDB& db, const std::string& node_hash) {
+    MerkleNode node;
+    if (!db.getMerkleNode(node_hash, node)) throw std::runtime_error("Missing Merkle node " + node_hash);
+    return node;
 }
 
-int64_t MetadataDB::getLastInsertId() {
-    return sqlite3_last_insert_rowid(db);
+} // namespace
+
+std::string MetadataDB::backendOf(const std::string& root) {
+    namespace fs = std::filesystem;
+    if (fs::exists(fs::path(root) / "metadata.lsm")) return "lsm";
+    if (fs::exists(fs::path(root) / "metadata.db")) return "sqlite";
+    return "";
 }
 
-void MetadataDB::initialize(const std::string& db_path) {
-    if (sqlite3_open(db_path.c_str(), &db) != SQLITE_OK) {
-        throw std::runtime_error("Failed to open DB: " + db_path);
+std::shared_ptr<MetadataDB> MetadataDB::open(const std::string& root, const std::string& backend) {
+    std::string existing = backendOf(root);
+    if (!existing.empty() && !backend.empty() && backend != existing) {
+        throw std::runtime_error("Repository " + root + " keeps its catalog in " + existing + ", not " + backend);
     }
+    std::string chosen = !existing.empty() ? existing : (backend.empty() ? "sqlite" : backend);
 
-    // Create Tables
-    const char* schema = R"(
-        CREATE TABLE IF NOT EXISTS files (
-            file_id INTEGER PRIMARY KEY,
-            file_path TEXT UNIQUE,
-            created_at INTEGER
-        );
-        CREATE TABLE IF NOT EXISTS blocks (
-            block_id INTEGER PRIMARY KEY,
-            block_hash TEXT UNIQUE,
-            size INTEGER,
-            compressed_size INTEGER
-        );
-        CREATE TABLE IF NOT EXISTS versions (
-            version_id INTEGER PRIMARY KEY,
-            file_id INTEGER,
-            parent_id INTEGER,
-            file_hash TEXT,
-            created_at INTEGER,
-            FOREIGN KEY(file_id) REFERENCES files(file_id)
-        );
-        CREATE TABLE IF NOT EXISTS file_blocks (
-            version_id INTEGER,
-            block_sequence INTEGER,
-            block_id INTEGER,
-            PRIMARY KEY(version_id, block_sequence),
-            FOREIGN KEY(version_id) REFERENCES versions(version_id),
-            FOREIGN KEY(block_id) REFERENCES blocks(block_id)
-        );
-    )";
-    executeSQL(schema);
-}
-
-uint64_t MetadataDB::getOrCreateFile(const std::string& path) {
-    sqlite3_stmt* stmt;
-    std::string sql = "SELECT file_id FROM files WHERE file_path = ?";
-    
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        throw std::runtime_error("Prepare failed");
+    if (chosen == "sqlite") {
+        auto db = std::make_shared<SqliteMetadataDB>();
+        db->initialize(root + "/metadata.db");
+        return db;
     }
-    
-    sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_STATIC);
-    
-    uint64_t id = 0;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        id = sqlite3_column_int64(stmt, 0);
+    if (chosen == "lsm") {
+        auto db = std::make_shared<LsmMetadataDB>();
+        db->initialize(root + "/metadata.lsm");
+        return db;
     }
-    sqlite3_finalize(stmt);
-
-    if (id != 0) return id;
-
-    // Insert
-    sql = "INSERT INTO files (file_path, created_at) VALUES (?, ?)";
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
-    
-    sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int64(stmt, 2, std::time(nullptr));
-    
-    if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Insert file failed");
-    sqlite3_finalize(stmt);
-    
-    return getLastInsertId();
+    throw std::runtime_error("Unknown metadata backend: " + chosen + " (expected sqlite or lsm)");
 }
 
-uint64_t MetadataDB::storeBlock(const std::string& hash, int size, int compressed_size) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    // Check existence first
-    sqlite3_stmt* stmt;
-    std::string sql = "SELECT block_id FROM blocks WHERE block_hash = ?";
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
-    sqlite3_bind_text(stmt, 1, hash.c_str(), -1, SQLITE_STATIC);
-    
-    uint64_t id = 0;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        id = sqlite3_column_int64(stmt, 0);
+void MetadataDB::forEachVersionBlock(uint64_t version_id, const BlockRefCallback& callback) {
+    // Sentinel thrown by the sink once the callback asks to stop
+    struct StopIteration {};
+
+    try {
+        readVersionBlockIds(resolveContentVersion(version_id), [&](const uint64_t* ids, size_t count) {
+            for (const auto& ref : lookupBlockRefs(ids, count)) {
+                if (!callback(ref)) throw StopIteration{};
+            }
+        });
+    } catch (const StopIteration&) {
     }
-    sqlite3_finalize(stmt);
+}
 
-    if (id != 0) return id;
+std::vector<std::string> MetadataDB::getVersionBlockHashes(uint64_t version_id) {
+    std::vector<std::string> hashes;
+    forEachVersionBlock(version_id, [&hashes](const DBBlockRef& ref) {
+        hashes.push_back(ref.block_hash);
+        return true;
+    });
+    return hashes;
+}
 
-    // Insert
-    sql = "INSERT INTO blocks (block_hash, size, compressed_size) VALUES (?, ?, ?)";
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
-    sqlite3_bind_text(stmt, 1, hash.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 2, size);
-    sqlite3_bind_int(stmt, 3, compressed_size);
+VersionDiff MetadataDB::diffVersions(uint64_t old_version_id, uint64_t new_version_id) {
+    VersionDiff diff;
+    diff.old_size = getVersionSize(old_version_id);
+    diff.new_size = getVersionSize(new_version_id);
+
+    auto addRange = [&diff](uint64_t offset, uint64_t length) {
+        if (length == 0) return;
+        if (!diff.changed.empty() && diff.changed.back().offset + diff.changed.back().length == offset) {
+            diff.changed.back().length += length;
+        } else {
+            diff.changed.push_back({offset, length});
+        }
+        diff.changed_bytes += length;
+    };
+
+    uint64_t old_resolved = resolveContentVersion(old_version_id);
+    uint64_t new_resolved = resolveContentVersion(new_version_id);
+    if (old_resolved == new_resolved) return diff;
+
+    // Small files have no block list: they either match byte for byte or not at all
+    DBPackedExtent old_extent, new_extent;
+    bool old_packed = getPackedExtent(old_resolved, old_extent);
+    bool new_packed = getPackedExtent(new_resolved, new_extent);
+    if (old_packed || new_packed) {
+        bool same = old_packed && new_packed &&
+                    old_extent.block_id == new_extent.block_id &&
+                    old_extent.offset == new_extent.offset &&
+                    old_extent.length == new_extent.length;
+        if (!same) addRange(0, diff.new_size);
+        return diff;
+    }
+
+    std::string old_root = getMerkleRoot(old_resolved);
+    std::string new_root = getMerkleRoot(new_resolved);
+    if (new_root.empty() || old_root == new_root) return diff;
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Insert block failed");
-    sqlite3_finalize(stmt);
+    MerkleNode new_node = requireMerkleNode(*this, new_root);
+    if (old_root.empty()) {
+        addRange(0, new_node.byte_count);
+        return diff;
+    }
 
-    return getLastInsertId();
+    // Fixed-size blocks: sequence number i covers the same byte range in both
+    // versions, so the trees line up node for node. A shorter tree lines up
+    // with the first-child chain of a taller one.
+    MerkleNode old_node = requireMerkleNode(*this, old_root);
+    while (old_node.level > new_node.level) {
+        old_node = requireMerkleNode(*this, old_node.children.front().digest);
+    }
+    diffMerkleNodes(old_node, new_node, 0, addRange);
+    return diff;
 }
 
-uint64_t MetadataDB::createVersion(
-    uint64_t file_id, 
-    const std::string& file_hash, 
-    const std::vector<uint64_t>& block_ids,
-    uint64_t parent_id
-) {
-    executeSQL("BEGIN TRANSACTION");
-    try {
-        sqlite3_stmt* stmt;
-        std::string sql = "INSERT INTO versions (file_id, parent_id, file_hash, created_at) VALUES (?, ?, ?, ?)";
-        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare version failed");
-        
-        sqlite3_bind_int64(stmt, 1, file_id);
-        sqlite3_bind_int64(stmt, 2, parent_id);
-        sqlite3_bind_text(stmt, 3, file_hash.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int64(stmt, 4, std::time(nullptr));
-
-        if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Step version failed");
-        sqlite3_finalize(stmt);
-
-        uint64_t version_id = getLastInsertId();
-
-        // Insert mappings
-        sql = "INSERT INTO file_blocks (version_id, block_sequence, block_id) VALUES (?, ?, ?)";
-        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare mapping failed");
-
-        int seq = 0;
-        for (uint64_t bid : block_ids) {
-            sqlite3_reset(stmt);
-            sqlite3_bind_int64(stmt, 1, version_id);
-            sqlite3_bind_int(stmt, 2, seq++);
-            sqlite3_bind_int64(stmt, 3, bid);
-            if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Step mapping failed");
+void MetadataDB::diffMerkleNodes(const MerkleNode& old_node, const MerkleNode& new_node, uint64_t offset,
+                                 const std::function<void(uint64_t, uint64_t)>& add_range) {
+    if (old_node.hash == new_node.hash) return;
+
+    if (new_node.level > old_node.level) {
+        // Only the first child overlaps the old version; the rest is all new
+        diffMerkleNodes(old_node, requireMerkleNode(*this, new_node.children.front().digest), offset, add_range);
+        for (size_t i = 0; i < new_node.children.size(); ++i) {
+            if (i > 0) add_range(offset, new_node.children[i].bytes);
+            offset += new_node.children[i].bytes;
         }
-        sqlite3_finalize(stmt);
+        return;
+    }
 
-        executeSQL("COMMIT");
-        return version_id;
-    } catch (...) {
-        executeSQL("ROLLBACK");
-        throw;
+    for (size_t i = 0; i < new_node.children.size(); ++i) {
+        const auto& child = new_node.children[i];
+        if (i >= old_node.children.size()) {
+            add_range(offset, child.bytes);
+        } else if (new_node.level == 1) {
+            if (old_node.children[i].block_id != child.block_id) add_range(offset, child.bytes);
+        } else if (old_node.children[i].digest != child.digest) {
+            diffMerkleNodes(requireMerkleNode(*this, old_node.children[i].digest),
+                            requireMerkleNode(*this, child.digest), offset, add_range);
+        }
+        offset += child.bytes;
     }
 }
 
-std::vector<std::string> MetadataDB::getVersionBlockHashes(uint64_t version_id) {
-    std::vector<std::string> hashes;
-    sqlite3_stmt* stmt;
-    std::string sql = R"(
-        SELECT b.block_hash 
-        FROM file_blocks fb
-        JOIN blocks b ON fb.block_id = b.block_id
-        WHERE fb.version_id = ?
-        ORDER BY fb.block_sequence ASC
-    )";
-
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
-    sqlite3_bind_int64(stmt, 1, version_id);
-
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char* h = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-        hashes.push_back(h ? std::string(h) : "");
+VersionStats MetadataDB::getVersionStats(uint64_t version_id) {
+    VersionStats stats;
+    uint64_t resolved = resolveContentVersion(version_id);
+
+    // A version that shares its whole block list (or lends it out) has nothing unique
+    bool content_shared = resolved != version_id || hasContentClones(version_id);
+
+    DBPackedExtent extent;
+    if (getPackedExtent(resolved, extent)) {
+        stats.total_bytes = extent.length;
+        stats.block_count = 1;
+        if (content_shared) {
+            stats.shared_blocks = 1;
+            stats.shared_bytes = extent.length;
+        } else {
+            // The shared aggregate block is split between its files; this slice is ours alone
+            stats.unique_blocks = 1;
+            stats.unique_bytes = extent.length;
+        }
+        return stats;
     }
-    sqlite3_finalize(stmt);
-    return hashes;
+
+    // Count each distinct block once; another version shares it iff its ref_count exceeds one.
+    // Every version counts once per block, so a block repeated within this version is still unique.
+    std::unordered_map<uint64_t, uint64_t> seen;   // block_id -> references from this version
+    std::vector<DBBlockRef> distinct;
+    forEachVersionBlock(resolved, [&](const DBBlockRef& ref) {
+        if (seen[ref.block_id]++ == 0) distinct.push_back(ref);
+        return true;
+    });
+
+    for (const auto& ref : distinct) {
+        uint64_t refs = seen[ref.block_id];
+        bool shared = content_shared || ref.ref_count > 1;
+
+        stats.total_bytes += ref.size * refs;
+        stats.block_count += refs;
+        if (shared) {
+            stats.shared_blocks++;
+            stats.shared_bytes += ref.size;
+        } else {
+            stats.unique_blocks++;
+            stats.unique_bytes += ref.size;
+            stats.unique_compressed_bytes += ref.compressed_size;
+        }
+    }
+    return stats;
+}
+
+std::vector<DBBlockRef> MetadataDB::getVerifiedRange(uint64_t version_id, uint64_t offset, uint64_t length,
+                                                     uint64_t& first_offset) {
+    std::vector<DBBlockRef> refs;
+    first_offset = 0;
+    std::string root = getMerkleRoot(version_id);
+    if (root.empty()) return refs;
+    uint64_t end = length > UINT64_MAX - offset ? UINT64_MAX : offset + length;
+
+    std::function<void(const std::string&, uint64_t)> descend = [&](const std::string& node_hash, uint64_t node_offset) {
+        MerkleNode node = requireMerkleNode(*this, node_hash);
+        std::vector<DBBlockRef> blocks;
+        if (node.level == 1) {
+            // Block hashes come from the blocks table; the recorded sizes must agree with it
+            std::vector<uint64_t> ids;
+            for (const auto& child : node.children) ids.push_back(child.block_id);
+            blocks = lookupBlockRefs(ids.data(), ids.size());
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                if (blocks[i].size != node.children[i].bytes) {
+                    throw std::runtime_error("Merkle node " + node_hash + " disagrees with the size of block " + blocks[i].block_hash);
+                }
+                node.children[i].digest = blocks[i].block_hash;
+            }
+        }
+        if (node.children.empty() || merkleNodeHash(node.level, node.children) != node_hash) {
+            throw std::runtime_error("Merkle node does not match its digest: " + node_hash);
+        }
+
+        uint64_t child_offset = node_offset;
+        for (size_t i = 0; i < node.children.size(); ++i) {
+            uint64_t child_end = child_offset + node.children[i].bytes;
+            if (child_end > offset && child_offset < end) {
+                if (node.level == 1) {
+                    if (refs.empty()) first_offset = child_offset;
+                    refs.push_back(std::move(blocks[i]));
+                } else {
+                    descend(node.children[i].digest, child_offset);
+                }
+            }
+            child_offset = child_end;
+        }
+    };
+    descend(root, 0);
+    return refs;
 }
@@ -3,8 +3,9 @@
 #include <string>
 #include <vector>
 #include <memory>
-#include <mutex>
-#include <sqlite3.h>
+#include <functional>
+#include "merkle_tree.h"
+#include "block_sketch.h"
 
 struct DBFile {
     uint64_t file_id;
@@ -18,45 +19,336 @@ struct DBBlock {
     std::string block_hash;
     int size;
     int compressed_size;
+    int compression_level = 3;   // zstd level of the stored payload (or that recompression found no gain at)
+    std::string delta_base;      // Block this one is stored as a delta against ("" = stored whole)
+    int delta_depth = 0;         // Deltas on the chain ending here (0 = stored whole)
 };
 
+// One entry of a version's block list, in file order
+struct DBBlockRef {
+    uint64_t block_id;
+    std::string block_hash;
+    uint64_t size;
+    uint64_t compressed_size;
+    uint64_t ref_count;       // Versions/packed files referencing the block
+};
+
+// Return false to stop the iteration early
+using BlockRefCallback = std::function<bool(const DBBlockRef&)>;
+
 struct DBVersion {
     uint64_t version_id;
     uint64_t file_id;
     uint64_t parent_id;
     std::string file_hash;
     uint64_t created_at;
+    uint64_t file_size;
+};
+
+struct ByteRange {
+    uint64_t offset;
+    uint64_t length;
+};
+
+// Byte ranges of the new version whose blocks differ from the old version
+struct VersionDiff {
+    uint64_t old_size = 0;
+    uint64_t new_size = 0;
+    std::vector<ByteRange> changed;   // In new-version coordinates, merged and sorted
+    uint64_t changed_bytes = 0;
+};
+
+// Space accounting for one version. A block is "shared" if any other version
+// references it (blocks.ref_count > 1), "unique" if this version is its only user.
+struct VersionStats {
+    uint64_t total_bytes = 0;
+    uint64_t block_count = 0;
+    uint64_t unique_blocks = 0;
+    uint64_t unique_bytes = 0;
+    uint64_t unique_compressed_bytes = 0;
+    uint64_t shared_blocks = 0;
+    uint64_t shared_bytes = 0;
+};
+
+// Permission bits of a version (std::filesystem::perms & 07777) when they are
+// not known, e.g. for versions stored before modes were recorded
+constexpr uint32_t FILE_MODE_UNKNOWN = 0xFFFFFFFF;
+
+// A file stored inside an aggregate block of small files
+struct PackedFileEntry {
+    uint64_t file_id;
+    std::string file_hash;
+    uint64_t offset;
+    uint64_t length;
+    uint32_t mode = FILE_MODE_UNKNOWN;
+    uint64_t parent_id = 0;            // Previous version of the file (0 = first)
+};
+
+// Where a packed version's bytes live
+struct DBPackedExtent {
+    uint64_t block_id;
+    std::string block_hash;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t ref_count;       // Files packed into the aggregate block
 };
 
+// Progress of an interrupted backup of one file: the first block_ids.size()
+// blocks are stored, and hash_state is the whole-file hash state after them
+struct BackupCheckpoint {
+    std::string file_path;
+    uint64_t file_size = 0;
+    int64_t mtime = 0;                  // Raw file time ticks, only compared for equality
+    std::vector<uint64_t> block_ids;
+    std::string hash_state;
+};
+
+// A catalog version with its file path, as copied by replication
+struct DBVersionRecord {
+    uint64_t version_id = 0;
+    std::string file_path;
+    uint64_t parent_id = 0;
+    std::string file_hash;
+    uint64_t created_at = 0;
+    uint64_t file_size = 0;
+    uint64_t source_version_id = 0;   // Whole-file clone of this version (0 = owns its content)
+    uint32_t mode = FILE_MODE_UNKNOWN;
+};
+
+// A version to recreate in another catalog. Ids are those of the source
+// catalog; blocks are referenced by hash and resolved on import.
+struct ReplicaVersion {
+    DBVersionRecord record;
+    std::vector<std::string> block_hashes;   // Block list in file order, or the aggregate block if packed
+    bool packed = false;
+    uint64_t packed_offset = 0;
+};
+
+struct DBSnapshot {
+    uint64_t snapshot_id = 0;
+    std::string root_path;
+    uint64_t created_at = 0;
+    std::vector<uint64_t> version_ids;
+};
+
+struct DBSnapshotEntry {
+    uint64_t version_id;
+    std::string file_path;
+    uint64_t file_size = 0;
+    uint32_t mode = FILE_MODE_UNKNOWN;
+};
+
+// The repository catalog. Two embedded backends implement it:
+// SqliteMetadataDB (metadata.db, the default) and LsmMetadataDB (metadata.lsm/,
+// a log-structured store for high block ingest rates). A repository keeps the
+// backend it was created with; open() picks it from the files on disk.
+// Algorithms over the catalog (diffs, verified ranges, space accounting) live
+// here and only use the primitives below.
 class MetadataDB {
 public:
-    ~MetadataDB();
-    
-    // Open DB connection and create tables if needed
-    void initialize(const std::string& db_path);
+    virtual ~MetadataDB() = default;
+
+    // Open the catalog of the repository at `root`, creating it with `backend`
+    // ("sqlite" or "lsm"; "" = sqlite) if there is none. Throws if an existing
+    // catalog uses a different backend than the one asked for.
+    static std::shared_ptr<MetadataDB> open(const std::string& root, const std::string& backend = "");
+
+    // Backend of the catalog at `root`: "sqlite", "lsm", or "" if there is none
+    static std::string backendOf(const std::string& root);
 
     // File Operations
-    uint64_t getOrCreateFile(const std::string& path);
+    virtual uint64_t getOrCreateFile(const std::string& path) = 0;
     
     // Block Operations
-    // Returns block_id. If block exists, returns existing ID
-    uint64_t storeBlock(const std::string& hash, int size, int compressed_size);
+    // Returns block_id. If block exists, returns existing ID. A block stored as
+    // a delta names its base and the depth of its chain.
+    virtual uint64_t storeBlock(const std::string& hash, int size, int compressed_size, int compression_level = 3,
+                                const std::string& delta_base = "", int delta_depth = 0) = 0;
+
+    // Returns block_id if a block with this hash is already stored, 0 otherwise
+    virtual uint64_t findBlock(const std::string& hash) = 0;
+
+    // Look up one block by hash; false if it is not stored
+    virtual bool getBlock(const std::string& hash, DBBlock& block) = 0;
+
+    // --- Similarity index (delta compression) ---
+
+    // Index a stored block under its sketch's super-features
+    virtual void addBlockFeatures(uint64_t block_id, const BlockSketch& sketch) = 0;
+
+    // Among the first SKETCH_CANDIDATES_PER_FEATURE blocks indexed under each
+    // super-feature of `sketch`, the one sharing the most super-features (newest
+    // first on ties) whose delta chain is shorter than `max_depth`; false if none
+    virtual bool findSimilarBlock(const BlockSketch& sketch, int max_depth, DBBlock& base) = 0;
     
     // Version Operations
-    uint64_t createVersion(
+    virtual uint64_t createVersion(
         uint64_t file_id, 
         const std::string& file_hash, 
+        uint64_t file_size,
         const std::vector<uint64_t>& block_ids,
-        uint64_t parent_id = 0
-    );
+        uint64_t parent_id = 0,
+        uint32_t mode = FILE_MODE_UNKNOWN
+    ) = 0;
+
+    // Newest version of a file (the parent of its next one), 0 if it has none
+    virtual uint64_t getLatestVersionId(uint64_t file_id) = 0;
+
+    // True if some indexed whole-file content has exactly this size: a cheap
+    // check before hashing a file to look it up with findVersionByContent
+    virtual bool hasContentOfSize(uint64_t file_size) = 0;
+
+    // Whole-file content index: returns a version whose content has this hash and size, 0 if none
+    virtual uint64_t findVersionByContent(const std::string& file_hash, uint64_t file_size) = 0;
+
+    // Create a version that reuses the block list of `source_version_id` (a single row insert)
+    virtual uint64_t createVersionFromContent(
+        uint64_t file_id,
+        const std::string& file_hash,
+        uint64_t file_size,
+        uint64_t source_version_id,
+        uint64_t parent_id = 0,
+        uint32_t mode = FILE_MODE_UNKNOWN
+    ) = 0;
+
+    // Create one version per small file stored in the shared block `block_id`
+    // (single transaction). Returns version ids in the order of `entries`.
+    virtual std::vector<uint64_t> createPackedVersions(
+        uint64_t block_id,
+        const std::vector<PackedFileEntry>& entries
+    ) = 0;
+
+    // Backup checkpoints (one per file path). A save only replaces a checkpoint
+    // that covers fewer blocks, so out-of-order saves never move progress back.
+    virtual void saveCheckpoint(const BackupCheckpoint& checkpoint) = 0;
+    virtual bool loadCheckpoint(const std::string& file_path, BackupCheckpoint& checkpoint) = 0;
+    virtual void clearCheckpoint(const std::string& file_path) = 0;
+
+    // Snapshot Operations
+    virtual uint64_t createSnapshot(const std::string& root_path, const std::vector<uint64_t>& version_ids) = 0;
+    // Files of a snapshot sorted by path, with their sizes and modes
+    virtual std::vector<DBSnapshotEntry> getSnapshotFiles(uint64_t snapshot_id) = 0;
 
     // Queries
     std::vector<std::string> getVersionBlockHashes(uint64_t version_id);
 
+    // Stream a version's block list in file order without materializing it
+    void forEachVersionBlock(uint64_t version_id, const BlockRefCallback& callback);
+
+    // Look up one block by id; false if it does not exist
+    virtual bool getBlockRef(uint64_t block_id, DBBlockRef& ref) = 0;
+
+    // Number of block references in a version's block list
+    virtual uint64_t getVersionBlockCount(uint64_t version_id) = 0;
+
+    // Returns true (and fills `extent`) if the version lives inside an aggregate block
+    virtual bool getPackedExtent(uint64_t version_id, DBPackedExtent& extent) = 0;
+
+    // Total uncompressed size of a version (sum of its block sizes)
+    virtual uint64_t getVersionSize(uint64_t version_id) = 0;
+
+    // Page through stored blocks in block_id order, starting after `after_block_id`
+    virtual std::vector<DBBlock> listBlocks(uint64_t after_block_id, size_t limit) = 0;
+
+    // (block count, compressed bytes) of blocks with block_id > after_block_id
+    virtual std::pair<uint64_t, uint64_t> getBlockTotals(uint64_t after_block_id) = 0;
+
+    // Every version whose content references one of `block_ids`, including
+    // whole-file clones of such versions. Scans all block lists; meant for
+    // reporting damage, not for hot paths.
+    virtual std::vector<uint64_t> findVersionsUsingBlocks(const std::vector<uint64_t>& block_ids) = 0;
+
+    virtual bool versionExists(uint64_t version_id) = 0;
+
+    // --- Recompression ---
+
+    // Blocks after `after_block_id` (in block_id order) stored whole at a zstd
+    // level below `below_level` no later than `stored_before` (unix time), at
+    // most `limit`. Deltas are left alone: their frames depend on the base.
+    virtual std::vector<DBBlock> listCompactionCandidates(uint64_t after_block_id, int64_t stored_before,
+                                                          int below_level, size_t limit) = 0;
+
+    // (block count, compressed bytes) of all such blocks
+    virtual std::pair<uint64_t, uint64_t> getCompactionTotals(int64_t stored_before, int below_level) = 0;
+
+    // Record new compressed sizes and levels after payloads were rewritten (one transaction)
+    virtual void updateBlockCompression(const std::vector<DBBlock>& blocks) = 0;
+
+    // --- Replication ---
+
+    // Blocks with first_hash <= block_hash < end_hash in hash order (empty end_hash = no upper bound)
+    virtual void forEachBlockInRange(const std::string& first_hash, const std::string& end_hash,
+                                     const std::function<void(const DBBlock&)>& callback) = 0;
+
+    // Insert rows for blocks copied from another repository (one transaction;
+    // hashes already present are skipped). ref_count starts at 0.
+    virtual void storeBlocks(const std::vector<DBBlock>& blocks) = 0;
+
+    virtual uint64_t getMaxVersionId() = 0;
+    virtual uint64_t getMaxSnapshotId() = 0;
+
+    // Versions / snapshots with after_id < id <= last_id in id order, at most `limit`
+    virtual std::vector<DBVersionRecord> listVersionRecords(uint64_t after_id, uint64_t last_id, size_t limit) = 0;
+    virtual std::vector<DBSnapshot> listSnapshots(uint64_t after_id, uint64_t last_id, size_t limit) = 0;
+
+    // Highest source version / snapshot id already imported from `source` (0 if none)
+    virtual uint64_t getReplicaVersionCursor(const std::string& source) = 0;
+    virtual uint64_t getReplicaSnapshotCursor(const std::string& source) = 0;
+
+    // Recreate versions of `source` in id order in one transaction. Parents and
+    // clone sources are mapped through earlier imports; every referenced block
+    // must already be stored here. Versions imported before are skipped.
+    virtual void importVersions(const std::string& source, const std::vector<ReplicaVersion>& versions) = 0;
+    virtual void importSnapshots(const std::string& source, const std::vector<DBSnapshot>& snapshots) = 0;
+
+    // All versions of a file, oldest first
+    virtual std::vector<DBVersion> listVersions(const std::string& file_path) = 0;
+
+    // Which byte ranges changed from old_version_id to new_version_id. Walks
+    // both Merkle trees and only descends into subtrees whose digests differ.
+    VersionDiff diffVersions(uint64_t old_version_id, uint64_t new_version_id);
+
+    // Unique vs shared size of a version
+    VersionStats getVersionStats(uint64_t version_id);
+
+    // --- Merkle trees ---
+
+    // Root digest of the tree over a version's block list ("" for packed and
+    // empty versions). Trees of versions written before they existed are built
+    // and stored on first use.
+    virtual std::string getMerkleRoot(uint64_t version_id) = 0;
+
+    // Load a stored node; false if there is none with this digest
+    virtual bool getMerkleNode(const std::string& node_hash, MerkleNode& node) = 0;
+
+    // Blocks of a version overlapping [offset, offset + length), found by
+    // descending its tree from the root. Every node on the way is re-hashed
+    // from its children and checked against the digest that led to it, so the
+    // result is authenticated by the root alone; throws on a mismatch.
+    // `first_offset` receives the file offset of the first returned block.
+    std::vector<DBBlockRef> getVerifiedRange(uint64_t version_id, uint64_t offset, uint64_t length,
+                                             uint64_t& first_offset);
+
+protected:
+    // Block ids are resolved to hashes/sizes in chunks of this many list entries
+    static constexpr size_t BLOCK_REF_CHUNK = 4096;
+
+    // Follow a whole-file clone to the version that owns the block list
+    virtual uint64_t resolveContentVersion(uint64_t version_id) = 0;
+
+    // True if some whole-file clone borrows the block list of `version_id`
+    virtual bool hasContentClones(uint64_t version_id) = 0;
+
+    // Decode the ordered block id list of a resolved version; calls `sink` with
+    // chunks of at most BLOCK_REF_CHUNK ids
+    virtual void readVersionBlockIds(uint64_t version_id,
+                                     const std::function<void(const uint64_t* ids, size_t count)>& sink) = 0;
+
+    // Blocks by id, in the order given (throws if one does not exist)
+    virtual std::vector<DBBlockRef> lookupBlockRefs(const uint64_t* block_ids, size_t count) = 0;
+
 private:
-    sqlite3* db = nullptr;
-    std::mutex db_mutex;
-    
-    void executeSQL(const std::string& sql);
-    int64_t getLastInsertId();
+    // Compare two aligned subtrees, reporting differing byte ranges of the new one
+    void diffMerkleNodes(const MerkleNode& old_node, const MerkleNode& new_node, uint64_t offset,
+                         const std::function<void(uint64_t, uint64_t)>& add_range);
 };
@@ -0,0 +1,269 @@
+#include "pipeline_stats.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+const char* stageName(PipelineStage stage) {
+    switch (stage) {
+        case PipelineStage::Read:     return "read";
+        case PipelineStage::Hash:     return "hash";
+        case PipelineStage::Dedup:    return "dedup";
+        case PipelineStage::Compress: return "compress";
+        case PipelineStage::Encrypt:  return "encrypt";
+        case PipelineStage::Store:    return "store";
+        case PipelineStage::Commit:   return "commit";
+        default:                      return "unknown";
+    }
+}
+
+namespace {
+
+size_t latencyBucket(uint64_t elapsed_ns) {
+    uint64_t us = elapsed_ns / 1000;
+    size_t bucket = 0;
+    while (us > 1 && bucket + 1 < LATENCY_BUCKETS) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void updateMax(std::atomic<uint64_t>& target, uint64_t value) {
+    uint64_t current = target.load(std::memory_order_relaxed);
+    while (value > current &&
+           !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+} // namespace
+
+// --- PipelineStats ---
+
+void PipelineStats::record(PipelineStage stage, uint64_t elapsed_ns, uint64_t bytes_in, uint64_t bytes_out) {
+    auto& s = stages[static_cast<size_t>(stage)];
+    s.count.fetch_add(1, std::memory_order_relaxed);
+    s.bytes_in.fetch_add(bytes_in, std::memory_order_relaxed);
+    s.bytes_out.fetch_add(bytes_out, std::memory_order_relaxed);
+    s.total_ns.fetch_add(elapsed_ns, std::memory_order_relaxed);
+    s.latency_histogram[latencyBucket(elapsed_ns)].fetch_add(1, std::memory_order_relaxed);
+    updateMax(s.max_ns, elapsed_ns);
+}
+
+void PipelineStats::recordQueueWait(uint64_t wait_ns) {
+    queue_wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+    updateMax(max_queue_wait_ns, wait_ns);
+}
+
+void PipelineStats::recordDedupHit() {
+    dedup_hits.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PipelineStats::recordFileDedupHit() {
+    file_dedup_hits.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PipelineStats::recordDelta(uint64_t saved_bytes) {
+    delta_blocks.fetch_add(1, std::memory_order_relaxed);
+    delta_saved_bytes.fetch_add(saved_bytes, std::memory_order_relaxed);
+}
+
+void PipelineStats::recordBlock() {
+    blocks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PipelineStats::recordFile() {
+    files.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PipelineStats::recordResumed(uint64_t bytes) {
+    resumed_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+PipelineStatsSnapshot PipelineStats::snapshot() const {
+    PipelineStatsSnapshot snap;
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        const auto& s = stages[i];
+        auto& out = snap.stages[i];
+        out.count = s.count.load(std::memory_order_relaxed);
+        out.bytes_in = s.bytes_in.load(std::memory_order_relaxed);
+        out.bytes_out = s.bytes_out.load(std::memory_order_relaxed);
+        out.total_ns = s.total_ns.load(std::memory_order_relaxed);
+        out.max_ns = s.max_ns.load(std::memory_order_relaxed);
+        for (size_t b = 0; b < LATENCY_BUCKETS; ++b) {
+            out.latency_histogram[b] = s.latency_histogram[b].load(std::memory_order_relaxed);
+        }
+    }
+    snap.files = files.load(std::memory_order_relaxed);
+    snap.blocks = blocks.load(std::memory_order_relaxed);
+    snap.dedup_hits = dedup_hits.load(std::memory_order_relaxed);
+    snap.file_dedup_hits = file_dedup_hits.load(std::memory_order_relaxed);
+    snap.delta_blocks = delta_blocks.load(std::memory_order_relaxed);
+    snap.delta_saved_bytes = delta_saved_bytes.load(std::memory_order_relaxed);
+    snap.resumed_bytes = resumed_bytes.load(std::memory_order_relaxed);
+    snap.queue_wait_ns = queue_wait_ns.load(std::memory_order_relaxed);
+    snap.max_queue_wait_ns = max_queue_wait_ns.load(std::memory_order_relaxed);
+    return snap;
+}
+
+void PipelineStats::reset() {
+    for (auto& s : stages) {
+        s.count = 0;
+        s.bytes_in = 0;
+        s.bytes_out = 0;
+        s.total_ns = 0;
+        s.max_ns = 0;
+        for (auto& b : s.latency_histogram) b = 0;
+    }
+    files = 0;
+    blocks = 0;
+    dedup_hits = 0;
+    file_dedup_hits = 0;
+    delta_blocks = 0;
+    delta_saved_bytes = 0;
+    resumed_bytes = 0;
+    queue_wait_ns = 0;
+    max_queue_wait_ns = 0;
+}
+
+// --- Snapshot formatting ---
+
+std::string PipelineStatsSnapshot::toJson() const {
+    std::stringstream ss;
+    ss << "{\"files\":" << files
+       << ",\"blocks\":" << blocks
+       << ",\"dedup_hits\":" << dedup_hits
+       << ",\"file_dedup_hits\":" << file_dedup_hits
+       << ",\"delta_blocks\":" << delta_blocks
+       << ",\"delta_saved_bytes\":" << delta_saved_bytes
+       << ",\"resumed_bytes\":" << resumed_bytes
+       << ",\"queue_wait_ns\":" << queue_wait_ns
+       << ",\"max_queue_wait_ns\":" << max_queue_wait_ns
+       << ",\"stages\":{";
+
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        const auto& s = stages[i];
+        if (i > 0) ss << ",";
+        ss << "\"" << stageName(static_cast<PipelineStage>(i)) << "\":{"
+           << "\"count\":" << s.count
+           << ",\"bytes_in\":" << s.bytes_in
+           << ",\"bytes_out\":" << s.bytes_out
+           << ",\"total_ns\":" << s.total_ns
+           << ",\"max_ns\":" << s.max_ns
+           << ",\"latency_us_log2_histogram\":[";
+        // Trim trailing empty buckets to keep the output readable
+        size_t last = LATENCY_BUCKETS;
+        while (last > 0 && s.latency_histogram[last - 1] == 0) last--;
+        for (size_t b = 0; b < last; ++b) {
+            if (b > 0) ss << ",";
+            ss << s.latency_histogram[b];
+        }
+        ss << "]}";
+    }
+    ss << "}}";
+    return ss.str();
+}
+
+std::string PipelineStatsSnapshot::toText() const {
+    std::stringstream ss;
+    ss << "Files: " << files << "  Blocks: " << blocks << "  Dedup hits: " << dedup_hits
+       << "  Duplicate files: " << file_dedup_hits << "\n";
+    if (delta_blocks > 0) {
+        ss << "Delta blocks: " << delta_blocks << " (" << delta_saved_bytes << " bytes saved)\n";
+    }
+    if (resumed_bytes > 0) {
+        ss << "Resumed from checkpoint: " << resumed_bytes << " bytes\n";
+    }
+    ss << std::left << std::setw(10) << "stage"
+       << std::right << std::setw(10) << "count"
+       << std::setw(14) << "bytes_in"
+       << std::setw(14) << "bytes_out"
+       << std::setw(12) << "total_ms"
+       << std::setw(12) << "avg_us"
+       << std::setw(12) << "max_us" << "\n";
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        const auto& s = stages[i];
+        double avg_us = s.count ? (s.total_ns / 1000.0) / s.count : 0.0;
+        ss << std::left << std::setw(10) << stageName(static_cast<PipelineStage>(i))
+           << std::right << std::setw(10) << s.count
+           << std::setw(14) << s.bytes_in
+           << std::setw(14) << s.bytes_out
+           << std::setw(12) << std::fixed << std::setprecision(2) << s.total_ns / 1e6
+           << std::setw(12) << std::setprecision(1) << avg_us
+           << std::setw(12) << s.max_ns / 1000 << "\n";
+    }
+    ss << "Queue wait total: " << std::fixed << std::setprecision(2) << queue_wait_ns / 1e6
+       << " ms (max " << max_queue_wait_ns / 1000 << " us)\n";
+    return ss.str();
+}
+
+// --- TraceRecorder ---
+
+TraceRecorder::TraceRecorder() : epoch(std::chrono::steady_clock::now()) {}
+
+uint64_t TraceRecorder::nowMicros() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - epoch).count();
+}
+
+uint32_t TraceRecorder::currentThreadIndex() {
+    // Caller holds events_mutex
+    auto id = std::this_thread::get_id();
+    auto it = std::find(thread_ids.begin(), thread_ids.end(), id);
+    if (it != thread_ids.end()) {
+        return static_cast<uint32_t>(it - thread_ids.begin());
+    }
+    thread_ids.push_back(id);
+    return static_cast<uint32_t>(thread_ids.size() - 1);
+}
+
+void TraceRecorder::addEvent(PipelineStage stage, uint64_t start_us, uint64_t duration_us,
+                             uint64_t queue_wait_us, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(events_mutex);
+    events.push_back({stage, currentThreadIndex(), start_us, duration_us, queue_wait_us, bytes});
+}
+
+bool TraceRecorder::writeChromeTrace(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file) return false;
+
+    std::lock_guard<std::mutex> lock(events_mutex);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (size_t t = 0; t < thread_ids.size(); ++t) {
+        if (!first) file << ",\n";
+        first = false;
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+             << ",\"args\":{\"name\":\"worker-" << t << "\"}}";
+    }
+    for (const auto& e : events) {
+        if (!first) file << ",\n";
+        first = false;
+        file << "{\"name\":\"" << stageName(e.stage) << "\",\"cat\":\"pipeline\",\"ph\":\"X\""
+             << ",\"pid\":1,\"tid\":" << e.thread_index
+             << ",\"ts\":" << e.start_us
+             << ",\"dur\":" << e.duration_us
+             << ",\"args\":{\"bytes\":" << e.bytes
+             << ",\"queue_wait_us\":" << e.queue_wait_us << "}}";
+    }
+    file << "\n]}\n";
+    return static_cast<bool>(file);
+}
+
+// --- StageTimer ---
+
+StageTimer::StageTimer(PipelineStats& stats, PipelineStage stage, TraceRecorder* trace, uint64_t queue_wait_us)
+    : stats(stats), stage(stage), trace(trace), queue_wait_us(queue_wait_us),
+      start(std::chrono::steady_clock::now())
+{
+    if (trace) trace_start_us = trace->nowMicros();
+}
+
+StageTimer::~StageTimer() {
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    stats.record(stage, elapsed, bytes_in, bytes_out);
+    if (trace) {
+        trace->addEvent(stage, trace_start_us, elapsed / 1000, queue_wait_us, bytes_in);
+    }
+}
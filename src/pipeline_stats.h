@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Stages of the backup pipeline that are timed individually
+enum class PipelineStage {
+    Read = 0,
+    Hash,
+    Dedup,
+    Compress,
+    Encrypt,
+    Store,
+    Commit,
+    Count
+};
+
+const char* stageName(PipelineStage stage);
+
+constexpr size_t STAGE_COUNT = static_cast<size_t>(PipelineStage::Count);
+
+// Latency histogram bucket i counts operations that took [2^i, 2^(i+1)) microseconds
+// (bucket 0 also holds everything below 1us, the last bucket everything above)
+constexpr size_t LATENCY_BUCKETS = 24;
+
+// Plain copy of one stage's counters
+struct StageSnapshot {
+    uint64_t count = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    std::array<uint64_t, LATENCY_BUCKETS> latency_histogram{};
+};
+
+struct PipelineStatsSnapshot {
+    std::array<StageSnapshot, STAGE_COUNT> stages{};
+    uint64_t files = 0;
+    uint64_t blocks = 0;
+    uint64_t dedup_hits = 0;
+    uint64_t file_dedup_hits = 0;   // Whole files matched by content
+    uint64_t delta_blocks = 0;      // New blocks stored as a delta against a similar block
+    uint64_t delta_saved_bytes = 0; // Stored bytes saved by those deltas
+    uint64_t resumed_bytes = 0;     // Skipped because a checkpoint already covered them
+    uint64_t queue_wait_ns = 0;
+    uint64_t max_queue_wait_ns = 0;
+
+    std::string toJson() const;
+    std::string toText() const;
+};
+
+// Lock-free counters shared by all pipeline workers.
+// Everything uses relaxed atomics: the numbers are statistics, not synchronization.
+class PipelineStats {
+public:
+    void record(PipelineStage stage, uint64_t elapsed_ns, uint64_t bytes_in, uint64_t bytes_out);
+    void recordQueueWait(uint64_t wait_ns);
+    void recordDedupHit();
+    void recordFileDedupHit();
+    void recordDelta(uint64_t saved_bytes);
+    void recordBlock();
+    void recordFile();
+    void recordResumed(uint64_t bytes);
+
+    PipelineStatsSnapshot snapshot() const;
+    void reset();
+
+private:
+    struct StageCounters {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> bytes_in{0};
+        std::atomic<uint64_t> bytes_out{0};
+        std::atomic<uint64_t> total_ns{0};
+        std::atomic<uint64_t> max_ns{0};
+        std::array<std::atomic<uint64_t>, LATENCY_BUCKETS> latency_histogram{};
+    };
+
+    std::array<StageCounters, STAGE_COUNT> stages;
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> blocks{0};
+    std::atomic<uint64_t> dedup_hits{0};
+    std::atomic<uint64_t> file_dedup_hits{0};
+    std::atomic<uint64_t> delta_blocks{0};
+    std::atomic<uint64_t> delta_saved_bytes{0};
+    std::atomic<uint64_t> resumed_bytes{0};
+    std::atomic<uint64_t> queue_wait_ns{0};
+    std::atomic<uint64_t> max_queue_wait_ns{0};
+};
+
+// Collects per-task events and writes them in the Chrome trace event format,
+// which chrome://tracing and ui.perfetto.dev both open.
+class TraceRecorder {
+public:
+    TraceRecorder();
+
+    // Microseconds since the recorder was created
+    uint64_t nowMicros() const;
+
+    void addEvent(PipelineStage stage, uint64_t start_us, uint64_t duration_us,
+                  uint64_t queue_wait_us, uint64_t bytes);
+
+    bool writeChromeTrace(const std::string& path) const;
+
+private:
+    struct TraceEvent {
+        PipelineStage stage;
+        uint32_t thread_index;
+        uint64_t start_us;
+        uint64_t duration_us;
+        uint64_t queue_wait_us;
+        uint64_t bytes;
+    };
+
+    uint32_t currentThreadIndex();
+
+    std::chrono::steady_clock::time_point epoch;
+    mutable std::mutex events_mutex;
+    std::vector<TraceEvent> events;
+    std::vector<std::thread::id> thread_ids;
+};
+
+// Times one stage of one task and reports it on destruction
+class StageTimer {
+public:
+    StageTimer(PipelineStats& stats, PipelineStage stage, TraceRecorder* trace = nullptr,
+               uint64_t queue_wait_us = 0);
+    ~StageTimer();
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    void setBytes(uint64_t in, uint64_t out) { bytes_in = in; bytes_out = out; }
+
+private:
+    PipelineStats& stats;
+    PipelineStage stage;
+    TraceRecorder* trace;
+    uint64_t queue_wait_us;
+    uint64_t trace_start_us = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,117 @@
+#include "progress_reporter.h"
+#include <sstream>
+#include <iomanip>
+
+double ProgressSnapshot::fraction() const {
+    if (bytes_total == 0) return finished ? 1.0 : 0.0;
+    double f = static_cast<double>(bytes_done) / bytes_total;
+    return f > 1.0 ? 1.0 : f;
+}
+
+std::string ProgressSnapshot::toString() const {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1)
+       << fraction() * 100.0 << "% "
+       << bytes_done / (1024.0 * 1024.0) << "/" << bytes_total / (1024.0 * 1024.0) << " MB, "
+       << blocks_done << "/" << blocks_total << " blocks, "
+       << throughput_bps / (1024.0 * 1024.0) << " MB/s, "
+       << "dedup " << dedup_ratio * 100.0 << "%";
+    if (finished) {
+        ss << ", done in " << elapsed_seconds << "s";
+    } else if (eta_seconds >= 0) {
+        ss << ", ETA " << static_cast<uint64_t>(eta_seconds) << "s";
+    }
+    return ss.str();
+}
+
+ProgressTracker::ProgressTracker(ProgressCallback callback, std::chrono::milliseconds interval)
+    : callback(std::move(callback)), interval(interval),
+      start_time(std::chrono::steady_clock::now()), last_sample(start_time)
+{
+    reporter = std::thread([this]() { reporterLoop(); });
+}
+
+ProgressTracker::~ProgressTracker() {
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        stopping = true;
+    }
+    stop_cv.notify_all();
+    if (reporter.joinable()) reporter.join();
+}
+
+void ProgressTracker::addTotal(uint64_t bytes, uint64_t blocks) {
+    bytes_total.fetch_add(bytes, std::memory_order_relaxed);
+    blocks_total.fetch_add(blocks, std::memory_order_relaxed);
+}
+
+void ProgressTracker::addDone(uint64_t bytes, uint64_t blocks) {
+    bytes_done.fetch_add(bytes, std::memory_order_relaxed);
+    blocks_done.fetch_add(blocks, std::memory_order_relaxed);
+}
+
+void ProgressTracker::addDedup(uint64_t bytes) {
+    dedup_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void ProgressTracker::finish() {
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        if (finished) return;
+        finished = true;
+        stopping = true;
+    }
+    stop_cv.notify_all();
+    if (reporter.joinable()) reporter.join();
+
+    if (callback) callback(sample(true));
+}
+
+void ProgressTracker::reporterLoop() {
+    std::unique_lock<std::mutex> lock(stop_mutex);
+    while (!stopping) {
+        if (stop_cv.wait_for(lock, interval, [this] { return stopping; })) break;
+        lock.unlock();
+        if (callback) callback(sample(false));
+        lock.lock();
+    }
+}
+
+ProgressSnapshot ProgressTracker::sample(bool is_finished) {
+    auto now = std::chrono::steady_clock::now();
+
+    ProgressSnapshot snap;
+    snap.bytes_total = bytes_total.load(std::memory_order_relaxed);
+    snap.bytes_done = bytes_done.load(std::memory_order_relaxed);
+    snap.blocks_total = blocks_total.load(std::memory_order_relaxed);
+    snap.blocks_done = blocks_done.load(std::memory_order_relaxed);
+    snap.dedup_bytes = dedup_bytes.load(std::memory_order_relaxed);
+    snap.finished = is_finished;
+    snap.elapsed_seconds = std::chrono::duration<double>(now - start_time).count();
+
+    // Exponentially smoothed throughput over the sampling intervals
+    double dt = std::chrono::duration<double>(now - last_sample).count();
+    if (dt > 0) {
+        double instant = (snap.bytes_done - last_bytes) / dt;
+        smoothed_bps = (last_bytes == 0 && smoothed_bps == 0.0) ? instant : 0.7 * smoothed_bps + 0.3 * instant;
+    }
+    last_bytes = snap.bytes_done;
+    last_sample = now;
+
+    if (is_finished && snap.elapsed_seconds > 0) {
+        snap.throughput_bps = snap.bytes_done / snap.elapsed_seconds;
+    } else {
+        snap.throughput_bps = smoothed_bps;
+    }
+
+    if (snap.bytes_done > 0) {
+        snap.dedup_ratio = static_cast<double>(snap.dedup_bytes) / snap.bytes_done;
+    }
+
+    if (is_finished) {
+        snap.eta_seconds = 0.0;
+    } else if (snap.throughput_bps > 0 && snap.bytes_total >= snap.bytes_done) {
+        snap.eta_seconds = (snap.bytes_total - snap.bytes_done) / snap.throughput_bps;
+    }
+    return snap;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct ProgressSnapshot {
+    uint64_t bytes_total = 0;
+    uint64_t bytes_done = 0;
+    uint64_t blocks_total = 0;
+    uint64_t blocks_done = 0;
+    uint64_t dedup_bytes = 0;     // Bytes of blocks that were already stored
+
+    double elapsed_seconds = 0.0;
+    double throughput_bps = 0.0;  // Smoothed bytes per second
+    double dedup_ratio = 0.0;     // dedup_bytes / bytes_done (0..1)
+    double eta_seconds = -1.0;    // -1 while unknown
+    bool finished = false;
+
+    // Completed fraction in [0, 1]
+    double fraction() const;
+
+    // One-line human readable summary, e.g. for a CLI progress line
+    std::string toString() const;
+};
+
+using ProgressCallback = std::function<void(const ProgressSnapshot&)>;
+
+// Hot-path side is a handful of relaxed atomic adds. A reporter thread samples
+// the counters every `interval`, derives throughput/ETA and invokes the callback,
+// so the callback never runs on a pipeline worker.
+class ProgressTracker {
+public:
+    ProgressTracker(ProgressCallback callback, std::chrono::milliseconds interval);
+    ~ProgressTracker();
+
+    ProgressTracker(const ProgressTracker&) = delete;
+    ProgressTracker& operator=(const ProgressTracker&) = delete;
+
+    void addTotal(uint64_t bytes, uint64_t blocks);
+    void addDone(uint64_t bytes, uint64_t blocks = 1);
+    void addDedup(uint64_t bytes);
+
+    // Stop the reporter thread and deliver a final snapshot with finished = true
+    void finish();
+
+private:
+    void reporterLoop();
+    ProgressSnapshot sample(bool finished);
+
+    ProgressCallback callback;
+    std::chrono::milliseconds interval;
+    std::chrono::steady_clock::time_point start_time;
+
+    std::atomic<uint64_t> bytes_total{0};
+    std::atomic<uint64_t> bytes_done{0};
+    std::atomic<uint64_t> blocks_total{0};
+    std::atomic<uint64_t> blocks_done{0};
+    std::atomic<uint64_t> dedup_bytes{0};
+
+    // Only touched by whichever thread is sampling (reporter, then finish())
+    double smoothed_bps = 0.0;
+    uint64_t last_bytes = 0;
+    std::chrono::steady_clock::time_point last_sample;
+
+    std::mutex stop_mutex;
+    std::condition_variable stop_cv;
+    bool stopping = false;
+    bool finished = false;
+    std::thread reporter;
+};
@@ -0,0 +1,44 @@
+#include "rate_limiter.h"
+#include <thread>
+
+TokenBucket::TokenBucket(uint64_t rate, uint64_t burst_tokens)
+    : last_refill(std::chrono::steady_clock::now())
+{
+    setRate(rate, burst_tokens);
+    tokens = burst;   // Start with a full bucket
+}
+
+void TokenBucket::setRate(uint64_t rate, uint64_t burst_tokens) {
+    std::lock_guard<std::mutex> lock(bucket_mutex);
+    refill(std::chrono::steady_clock::now());
+    rate_per_second = static_cast<double>(rate);
+    burst = static_cast<double>(burst_tokens ? burst_tokens : rate);
+    if (tokens > burst) tokens = burst;
+}
+
+uint64_t TokenBucket::rate() const {
+    std::lock_guard<std::mutex> lock(bucket_mutex);
+    return static_cast<uint64_t>(rate_per_second);
+}
+
+void TokenBucket::refill(std::chrono::steady_clock::time_point now) {
+    // Caller holds bucket_mutex
+    double elapsed = std::chrono::duration<double>(now - last_refill).count();
+    last_refill = now;
+    tokens += elapsed * rate_per_second;
+    if (tokens > burst) tokens = burst;
+}
+
+void TokenBucket::acquire(uint64_t count) {
+    double wait_seconds = 0.0;
+    {
+        std::lock_guard<std::mutex> lock(bucket_mutex);
+        if (rate_per_second <= 0.0) return;
+        refill(std::chrono::steady_clock::now());
+        tokens -= static_cast<double>(count);
+        if (tokens < 0.0) wait_seconds = -tokens / rate_per_second;
+    }
+    if (wait_seconds > 0.0) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait_seconds));
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <chrono>
+
+// Token bucket shared by worker threads. acquire() takes the tokens immediately
+// and sleeps off any deficit, so one large request (e.g. a 256 KiB block against
+// a small burst) is paced instead of rejected. A rate of 0 means unlimited.
+class TokenBucket {
+public:
+    explicit TokenBucket(uint64_t rate_per_second = 0, uint64_t burst = 0);
+
+    // Block until `tokens` may be consumed
+    void acquire(uint64_t tokens);
+
+    // Change the rate at runtime (0 = unlimited). Burst defaults to one second worth.
+    void setRate(uint64_t rate_per_second, uint64_t burst = 0);
+    uint64_t rate() const;
+
+private:
+    void refill(std::chrono::steady_clock::time_point now);
+
+    mutable std::mutex bucket_mutex;
+    double rate_per_second = 0.0;
+    double burst = 0.0;
+    double tokens = 0.0;
+    std::chrono::steady_clock::time_point last_refill;
+};
@@ -0,0 +1,245 @@
+#include "replicator.h"
+#include "buffer_pool.h"
+#include <future>
+#include <stdexcept>
+
+namespace {
+
+// Order-independent summary of the hashes in one range
+struct RangeDigest {
+    uint64_t count = 0;
+    uint64_t xor_fold = 0;
+    uint64_t sum_fold = 0;
+    uint64_t compressed_bytes = 0;
+
+    bool operator==(const RangeDigest& other) const {
+        return count == other.count && xor_fold == other.xor_fold && sum_fold == other.sum_fold;
+    }
+};
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 0;
+}
+
+// Leading `chars` hex digits of a hash as a number
+size_t rangeOf(const std::string& hash, unsigned chars) {
+    size_t index = 0;
+    for (unsigned i = 0; i < chars; ++i) {
+        index = index << 4 | (i < hash.size() ? hexValue(hash[i]) : 0);
+    }
+    return index;
+}
+
+// Lower bound of range `index` as a hash prefix, e.g. 0x3a7 -> "3a7"
+std::string rangePrefix(size_t index, unsigned chars) {
+    static const char* digits = "0123456789abcdef";
+    std::string prefix(chars, '0');
+    for (unsigned i = chars; i-- > 0; index >>= 4) prefix[i] = digits[index & 0xf];
+    return prefix;
+}
+
+uint64_t hashWord(const std::string& hash) {
+    uint64_t word = 0;
+    for (size_t i = 0; i < 16 && i < hash.size(); ++i) word = word << 4 | hexValue(hash[i]);
+    return word;
+}
+
+std::vector<RangeDigest> rangeDigests(MetadataDB& db, unsigned chars) {
+    std::vector<RangeDigest> digests(size_t(1) << (4 * chars));
+    db.forEachBlockInRange("", "", [&](const DBBlock& block) {
+        auto& d = digests[rangeOf(block.block_hash, chars)];
+        uint64_t word = hashWord(block.block_hash);
+        d.count++;
+        d.xor_fold ^= word;
+        d.sum_fold += word;
+        d.compressed_bytes += block.compressed_size;
+    });
+    return digests;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+Replicator::Replicator(
+    std::shared_ptr<MetadataDB> source_db,
+    std::shared_ptr<StorageManager> source_storage,
+    std::shared_ptr<MetadataDB> target_db,
+    std::shared_ptr<StorageManager> target_storage,
+    std::shared_ptr<ThreadPool> tp,
+    std::string source_id
+) : source_db(source_db), source_storage(source_storage), target_db(target_db),
+    target_storage(target_storage), tp(tp), source_id(std::move(source_id)) {}
+
+void Replicator::setProgressCallback(ProgressCallback callback, std::chrono::milliseconds interval) {
+    progress_callback = std::move(callback);
+    progress_interval = interval;
+}
+
+void Replicator::copyBlocks(const std::vector<DBBlock>& blocks, ReplicationReport& report, ProgressTracker* progress) {
+    // Stored payloads are copied as they are (still compressed, still
+    // encrypted); the source CRC is checked on read, so damage is not propagated
+    std::vector<std::future<size_t>> futures;
+    futures.reserve(blocks.size());
+    for (const auto& block : blocks) {
+        futures.push_back(tp->enqueue([this, &block, progress]() {
+            uint32_t flags = 0;
+            PooledBuffer payload = source_storage->readBlock(block.block_hash, *BufferPool::defaultPool(), &flags);
+            if (!target_storage->writeBlock(block.block_hash, payload.data(), payload.size(), flags)) {
+                throw std::runtime_error("Failed to write block: " + block.block_hash);
+            }
+            if (progress) progress->addDone(payload.size());
+            return payload.size();
+        }));
+    }
+
+    // Wait for every copy before rethrowing so no task outlives `blocks`
+    std::exception_ptr error;
+    for (auto& f : futures) {
+        try {
+            report.bytes_copied += f.get();
+        } catch (...) {
+            if (!error) error = std::current_exception();
+        }
+    }
+    if (error) std::rethrow_exception(error);
+
+    // Rows last: a block is only listed in the target once its file is in place
+    target_db->storeBlocks(blocks);
+    report.blocks_copied += blocks.size();
+}
+
+void Replicator::addMissingBases(std::vector<DBBlock>& batch, std::unordered_set<std::string>& added) {
+    std::unordered_set<std::string> listed;
+    for (const auto& block : batch) listed.insert(block.block_hash);
+    // The batch grows while it is scanned, which covers bases of bases
+    for (size_t i = 0; i < batch.size(); ++i) {
+        std::string base = batch[i].delta_base;
+        if (base.empty() || listed.count(base) || target_db->findBlock(base) != 0) continue;
+        DBBlock block;
+        if (!source_db->getBlock(base, block)) throw std::runtime_error("Delta base not in catalog: " + base);
+        listed.insert(base);
+        added.insert(base);
+        batch.push_back(std::move(block));
+    }
+}
+
+void Replicator::copyCatalog(uint64_t last_version_id, uint64_t last_snapshot_id,
+                             const ReplicationOptions& options, ReplicationReport& report) {
+    uint64_t cursor = target_db->getReplicaVersionCursor(source_id);
+    while (cursor < last_version_id) {
+        auto records = source_db->listVersionRecords(cursor, last_version_id, options.batch_versions);
+        if (records.empty()) break;
+
+        std::vector<ReplicaVersion> batch;
+        batch.reserve(records.size());
+        for (auto& record : records) {
+            ReplicaVersion replica;
+            replica.record = std::move(record);
+            uint64_t vid = replica.record.version_id;
+            if (replica.record.source_version_id == 0) {
+                DBPackedExtent extent;
+                if (source_db->getPackedExtent(vid, extent)) {
+                    replica.packed = true;
+                    replica.packed_offset = extent.offset;
+                    replica.block_hashes.push_back(extent.block_hash);
+                } else {
+                    source_db->forEachVersionBlock(vid, [&](const DBBlockRef& ref) {
+                        replica.block_hashes.push_back(ref.block_hash);
+                        return true;
+                    });
+                }
+            }
+            batch.push_back(std::move(replica));
+        }
+
+        target_db->importVersions(source_id, batch);
+        report.versions_copied += batch.size();
+        cursor = batch.back().record.version_id;
+    }
+
+    uint64_t snapshot_cursor = target_db->getReplicaSnapshotCursor(source_id);
+    while (snapshot_cursor < last_snapshot_id) {
+        auto snapshots = source_db->listSnapshots(snapshot_cursor, last_snapshot_id, options.batch_versions);
+        if (snapshots.empty()) break;
+        target_db->importSnapshots(source_id, snapshots);
+        report.snapshots_copied += snapshots.size();
+        snapshot_cursor = snapshots.back().snapshot_id;
+    }
+}
+
+ReplicationReport Replicator::replicate(const ReplicationOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    ReplicationReport report;
+    if (options.range_prefix_chars == 0 || options.range_prefix_chars > 6) {
+        throw std::runtime_error("range_prefix_chars must be between 1 and 6");
+    }
+
+    // Catalog rows up to here only reference blocks that are already listed,
+    // since a backup stores its blocks before it creates versions. Capturing
+    // the high-water marks first keeps a concurrent backup out of this run.
+    uint64_t last_version_id = source_db->getMaxVersionId();
+    uint64_t last_snapshot_id = source_db->getMaxSnapshotId();
+
+    unsigned chars = options.range_prefix_chars;
+    auto source_digests = rangeDigests(*source_db, chars);
+    auto target_digests = rangeDigests(*target_db, chars);
+    report.ranges_compared = source_digests.size();
+
+    std::vector<size_t> different;
+    uint64_t bytes_estimate = 0, blocks_estimate = 0;
+    for (size_t i = 0; i < source_digests.size(); ++i) {
+        const auto& s = source_digests[i];
+        const auto& t = target_digests[i];
+        if (s.count == 0 || s == t) continue;
+        different.push_back(i);
+        if (s.count > t.count) blocks_estimate += s.count - t.count;
+        if (s.compressed_bytes > t.compressed_bytes) bytes_estimate += s.compressed_bytes - t.compressed_bytes;
+    }
+    report.ranges_different = different.size();
+
+    std::unique_ptr<ProgressTracker> progress;
+    if (progress_callback && !different.empty()) {
+        progress = std::make_unique<ProgressTracker>(progress_callback, progress_interval);
+        progress->addTotal(bytes_estimate, blocks_estimate);
+    }
+
+    // Merge the sorted hash lists of each differing range
+    std::vector<DBBlock> batch;
+    batch.reserve(options.batch_blocks);
+    std::unordered_set<std::string> added_bases;
+    for (size_t range : different) {
+        std::string first = rangePrefix(range, chars);
+        std::string end = range + 1 < source_digests.size() ? rangePrefix(range + 1, chars) : "";
+
+        std::vector<std::string> present;
+        target_db->forEachBlockInRange(first, end, [&](const DBBlock& block) { present.push_back(block.block_hash); });
+        size_t next = 0;
+        source_db->forEachBlockInRange(first, end, [&](const DBBlock& block) {
+            while (next < present.size() && present[next] < block.block_hash) next++;
+            if (next < present.size() && present[next] == block.block_hash) return;
+            if (added_bases.count(block.block_hash)) return;
+            batch.push_back(block);
+            if (batch.size() >= options.batch_blocks) {
+                addMissingBases(batch, added_bases);
+                copyBlocks(batch, report, progress.get());
+                batch.clear();
+            }
+        });
+    }
+    if (!batch.empty()) {
+        addMissingBases(batch, added_bases);
+        copyBlocks(batch, report, progress.get());
+    }
+    if (progress) progress->finish();
+
+    copyCatalog(last_version_id, last_snapshot_id, options, report);
+
+    report.elapsed_seconds = secondsSince(start);
+    return report;
+}
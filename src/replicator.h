@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <chrono>
+#include <unordered_set>
+#include "metadata_db.h"
+#include "storage_manager.h"
+#include "thread_pool.h"
+#include "progress_reporter.h"
+
+struct ReplicationOptions {
+    size_t batch_blocks = 256;      // Blocks copied in parallel before their rows are committed
+    size_t batch_versions = 512;    // Catalog versions applied per transaction
+    unsigned range_prefix_chars = 3; // Block hash space split into 16^n ranges for the comparison
+};
+
+struct ReplicationReport {
+    uint64_t ranges_compared = 0;
+    uint64_t ranges_different = 0;  // Ranges whose digests differ and were listed block by block
+    uint64_t blocks_copied = 0;
+    uint64_t bytes_copied = 0;      // Stored (compressed) bytes
+    uint64_t versions_copied = 0;
+    uint64_t snapshots_copied = 0;
+    double elapsed_seconds = 0.0;
+};
+
+// Pushes one repository into another: only blocks the target lacks are
+// copied, then the catalog rows the target has not seen yet are applied.
+//
+// Both block sets are summarized as digests of hash-prefix ranges (count and
+// XOR/sum of the hashes, computed from one ordered index scan per side); only
+// ranges whose digests differ are listed and merged. Missing blocks are copied
+// in parallel batches, each batch's block rows committed after its files are
+// written. Versions and snapshots are applied in source id order, a batch per
+// transaction, together with the source -> target id mapping that serves as
+// the replication cursor. An interrupted run therefore loses at most one batch
+// and the next run continues where it stopped.
+class Replicator {
+public:
+    // `source_id` names the source repository in the target's replica cursors
+    Replicator(
+        std::shared_ptr<MetadataDB> source_db,
+        std::shared_ptr<StorageManager> source_storage,
+        std::shared_ptr<MetadataDB> target_db,
+        std::shared_ptr<StorageManager> target_storage,
+        std::shared_ptr<ThreadPool> tp,
+        std::string source_id
+    );
+
+    ReplicationReport replicate(const ReplicationOptions& options = {});
+
+    // Receive progress snapshots while blocks are copied (called from a reporter thread)
+    void setProgressCallback(ProgressCallback callback,
+                             std::chrono::milliseconds interval = std::chrono::milliseconds(250));
+
+private:
+    void copyBlocks(const std::vector<DBBlock>& blocks, ReplicationReport& report, ProgressTracker* progress);
+
+    // Append the bases of delta blocks in `batch` that the target lacks (and
+    // their bases), so no batch leaves a delta behind without its base. Their
+    // hashes go into `added` so their own hash range does not copy them again.
+    void addMissingBases(std::vector<DBBlock>& batch, std::unordered_set<std::string>& added);
+    void copyCatalog(uint64_t last_version_id, uint64_t last_snapshot_id, const ReplicationOptions& options,
+                     ReplicationReport& report);
+
+    std::shared_ptr<MetadataDB> source_db;
+    std::shared_ptr<StorageManager> source_storage;
+    std::shared_ptr<MetadataDB> target_db;
+    std::shared_ptr<StorageManager> target_storage;
+    std::shared_ptr<ThreadPool> tp;
+    std::string source_id;
+    ProgressCallback progress_callback;
+    std::chrono::milliseconds progress_interval{250};
+};
@@ -0,0 +1,344 @@
+#include "repository_verifier.h"
+#include "block_cipher.h"
+#include "block_reader.h"
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <future>
+#include <random>
+#include <unordered_set>
+#include "rate_limiter.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Blocks per batch; the checkpoint advances once a whole batch is verified
+constexpr size_t VERIFY_BATCH = 256;
+
+uint64_t mix64(uint64_t x) {
+    // splitmix64 finalizer
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Same seed, same sample: a resumed scrub continues with the blocks it would have checked
+bool sampled(uint64_t block_id, uint64_t seed, double fraction) {
+    if (fraction >= 1.0) return true;
+    if (fraction <= 0.0) return false;
+    return static_cast<double>(mix64(block_id ^ seed)) < fraction * 18446744073709551616.0;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct BlockResult {
+    bool ok = true;
+    CorruptBlock fault;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_verified = 0;
+};
+
+} // namespace
+
+const char* blockFaultName(BlockFault fault) {
+    switch (fault) {
+        case BlockFault::Missing:          return "missing";
+        case BlockFault::ChecksumMismatch: return "checksum-mismatch";
+        case BlockFault::SizeMismatch:     return "size-mismatch";
+        case BlockFault::DecryptFailed:    return "decrypt-failed";
+        case BlockFault::DecompressFailed: return "decompress-failed";
+        case BlockFault::HashMismatch:     return "hash-mismatch";
+        default:                           return "unknown";
+    }
+}
+
+RepositoryVerifier::RepositoryVerifier(
+    std::shared_ptr<MetadataDB> db,
+    std::shared_ptr<StorageManager> storage,
+    std::shared_ptr<HashEngine> hasher,
+    std::shared_ptr<ThreadPool> tp
+) : db(db), storage(storage), hasher(hasher), tp(tp) {}
+
+void RepositoryVerifier::setProgressCallback(ProgressCallback callback, std::chrono::milliseconds interval) {
+    progress_callback = std::move(callback);
+    progress_interval = interval;
+}
+
+bool RepositoryVerifier::checkBlock(const DBBlock& block, CorruptBlock& fault, uint64_t& bytes_verified) {
+    fault.block_id = block.block_id;
+    fault.block_hash = block.block_hash;
+
+    BufferPool& pool = *BufferPool::defaultPool();
+    PooledBuffer compressed;
+    uint32_t flags = 0;
+    try {
+        compressed = storage->readBlock(block.block_hash, pool, &flags);
+    } catch (const BlockCorruptError& e) {
+        fault.fault = BlockFault::ChecksumMismatch;
+        fault.detail = e.what();
+        return false;
+    } catch (const std::exception& e) {
+        fault.fault = BlockFault::Missing;
+        fault.detail = e.what();
+        return false;
+    }
+
+    if (compressed.size() != static_cast<size_t>(block.compressed_size)) {
+        fault.fault = BlockFault::SizeMismatch;
+        fault.detail = "stored " + std::to_string(compressed.size()) + " bytes, expected " + std::to_string(block.compressed_size);
+        return false;
+    }
+
+    // A delta's frame follows the base reference
+    uint8_t* frame = compressed.data();
+    size_t compressed_size = compressed.size();
+    std::string base_hash;
+    if (flags & BLOCK_FLAG_DELTA) {
+        try {
+            base_hash = deltaBaseHash(frame, compressed_size);
+        } catch (const std::exception& e) {
+            fault.fault = BlockFault::DecompressFailed;
+            fault.detail = e.what();
+            return false;
+        }
+        frame += DELTA_BASE_SIZE;
+        compressed_size -= DELTA_BASE_SIZE;
+    }
+
+    if (flags & BLOCK_FLAG_ENCRYPTED) {
+        if (!cipher) {
+            bytes_verified = 0;
+            return true;
+        }
+        try {
+            size_t aad_size = (flags & BLOCK_FLAG_BASE_SEALED) ? DELTA_BASE_SIZE : 0;
+            compressed_size = cipher->decrypt(block.block_hash, frame, compressed_size, blockGeneration(flags),
+                                              frame - aad_size, aad_size);
+        } catch (const std::exception& e) {
+            fault.fault = BlockFault::DecryptFailed;
+            fault.detail = e.what();
+            return false;
+        }
+    }
+
+    PooledBuffer data = pool.acquire(block.size > 0 ? static_cast<size_t>(block.size) : 0);
+    try {
+        if (base_hash.empty()) {
+            hasher->decompressBlockInto(frame, compressed_size, data);
+        } else {
+            // A damaged base shows up here too, and again when its own row is checked
+            BlockReader bases(storage, hasher);
+            bases.setCipher(cipher);
+            BlockBuffer base = bases.read(base_hash);
+            hasher->decompressDeltaInto(frame, compressed_size, base->data(), base->size(), data);
+        }
+    } catch (const std::exception& e) {
+        fault.fault = BlockFault::DecompressFailed;
+        fault.detail = e.what();
+        return false;
+    }
+
+    if (data.size() != static_cast<size_t>(block.size)) {
+        fault.fault = BlockFault::SizeMismatch;
+        fault.detail = "decompressed " + std::to_string(data.size()) + " bytes, expected " + std::to_string(block.size);
+        return false;
+    }
+
+    std::string actual = hasher->computeBlockHash(data.data(), data.size());
+    if (flags & BLOCK_FLAG_ENCRYPTED) actual = cipher->blockName(actual);
+    if (actual != block.block_hash) {
+        fault.fault = BlockFault::HashMismatch;
+        fault.detail = "content hash " + actual;
+        return false;
+    }
+
+    bytes_verified = data.size();
+    return true;
+}
+
+VerifyReport RepositoryVerifier::verify(const VerifyOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+
+    Checkpoint checkpoint;
+    if (options.resume && !options.checkpoint_path.empty() && loadCheckpoint(options.checkpoint_path, checkpoint)) {
+        checkpoint.partial.resumed_after_block = checkpoint.last_block_id;
+    } else {
+        checkpoint = Checkpoint();
+        checkpoint.seed = std::random_device{}();
+    }
+    VerifyReport& report = checkpoint.partial;
+    double previous_elapsed = report.elapsed_seconds;   // Time spent before a resume
+
+    std::unique_ptr<ProgressTracker> progress;
+    if (progress_callback) {
+        auto totals = db->getBlockTotals(checkpoint.last_block_id);
+        double fraction = options.sample_fraction < 1.0 ? options.sample_fraction : 1.0;
+        progress = std::make_unique<ProgressTracker>(progress_callback, progress_interval);
+        progress->addTotal(static_cast<uint64_t>(totals.second * fraction),
+                           static_cast<uint64_t>(totals.first * fraction));
+    }
+
+    TokenBucket read_limit(options.max_bytes_per_second);
+
+    while (true) {
+        auto batch = db->listBlocks(checkpoint.last_block_id, VERIFY_BATCH);
+        if (batch.empty()) break;
+
+        std::vector<std::future<BlockResult>> futures;
+        futures.reserve(batch.size());
+        for (const auto& block : batch) {
+            if (!sampled(block.block_id, checkpoint.seed, options.sample_fraction)) {
+                report.blocks_skipped++;
+                continue;
+            }
+            futures.push_back(tp->enqueue([this, block, &read_limit, &progress]() {
+                read_limit.acquire(block.compressed_size);
+                BlockResult result;
+                result.ok = checkBlock(block, result.fault, result.bytes_verified);
+                result.bytes_read = block.compressed_size;
+                if (progress) progress->addDone(result.bytes_read);
+                return result;
+            }));
+        }
+
+        for (auto& f : futures) {
+            BlockResult result = f.get();
+            report.blocks_checked++;
+            report.bytes_read += result.bytes_read;
+            report.bytes_verified += result.bytes_verified;
+            if (!result.ok) report.corrupt.push_back(result.fault);
+        }
+
+        checkpoint.last_block_id = batch.back().block_id;
+        report.elapsed_seconds = previous_elapsed + secondsSince(start);
+        if (!options.checkpoint_path.empty()) saveCheckpoint(options.checkpoint_path, checkpoint);
+    }
+
+    if (progress) progress->finish();
+
+    // Map damaged blocks back to the versions that can no longer be restored
+    if (!report.corrupt.empty()) {
+        std::vector<uint64_t> ids;
+        for (const auto& c : report.corrupt) ids.push_back(c.block_id);
+        report.affected_versions = db->findVersionsUsingBlocks(ids);
+    }
+
+    // The scan is complete; a later --resume starts over
+    if (!options.checkpoint_path.empty()) {
+        std::error_code ec;
+        fs::remove(options.checkpoint_path, ec);
+    }
+
+    report.elapsed_seconds = previous_elapsed + secondsSince(start);
+    return report;
+}
+
+VerifyReport RepositoryVerifier::verifyRange(uint64_t version_id, uint64_t offset, uint64_t length) {
+    auto start = std::chrono::steady_clock::now();
+    VerifyReport report;
+
+    std::vector<DBBlockRef> refs;
+    DBPackedExtent extent;
+    if (db->getPackedExtent(version_id, extent)) {
+        // A packed file lives in one aggregate block and has no tree
+        DBBlockRef ref;
+        if (db->getBlockRef(extent.block_id, ref)) refs.push_back(ref);
+    } else {
+        uint64_t first_offset = 0;
+        refs = db->getVerifiedRange(version_id, offset, length, first_offset);
+    }
+
+    std::vector<std::future<BlockResult>> futures;
+    futures.reserve(refs.size());
+    std::unordered_set<uint64_t> seen;   // A block repeated within the range is read once
+    for (const auto& ref : refs) {
+        if (!seen.insert(ref.block_id).second) continue;
+        // Delta payloads name their base themselves, so the chain fields stay at "stored whole"
+        DBBlock block;
+        block.block_id = ref.block_id;
+        block.block_hash = ref.block_hash;
+        block.size = static_cast<int>(ref.size);
+        block.compressed_size = static_cast<int>(ref.compressed_size);
+        futures.push_back(tp->enqueue([this, block]() {
+            BlockResult result;
+            result.ok = checkBlock(block, result.fault, result.bytes_verified);
+            result.bytes_read = block.compressed_size;
+            return result;
+        }));
+    }
+
+    for (auto& f : futures) {
+        BlockResult result = f.get();
+        report.blocks_checked++;
+        report.bytes_read += result.bytes_read;
+        report.bytes_verified += result.bytes_verified;
+        if (!result.ok) report.corrupt.push_back(result.fault);
+    }
+    if (!report.corrupt.empty()) report.affected_versions.push_back(version_id);
+
+    report.elapsed_seconds = secondsSince(start);
+    return report;
+}
+
+// Checkpoint file (text):
+//   deltavault-verify 1
+//   seed <n>
+//   last_block_id <n>
+//   counters <checked> <skipped> <bytes_read> <bytes_verified> <elapsed_seconds>
+//   corrupt <block_id> <fault> <hash> <detail...>     (one line per fault found so far)
+bool RepositoryVerifier::loadCheckpoint(const std::string& path, Checkpoint& checkpoint) {
+    std::ifstream file(path);
+    if (!file) return false;
+
+    std::string line, key;
+    if (!std::getline(file, line) || line != "deltavault-verify 1") return false;
+
+    Checkpoint loaded;
+    while (std::getline(file, line)) {
+        std::istringstream ss(line);
+        ss >> key;
+        if (key == "seed") {
+            ss >> loaded.seed;
+        } else if (key == "last_block_id") {
+            ss >> loaded.last_block_id;
+        } else if (key == "counters") {
+            ss >> loaded.partial.blocks_checked >> loaded.partial.blocks_skipped
+               >> loaded.partial.bytes_read >> loaded.partial.bytes_verified
+               >> loaded.partial.elapsed_seconds;
+        } else if (key == "corrupt") {
+            CorruptBlock c;
+            int fault = 0;
+            ss >> c.block_id >> fault >> c.block_hash;
+            c.fault = static_cast<BlockFault>(fault);
+            std::getline(ss >> std::ws, c.detail);
+            loaded.partial.corrupt.push_back(c);
+        }
+    }
+    checkpoint = loaded;
+    return true;
+}
+
+void RepositoryVerifier::saveCheckpoint(const std::string& path, const Checkpoint& checkpoint) {
+    // Write aside and rename so a crash never leaves a half-written checkpoint
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!file) throw std::runtime_error("Failed to write checkpoint: " + tmp_path);
+        const auto& r = checkpoint.partial;
+        file << "deltavault-verify 1\n"
+             << "seed " << checkpoint.seed << "\n"
+             << "last_block_id " << checkpoint.last_block_id << "\n"
+             << "counters " << r.blocks_checked << " " << r.blocks_skipped << " "
+             << r.bytes_read << " " << r.bytes_verified << " " << r.elapsed_seconds << "\n";
+        for (const auto& c : r.corrupt) {
+            file << "corrupt " << c.block_id << " " << static_cast<int>(c.fault) << " "
+                 << c.block_hash << " " << c.detail << "\n";
+        }
+        if (!file) throw std::runtime_error("Failed to write checkpoint: " + tmp_path);
+    }
+    fs::rename(tmp_path, path);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include "metadata_db.h"
+#include "storage_manager.h"
+#include "hash_engine.h"
+#include "thread_pool.h"
+#include "progress_reporter.h"
+
+class BlockCipher;
+
+enum class BlockFault {
+    Missing,            // Block file cannot be read
+    ChecksumMismatch,   // Stored bytes fail the block file's CRC-32C
+    SizeMismatch,       // Stored or decompressed size differs from the blocks table
+    DecryptFailed,      // GCM tag does not verify under the repository key
+    DecompressFailed,   // Not a valid zstd frame
+    HashMismatch        // Content no longer matches its SHA-256
+};
+
+const char* blockFaultName(BlockFault fault);
+
+struct CorruptBlock {
+    uint64_t block_id;
+    std::string block_hash;
+    BlockFault fault;
+    std::string detail;
+};
+
+struct VerifyOptions {
+    double sample_fraction = 1.0;        // Check this fraction of blocks (deterministic per seed)
+    uint64_t max_bytes_per_second = 0;   // Read rate limit, 0 = unlimited
+    std::string checkpoint_path;         // Progress is saved here after every batch (empty = none)
+    bool resume = false;                 // Continue from checkpoint_path if it exists
+};
+
+struct VerifyReport {
+    uint64_t blocks_checked = 0;
+    uint64_t blocks_skipped = 0;         // Not selected by sampling
+    uint64_t bytes_read = 0;             // Compressed bytes read from storage
+    uint64_t bytes_verified = 0;         // Decompressed bytes hashed (encrypted blocks need a key)
+    uint64_t resumed_after_block = 0;    // 0 if the scan started from the beginning
+    double elapsed_seconds = 0.0;
+    std::vector<CorruptBlock> corrupt;
+    std::vector<uint64_t> affected_versions;
+
+    bool ok() const { return corrupt.empty(); }
+};
+
+// Scrubs the repository: re-reads stored blocks in parallel on the thread pool,
+// decompresses them, and checks sizes and SHA-256 against the blocks table.
+// Blocks are visited in block_id order in batches; after each batch the last
+// verified block_id is checkpointed so an interrupted scrub can resume.
+class RepositoryVerifier {
+public:
+    RepositoryVerifier(
+        std::shared_ptr<MetadataDB> db,
+        std::shared_ptr<StorageManager> storage,
+        std::shared_ptr<HashEngine> hasher,
+        std::shared_ptr<ThreadPool> tp
+    );
+
+    VerifyReport verify(const VerifyOptions& options);
+
+    // Check only the blocks of one version that overlap [offset, offset + length).
+    // They are found through the version's Merkle tree, whose nodes are checked
+    // on the way down, so the work is proportional to the range rather than to
+    // the file or the repository.
+    VerifyReport verifyRange(uint64_t version_id, uint64_t offset, uint64_t length);
+
+    // Receive progress snapshots while verify is running (called from a reporter thread)
+    void setProgressCallback(ProgressCallback callback,
+                             std::chrono::milliseconds interval = std::chrono::milliseconds(250));
+
+    // Key for encrypted blocks. Without one they are only checked against
+    // their CRC-32C and stored size.
+    void setCipher(std::shared_ptr<BlockCipher> block_cipher) { cipher = std::move(block_cipher); }
+
+private:
+    struct Checkpoint {
+        uint64_t seed = 0;
+        uint64_t last_block_id = 0;
+        VerifyReport partial;
+    };
+
+    bool checkBlock(const DBBlock& block, CorruptBlock& fault, uint64_t& bytes_verified);
+    bool loadCheckpoint(const std::string& path, Checkpoint& checkpoint);
+    void saveCheckpoint(const std::string& path, const Checkpoint& checkpoint);
+
+    std::shared_ptr<MetadataDB> db;
+    std::shared_ptr<StorageManager> storage;
+    std::shared_ptr<HashEngine> hasher;
+    std::shared_ptr<ThreadPool> tp;
+    std::shared_ptr<BlockCipher> cipher;
+    ProgressCallback progress_callback;
+    std::chrono::milliseconds progress_interval{250};
+};
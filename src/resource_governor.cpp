@@ -0,0 +1,294 @@
+#include "resource_governor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+uint64_t nanosSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+uint64_t scaledRate(uint64_t rate, double factor) {
+    if (rate == 0) return 0;
+    return std::max<uint64_t>(1, static_cast<uint64_t>(rate * factor));
+}
+
+// Oversleep of a 1 ms sleep: grows when runnable threads queue for a CPU
+std::chrono::microseconds schedulerLatency() {
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    return std::max(std::chrono::microseconds(0), elapsed - std::chrono::milliseconds(1));
+}
+
+double loadPerCpu() {
+#if defined(_WIN32)
+    return 0.0;   // No load average on Windows; rely on the latency probe
+#else
+    double load[1];
+    if (getloadavg(load, 1) != 1) return 0.0;
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    return load[0] / cpus;
+#endif
+}
+
+// Scheduling class and CPU mask of the calling thread. A thread is only
+// touched once a limit asks for it, and is put back when the limit is lifted.
+// Failures (missing privileges, CPUs that don't exist) leave it as it was.
+void applyThreadSettings(bool idle_priority, const std::vector<int>& cpu_affinity) {
+    thread_local bool idle_applied = false;
+    thread_local bool affinity_applied = false;
+    bool change_priority = idle_priority != idle_applied;
+    bool change_affinity = !cpu_affinity.empty() || affinity_applied;
+    idle_applied = idle_priority;
+    affinity_applied = !cpu_affinity.empty();
+
+#if defined(_WIN32)
+    if (change_priority) {
+        // Background mode lowers both CPU and I/O priority
+        SetThreadPriority(GetCurrentThread(), idle_priority ? THREAD_MODE_BACKGROUND_BEGIN : THREAD_MODE_BACKGROUND_END);
+    }
+    if (change_affinity) {
+        DWORD_PTR mask = 0;
+        for (int cpu : cpu_affinity) {
+            if (cpu >= 0 && cpu < static_cast<int>(sizeof(DWORD_PTR) * 8)) mask |= DWORD_PTR(1) << cpu;
+        }
+        if (mask == 0) {
+            DWORD_PTR system_mask = 0;
+            GetProcessAffinityMask(GetCurrentProcess(), &mask, &system_mask);
+        }
+        if (mask != 0) SetThreadAffinityMask(GetCurrentThread(), mask);
+    }
+#elif defined(__linux__)
+    if (change_priority) {
+        sched_param param{};
+        pthread_setschedparam(pthread_self(), idle_priority ? SCHED_IDLE : SCHED_OTHER, &param);
+
+        // ioprio_set(IOPRIO_WHO_PROCESS, 0 = calling thread, class << 13 | level)
+        const int IOPRIO_CLASS_BE = 2, IOPRIO_CLASS_IDLE = 3, IOPRIO_CLASS_SHIFT = 13;
+        int ioprio = idle_priority ? (IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) : (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT | 4);
+        syscall(SYS_ioprio_set, 1, 0, ioprio);
+    }
+    if (change_affinity) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpu_affinity) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+        }
+        if (CPU_COUNT(&set) == 0) {
+            for (unsigned cpu = 0; cpu < std::thread::hardware_concurrency() && cpu < CPU_SETSIZE; ++cpu) CPU_SET(cpu, &set);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#else
+    (void)change_priority;
+    (void)change_affinity;
+#endif
+}
+
+} // namespace
+
+std::string GovernorStats::toString() const {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2)
+        << "Governor: throttle " << throttle_factor
+        << ", waited read " << read_wait_ns / 1e9 << " s"
+        << ", write " << write_wait_ns / 1e9 << " s"
+        << ", cpu " << cpu_wait_ns / 1e9 << " s"
+        << ", " << backoffs << " backoffs";
+    return out.str();
+}
+
+ResourceGovernor::ResourceGovernor(const GovernorLimits& initial_limits) {
+    setLimits(initial_limits);
+}
+
+ResourceGovernor::~ResourceGovernor() {
+    AdaptiveConfig off;
+    setAdaptive(off);
+}
+
+void ResourceGovernor::setLimits(const GovernorLimits& new_limits) {
+    {
+        std::lock_guard<std::mutex> lock(limits_mutex);
+        limits = new_limits;
+    }
+    applyRates();
+    generation.fetch_add(1);
+    // Waiters re-check the CPU cap
+    std::lock_guard<std::mutex> lock(cpu_mutex);
+    cpu_cv.notify_all();
+}
+
+GovernorLimits ResourceGovernor::getLimits() const {
+    std::lock_guard<std::mutex> lock(limits_mutex);
+    return limits;
+}
+
+void ResourceGovernor::applyRates() {
+    std::lock_guard<std::mutex> lock(limits_mutex);
+    double factor = throttle_factor.load();
+    read_bucket.setRate(scaledRate(limits.read_bytes_per_second, factor));
+    write_bucket.setRate(scaledRate(limits.write_bytes_per_second, factor));
+}
+
+size_t ResourceGovernor::cpuCap() const {
+    std::lock_guard<std::mutex> lock(limits_mutex);
+    double factor = throttle_factor.load();
+    size_t base = limits.max_cpu_threads;
+    if (base == 0 && factor < 1.0) base = std::max(1u, std::thread::hardware_concurrency());
+    if (base == 0) return 0;
+    return std::max<size_t>(1, static_cast<size_t>(std::floor(base * factor)));
+}
+
+void ResourceGovernor::enterWorker() {
+    auto current = getLimits();
+    applyThreadSettings(current.idle_priority, current.cpu_affinity);
+}
+
+void ResourceGovernor::refreshThread() {
+    // Last settings generation applied to this thread
+    thread_local uint64_t applied_generation = 0;
+    uint64_t current = generation.load(std::memory_order_relaxed);
+    if (applied_generation != current) {
+        applied_generation = current;
+        enterWorker();
+    }
+}
+
+void ResourceGovernor::throttleRead(uint64_t bytes) {
+    refreshThread();
+    auto start = std::chrono::steady_clock::now();
+    read_bucket.acquire(bytes);
+    read_wait_ns.fetch_add(nanosSince(start), std::memory_order_relaxed);
+}
+
+void ResourceGovernor::throttleWrite(uint64_t bytes) {
+    refreshThread();
+    auto start = std::chrono::steady_clock::now();
+    write_bucket.acquire(bytes);
+    write_wait_ns.fetch_add(nanosSince(start), std::memory_order_relaxed);
+}
+
+ResourceGovernor::CpuSlot ResourceGovernor::acquireCpu() {
+    refreshThread();
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(cpu_mutex);
+    cpu_cv.wait(lock, [this] {
+        size_t cap = cpuCap();
+        return cap == 0 || cpu_active < cap;
+    });
+    cpu_active++;
+    lock.unlock();
+    cpu_wait_ns.fetch_add(nanosSince(start), std::memory_order_relaxed);
+    return CpuSlot(this);
+}
+
+ResourceGovernor::CpuSlot::~CpuSlot() {
+    if (!governor) return;
+    std::lock_guard<std::mutex> lock(governor->cpu_mutex);
+    governor->cpu_active--;
+    governor->cpu_cv.notify_one();
+}
+
+void ResourceGovernor::setAdaptive(const AdaptiveConfig& config) {
+    {
+        std::lock_guard<std::mutex> lock(monitor_mutex);
+        monitor_stop = true;
+    }
+    monitor_cv.notify_all();
+    if (monitor.joinable()) monitor.join();
+
+    {
+        std::lock_guard<std::mutex> lock(limits_mutex);
+        adaptive = config;
+        if (!adaptive.probe) adaptive.probe = schedulerLatency;
+    }
+    if (!config.enabled) {
+        throttle_factor.store(1.0);
+        applyRates();
+        std::lock_guard<std::mutex> lock(cpu_mutex);
+        cpu_cv.notify_all();
+        return;
+    }
+
+    monitor_stop = false;
+    monitor = std::thread([this] { monitorLoop(); });
+}
+
+bool ResourceGovernor::sampleOverloaded() {
+    AdaptiveConfig config;
+    {
+        std::lock_guard<std::mutex> lock(limits_mutex);
+        config = adaptive;
+    }
+
+    bool overloaded = false;
+    if (config.max_load_per_cpu > 0.0) {
+        double load = loadPerCpu();
+        last_load_per_cpu.store(load);
+        overloaded |= load > config.max_load_per_cpu;
+    }
+    if (config.max_probe_latency.count() > 0) {
+        auto latency = config.probe();
+        last_probe_us.store(latency.count());
+        overloaded |= latency > config.max_probe_latency;
+    }
+    return overloaded;
+}
+
+void ResourceGovernor::monitorLoop() {
+    while (true) {
+        std::chrono::milliseconds interval;
+        double min_factor;
+        {
+            std::lock_guard<std::mutex> lock(limits_mutex);
+            interval = adaptive.interval;
+            min_factor = adaptive.min_factor;
+        }
+        {
+            std::unique_lock<std::mutex> lock(monitor_mutex);
+            if (monitor_cv.wait_for(lock, interval, [this] { return monitor_stop; })) return;
+        }
+
+        double factor = throttle_factor.load();
+        double next;
+        if (sampleOverloaded()) {
+            backoffs.fetch_add(1, std::memory_order_relaxed);
+            next = std::max(min_factor, factor * 0.5);
+        } else {
+            next = std::min(1.0, factor * 1.25);
+        }
+        if (next != factor) {
+            throttle_factor.store(next);
+            applyRates();
+            std::lock_guard<std::mutex> lock(cpu_mutex);
+            cpu_cv.notify_all();
+        }
+    }
+}
+
+GovernorStats ResourceGovernor::stats() const {
+    GovernorStats s;
+    s.read_wait_ns = read_wait_ns.load(std::memory_order_relaxed);
+    s.write_wait_ns = write_wait_ns.load(std::memory_order_relaxed);
+    s.cpu_wait_ns = cpu_wait_ns.load(std::memory_order_relaxed);
+    s.backoffs = backoffs.load(std::memory_order_relaxed);
+    s.throttle_factor = throttle_factor.load();
+    s.last_load_per_cpu = last_load_per_cpu.load();
+    s.last_probe_us = last_probe_us.load(std::memory_order_relaxed);
+    return s;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "rate_limiter.h"
+
+// Resource limits for pipeline workers. Zero / empty means "no limit".
+struct GovernorLimits {
+    uint64_t read_bytes_per_second = 0;
+    uint64_t write_bytes_per_second = 0;
+    size_t max_cpu_threads = 0;     // Workers allowed in CPU-heavy stages (hash, compress) at once
+    bool idle_priority = false;     // SCHED_IDLE + idle I/O class (Linux), background mode (Windows)
+    std::vector<int> cpu_affinity;  // CPUs the workers may run on
+};
+
+// Back off while the host is busy. Every `interval` the governor samples the
+// load average and a latency probe; when either exceeds its threshold the
+// throttle factor is halved (down to min_factor), otherwise it recovers by
+// 25%. The factor scales the bandwidth caps and the CPU thread cap (which
+// defaults to hardware_concurrency when adaptive mode needs one).
+struct AdaptiveConfig {
+    bool enabled = false;
+    double max_load_per_cpu = 0.0;                       // 1-minute load average / CPUs (0 = ignore)
+    std::chrono::microseconds max_probe_latency{0};      // (0 = ignore)
+    std::chrono::milliseconds interval{1000};
+    double min_factor = 0.1;
+
+    // Returns the latency of one probe. The default measures how late a 1 ms
+    // sleep wakes up, which grows with CPU contention on the host.
+    std::function<std::chrono::microseconds()> probe;
+};
+
+struct GovernorStats {
+    uint64_t read_wait_ns = 0;
+    uint64_t write_wait_ns = 0;
+    uint64_t cpu_wait_ns = 0;        // Time workers waited for a CPU slot
+    uint64_t backoffs = 0;           // Adaptive samples over a threshold
+    double throttle_factor = 1.0;
+    double last_load_per_cpu = 0.0;
+    uint64_t last_probe_us = 0;
+
+    std::string toString() const;
+};
+
+// Caps the I/O bandwidth, CPU parallelism and scheduling class of backup
+// workers so backups can share hosts with latency-sensitive services.
+// Shared by all pipeline threads; every setter may be called while a job is
+// running and takes effect on the workers' next block.
+class ResourceGovernor {
+public:
+    explicit ResourceGovernor(const GovernorLimits& limits = {});
+    ~ResourceGovernor();
+
+    ResourceGovernor(const ResourceGovernor&) = delete;
+    ResourceGovernor& operator=(const ResourceGovernor&) = delete;
+
+    void setLimits(const GovernorLimits& limits);
+    GovernorLimits getLimits() const;
+
+    // Start, reconfigure or stop (enabled = false) the adaptive monitor
+    void setAdaptive(const AdaptiveConfig& config);
+
+    // Pace reads and writes against the (scaled) bandwidth caps
+    void throttleRead(uint64_t bytes);
+    void throttleWrite(uint64_t bytes);
+
+    // Held by a worker for the duration of CPU-heavy work on one block
+    class CpuSlot {
+    public:
+        explicit CpuSlot(ResourceGovernor* governor = nullptr) : governor(governor) {}
+        CpuSlot(CpuSlot&& other) noexcept : governor(other.governor) { other.governor = nullptr; }
+        CpuSlot(const CpuSlot&) = delete;
+        CpuSlot& operator=(const CpuSlot&) = delete;
+        CpuSlot& operator=(CpuSlot&&) = delete;
+        ~CpuSlot();
+    private:
+        ResourceGovernor* governor;
+    };
+    CpuSlot acquireCpu();
+
+    // Apply priority and affinity to the calling worker thread. Workers call
+    // this when they start; the throttle calls re-apply it after setLimits.
+    void enterWorker();
+
+    GovernorStats stats() const;
+
+private:
+    void applyRates();
+    size_t cpuCap() const;
+    void refreshThread();
+    void monitorLoop();
+    bool sampleOverloaded();
+
+    mutable std::mutex limits_mutex;
+    GovernorLimits limits;
+    AdaptiveConfig adaptive;
+
+    TokenBucket read_bucket;
+    TokenBucket write_bucket;
+
+    std::mutex cpu_mutex;
+    std::condition_variable cpu_cv;
+    size_t cpu_active = 0;
+
+    std::atomic<double> throttle_factor{1.0};
+    std::atomic<uint64_t> generation{1};   // Bumped when thread settings change
+
+    std::atomic<uint64_t> read_wait_ns{0};
+    std::atomic<uint64_t> write_wait_ns{0};
+    std::atomic<uint64_t> cpu_wait_ns{0};
+    std::atomic<uint64_t> backoffs{0};
+    std::atomic<double> last_load_per_cpu{0.0};
+    std::atomic<uint64_t> last_probe_us{0};
+
+    std::mutex monitor_mutex;
+    std::condition_variable monitor_cv;
+    bool monitor_stop = false;
+    std::thread monitor;
+};
@@ -1,26 +1,380 @@
 #include "restore_manager.h"
-#include <fstream>
+#include "cancellation.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
 #include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// A restored file being written. It is created at its final size where the
+// filesystem can preallocate, so extents are laid out once instead of growing
+// with every write; the destructor removes a file that was never close()d.
+class OutputFile {
+public:
+    OutputFile(const std::string& path, uint64_t size) : path(path) {
+#ifdef _WIN32
+        fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+        if (fd < 0) throw std::runtime_error("Failed to create output file: " + path);
+#ifdef __linux__
+        if (size > 0) {
+            int rc = posix_fallocate(fd, 0, static_cast<off_t>(size));
+            if (rc == 0) {
+                allocated = size;
+            } else if (rc == ENOSPC) {
+                discard();
+                throw std::runtime_error("No space left to restore " + path);
+            }
+            // Otherwise (EINVAL, EOPNOTSUPP) the filesystem cannot preallocate; writes extend it
+        }
+#else
+        (void)size;
+#endif
+    }
+
+    ~OutputFile() {
+        if (fd >= 0) discard();
+    }
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    void write(const uint8_t* data, size_t size) {
+        while (size > 0) {
+#ifdef _WIN32
+            int n = _write(fd, data, static_cast<unsigned>(std::min<size_t>(size, 1u << 30)));
+#else
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR) continue;
+#endif
+            if (n <= 0) throw std::runtime_error("Failed to write output file: " + path);
+            data += n;
+            size -= static_cast<size_t>(n);
+            written += static_cast<uint64_t>(n);
+        }
+    }
+
+    // Permission bits to give the file when it is closed (FILE_MODE_UNKNOWN = leave the default)
+    void setMode(uint32_t file_mode) { mode = file_mode; }
+
+    void close() {
+        bool ok = true;
+#ifdef _WIN32
+        ok = _close(fd) == 0;
+        fd = -1;
+        if (ok && mode != FILE_MODE_UNKNOWN) {
+            std::error_code ec;
+            std::filesystem::permissions(path, static_cast<std::filesystem::perms>(mode), ec);
+        }
+#else
+        // Drop preallocated space the content did not fill
+        if (allocated > written) ok = ftruncate(fd, static_cast<off_t>(written)) == 0;
+        // Through the descriptor, so no second path lookup per file
+        if (ok && mode != FILE_MODE_UNKNOWN) ok = fchmod(fd, static_cast<mode_t>(mode & 07777)) == 0;
+        ok = ::close(fd) == 0 && ok;
+        fd = -1;
+#endif
+        if (!ok) {
+            std::remove(path.c_str());
+            throw std::runtime_error("Failed to finish output file: " + path);
+        }
+    }
+
+private:
+    void discard() {
+#ifdef _WIN32
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+        fd = -1;
+        std::remove(path.c_str());
+    }
+
+    std::string path;
+    int fd = -1;
+    uint64_t allocated = 0;
+    uint64_t written = 0;
+    uint32_t mode = FILE_MODE_UNKNOWN;
+};
+
+// One file of a snapshot restore
+struct RestoreItem {
+    std::filesystem::path target;
+    uint64_t version_id = 0;
+    uint64_t size = 0;
+    uint32_t mode = FILE_MODE_UNKNOWN;
+    bool packed = false;
+    DBPackedExtent extent;
+};
+
+} // namespace
 
 RestoreManager::RestoreManager(
     std::shared_ptr<MetadataDB> db,
     std::shared_ptr<StorageManager> storage,
     std::shared_ptr<HashEngine> hasher
-) : db(db), storage(storage), hasher(hasher) {}
+) : db(db), storage(storage), hasher(hasher), reader(storage, hasher) {}
 
 void RestoreManager::restoreFile(uint64_t version_id, const std::string& output_path) {
-    auto block_hashes = db->getVersionBlockHashes(version_id);
+    DBPackedExtent extent;
+    if (db->getPackedExtent(version_id, extent)) {
+        restorePackedFile(extent, output_path);
+        return;
+    }
 
-    std::ofstream out_file(output_path, std::ios::binary);
-    if (!out_file) {
-        throw std::runtime_error("Failed to create output file: " + output_path);
+    uint64_t size = db->getVersionSize(version_id);
+    std::unique_ptr<ProgressTracker> progress;
+    if (progress_callback) {
+        progress = std::make_unique<ProgressTracker>(progress_callback, progress_interval);
+        progress->addTotal(size, db->getVersionBlockCount(version_id));
     }
 
-    for (const auto& hash : block_hashes) {
-        auto compressed_data = storage->readBlock(hash);
-        auto block_data = hasher->decompressBlock(compressed_data);
-        out_file.write(reinterpret_cast<const char*>(block_data.data()), block_data.size());
+    // The block list is decoded incrementally while blocks are written
+    OutputFile out_file(output_path, size);
+    bool completed = writeVersion(version_id, [&out_file](const uint8_t* data, size_t length) {
+        out_file.write(data, length);
+    }, progress.get());
+    if (!completed) throw OperationCanceled();   // out_file removes the partial file
+
+    out_file.close();
+    if (progress) progress->finish();
+}
+
+void RestoreManager::restorePackedFile(const DBPackedExtent& extent, const std::string& output_path) {
+    std::unique_ptr<ProgressTracker> progress;
+    if (progress_callback) {
+        progress = std::make_unique<ProgressTracker>(progress_callback, progress_interval);
+        progress->addTotal(extent.length, 1);
     }
-    
+
+    OutputFile out_file(output_path, extent.length);
+
+    // Only decode the aggregate block up to the end of this file, unless it is worth caching whole
+    auto block_data = reader.readPrefix(extent.block_hash, extent.offset + extent.length, extent.ref_count);
+    out_file.write(block_data->data() + extent.offset, extent.length);
     out_file.close();
+
+    if (progress) {
+        progress->addDone(extent.length);
+        progress->finish();
+    }
+}
+
+bool RestoreManager::writeVersion(uint64_t version_id,
+                                  const std::function<void(const uint8_t* data, size_t size)>& write,
+                                  ProgressTracker* progress) {
+    bool canceled = false;
+    db->forEachVersionBlock(version_id, [&](const DBBlockRef& ref) {
+        if (cancel_token && cancel_token->isCanceled()) {
+            canceled = true;
+            return false;
+        }
+        auto block_data = reader.read(ref.block_hash, ref.ref_count);
+        write(block_data->data(), block_data->size());
+        if (progress) progress->addDone(block_data->size());
+        return true;
+    });
+    return !canceled;
+}
+
+SnapshotRestoreReport RestoreManager::restoreSnapshot(uint64_t snapshot_id, const std::string& output_dir,
+                                                      const SnapshotRestoreOptions& options) {
+    namespace fs = std::filesystem;
+    auto start = std::chrono::steady_clock::now();
+    SnapshotRestoreReport report;
+
+    auto snapshots = snapshot_id > 0 ? db->listSnapshots(snapshot_id - 1, snapshot_id, 1)
+                                     : std::vector<DBSnapshot>();
+    if (snapshots.empty()) throw std::runtime_error("No such snapshot: " + std::to_string(snapshot_id));
+    fs::path root = fs::path(snapshots[0].root_path).lexically_normal();
+    fs::path output(output_dir);
+
+    // Map every file below output_dir and collect the directories it needs
+    auto entries = db->getSnapshotFiles(snapshot_id);
+    std::vector<RestoreItem> files;
+    files.reserve(entries.size());
+    std::set<fs::path> dirs;
+    for (const auto& entry : entries) {
+        // Normalize first: "b/../../x" is below the root only until its ".." are resolved
+        fs::path relative = fs::path(entry.file_path).lexically_normal().lexically_relative(root);
+        if (relative.empty() || relative == "." || relative.is_absolute() || *relative.begin() == "..") {
+            throw std::runtime_error("Snapshot file outside its root: " + entry.file_path);
+        }
+        for (fs::path dir = relative.parent_path(); !dir.empty() && dirs.insert(dir).second;) {
+            dir = dir.parent_path();
+        }
+        RestoreItem item;
+        item.target = output / relative;
+        item.version_id = entry.version_id;
+        item.size = entry.file_size;
+        item.mode = options.restore_permissions ? entry.mode : FILE_MODE_UNKNOWN;
+        files.push_back(std::move(item));
+    }
+
+    // Paths order parents before children, so each directory is one mkdir
+    // with no existence probes and no worker ever creates one
+    fs::create_directories(output);
+    for (const auto& dir : dirs) {
+        if (fs::create_directory(output / dir)) report.directories++;
+    }
+
+    // Plan tasks: big files alone (largest first, so they do not end up last
+    // on a single thread), then batches of small files. Packed files are
+    // ordered by aggregate block and offset and a block is not split between
+    // batches unless it alone is over the limits.
+    std::vector<RestoreItem> large, packed, small;
+    for (auto& item : files) {
+        if (item.size >= options.small_file_bytes) {
+            large.push_back(std::move(item));
+        } else if (db->getPackedExtent(item.version_id, item.extent)) {
+            item.packed = true;
+            packed.push_back(std::move(item));
+        } else {
+            small.push_back(std::move(item));
+        }
+    }
+    std::stable_sort(large.begin(), large.end(), [](const RestoreItem& a, const RestoreItem& b) {
+        return a.size > b.size;
+    });
+    std::sort(packed.begin(), packed.end(), [](const RestoreItem& a, const RestoreItem& b) {
+        if (a.extent.block_id != b.extent.block_id) return a.extent.block_id < b.extent.block_id;
+        return a.extent.offset < b.extent.offset;
+    });
+
+    std::vector<RestoreItem> items;
+    std::vector<std::pair<size_t, size_t>> tasks;   // [begin, end) in items
+    items.reserve(files.size());
+    for (auto& item : large) {
+        tasks.emplace_back(items.size(), items.size() + 1);
+        items.push_back(std::move(item));
+    }
+    auto addBatches = [&](std::vector<RestoreItem>& group) {
+        size_t begin = items.size();
+        uint64_t batch_bytes = 0;
+        for (auto& item : group) {
+            size_t count = items.size() - begin;
+            bool full = count >= options.batch_files || batch_bytes + item.size > options.batch_bytes;
+            bool same_block = item.packed && count > 0 && items.back().extent.block_id == item.extent.block_id;
+            if (count > 0 && full && !same_block) {
+                tasks.emplace_back(begin, items.size());
+                begin = items.size();
+                batch_bytes = 0;
+            }
+            batch_bytes += item.size;
+            items.push_back(std::move(item));
+        }
+        if (items.size() > begin) tasks.emplace_back(begin, items.size());
+    };
+    addBatches(packed);
+    addBatches(small);
+
+    std::unique_ptr<ProgressTracker> progress;
+    if (progress_callback) {
+        uint64_t total_bytes = 0, total_blocks = 0;
+        for (const auto& item : items) {
+            total_bytes += item.size;
+            total_blocks += item.packed ? 1 : db->getVersionBlockCount(item.version_id);
+        }
+        progress = std::make_unique<ProgressTracker>(progress_callback, progress_interval);
+        progress->addTotal(total_bytes, total_blocks);
+    }
+
+    std::atomic<size_t> next{0};
+    std::atomic<bool> stop{false};
+    std::atomic<bool> canceled{false};
+    std::atomic<uint64_t> files_done{0}, bytes_done{0}, batches{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    auto restoreItems = [&](size_t begin, size_t end) {
+        BlockBuffer block;   // Aggregate block shared by consecutive packed files
+        uint64_t block_id = 0;
+        for (size_t i = begin; i < end && !stop; ++i) {
+            const RestoreItem& item = items[i];
+            if (cancel_token && cancel_token->isCanceled()) {
+                canceled = true;
+                stop = true;
+                return;
+            }
+            OutputFile out(item.target.string(), item.size);
+            if (item.packed) {
+                if (!block || block_id != item.extent.block_id) {
+                    // Decode only as far as the last file of this block in the batch
+                    uint64_t prefix = item.extent.offset + item.extent.length;
+                    for (size_t j = i + 1; j < end && items[j].extent.block_id == item.extent.block_id; ++j) {
+                        prefix = std::max(prefix, items[j].extent.offset + items[j].extent.length);
+                    }
+                    block = reader.readPrefix(item.extent.block_hash, prefix, item.extent.ref_count);
+                    block_id = item.extent.block_id;
+                }
+                out.write(block->data() + item.extent.offset, item.extent.length);
+                if (progress) progress->addDone(item.extent.length);
+            } else {
+                bool completed = writeVersion(item.version_id, [&out](const uint8_t* data, size_t length) {
+                    out.write(data, length);
+                }, progress.get());
+                if (!completed) {
+                    canceled = true;
+                    stop = true;
+                    return;   // out removes the partial file
+                }
+            }
+            out.setMode(item.mode);
+            out.close();
+            files_done++;
+            bytes_done += item.size;
+        }
+    };
+
+    auto work = [&]() {
+        for (size_t t; !stop && (t = next.fetch_add(1)) < tasks.size();) {
+            try {
+                restoreItems(tasks[t].first, tasks[t].second);
+                if (tasks[t].second - tasks[t].first > 1) batches++;
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) error = std::current_exception();
+                stop = true;
+            }
+        }
+    };
+    size_t workers = options.workers > 0 ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < std::min(workers, tasks.size()); ++t) threads.emplace_back(work);
+    for (auto& thread : threads) thread.join();
+
+    if (error) std::rethrow_exception(error);
+    if (canceled) throw OperationCanceled();
+    if (progress) progress->finish();
+
+    report.files = files_done;
+    report.bytes = bytes_done;
+    report.batches = batches;
+    report.elapsed_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+void RestoreManager::setProgressCallback(ProgressCallback callback, std::chrono::milliseconds interval) {
+    progress_callback = std::move(callback);
+    progress_interval = interval;
 }
@@ -2,9 +2,30 @@
 
 #include <string>
 #include <memory>
+#include <functional>
 #include "metadata_db.h"
 #include "storage_manager.h"
 #include "hash_engine.h"
+#include "progress_reporter.h"
+#include "block_reader.h"
+
+class CancellationToken;
+
+struct SnapshotRestoreOptions {
+    size_t workers = 0;                       // Files written in parallel (0 = one per hardware thread)
+    uint64_t small_file_bytes = 1024 * 1024;  // Files below this are restored in batches...
+    size_t batch_files = 256;                 // ...of at most this many files
+    uint64_t batch_bytes = 16 * 1024 * 1024;  // ...and this many bytes
+    bool restore_permissions = true;          // Apply the permission bits recorded at backup
+};
+
+struct SnapshotRestoreReport {
+    uint64_t files = 0;
+    uint64_t directories = 0;     // Created (existing ones are reused)
+    uint64_t bytes = 0;
+    uint64_t batches = 0;         // Tasks of more than one small file
+    double elapsed_seconds = 0.0;
+};
 
 class RestoreManager {
 public:
@@ -17,8 +38,51 @@ public:
     // Reconstruct file from version
     void restoreFile(uint64_t version_id, const std::string& output_path);
 
+    // Recreate the tree of a snapshot below `output_dir`, each file at its path
+    // relative to the snapshot root.
+    //
+    // All directories are made first, parents before children, so workers
+    // never race on mkdir. Files then go to `workers` threads: big files one
+    // per task, largest first, and small files in batches, with the files of
+    // one aggregate block in the same batch so the block is read once. Each
+    // file is created at its final size (preallocated on Linux), written front
+    // to back and given its recorded permissions through the open descriptor
+    // before it is closed. A canceled or failed restore removes the files it
+    // was writing; files already finished stay.
+    SnapshotRestoreReport restoreSnapshot(uint64_t snapshot_id, const std::string& output_dir,
+                                          const SnapshotRestoreOptions& options = SnapshotRestoreOptions());
+
+    // Receive progress snapshots while restoreFile or restoreSnapshot is running (called from a reporter thread)
+    void setProgressCallback(ProgressCallback callback,
+                             std::chrono::milliseconds interval = std::chrono::milliseconds(250));
+
+    // Also check every decompressed block against its SHA-256 (the CRC-32C of the
+    // stored bytes is always checked). Off by default: it costs a hash per block.
+    void setVerifyHashes(bool enabled) { reader.setVerifyHashes(enabled); }
+
+    // Share decompressed blocks across restores (and RestoreManagers) through `cache`
+    void setBlockCache(std::shared_ptr<BlockCache> cache) { reader.setCache(std::move(cache)); }
+
+    // Key for encrypted blocks; they are decrypted in place before decompression
+    void setCipher(std::shared_ptr<BlockCipher> cipher) { reader.setCipher(std::move(cipher)); }
+
+    // Checked between blocks (nullptr = not cancelable). A canceled restore removes
+    // its partial output file and throws OperationCanceled.
+    void setCancellationToken(std::shared_ptr<CancellationToken> token) { cancel_token = std::move(token); }
+
 private:
+    void restorePackedFile(const DBPackedExtent& extent, const std::string& output_path);
+
+    // Hand the blocks of a (non-packed) version to `write` in file order;
+    // returns false if the cancellation token stopped it first
+    bool writeVersion(uint64_t version_id, const std::function<void(const uint8_t* data, size_t size)>& write,
+                      ProgressTracker* progress);
+
     std::shared_ptr<MetadataDB> db;
     std::shared_ptr<StorageManager> storage;
     std::shared_ptr<HashEngine> hasher;
+    ProgressCallback progress_callback;
+    std::chrono::milliseconds progress_interval{250};
+    std::shared_ptr<CancellationToken> cancel_token;
+    BlockReader reader;
 };
@@ -0,0 +1,652 @@
+#include "snapshot_archive.h"
+#include "buffer_pool.h"
+#include "checksum.h"
+#include "block_reader.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+namespace {
+
+const char ARCHIVE_MAGIC[4] = {'D', 'V', 'A', 'R'};
+constexpr size_t IO_BUFFER_SIZE = 8 * 1024 * 1024;
+constexpr size_t IMPORT_BATCH = 256;   // Block rows / versions committed per transaction
+
+// Sanity limits for sizes read from an archive
+constexpr uint64_t MAX_BLOCK_PAYLOAD = 64ull * 1024 * 1024;
+constexpr uint64_t MAX_METADATA_RECORD = 1ull << 30;
+
+enum RecordType : uint8_t {
+    RecordHeader = 'H',
+    RecordBlock = 'B',
+    RecordVersion = 'V',
+    RecordSnapshot = 'S',
+    RecordEnd = 'E',
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+#ifdef _WIN32
+long long rawWrite(int fd, const void* data, size_t size) { return _write(fd, data, static_cast<unsigned>(size)); }
+long long rawRead(int fd, void* data, size_t size) { return _read(fd, data, static_cast<unsigned>(size)); }
+#else
+long long rawWrite(int fd, const void* data, size_t size) { return ::write(fd, data, size); }
+long long rawRead(int fd, void* data, size_t size) { return ::read(fd, data, size); }
+#endif
+
+// --- Record encoding -------------------------------------------------------
+
+class RecordBuilder {
+public:
+    void u8(uint8_t v) { body.push_back(v); }
+    void u32(uint32_t v) { for (int i = 0; i < 4; ++i) body.push_back(static_cast<uint8_t>(v >> (8 * i))); }
+    void u64(uint64_t v) { for (int i = 0; i < 8; ++i) body.push_back(static_cast<uint8_t>(v >> (8 * i))); }
+    void str(const std::string& s) {
+        u32(static_cast<uint32_t>(s.size()));
+        body.insert(body.end(), s.begin(), s.end());
+    }
+    // Close a metadata record with the CRC of everything before it
+    void seal() { u32(crc32c(body.data(), body.size())); }
+
+    std::vector<uint8_t> body;
+};
+
+class RecordParser {
+public:
+    RecordParser(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+    uint8_t u8() { need(1); return data[pos++]; }
+    uint32_t u32() {
+        need(4);
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) v |= uint32_t(data[pos + i]) << (8 * i);
+        pos += 4;
+        return v;
+    }
+    uint64_t u64() {
+        need(8);
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) v |= uint64_t(data[pos + i]) << (8 * i);
+        pos += 8;
+        return v;
+    }
+    std::string str() {
+        uint32_t n = u32();
+        need(n);
+        std::string s(reinterpret_cast<const char*>(data + pos), n);
+        pos += n;
+        return s;
+    }
+    // Check the trailing CRC of a metadata record
+    void verifySeal(const char* what) {
+        uint32_t expected = crc32c(data, pos);
+        if (u32() != expected) throw std::runtime_error(std::string("Archive ") + what + " record is corrupt");
+    }
+
+private:
+    void need(size_t n) {
+        if (size - pos < n) throw std::runtime_error("Archive record truncated");
+    }
+    const uint8_t* data;
+    size_t size;
+    size_t pos = 0;
+};
+
+// --- Buffered descriptor I/O ----------------------------------------------
+
+class StreamWriter {
+public:
+    explicit StreamWriter(int fd) : fd(fd) { buffer.reserve(IO_BUFFER_SIZE); }
+
+    void write(const void* data, size_t size) {
+        const auto* p = static_cast<const uint8_t*>(data);
+        if (buffer.size() + size > IO_BUFFER_SIZE) flush();
+        if (size >= IO_BUFFER_SIZE) {
+            writeAll(p, size);
+        } else {
+            buffer.insert(buffer.end(), p, p + size);
+        }
+        bytes += size;
+    }
+
+    void record(RecordType type, const std::vector<uint8_t>& body) {
+        recordHeader(type, body.size());
+        write(body.data(), body.size());
+    }
+
+    void recordHeader(RecordType type, uint64_t body_size) {
+        uint8_t header[9];
+        header[0] = type;
+        for (int i = 0; i < 8; ++i) header[1 + i] = static_cast<uint8_t>(body_size >> (8 * i));
+        write(header, sizeof(header));
+    }
+
+    // Append `size` bytes of a file starting at `offset`. The kernel copies
+    // them when it can; otherwise they go through the buffer.
+    void copyFile(const std::string& path, uint64_t offset, uint64_t size) {
+#ifdef __linux__
+        if (sendfile_ok) {
+            int in = ::open(path.c_str(), O_RDONLY);
+            if (in < 0) throw std::runtime_error("Cannot open block file: " + path);
+            flush();
+            off_t pos = static_cast<off_t>(offset);
+            uint64_t left = size;
+            while (left > 0) {
+                ssize_t n = ::sendfile(fd, in, &pos, left);
+                if (n <= 0) break;
+                left -= static_cast<uint64_t>(n);
+            }
+            ::close(in);
+            if (left == 0) {
+                bytes += size;
+                return;
+            }
+            if (left != size) throw std::runtime_error("Archive write failed");
+            sendfile_ok = false;   // Descriptor type not supported; use the buffer from now on
+        }
+#endif
+        std::ifstream file(path, std::ios::binary);
+        file.seekg(static_cast<std::streamoff>(offset));
+        std::vector<char> chunk(static_cast<size_t>(size));
+        if (!file.read(chunk.data(), chunk.size())) throw std::runtime_error("Cannot read block file: " + path);
+        write(chunk.data(), chunk.size());
+    }
+
+    void flush() {
+        if (!buffer.empty()) writeAll(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    uint64_t bytes = 0;
+
+private:
+    void writeAll(const uint8_t* p, size_t size) {
+        while (size > 0) {
+            long long n = rawWrite(fd, p, size);
+            if (n <= 0) throw std::runtime_error("Archive write failed");
+            p += n;
+            size -= static_cast<size_t>(n);
+        }
+    }
+
+    int fd;
+    std::vector<uint8_t> buffer;
+    bool sendfile_ok = true;
+};
+
+class StreamReader {
+public:
+    explicit StreamReader(int fd) : fd(fd), buffer(IO_BUFFER_SIZE) {}
+
+    // False only at a clean end of stream (no bytes at all)
+    bool tryRead(void* out, size_t size) {
+        auto* p = static_cast<uint8_t*>(out);
+        size_t done = 0;
+        while (done < size) {
+            if (pos == end && !fill()) {
+                if (done == 0) return false;
+                throw std::runtime_error("Archive truncated");
+            }
+            size_t n = std::min(size - done, end - pos);
+            std::memcpy(p + done, buffer.data() + pos, n);
+            pos += n;
+            done += n;
+        }
+        bytes += size;
+        return true;
+    }
+
+    void read(void* out, size_t size) {
+        if (!tryRead(out, size)) throw std::runtime_error("Archive truncated");
+    }
+
+    void skip(uint64_t size) {
+        while (size > 0) {
+            if (pos == end && !fill()) throw std::runtime_error("Archive truncated");
+            size_t n = static_cast<size_t>(std::min<uint64_t>(size, end - pos));
+            pos += n;
+            size -= n;
+            bytes += n;
+        }
+    }
+
+    uint64_t bytes = 0;
+
+private:
+    bool fill() {
+        long long n = rawRead(fd, buffer.data(), buffer.size());
+        if (n < 0) throw std::runtime_error("Archive read failed");
+        pos = 0;
+        end = static_cast<size_t>(n);
+        return n > 0;
+    }
+
+    int fd;
+    std::vector<uint8_t> buffer;
+    size_t pos = 0;
+    size_t end = 0;
+};
+
+// Block names become file names: only accept what the hasher produces
+bool isBlockHash(const std::string& hash) {
+    if (hash.size() != 64) return false;
+    return std::all_of(hash.begin(), hash.end(), [](char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); });
+}
+
+std::vector<uint8_t> versionRecord(const ReplicaVersion& v) {
+    RecordBuilder b;
+    b.u64(v.record.version_id);
+    b.str(v.record.file_path);
+    b.u64(v.record.parent_id);
+    b.str(v.record.file_hash);
+    b.u64(v.record.created_at);
+    b.u64(v.record.file_size);
+    b.u64(v.record.source_version_id);
+    b.u8(v.packed ? 1 : 0);
+    b.u64(v.packed_offset);
+    b.u32(static_cast<uint32_t>(v.block_hashes.size()));
+    for (const auto& hash : v.block_hashes) b.str(hash);
+    b.u32(v.record.mode);
+    b.seal();
+    return b.body;
+}
+
+ReplicaVersion parseVersion(const std::vector<uint8_t>& body, uint32_t format) {
+    RecordParser p(body.data(), body.size());
+    ReplicaVersion v;
+    v.record.version_id = p.u64();
+    v.record.file_path = p.str();
+    v.record.parent_id = p.u64();
+    v.record.file_hash = p.str();
+    v.record.created_at = p.u64();
+    v.record.file_size = p.u64();
+    v.record.source_version_id = p.u64();
+    v.packed = p.u8() != 0;
+    v.packed_offset = p.u64();
+    uint32_t n = p.u32();
+    v.block_hashes.reserve(n);
+    for (uint32_t i = 0; i < n; ++i) v.block_hashes.push_back(p.str());
+    if (format >= 3) v.record.mode = p.u32();
+    p.verifySeal("version");
+    return v;
+}
+
+} // namespace
+
+// --- Export ------------------------------------------------------------------
+
+ArchiveExporter::ArchiveExporter(std::shared_ptr<MetadataDB> db, std::shared_ptr<StorageManager> storage)
+    : db(db), storage(storage) {}
+
+ArchiveStats ArchiveExporter::exportVersions(const std::vector<uint64_t>& version_ids, int fd,
+                                             const std::string& source, const std::string& key_id) {
+    return write(version_ids, {}, fd, source, key_id);
+}
+
+ArchiveStats ArchiveExporter::exportSnapshot(uint64_t snapshot_id, int fd,
+                                             const std::string& source, const std::string& key_id) {
+    auto snapshots = db->listSnapshots(snapshot_id - 1, snapshot_id, 1);
+    if (snapshots.empty()) throw std::runtime_error("No such snapshot: " + std::to_string(snapshot_id));
+    return write(snapshots[0].version_ids, snapshots, fd, source, key_id);
+}
+
+ArchiveStats ArchiveExporter::write(const std::vector<uint64_t>& version_ids, const std::vector<DBSnapshot>& snapshots,
+                                    int fd, const std::string& source, const std::string& key_id) {
+    auto start = std::chrono::steady_clock::now();
+    ArchiveStats stats;
+    StreamWriter out(fd);
+
+    out.write(ARCHIVE_MAGIC, 4);
+    uint8_t version[4];
+    for (int i = 0; i < 4; ++i) version[i] = static_cast<uint8_t>(ARCHIVE_FORMAT_VERSION >> (8 * i));
+    out.write(version, 4);
+
+    RecordBuilder header;
+    header.str(source);
+    header.u64(static_cast<uint64_t>(std::time(nullptr)));
+    header.str(key_id);
+    header.seal();
+    out.record(RecordHeader, header.body);
+
+    // Ascending ids put every clone after the version that owns its content
+    std::vector<uint64_t> ids = version_ids;
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    std::unordered_set<uint64_t> exported;
+    std::unordered_set<std::string> sent_blocks;
+
+    for (uint64_t vid : ids) {
+        auto records = db->listVersionRecords(vid - 1, vid, 1);
+        if (records.empty()) throw std::runtime_error("No such version: " + std::to_string(vid));
+
+        ReplicaVersion replica;
+        replica.record = std::move(records[0]);
+        // A clone stays a clone only if its content version is in the archive too
+        if (replica.record.source_version_id != 0 && !exported.count(replica.record.source_version_id)) {
+            replica.record.source_version_id = 0;
+        }
+        if (replica.record.source_version_id == 0) {
+            DBPackedExtent extent;
+            if (db->getPackedExtent(vid, extent)) {
+                replica.packed = true;
+                replica.packed_offset = extent.offset;
+                replica.block_hashes.push_back(extent.block_hash);
+            } else {
+                db->forEachVersionBlock(vid, [&](const DBBlockRef& ref) {
+                    replica.block_hashes.push_back(ref.block_hash);
+                    return true;
+                });
+            }
+        }
+
+        // A delta's base goes out before it, so an import can check it in order
+        std::function<void(const std::string&)> sendBlock = [&](const std::string& hash) {
+            if (!sent_blocks.insert(hash).second) return;
+            if (skip_block && skip_block(hash)) {
+                stats.blocks_skipped++;
+                return;
+            }
+
+            DBBlock block;
+            if (!db->getBlock(hash, block)) throw std::runtime_error("Block not in catalog: " + hash);
+            if (!block.delta_base.empty()) sendBlock(block.delta_base);
+
+            BlockLocation location = storage->locateBlock(hash);
+            RecordBuilder b;
+            b.str(hash);
+            b.u32(location.flags);
+            b.u32(static_cast<uint32_t>(block.size));
+            if (location.legacy) {
+                // No stored checksum: read the payload and send it from memory
+                auto payload = storage->readBlock(hash);
+                b.u32(crc32c(payload.data(), payload.size()));
+                out.recordHeader(RecordBlock, b.body.size() + payload.size());
+                out.write(b.body.data(), b.body.size());
+                out.write(payload.data(), payload.size());
+            } else {
+                b.u32(location.crc);
+                out.recordHeader(RecordBlock, b.body.size() + location.payload_size);
+                out.write(b.body.data(), b.body.size());
+                out.copyFile(location.path, location.payload_offset, location.payload_size);
+            }
+            stats.blocks++;
+        };
+        for (const auto& hash : replica.block_hashes) sendBlock(hash);
+
+        out.record(RecordVersion, versionRecord(replica));
+        exported.insert(vid);
+        stats.versions++;
+    }
+
+    for (const auto& snapshot : snapshots) {
+        RecordBuilder b;
+        b.u64(snapshot.snapshot_id);
+        b.str(snapshot.root_path);
+        b.u64(snapshot.created_at);
+        b.u32(static_cast<uint32_t>(snapshot.version_ids.size()));
+        for (uint64_t vid : snapshot.version_ids) b.u64(vid);
+        b.seal();
+        out.record(RecordSnapshot, b.body);
+        stats.snapshots++;
+    }
+
+    RecordBuilder end;
+    end.u64(stats.blocks);
+    end.u64(stats.versions);
+    end.u64(stats.snapshots);
+    end.seal();
+    out.record(RecordEnd, end.body);
+    out.flush();
+
+    stats.bytes = out.bytes;
+    stats.elapsed_seconds = secondsSince(start);
+    return stats;
+}
+
+// --- Import ------------------------------------------------------------------
+
+ArchiveImporter::ArchiveImporter(
+    std::shared_ptr<MetadataDB> db,
+    std::shared_ptr<StorageManager> storage,
+    std::shared_ptr<HashEngine> hasher,
+    std::shared_ptr<ThreadPool> tp
+) : db(db), storage(storage), hasher(hasher), tp(tp) {}
+
+ArchiveStats ArchiveImporter::importArchive(int fd) {
+    auto start = std::chrono::steady_clock::now();
+    ArchiveStats stats;
+    StreamReader in(fd);
+
+    uint8_t preamble[8];
+    if (!in.tryRead(preamble, sizeof(preamble)) || std::memcmp(preamble, ARCHIVE_MAGIC, 4) != 0) {
+        throw std::runtime_error("Not a deltavault archive");
+    }
+    RecordParser version_parser(preamble + 4, 4);
+    uint32_t format = version_parser.u32();
+    if (format > ARCHIVE_FORMAT_VERSION) {
+        throw std::runtime_error("Archive format " + std::to_string(format) + " is newer than this build supports");
+    }
+
+    std::string source;
+    bool have_header = false, have_end = false;
+    uint64_t blocks_seen = 0;
+    std::vector<ReplicaVersion> versions;
+    std::vector<DBSnapshot> snapshots;
+
+    // Blocks being verified and written on the pool, oldest first
+    std::deque<std::future<DBBlock>> in_flight;
+    std::deque<std::string> in_flight_hashes;
+    std::vector<DBBlock> stored;
+    std::unordered_map<std::string, int> imported_depth;   // Delta chain length of blocks from this archive
+    auto drainOne = [&]() {
+        in_flight_hashes.pop_front();
+        stored.push_back(in_flight.front().get());
+        in_flight.pop_front();
+        if (stored.size() >= IMPORT_BATCH) {
+            db->storeBlocks(stored);
+            stored.clear();
+        }
+    };
+    auto drainAll = [&]() {
+        // Every task must finish before the buffers it uses go away
+        std::exception_ptr error;
+        while (!in_flight.empty()) {
+            try {
+                drainOne();
+            } catch (...) {
+                if (!error) error = std::current_exception();
+                in_flight.pop_front();
+            }
+        }
+        if (error) std::rethrow_exception(error);
+        if (!stored.empty()) db->storeBlocks(stored);
+        stored.clear();
+    };
+    const size_t max_in_flight = 64;
+    auto pool = BufferPool::defaultPool();
+
+    try {
+        uint8_t record_header[9];
+        while (!have_end && in.tryRead(record_header, sizeof(record_header))) {
+            uint8_t type = record_header[0];
+            RecordParser size_parser(record_header + 1, 8);
+            uint64_t body_size = size_parser.u64();
+
+            if (type == RecordBlock) {
+                if (!have_header) throw std::runtime_error("Archive block before header");
+                // Fixed part: hash string, flags, size, crc
+                uint8_t length_bytes[4];
+                in.read(length_bytes, 4);
+                uint32_t hash_length = RecordParser(length_bytes, 4).u32();
+                if (hash_length > 256 || 4 + uint64_t(hash_length) + 12 > body_size) {
+                    throw std::runtime_error("Archive block record is corrupt");
+                }
+                std::string hash(hash_length, '\0');
+                in.read(hash.data(), hash_length);
+                uint8_t fields[12];
+                in.read(fields, sizeof(fields));
+                RecordParser f(fields, sizeof(fields));
+                uint32_t flags = f.u32();
+                uint32_t block_size = f.u32();
+                uint32_t crc = f.u32();
+                uint64_t payload_size = body_size - 4 - hash_length - 12;
+                if (!isBlockHash(hash) || payload_size > MAX_BLOCK_PAYLOAD) {
+                    throw std::runtime_error("Archive block record is corrupt");
+                }
+                blocks_seen++;
+                stats.blocks++;
+
+                if (db->findBlock(hash) != 0) {
+                    in.skip(payload_size);
+                    stats.blocks_skipped++;
+                    continue;
+                }
+
+                auto payload = std::make_shared<PooledBuffer>(pool->acquire(static_cast<size_t>(payload_size)));
+                in.read(payload->data(), payload->size());
+
+                std::string base_hash;
+                int depth = 0;
+                if (flags & BLOCK_FLAG_DELTA) {
+                    base_hash = deltaBaseHash(payload->data(), payload->size());
+                    auto imported = imported_depth.find(base_hash);
+                    DBBlock base;
+                    if (imported != imported_depth.end()) {
+                        depth = imported->second + 1;
+                    } else if (db->getBlock(base_hash, base)) {
+                        depth = base.delta_depth + 1;
+                    } else {
+                        throw std::runtime_error("Archive delta block's base is not available: " + hash);
+                    }
+                    // Checking the delta reads its base from storage
+                    if (std::find(in_flight_hashes.begin(), in_flight_hashes.end(), base_hash) != in_flight_hashes.end()) {
+                        drainAll();
+                    }
+                }
+                imported_depth[hash] = depth;
+
+                if (in_flight.size() >= max_in_flight) drainOne();
+                in_flight_hashes.push_back(hash);
+                in_flight.push_back(tp->enqueue([this, hash, flags, block_size, crc, payload, pool, base_hash, depth]() {
+                    if (crc32c(payload->data(), payload->size()) != crc) {
+                        throw std::runtime_error("Archive block checksum mismatch: " + hash);
+                    }
+                    if (!(flags & BLOCK_FLAG_ENCRYPTED)) {
+                        PooledBuffer data = pool->acquire(block_size);
+                        if (base_hash.empty()) {
+                            hasher->decompressBlockInto(payload->data(), payload->size(), data);
+                        } else {
+                            BlockBuffer base = BlockReader(storage, hasher).read(base_hash);
+                            hasher->decompressDeltaInto(payload->data() + DELTA_BASE_SIZE, payload->size() - DELTA_BASE_SIZE,
+                                                        base->data(), base->size(), data);
+                        }
+                        if (data.size() != block_size || hasher->computeBlockHash(data.data(), data.size()) != hash) {
+                            throw std::runtime_error("Archive block does not match its hash: " + hash);
+                        }
+                    }
+                    if (!storage->writeBlock(hash, payload->data(), payload->size(), flags)) {
+                        throw std::runtime_error("Failed to write block: " + hash);
+                    }
+                    DBBlock block;
+                    block.block_id = 0;
+                    block.block_hash = hash;
+                    block.size = static_cast<int>(block_size);
+                    block.compressed_size = static_cast<int>(payload->size());
+                    block.delta_base = base_hash;
+                    block.delta_depth = depth;
+                    return block;
+                }));
+                continue;
+            }
+
+            if (type != RecordHeader && type != RecordVersion && type != RecordSnapshot && type != RecordEnd) {
+                in.skip(body_size);   // Written by a newer version; not needed
+                continue;
+            }
+            if (body_size > MAX_METADATA_RECORD) throw std::runtime_error("Archive record too large");
+            std::vector<uint8_t> body(static_cast<size_t>(body_size));
+            switch (type) {
+                case RecordHeader: {
+                    in.read(body.data(), body.size());
+                    RecordParser p(body.data(), body.size());
+                    source = p.str();
+                    p.u64();   // created_at
+                    std::string key_id = p.str();
+                    p.verifySeal("header");
+                    if (key_check) key_check(key_id);
+                    have_header = true;
+                    break;
+                }
+                case RecordVersion:
+                    in.read(body.data(), body.size());
+                    versions.push_back(parseVersion(body, format));
+                    break;
+                case RecordSnapshot: {
+                    in.read(body.data(), body.size());
+                    RecordParser p(body.data(), body.size());
+                    DBSnapshot snapshot;
+                    snapshot.snapshot_id = p.u64();
+                    snapshot.root_path = p.str();
+                    snapshot.created_at = p.u64();
+                    uint32_t n = p.u32();
+                    for (uint32_t i = 0; i < n; ++i) snapshot.version_ids.push_back(p.u64());
+                    p.verifySeal("snapshot");
+                    snapshots.push_back(std::move(snapshot));
+                    break;
+                }
+                case RecordEnd: {
+                    in.read(body.data(), body.size());
+                    RecordParser p(body.data(), body.size());
+                    uint64_t blocks = p.u64(), version_count = p.u64(), snapshot_count = p.u64();
+                    p.verifySeal("end");
+                    if (blocks != blocks_seen || version_count != versions.size() || snapshot_count != snapshots.size()) {
+                        throw std::runtime_error("Archive record counts do not match its end record");
+                    }
+                    have_end = true;
+                    break;
+                }
+            }
+        }
+        drainAll();
+    } catch (...) {
+        try { drainAll(); } catch (...) {}
+        throw;
+    }
+    if (!have_end) throw std::runtime_error("Archive truncated: no end record");
+
+    // Catalog last, in batches, under a source name of its own so archives and
+    // replication keep separate id mappings
+    std::string label = "archive:" + source;
+    for (size_t i = 0; i < versions.size(); i += IMPORT_BATCH) {
+        std::vector<ReplicaVersion> batch(versions.begin() + i, versions.begin() + std::min(versions.size(), i + IMPORT_BATCH));
+        db->importVersions(label, batch);
+    }
+    if (!snapshots.empty()) db->importSnapshots(label, snapshots);
+    stats.versions = versions.size();
+    stats.snapshots = snapshots.size();
+
+    stats.bytes = in.bytes;
+    stats.elapsed_seconds = secondsSince(start);
+    return stats;
+}
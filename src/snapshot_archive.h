@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "metadata_db.h"
+#include "storage_manager.h"
+#include "hash_engine.h"
+#include "thread_pool.h"
+
+// Streaming archive of versions and snapshots, for tape and cold storage.
+//
+//   "DVAR" | u32 format version | record*
+//   record: u8 type | u64 body size | body
+//
+// Integers are little-endian, strings are u32 length + bytes. Readers skip
+// record types they don't know. Record bodies:
+//   'H' header:   str source | u64 created_at | str key_id | u32 crc
+//   'B' block:    str hash | u32 flags | u32 size | u32 payload crc | payload
+//   'V' version:  u64 id | str path | u64 parent | str file_hash | u64 created_at |
+//                 u64 file_size | u64 clone_of | u8 packed | u64 packed_offset |
+//                 u32 n | n * str block_hash | u32 mode | u32 crc
+//   'S' snapshot: u64 id | str root_path | u64 created_at | u32 n | n * u64 version_id | u32 crc
+//   'E' end:      u64 blocks | u64 versions | u64 snapshots | u32 crc
+// The crc fields are CRC-32C of the record body before them. Blocks precede
+// the versions that use them, and a delta block (BLOCK_FLAG_DELTA) follows its
+// base unless the base was filtered out; payloads are stored bytes
+// (compressed, and encrypted if the repository is), identical to the block
+// file payload. Format 2 added delta blocks, format 3 the permission bits of
+// versions (0xFFFFFFFF = unknown; absent before format 3).
+constexpr uint32_t ARCHIVE_FORMAT_VERSION = 3;
+
+struct ArchiveStats {
+    uint64_t blocks = 0;           // Block records written / read
+    uint64_t blocks_skipped = 0;   // Export: target already has them. Import: already stored here.
+    uint64_t versions = 0;
+    uint64_t snapshots = 0;
+    uint64_t bytes = 0;            // Archive bytes written / read
+    double elapsed_seconds = 0.0;
+};
+
+// Writes versions or a snapshot to a file descriptor as one sequential stream.
+// Output goes through a large buffer; block payloads are sent straight from
+// their block files with sendfile(2) on Linux when the descriptor allows it.
+class ArchiveExporter {
+public:
+    ArchiveExporter(std::shared_ptr<MetadataDB> db, std::shared_ptr<StorageManager> storage);
+
+    // Leave out blocks for which `skip` returns true (e.g. blocks the importing
+    // repository already has). Their versions still reference them.
+    void setBlockFilter(std::function<bool(const std::string& block_hash)> skip) { skip_block = std::move(skip); }
+
+    // `source` and `key_id` go into the header (key_id is empty for unencrypted repositories)
+    ArchiveStats exportVersions(const std::vector<uint64_t>& version_ids, int fd,
+                                const std::string& source, const std::string& key_id);
+    ArchiveStats exportSnapshot(uint64_t snapshot_id, int fd,
+                                const std::string& source, const std::string& key_id);
+
+private:
+    ArchiveStats write(const std::vector<uint64_t>& version_ids, const std::vector<DBSnapshot>& snapshots,
+                       int fd, const std::string& source, const std::string& key_id);
+
+    std::shared_ptr<MetadataDB> db;
+    std::shared_ptr<StorageManager> storage;
+    std::function<bool(const std::string&)> skip_block;
+};
+
+// Reads an archive from a file descriptor into a repository. Blocks already
+// stored are skipped; new ones are checked (payload CRC-32C, and for
+// unencrypted blocks the decompressed size and SHA-256) on the thread pool
+// and stored. A delta block is refused unless its base is stored here or came
+// earlier in the archive. The catalog is only applied after the end record has been read
+// and verified, so a truncated stream adds no versions. Importing the same
+// archive twice adds nothing the second time.
+class ArchiveImporter {
+public:
+    ArchiveImporter(
+        std::shared_ptr<MetadataDB> db,
+        std::shared_ptr<StorageManager> storage,
+        std::shared_ptr<HashEngine> hasher,
+        std::shared_ptr<ThreadPool> tp
+    );
+
+    // Called with the archive's key id (empty if unencrypted) before any block
+    // is stored; throw from it to refuse the archive
+    void setKeyCheck(std::function<void(const std::string& key_id)> check) { key_check = std::move(check); }
+
+    ArchiveStats importArchive(int fd);
+
+private:
+    std::shared_ptr<MetadataDB> db;
+    std::shared_ptr<StorageManager> storage;
+    std::shared_ptr<HashEngine> hasher;
+    std::shared_ptr<ThreadPool> tp;
+    std::function<void(const std::string&)> key_check;
+};
@@ -0,0 +1,1676 @@
+#include "sqlite_metadata_db.h"
+#include "block_list_codec.h"
+#include <stdexcept>
+#include <iostream>
+#include <ctime>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <set>
+
+namespace {
+
+// Collapse sorted, distinct ids into [first, last] runs of consecutive ids
+std::vector<std::pair<uint64_t, uint64_t>> idRuns(const std::vector<uint64_t>& sorted_ids) {
+    std::vector<std::pair<uint64_t, uint64_t>> runs;
+    for (uint64_t id : sorted_ids) {
+        if (!runs.empty() && runs.back().second + 1 == id) {
+            runs.back().second = id;
+        } else {
+            runs.emplace_back(id, id);
+        }
+    }
+    return runs;
+}
+
+// First column of the first row of a single-value query (0 if no row); `text` binds parameter 1
+uint64_t queryId(sqlite3* db, const std::string& sql, const std::string& text = "") {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    if (!text.empty()) sqlite3_bind_text(stmt, 1, text.c_str(), -1, SQLITE_STATIC);
+    uint64_t id = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return id;
+}
+
+// versions.mode is NULL when unknown
+void bindMode(sqlite3_stmt* stmt, int index, uint32_t mode) {
+    if (mode == FILE_MODE_UNKNOWN) {
+        sqlite3_bind_null(stmt, index);
+    } else {
+        sqlite3_bind_int64(stmt, index, mode);
+    }
+}
+
+uint32_t columnMode(sqlite3_stmt* stmt, int column) {
+    if (sqlite3_column_type(stmt, column) == SQLITE_NULL) return FILE_MODE_UNKNOWN;
+    return static_cast<uint32_t>(sqlite3_column_int64(stmt, column));
+}
+
+} // namespace
+
+SqliteMetadataDB::~SqliteMetadataDB() {
+    if (db) {
+        sqlite3_close(db);
+    }
+}
+
+void SqliteMetadataDB::executeSQL(const std::string& sql) {
+    char* errMsg = nullptr;
+    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        std::string err = errMsg;
+        sqlite3_free(errMsg);
+        throw std::runtime_error("SQL Error: " + err);
+    }
+}
+
+int64_t SqliteMetadataDB::getLastInsertId() {
+    return sqlite3_last_insert_rowid(db);
+}
+
+bool SqliteMetadataDB::ensureColumn(const std::string& table, const std::string& column, const std::string& definition) {
+    sqlite3_stmt* stmt;
+    std::string sql = "PRAGMA table_info(" + table + ")";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
+
+    bool found = false;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        if (name && column == name) {
+            found = true;
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    if (found) return false;
+    executeSQL("ALTER TABLE " + table + " ADD COLUMN " + column + " " + definition);
+    return true;
+}
+
+void SqliteMetadataDB::addBlockRefs(std::vector<uint64_t> block_ids, int64_t delta) {
+    std::sort(block_ids.begin(), block_ids.end());
+    block_ids.erase(std::unique(block_ids.begin(), block_ids.end()), block_ids.end());
+
+    // Freshly stored blocks have consecutive ids, so most lists collapse to a few ranges
+    sqlite3_stmt* stmt;
+    std::string sql = "UPDATE blocks SET ref_count = ref_count + ? WHERE block_id BETWEEN ? AND ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare ref count failed");
+    for (const auto& [first, last] : idRuns(block_ids)) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, delta);
+        sqlite3_bind_int64(stmt, 2, first);
+        sqlite3_bind_int64(stmt, 3, last);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            sqlite3_finalize(stmt);
+            throw std::runtime_error("Step ref count failed");
+        }
+    }
+    sqlite3_finalize(stmt);
+}
+
+uint64_t SqliteMetadataDB::resolveContentVersion(uint64_t version_id) {
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT source_version_id FROM versions WHERE version_id = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, version_id);
+
+    uint64_t source = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        source = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return source != 0 ? source : version_id;
+}
+
+bool SqliteMetadataDB::hasContentClones(uint64_t version_id) {
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT 1 FROM versions WHERE source_version_id = ? LIMIT 1";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, version_id);
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+void SqliteMetadataDB::initialize(const std::string& db_path) {
+    if (sqlite3_open(db_path.c_str(), &db) != SQLITE_OK) {
+        throw std::runtime_error("Failed to open DB: " + db_path);
+    }
+
+    // Create Tables
+    const char* schema = R"(
+        CREATE TABLE IF NOT EXISTS files (
+            file_id INTEGER PRIMARY KEY,
+            file_path TEXT UNIQUE,
+            created_at INTEGER
+        );
+        CREATE TABLE IF NOT EXISTS blocks (
+            block_id INTEGER PRIMARY KEY,
+            block_hash TEXT UNIQUE,
+            size INTEGER,
+            compressed_size INTEGER
+        );
+        CREATE TABLE IF NOT EXISTS versions (
+            version_id INTEGER PRIMARY KEY,
+            file_id INTEGER,
+            parent_id INTEGER,
+            file_hash TEXT,
+            created_at INTEGER,
+            FOREIGN KEY(file_id) REFERENCES files(file_id)
+        );
+        CREATE TABLE IF NOT EXISTS version_block_lists (
+            version_id INTEGER PRIMARY KEY,
+            block_count INTEGER,
+            encoding INTEGER,
+            data BLOB,
+            FOREIGN KEY(version_id) REFERENCES versions(version_id)
+        );
+        CREATE TABLE IF NOT EXISTS file_blocks (
+            version_id INTEGER,
+            block_sequence INTEGER,
+            block_id INTEGER,
+            PRIMARY KEY(version_id, block_sequence),
+            FOREIGN KEY(version_id) REFERENCES versions(version_id),
+            FOREIGN KEY(block_id) REFERENCES blocks(block_id)
+        );
+        CREATE TABLE IF NOT EXISTS packed_extents (
+            version_id INTEGER PRIMARY KEY,
+            block_id INTEGER,
+            block_offset INTEGER,
+            length INTEGER,
+            FOREIGN KEY(version_id) REFERENCES versions(version_id),
+            FOREIGN KEY(block_id) REFERENCES blocks(block_id)
+        );
+        CREATE TABLE IF NOT EXISTS file_contents (
+            file_hash TEXT,
+            file_size INTEGER,
+            version_id INTEGER,
+            PRIMARY KEY(file_hash, file_size),
+            FOREIGN KEY(version_id) REFERENCES versions(version_id)
+        ) WITHOUT ROWID;
+        CREATE TABLE IF NOT EXISTS snapshots (
+            snapshot_id INTEGER PRIMARY KEY,
+            root_path TEXT,
+            created_at INTEGER
+        );
+        CREATE TABLE IF NOT EXISTS backup_checkpoints (
+            file_path TEXT PRIMARY KEY,
+            file_size INTEGER,
+            mtime INTEGER,
+            block_count INTEGER,
+            encoding INTEGER,
+            block_ids BLOB,
+            hash_state BLOB,
+            updated_at INTEGER
+        );
+        CREATE TABLE IF NOT EXISTS replica_versions (
+            source TEXT,
+            source_id INTEGER,
+            version_id INTEGER,
+            PRIMARY KEY(source, source_id)
+        ) WITHOUT ROWID;
+        CREATE TABLE IF NOT EXISTS replica_snapshots (
+            source TEXT,
+            source_id INTEGER,
+            snapshot_id INTEGER,
+            PRIMARY KEY(source, source_id)
+        ) WITHOUT ROWID;
+        CREATE TABLE IF NOT EXISTS block_features (
+            feature INTEGER,
+            block_id INTEGER,
+            PRIMARY KEY(feature, block_id),
+            FOREIGN KEY(block_id) REFERENCES blocks(block_id)
+        ) WITHOUT ROWID;
+        CREATE TABLE IF NOT EXISTS merkle_nodes (
+            node_hash TEXT PRIMARY KEY,
+            level INTEGER,
+            byte_count INTEGER,
+            children BLOB
+        ) WITHOUT ROWID;
+        CREATE TABLE IF NOT EXISTS snapshot_versions (
+            snapshot_id INTEGER,
+            version_id INTEGER,
+            PRIMARY KEY(snapshot_id, version_id),
+            FOREIGN KEY(snapshot_id) REFERENCES snapshots(snapshot_id),
+            FOREIGN KEY(version_id) REFERENCES versions(version_id)
+        );
+    )";
+    executeSQL(schema);
+
+    // Versions created by whole-file dedup point at the version owning the block list
+    ensureColumn("versions", "source_version_id", "INTEGER DEFAULT 0");
+    ensureColumn("versions", "file_size", "INTEGER");
+
+    // Root of the version's Merkle tree; NULL until built (older versions get theirs on first use)
+    ensureColumn("versions", "merkle_root", "TEXT");
+
+    // Permission bits of the backed-up file; NULL for versions stored before they were recorded
+    ensureColumn("versions", "mode", "INTEGER");
+
+    // Reverse lookups on the legacy per-row block lists: damage reports and the
+    // ref_count backfill below (no new rows are written to file_blocks)
+    executeSQL("CREATE INDEX IF NOT EXISTS idx_file_blocks_block ON file_blocks(block_id, version_id)");
+
+    // Number of versions whose block list (or packed extent) references the block.
+    // Older catalogs are backfilled once from the per-row file_blocks table, in
+    // one grouped pass over idx_file_blocks_block and packed_extents.
+    if (ensureColumn("blocks", "ref_count", "INTEGER DEFAULT 0")) {
+        executeSQL(R"(
+            CREATE TEMP TABLE block_refs (block_id INTEGER PRIMARY KEY, refs INTEGER);
+            INSERT INTO block_refs
+                SELECT block_id, COUNT(*) FROM (
+                    SELECT block_id FROM file_blocks GROUP BY block_id, version_id
+                    UNION ALL
+                    SELECT block_id FROM packed_extents
+                ) GROUP BY block_id;
+            UPDATE blocks SET ref_count = (SELECT refs FROM block_refs r WHERE r.block_id = blocks.block_id)
+                WHERE block_id IN (SELECT block_id FROM block_refs);
+            DROP TABLE block_refs;
+        )");
+    }
+
+    // zstd level of the stored payload (older blocks were all written at 3) and
+    // when the block was first stored (NULL for older blocks), for recompression
+    ensureColumn("blocks", "compression_level", "INTEGER DEFAULT 3");
+    ensureColumn("blocks", "created_at", "INTEGER");
+
+    // Blocks stored as a delta: the base block's hash and the length of the chain
+    ensureColumn("blocks", "delta_base", "TEXT");
+    ensureColumn("blocks", "delta_depth", "INTEGER DEFAULT 0");
+
+    // Indexes for version listing and reverse block lookups
+    executeSQL(R"(
+        CREATE INDEX IF NOT EXISTS idx_versions_file ON versions(file_id, version_id);
+        CREATE INDEX IF NOT EXISTS idx_versions_source ON versions(source_version_id) WHERE source_version_id > 0;
+        CREATE INDEX IF NOT EXISTS idx_packed_extents_block ON packed_extents(block_id);
+        CREATE INDEX IF NOT EXISTS idx_file_contents_size ON file_contents(file_size);
+    )");
+}
+
+uint64_t SqliteMetadataDB::getOrCreateFile(const std::string& path) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT file_id FROM files WHERE file_path = ?";
+    
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Prepare failed");
+    }
+    
+    sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_STATIC);
+    
+    uint64_t id = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        id = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+
+    if (id != 0) return id;
+
+    // Insert
+    sql = "INSERT INTO files (file_path, created_at) VALUES (?, ?)";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
+    
+    sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, std::time(nullptr));
+    
+    if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Insert file failed");
+    sqlite3_finalize(stmt);
+    
+    return getLastInsertId();
+}
+
+uint64_t SqliteMetadataDB::storeBlock(const std::string& hash, int size, int compressed_size, int compression_level,
+                                const std::string& delta_base, int delta_depth) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    // Check existence first
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT block_id FROM blocks WHERE block_hash = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
+    sqlite3_bind_text(stmt, 1, hash.c_str(), -1, SQLITE_STATIC);
+    
+    uint64_t id = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        id = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+
+    if (id != 0) return id;
+
+    // Insert
+    sql = R"(
+        INSERT INTO blocks (block_hash, size, compressed_size, compression_level, created_at, delta_base, delta_depth)
+        VALUES (?, ?, ?, ?, ?, ?, ?)
+    )";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
+    sqlite3_bind_text(stmt, 1, hash.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, size);
+    sqlite3_bind_int(stmt, 3, compressed_size);
+    sqlite3_bind_int(stmt, 4, compression_level);
+    sqlite3_bind_int64(stmt, 5, std::time(nullptr));
+    if (delta_base.empty()) {
+        sqlite3_bind_null(stmt, 6);
+    } else {
+        sqlite3_bind_text(stmt, 6, delta_base.c_str(), -1, SQLITE_STATIC);
+    }
+    sqlite3_bind_int(stmt, 7, delta_depth);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Insert block failed");
+    sqlite3_finalize(stmt);
+
+    return getLastInsertId();
+}
+
+uint64_t SqliteMetadataDB::findBlock(const std::string& hash) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT block_id FROM blocks WHERE block_hash = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
+    sqlite3_bind_text(stmt, 1, hash.c_str(), -1, SQLITE_STATIC);
+
+    uint64_t id = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        id = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return id;
+}
+
+bool SqliteMetadataDB::getBlock(const std::string& hash, DBBlock& block) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    sqlite3_stmt* stmt;
+    std::string sql = R"(
+        SELECT block_id, size, compressed_size, compression_level, IFNULL(delta_base, ''), delta_depth
+        FROM blocks WHERE block_hash = ?
+    )";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
+    sqlite3_bind_text(stmt, 1, hash.c_str(), -1, SQLITE_STATIC);
+
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        block.block_id = sqlite3_column_int64(stmt, 0);
+        block.block_hash = hash;
+        block.size = sqlite3_column_int(stmt, 1);
+        block.compressed_size = sqlite3_column_int(stmt, 2);
+        block.compression_level = sqlite3_column_int(stmt, 3);
+        block.delta_base = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
+        block.delta_depth = sqlite3_column_int(stmt, 5);
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+void SqliteMetadataDB::addBlockFeatures(uint64_t block_id, const BlockSketch& sketch) {
+    if (sketch.empty()) return;
+    std::lock_guard<std::mutex> lock(db_mutex);
+    sqlite3_stmt* stmt;
+    std::string sql = "INSERT OR IGNORE INTO block_features (feature, block_id) VALUES (?, ?), (?, ?), (?, ?)";
+    static_assert(SKETCH_SUPER_FEATURES == 3, "one row per super-feature");
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
+    for (size_t i = 0; i < SKETCH_SUPER_FEATURES; ++i) {
+        sqlite3_bind_int64(stmt, static_cast<int>(2 * i + 1), sketch.super_features[i]);
+        sqlite3_bind_int64(stmt, static_cast<int>(2 * i + 2), block_id);
+    }
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) throw std::runtime_error("Insert block features failed");
+}
+
+bool SqliteMetadataDB::findSimilarBlock(const BlockSketch& sketch, int max_depth, DBBlock& base) {
+    if (sketch.empty()) return false;
+    std::lock_guard<std::mutex> lock(db_mutex);
+    sqlite3_stmt* stmt;
+    // Each feature contributes a bounded prefix of its index range
+    std::string sql = R"(
+        SELECT b.block_id, b.block_hash, b.size, b.compressed_size, b.delta_depth, COUNT(*) AS matches
+        FROM (
+            SELECT block_id FROM (SELECT block_id FROM block_features WHERE feature = ? ORDER BY block_id LIMIT ?)
+            UNION ALL
+            SELECT block_id FROM (SELECT block_id FROM block_features WHERE feature = ? ORDER BY block_id LIMIT ?)
+            UNION ALL
+            SELECT block_id FROM (SELECT block_id FROM block_features WHERE feature = ? ORDER BY block_id LIMIT ?)
+        ) f JOIN blocks b ON b.block_id = f.block_id
+        WHERE b.delta_depth < ?
+        GROUP BY b.block_id
+        ORDER BY matches DESC, b.block_id DESC
+        LIMIT 1
+    )";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    for (size_t i = 0; i < SKETCH_SUPER_FEATURES; ++i) {
+        sqlite3_bind_int64(stmt, static_cast<int>(2 * i + 1), sketch.super_features[i]);
+        sqlite3_bind_int64(stmt, static_cast<int>(2 * i + 2), static_cast<int64_t>(SKETCH_CANDIDATES_PER_FEATURE));
+    }
+    sqlite3_bind_int(stmt, 2 * SKETCH_SUPER_FEATURES + 1, max_depth);
+
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        base.block_id = sqlite3_column_int64(stmt, 0);
+        base.block_hash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        base.size = sqlite3_column_int(stmt, 2);
+        base.compressed_size = sqlite3_column_int(stmt, 3);
+        base.delta_depth = sqlite3_column_int(stmt, 4);
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+uint64_t SqliteMetadataDB::createVersion(
+    uint64_t file_id, 
+    const std::string& file_hash, 
+    uint64_t file_size,
+    const std::vector<uint64_t>& block_ids,
+    uint64_t parent_id,
+    uint32_t mode
+) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    executeSQL("BEGIN TRANSACTION");
+    try {
+        // Nodes shared with earlier versions are already stored and ignored
+        MerkleTreeBuilder tree([this](const MerkleNode& node) { storeMerkleNode(node); });
+        for (size_t first = 0; first < block_ids.size(); first += BLOCK_REF_CHUNK) {
+            size_t count = std::min(BLOCK_REF_CHUNK, block_ids.size() - first);
+            for (const auto& ref : lookupBlockRefs(block_ids.data() + first, count)) {
+                tree.addBlock(ref.block_hash, ref.block_id, ref.size);
+            }
+        }
+        std::string merkle_root = tree.finish();
+
+        sqlite3_stmt* stmt;
+        std::string sql = "INSERT INTO versions (file_id, parent_id, file_hash, created_at, file_size, merkle_root, mode) VALUES (?, ?, ?, ?, ?, ?, ?)";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare version failed");
+        
+        sqlite3_bind_int64(stmt, 1, file_id);
+        sqlite3_bind_int64(stmt, 2, parent_id);
+        sqlite3_bind_text(stmt, 3, file_hash.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 4, std::time(nullptr));
+        sqlite3_bind_int64(stmt, 5, file_size);
+        sqlite3_bind_text(stmt, 6, merkle_root.c_str(), -1, SQLITE_STATIC);
+        bindMode(stmt, 7, mode);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Step version failed");
+        sqlite3_finalize(stmt);
+
+        uint64_t version_id = getLastInsertId();
+
+        // Block list as a single encoded blob
+        BlockListEncoding encoding;
+        auto encoded = encodeBlockList(block_ids, encoding);
+        sql = "INSERT INTO version_block_lists (version_id, block_count, encoding, data) VALUES (?, ?, ?, ?)";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare block list failed");
+        sqlite3_bind_int64(stmt, 1, version_id);
+        sqlite3_bind_int64(stmt, 2, block_ids.size());
+        sqlite3_bind_int(stmt, 3, static_cast<int>(encoding));
+        sqlite3_bind_blob(stmt, 4, encoded.data(), static_cast<int>(encoded.size()), SQLITE_STATIC);
+        if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Step block list failed");
+        sqlite3_finalize(stmt);
+
+        addBlockRefs(block_ids, 1);
+
+        sql = "INSERT OR IGNORE INTO file_contents (file_hash, file_size, version_id) VALUES (?, ?, ?)";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare content failed");
+        sqlite3_bind_text(stmt, 1, file_hash.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, file_size);
+        sqlite3_bind_int64(stmt, 3, version_id);
+        if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Step content failed");
+        sqlite3_finalize(stmt);
+
+        executeSQL("COMMIT");
+        return version_id;
+    } catch (...) {
+        executeSQL("ROLLBACK");
+        throw;
+    }
+}
+
+uint64_t SqliteMetadataDB::getLatestVersionId(uint64_t file_id) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    sqlite3_stmt* stmt;
+    // Uses idx_versions_file
+    std::string sql = "SELECT MAX(version_id) FROM versions WHERE file_id = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
+    sqlite3_bind_int64(stmt, 1, file_id);
+
+    uint64_t id = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        id = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return id;
+}
+
+bool SqliteMetadataDB::hasContentOfSize(uint64_t file_size) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    sqlite3_stmt* stmt;
+    // Uses idx_file_contents_size
+    std::string sql = "SELECT 1 FROM file_contents WHERE file_size = ? LIMIT 1";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
+    sqlite3_bind_int64(stmt, 1, file_size);
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+uint64_t SqliteMetadataDB::findVersionByContent(const std::string& file_hash, uint64_t file_size) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT version_id FROM file_contents WHERE file_hash = ? AND file_size = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare failed");
+    sqlite3_bind_text(stmt, 1, file_hash.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, file_size);
+
+    uint64_t id = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        id = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return id;
+}
+
+uint64_t SqliteMetadataDB::createVersionFromContent(
+    uint64_t file_id,
+    const std::string& file_hash,
+    uint64_t file_size,
+    uint64_t source_version_id,
+    uint64_t parent_id,
+    uint32_t mode
+) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    sqlite3_stmt* stmt;
+    std::string sql = "INSERT INTO versions (file_id, parent_id, file_hash, created_at, source_version_id, file_size, mode) VALUES (?, ?, ?, ?, ?, ?, ?)";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare version failed");
+
+    sqlite3_bind_int64(stmt, 1, file_id);
+    sqlite3_bind_int64(stmt, 2, parent_id);
+    sqlite3_bind_text(stmt, 3, file_hash.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 4, std::time(nullptr));
+    sqlite3_bind_int64(stmt, 5, resolveContentVersion(source_version_id));
+    sqlite3_bind_int64(stmt, 6, file_size);
+    bindMode(stmt, 7, mode);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Step version failed");
+    sqlite3_finalize(stmt);
+    return getLastInsertId();
+}
+
+std::vector<uint64_t> SqliteMetadataDB::createPackedVersions(
+    uint64_t block_id,
+    const std::vector<PackedFileEntry>& entries
+) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    executeSQL("BEGIN TRANSACTION");
+    sqlite3_stmt* version_stmt = nullptr;
+    sqlite3_stmt* extent_stmt = nullptr;
+    sqlite3_stmt* content_stmt = nullptr;
+    try {
+        std::string sql = "INSERT INTO versions (file_id, parent_id, file_hash, created_at, file_size, mode) VALUES (?, ?, ?, ?, ?, ?)";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &version_stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare version failed");
+        sql = "INSERT INTO packed_extents (version_id, block_id, block_offset, length) VALUES (?, ?, ?, ?)";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &extent_stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare extent failed");
+        sql = "INSERT OR IGNORE INTO file_contents (file_hash, file_size, version_id) VALUES (?, ?, ?)";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &content_stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare content failed");
+
+        std::vector<uint64_t> version_ids;
+        version_ids.reserve(entries.size());
+        int64_t now = std::time(nullptr);
+
+        for (const auto& entry : entries) {
+            sqlite3_reset(version_stmt);
+            sqlite3_bind_int64(version_stmt, 1, entry.file_id);
+            sqlite3_bind_int64(version_stmt, 2, entry.parent_id);
+            sqlite3_bind_text(version_stmt, 3, entry.file_hash.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(version_stmt, 4, now);
+            sqlite3_bind_int64(version_stmt, 5, entry.length);
+            bindMode(version_stmt, 6, entry.mode);
+            if (sqlite3_step(version_stmt) != SQLITE_DONE) throw std::runtime_error("Step version failed");
+            uint64_t version_id = getLastInsertId();
+
+            sqlite3_reset(extent_stmt);
+            sqlite3_bind_int64(extent_stmt, 1, version_id);
+            sqlite3_bind_int64(extent_stmt, 2, block_id);
+            sqlite3_bind_int64(extent_stmt, 3, entry.offset);
+            sqlite3_bind_int64(extent_stmt, 4, entry.length);
+            if (sqlite3_step(extent_stmt) != SQLITE_DONE) throw std::runtime_error("Step extent failed");
+
+            sqlite3_reset(content_stmt);
+            sqlite3_bind_text(content_stmt, 1, entry.file_hash.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(content_stmt, 2, entry.length);
+            sqlite3_bind_int64(content_stmt, 3, version_id);
+            if (sqlite3_step(content_stmt) != SQLITE_DONE) throw std::runtime_error("Step content failed");
+
+            version_ids.push_back(version_id);
+        }
+        sqlite3_finalize(version_stmt);
+        sqlite3_finalize(extent_stmt);
+        sqlite3_finalize(content_stmt);
+        version_stmt = extent_stmt = content_stmt = nullptr;
+
+        // Every packed file counts as one reference to the aggregate block
+        if (!entries.empty()) {
+            addBlockRefs({block_id}, static_cast<int64_t>(entries.size()));
+        }
+
+        executeSQL("COMMIT");
+        return version_ids;
+    } catch (...) {
+        sqlite3_finalize(version_stmt);
+        sqlite3_finalize(extent_stmt);
+        sqlite3_finalize(content_stmt);
+        executeSQL("ROLLBACK");
+        throw;
+    }
+}
+
+uint64_t SqliteMetadataDB::createSnapshot(const std::string& root_path, const std::vector<uint64_t>& version_ids) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    executeSQL("BEGIN TRANSACTION");
+    try {
+        sqlite3_stmt* stmt;
+        std::string sql = "INSERT INTO snapshots (root_path, created_at) VALUES (?, ?)";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare snapshot failed");
+        sqlite3_bind_text(stmt, 1, root_path.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, std::time(nullptr));
+        if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Step snapshot failed");
+        sqlite3_finalize(stmt);
+
+        uint64_t snapshot_id = getLastInsertId();
+
+        sql = "INSERT OR IGNORE INTO snapshot_versions (snapshot_id, version_id) VALUES (?, ?)";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare snapshot mapping failed");
+        for (uint64_t vid : version_ids) {
+            sqlite3_reset(stmt);
+            sqlite3_bind_int64(stmt, 1, snapshot_id);
+            sqlite3_bind_int64(stmt, 2, vid);
+            if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Step snapshot mapping failed");
+        }
+        sqlite3_finalize(stmt);
+
+        executeSQL("COMMIT");
+        return snapshot_id;
+    } catch (...) {
+        executeSQL("ROLLBACK");
+        throw;
+    }
+}
+
+void SqliteMetadataDB::saveCheckpoint(const BackupCheckpoint& checkpoint) {
+    BlockListEncoding encoding;
+    auto encoded = encodeBlockList(checkpoint.block_ids, encoding);
+
+    std::lock_guard<std::mutex> lock(db_mutex);
+    sqlite3_stmt* stmt;
+    std::string sql = R"(
+        INSERT INTO backup_checkpoints (file_path, file_size, mtime, block_count, encoding, block_ids, hash_state, updated_at)
+        VALUES (?, ?, ?, ?, ?, ?, ?, ?)
+        ON CONFLICT(file_path) DO UPDATE SET
+            file_size = excluded.file_size, mtime = excluded.mtime, block_count = excluded.block_count,
+            encoding = excluded.encoding, block_ids = excluded.block_ids, hash_state = excluded.hash_state,
+            updated_at = excluded.updated_at
+        WHERE excluded.block_count > backup_checkpoints.block_count
+           OR excluded.file_size != backup_checkpoints.file_size
+           OR excluded.mtime != backup_checkpoints.mtime
+    )";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare checkpoint failed");
+    sqlite3_bind_text(stmt, 1, checkpoint.file_path.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, checkpoint.file_size);
+    sqlite3_bind_int64(stmt, 3, checkpoint.mtime);
+    sqlite3_bind_int64(stmt, 4, checkpoint.block_ids.size());
+    sqlite3_bind_int(stmt, 5, static_cast<int>(encoding));
+    sqlite3_bind_blob(stmt, 6, encoded.data(), static_cast<int>(encoded.size()), SQLITE_STATIC);
+    sqlite3_bind_blob(stmt, 7, checkpoint.hash_state.data(), static_cast<int>(checkpoint.hash_state.size()), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 8, std::time(nullptr));
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) throw std::runtime_error("Step checkpoint failed");
+}
+
+bool SqliteMetadataDB::loadCheckpoint(const std::string& file_path, BackupCheckpoint& checkpoint) {
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT file_size, mtime, encoding, block_ids, hash_state FROM backup_checkpoints WHERE file_path = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare checkpoint query failed");
+    sqlite3_bind_text(stmt, 1, file_path.c_str(), -1, SQLITE_STATIC);
+
+    bool found = false;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        checkpoint.file_path = file_path;
+        checkpoint.file_size = sqlite3_column_int64(stmt, 0);
+        checkpoint.mtime = sqlite3_column_int64(stmt, 1);
+        auto encoding = static_cast<BlockListEncoding>(sqlite3_column_int(stmt, 2));
+        const uint8_t* ids = static_cast<const uint8_t*>(sqlite3_column_blob(stmt, 3));
+        checkpoint.block_ids = decodeBlockList(ids, sqlite3_column_bytes(stmt, 3), encoding);
+        const char* state = static_cast<const char*>(sqlite3_column_blob(stmt, 4));
+        checkpoint.hash_state.assign(state ? state : "", sqlite3_column_bytes(stmt, 4));
+        found = true;
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+void SqliteMetadataDB::clearCheckpoint(const std::string& file_path) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    sqlite3_stmt* stmt;
+    std::string sql = "DELETE FROM backup_checkpoints WHERE file_path = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare checkpoint delete failed");
+    sqlite3_bind_text(stmt, 1, file_path.c_str(), -1, SQLITE_STATIC);
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) throw std::runtime_error("Step checkpoint delete failed");
+}
+
+std::vector<DBSnapshotEntry> SqliteMetadataDB::getSnapshotFiles(uint64_t snapshot_id) {
+    std::vector<DBSnapshotEntry> files;
+    sqlite3_stmt* stmt;
+    std::string sql = R"(
+        SELECT sv.version_id, f.file_path, v.file_size, v.mode
+        FROM snapshot_versions sv
+        JOIN versions v ON sv.version_id = v.version_id
+        JOIN files f ON v.file_id = f.file_id
+        WHERE sv.snapshot_id = ?
+        ORDER BY f.file_path ASC
+    )";
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, snapshot_id);
+
+    std::vector<size_t> missing_size;   // Rows written before versions.file_size existed
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        DBSnapshotEntry entry;
+        entry.version_id = sqlite3_column_int64(stmt, 0);
+        const char* p = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        entry.file_path = p ? p : "";
+        if (sqlite3_column_type(stmt, 2) == SQLITE_NULL) missing_size.push_back(files.size());
+        entry.file_size = sqlite3_column_int64(stmt, 2);
+        entry.mode = columnMode(stmt, 3);
+        files.push_back(std::move(entry));
+    }
+    sqlite3_finalize(stmt);
+
+    for (size_t i : missing_size) files[i].file_size = getVersionSize(files[i].version_id);
+    return files;
+}
+
+bool SqliteMetadataDB::getPackedExtent(uint64_t version_id, DBPackedExtent& extent) {
+    sqlite3_stmt* stmt;
+    std::string sql = R"(
+        SELECT pe.block_id, b.block_hash, pe.block_offset, pe.length, b.ref_count
+        FROM packed_extents pe
+        JOIN blocks b ON pe.block_id = b.block_id
+        WHERE pe.version_id = ?
+    )";
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, resolveContentVersion(version_id));
+
+    bool found = false;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* h = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        extent.block_id = sqlite3_column_int64(stmt, 0);
+        extent.block_hash = h ? std::string(h) : "";
+        extent.offset = sqlite3_column_int64(stmt, 2);
+        extent.length = sqlite3_column_int64(stmt, 3);
+        extent.ref_count = sqlite3_column_int64(stmt, 4);
+        found = true;
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+void SqliteMetadataDB::readVersionBlockIds(
+    uint64_t version_id,
+    const std::function<void(const uint64_t* ids, size_t count)>& sink
+) {
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT encoding, data FROM version_block_lists WHERE version_id = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, version_id);
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        auto encoding = static_cast<BlockListEncoding>(sqlite3_column_int(stmt, 0));
+        const auto* data = static_cast<const uint8_t*>(sqlite3_column_blob(stmt, 1));
+        size_t size = sqlite3_column_bytes(stmt, 1);
+        try {
+            BlockListDecoder decoder(data, size, encoding);
+            uint64_t ids[BLOCK_REF_CHUNK];
+            size_t n;
+            while ((n = decoder.next(ids, BLOCK_REF_CHUNK)) > 0) {
+                sink(ids, n);
+            }
+        } catch (...) {
+            sqlite3_finalize(stmt);
+            throw;
+        }
+        sqlite3_finalize(stmt);
+        return;
+    }
+    sqlite3_finalize(stmt);
+
+    // Versions written before block lists were encoded: range scan on the
+    // file_blocks primary key (version_id, block_sequence)
+    sql = "SELECT block_id FROM file_blocks WHERE version_id = ? ORDER BY block_sequence ASC";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, version_id);
+
+    std::vector<uint64_t> ids;
+    ids.reserve(BLOCK_REF_CHUNK);
+    try {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            ids.push_back(sqlite3_column_int64(stmt, 0));
+            if (ids.size() == BLOCK_REF_CHUNK) {
+                sink(ids.data(), ids.size());
+                ids.clear();
+            }
+        }
+        if (!ids.empty()) sink(ids.data(), ids.size());
+    } catch (...) {
+        sqlite3_finalize(stmt);
+        throw;
+    }
+    sqlite3_finalize(stmt);
+}
+
+bool SqliteMetadataDB::getBlockRef(uint64_t block_id, DBBlockRef& ref) {
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT block_hash, size, compressed_size, ref_count FROM blocks WHERE block_id = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, block_id);
+
+    bool found = false;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* h = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        ref.block_id = block_id;
+        ref.block_hash = h ? std::string(h) : "";
+        ref.size = sqlite3_column_int64(stmt, 1);
+        ref.compressed_size = sqlite3_column_int64(stmt, 2);
+        ref.ref_count = sqlite3_column_int64(stmt, 3);
+        found = true;
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+uint64_t SqliteMetadataDB::getVersionBlockCount(uint64_t version_id) {
+    uint64_t resolved = resolveContentVersion(version_id);
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT block_count FROM version_block_lists WHERE version_id = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, resolved);
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    uint64_t count = found ? sqlite3_column_int64(stmt, 0) : 0;
+    sqlite3_finalize(stmt);
+    if (found) return count;
+
+    sql = "SELECT COUNT(*) FROM file_blocks WHERE version_id = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, resolved);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        count = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return count;
+}
+
+uint64_t SqliteMetadataDB::getVersionSize(uint64_t version_id) {
+    {
+        sqlite3_stmt* stmt;
+        std::string sql = "SELECT file_size FROM versions WHERE version_id = ?";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+        sqlite3_bind_int64(stmt, 1, version_id);
+        bool known = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL;
+        uint64_t size = known ? sqlite3_column_int64(stmt, 0) : 0;
+        sqlite3_finalize(stmt);
+        if (known) return size;
+    }
+
+    // Versions written before file_size was recorded
+    DBPackedExtent extent;
+    if (getPackedExtent(version_id, extent)) {
+        return extent.length;
+    }
+
+    uint64_t size = 0;
+    forEachVersionBlock(version_id, [&size](const DBBlockRef& ref) {
+        size += ref.size;
+        return true;
+    });
+    return size;
+}
+
+std::vector<DBBlock> SqliteMetadataDB::listBlocks(uint64_t after_block_id, size_t limit) {
+    std::vector<DBBlock> blocks;
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT block_id, block_hash, size, compressed_size FROM blocks WHERE block_id > ? ORDER BY block_id ASC LIMIT ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, after_block_id);
+    sqlite3_bind_int64(stmt, 2, static_cast<int64_t>(limit));
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        DBBlock block;
+        block.block_id = sqlite3_column_int64(stmt, 0);
+        const char* h = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        block.block_hash = h ? std::string(h) : "";
+        block.size = sqlite3_column_int(stmt, 2);
+        block.compressed_size = sqlite3_column_int(stmt, 3);
+        blocks.push_back(block);
+    }
+    sqlite3_finalize(stmt);
+    return blocks;
+}
+
+std::pair<uint64_t, uint64_t> SqliteMetadataDB::getBlockTotals(uint64_t after_block_id) {
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT COUNT(*), COALESCE(SUM(compressed_size), 0) FROM blocks WHERE block_id > ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, after_block_id);
+
+    std::pair<uint64_t, uint64_t> totals{0, 0};
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        totals.first = sqlite3_column_int64(stmt, 0);
+        totals.second = sqlite3_column_int64(stmt, 1);
+    }
+    sqlite3_finalize(stmt);
+    return totals;
+}
+
+std::vector<uint64_t> SqliteMetadataDB::findVersionsUsingBlocks(const std::vector<uint64_t>& block_ids) {
+    std::unordered_set<uint64_t> wanted(block_ids.begin(), block_ids.end());
+    std::set<uint64_t> versions;
+    if (wanted.empty()) return {};
+
+    // Encoded block lists
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT version_id, encoding, data FROM version_block_lists";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    try {
+        uint64_t ids[BLOCK_REF_CHUNK];
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            uint64_t version_id = sqlite3_column_int64(stmt, 0);
+            BlockListDecoder decoder(static_cast<const uint8_t*>(sqlite3_column_blob(stmt, 2)),
+                                     sqlite3_column_bytes(stmt, 2),
+                                     static_cast<BlockListEncoding>(sqlite3_column_int(stmt, 1)));
+            size_t n;
+            bool hit = false;
+            while (!hit && (n = decoder.next(ids, BLOCK_REF_CHUNK)) > 0) {
+                for (size_t i = 0; i < n && !hit; ++i) hit = wanted.count(ids[i]) > 0;
+            }
+            if (hit) versions.insert(version_id);
+        }
+    } catch (...) {
+        sqlite3_finalize(stmt);
+        throw;
+    }
+    sqlite3_finalize(stmt);
+
+    // Legacy per-row lists and aggregate blocks of small files
+    const char* reverse_lookups[] = {
+        "SELECT DISTINCT version_id FROM file_blocks WHERE block_id = ?",
+        "SELECT version_id FROM packed_extents WHERE block_id = ?"
+    };
+    for (const char* lookup : reverse_lookups) {
+        if (sqlite3_prepare_v2(db, lookup, -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+        for (uint64_t block_id : wanted) {
+            sqlite3_reset(stmt);
+            sqlite3_bind_int64(stmt, 1, block_id);
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                versions.insert(sqlite3_column_int64(stmt, 0));
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    // Whole-file clones share the damaged content
+    sql = "SELECT version_id FROM versions WHERE source_version_id = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    std::vector<uint64_t> owners(versions.begin(), versions.end());
+    for (uint64_t owner : owners) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, owner);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            versions.insert(sqlite3_column_int64(stmt, 0));
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    return std::vector<uint64_t>(versions.begin(), versions.end());
+}
+
+bool SqliteMetadataDB::versionExists(uint64_t version_id) {
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT 1 FROM versions WHERE version_id = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, version_id);
+    bool exists = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    return exists;
+}
+
+std::vector<DBBlock> SqliteMetadataDB::listCompactionCandidates(uint64_t after_block_id, int64_t stored_before,
+                                                          int below_level, size_t limit) {
+    std::vector<DBBlock> blocks;
+    sqlite3_stmt* stmt;
+    std::string sql = R"(
+        SELECT block_id, block_hash, size, compressed_size, compression_level FROM blocks
+        WHERE block_id > ? AND compression_level < ? AND IFNULL(created_at, 0) <= ? AND delta_base IS NULL
+        ORDER BY block_id ASC LIMIT ?
+    )";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, after_block_id);
+    sqlite3_bind_int(stmt, 2, below_level);
+    sqlite3_bind_int64(stmt, 3, stored_before);
+    sqlite3_bind_int64(stmt, 4, static_cast<int64_t>(limit));
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        DBBlock block;
+        block.block_id = sqlite3_column_int64(stmt, 0);
+        const char* h = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        block.block_hash = h ? std::string(h) : "";
+        block.size = sqlite3_column_int(stmt, 2);
+        block.compressed_size = sqlite3_column_int(stmt, 3);
+        block.compression_level = sqlite3_column_int(stmt, 4);
+        blocks.push_back(std::move(block));
+    }
+    sqlite3_finalize(stmt);
+    return blocks;
+}
+
+std::pair<uint64_t, uint64_t> SqliteMetadataDB::getCompactionTotals(int64_t stored_before, int below_level) {
+    sqlite3_stmt* stmt;
+    std::string sql = R"(
+        SELECT COUNT(*), COALESCE(SUM(compressed_size), 0) FROM blocks
+        WHERE compression_level < ? AND IFNULL(created_at, 0) <= ? AND delta_base IS NULL
+    )";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int(stmt, 1, below_level);
+    sqlite3_bind_int64(stmt, 2, stored_before);
+    std::pair<uint64_t, uint64_t> totals{0, 0};
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        totals = {static_cast<uint64_t>(sqlite3_column_int64(stmt, 0)), static_cast<uint64_t>(sqlite3_column_int64(stmt, 1))};
+    }
+    sqlite3_finalize(stmt);
+    return totals;
+}
+
+void SqliteMetadataDB::updateBlockCompression(const std::vector<DBBlock>& blocks) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    executeSQL("BEGIN TRANSACTION");
+    sqlite3_stmt* stmt = nullptr;
+    try {
+        std::string sql = "UPDATE blocks SET compressed_size = ?, compression_level = ? WHERE block_id = ?";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare block update failed");
+        for (const auto& block : blocks) {
+            sqlite3_reset(stmt);
+            sqlite3_bind_int(stmt, 1, block.compressed_size);
+            sqlite3_bind_int(stmt, 2, block.compression_level);
+            sqlite3_bind_int64(stmt, 3, block.block_id);
+            if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Update block failed");
+        }
+        sqlite3_finalize(stmt);
+        executeSQL("COMMIT");
+    } catch (...) {
+        sqlite3_finalize(stmt);
+        executeSQL("ROLLBACK");
+        throw;
+    }
+}
+
+std::vector<DBVersion> SqliteMetadataDB::listVersions(const std::string& file_path) {
+    std::vector<DBVersion> versions;
+    sqlite3_stmt* stmt;
+    // Uses files(file_path) UNIQUE + idx_versions_file
+    std::string sql = R"(
+        SELECT v.version_id, v.file_id, v.parent_id, v.file_hash, v.created_at, v.file_size
+        FROM files f
+        JOIN versions v ON v.file_id = f.file_id
+        WHERE f.file_path = ?
+        ORDER BY v.version_id ASC
+    )";
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_text(stmt, 1, file_path.c_str(), -1, SQLITE_STATIC);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        DBVersion v;
+        v.version_id = sqlite3_column_int64(stmt, 0);
+        v.file_id = sqlite3_column_int64(stmt, 1);
+        v.parent_id = sqlite3_column_int64(stmt, 2);
+        const char* h = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+        v.file_hash = h ? std::string(h) : "";
+        v.created_at = sqlite3_column_int64(stmt, 4);
+        v.file_size = sqlite3_column_type(stmt, 5) == SQLITE_NULL ? 0 : sqlite3_column_int64(stmt, 5);
+        versions.push_back(v);
+    }
+    sqlite3_finalize(stmt);
+
+    for (auto& v : versions) {
+        if (v.file_size == 0) v.file_size = getVersionSize(v.version_id);
+    }
+    return versions;
+}
+
+std::vector<DBBlockRef> SqliteMetadataDB::lookupBlockRefs(const uint64_t* block_ids, size_t count) {
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT block_id, block_hash, size, compressed_size, ref_count FROM blocks WHERE block_id BETWEEN ? AND ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+
+    std::vector<uint64_t> sorted(block_ids, block_ids + count);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::unordered_map<uint64_t, DBBlockRef> found;
+    for (const auto& [first, last] : idRuns(sorted)) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, first);
+        sqlite3_bind_int64(stmt, 2, last);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            DBBlockRef ref;
+            ref.block_id = sqlite3_column_int64(stmt, 0);
+            const char* h = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+            ref.block_hash = h ? std::string(h) : "";
+            ref.size = sqlite3_column_int64(stmt, 2);
+            ref.compressed_size = sqlite3_column_int64(stmt, 3);
+            ref.ref_count = sqlite3_column_int64(stmt, 4);
+            found.emplace(ref.block_id, std::move(ref));
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    std::vector<DBBlockRef> refs;
+    refs.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        auto it = found.find(block_ids[i]);
+        if (it == found.end()) throw std::runtime_error("Block list references missing block " + std::to_string(block_ids[i]));
+        refs.push_back(it->second);
+    }
+    return refs;
+}
+
+void SqliteMetadataDB::storeMerkleNode(const MerkleNode& node) {
+    auto children = encodeMerkleChildren(node);
+    sqlite3_stmt* stmt;
+    std::string sql = "INSERT OR IGNORE INTO merkle_nodes (node_hash, level, byte_count, children) VALUES (?, ?, ?, ?)";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare Merkle node failed");
+    sqlite3_bind_text(stmt, 1, node.hash.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, static_cast<int>(node.level));
+    sqlite3_bind_int64(stmt, 3, node.byte_count);
+    sqlite3_bind_blob(stmt, 4, children.data(), static_cast<int>(children.size()), SQLITE_STATIC);
+    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+    if (!ok) throw std::runtime_error("Step Merkle node failed");
+}
+
+std::string SqliteMetadataDB::buildMerkleTree(uint64_t version_id) {
+    executeSQL("BEGIN TRANSACTION");
+    try {
+        MerkleTreeBuilder tree([this](const MerkleNode& node) { storeMerkleNode(node); });
+        readVersionBlockIds(version_id, [&](const uint64_t* ids, size_t count) {
+            for (const auto& ref : lookupBlockRefs(ids, count)) {
+                tree.addBlock(ref.block_hash, ref.block_id, ref.size);
+            }
+        });
+        std::string root = tree.finish();
+
+        sqlite3_stmt* stmt;
+        std::string sql = "UPDATE versions SET merkle_root = ? WHERE version_id = ?";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare Merkle root failed");
+        sqlite3_bind_text(stmt, 1, root.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, version_id);
+        bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+        if (!ok) throw std::runtime_error("Step Merkle root failed");
+
+        executeSQL("COMMIT");
+        return root;
+    } catch (...) {
+        executeSQL("ROLLBACK");
+        throw;
+    }
+}
+
+std::string SqliteMetadataDB::getMerkleRoot(uint64_t version_id) {
+    uint64_t resolved = resolveContentVersion(version_id);
+    {
+        sqlite3_stmt* stmt;
+        std::string sql = "SELECT merkle_root FROM versions WHERE version_id = ?";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+        sqlite3_bind_int64(stmt, 1, resolved);
+        bool exists = sqlite3_step(stmt) == SQLITE_ROW;
+        bool built = exists && sqlite3_column_type(stmt, 0) != SQLITE_NULL;
+        const char* root = built ? reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)) : nullptr;
+        std::string result = root ? std::string(root) : "";
+        sqlite3_finalize(stmt);
+        if (!exists) throw std::runtime_error("No such version: " + std::to_string(version_id));
+        if (built) return result;
+    }
+
+    // Packed files have no block list to build a tree over
+    DBPackedExtent extent;
+    if (getPackedExtent(resolved, extent)) return "";
+
+    std::lock_guard<std::mutex> lock(db_mutex);
+    return buildMerkleTree(resolved);
+}
+
+bool SqliteMetadataDB::getMerkleNode(const std::string& node_hash, MerkleNode& node) {
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT level, byte_count, children FROM merkle_nodes WHERE node_hash = ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_text(stmt, 1, node_hash.c_str(), -1, SQLITE_STATIC);
+
+    bool found = false;
+    try {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            node.hash = node_hash;
+            node.level = static_cast<unsigned>(sqlite3_column_int(stmt, 0));
+            node.byte_count = sqlite3_column_int64(stmt, 1);
+            const auto* data = static_cast<const uint8_t*>(sqlite3_column_blob(stmt, 2));
+            node.children = decodeMerkleChildren(node.level, data, sqlite3_column_bytes(stmt, 2));
+            found = true;
+        }
+    } catch (...) {
+        sqlite3_finalize(stmt);
+        throw;
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+void SqliteMetadataDB::forEachBlockInRange(const std::string& first_hash, const std::string& end_hash,
+                                     const std::function<void(const DBBlock&)>& callback) {
+    sqlite3_stmt* stmt;
+    std::string sql = std::string(R"(
+        SELECT block_id, block_hash, size, compressed_size, compression_level, IFNULL(delta_base, ''), delta_depth
+        FROM blocks WHERE block_hash >= ?)") + (end_hash.empty() ? "" : " AND block_hash < ?") + " ORDER BY block_hash";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_text(stmt, 1, first_hash.c_str(), -1, SQLITE_STATIC);
+    if (!end_hash.empty()) sqlite3_bind_text(stmt, 2, end_hash.c_str(), -1, SQLITE_STATIC);
+
+    try {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            DBBlock block;
+            block.block_id = sqlite3_column_int64(stmt, 0);
+            const char* h = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+            block.block_hash = h ? std::string(h) : "";
+            block.size = sqlite3_column_int(stmt, 2);
+            block.compressed_size = sqlite3_column_int(stmt, 3);
+            block.compression_level = sqlite3_column_int(stmt, 4);
+            block.delta_base = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
+            block.delta_depth = sqlite3_column_int(stmt, 6);
+            callback(block);
+        }
+    } catch (...) {
+        sqlite3_finalize(stmt);
+        throw;
+    }
+    sqlite3_finalize(stmt);
+}
+
+void SqliteMetadataDB::storeBlocks(const std::vector<DBBlock>& blocks) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    executeSQL("BEGIN TRANSACTION");
+    sqlite3_stmt* stmt = nullptr;
+    try {
+        std::string sql = R"(
+            INSERT OR IGNORE INTO blocks (block_hash, size, compressed_size, compression_level, created_at, delta_base, delta_depth)
+            VALUES (?, ?, ?, ?, ?, ?, ?)
+        )";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare block failed");
+        int64_t now = std::time(nullptr);
+        for (const auto& block : blocks) {
+            sqlite3_reset(stmt);
+            sqlite3_bind_text(stmt, 1, block.block_hash.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 2, block.size);
+            sqlite3_bind_int(stmt, 3, block.compressed_size);
+            sqlite3_bind_int(stmt, 4, block.compression_level);
+            sqlite3_bind_int64(stmt, 5, now);
+            if (block.delta_base.empty()) {
+                sqlite3_bind_null(stmt, 6);
+            } else {
+                sqlite3_bind_text(stmt, 6, block.delta_base.c_str(), -1, SQLITE_STATIC);
+            }
+            sqlite3_bind_int(stmt, 7, block.delta_depth);
+            if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Insert block failed");
+        }
+        sqlite3_finalize(stmt);
+        executeSQL("COMMIT");
+    } catch (...) {
+        sqlite3_finalize(stmt);
+        executeSQL("ROLLBACK");
+        throw;
+    }
+}
+
+uint64_t SqliteMetadataDB::getMaxVersionId() {
+    return queryId(db, "SELECT COALESCE(MAX(version_id), 0) FROM versions");
+}
+
+uint64_t SqliteMetadataDB::getMaxSnapshotId() {
+    return queryId(db, "SELECT COALESCE(MAX(snapshot_id), 0) FROM snapshots");
+}
+
+uint64_t SqliteMetadataDB::getReplicaVersionCursor(const std::string& source) {
+    return queryId(db, "SELECT COALESCE(MAX(source_id), 0) FROM replica_versions WHERE source = ?", source);
+}
+
+uint64_t SqliteMetadataDB::getReplicaSnapshotCursor(const std::string& source) {
+    return queryId(db, "SELECT COALESCE(MAX(source_id), 0) FROM replica_snapshots WHERE source = ?", source);
+}
+
+std::vector<DBVersionRecord> SqliteMetadataDB::listVersionRecords(uint64_t after_id, uint64_t last_id, size_t limit) {
+    std::vector<DBVersionRecord> records;
+    sqlite3_stmt* stmt;
+    std::string sql = R"(
+        SELECT v.version_id, f.file_path, v.parent_id, v.file_hash, v.created_at, v.file_size, v.source_version_id, v.mode
+        FROM versions v
+        JOIN files f ON v.file_id = f.file_id
+        WHERE v.version_id > ? AND v.version_id <= ?
+        ORDER BY v.version_id ASC
+        LIMIT ?
+    )";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, after_id);
+    sqlite3_bind_int64(stmt, 2, last_id);
+    sqlite3_bind_int64(stmt, 3, static_cast<int64_t>(limit));
+
+    std::vector<size_t> missing_size;   // Rows written before versions.file_size existed
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        DBVersionRecord r;
+        r.version_id = sqlite3_column_int64(stmt, 0);
+        const char* p = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        r.file_path = p ? p : "";
+        r.parent_id = sqlite3_column_int64(stmt, 2);
+        const char* h = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+        r.file_hash = h ? h : "";
+        r.created_at = sqlite3_column_int64(stmt, 4);
+        if (sqlite3_column_type(stmt, 5) == SQLITE_NULL) missing_size.push_back(records.size());
+        r.file_size = sqlite3_column_int64(stmt, 5);
+        r.source_version_id = sqlite3_column_int64(stmt, 6);
+        r.mode = columnMode(stmt, 7);
+        records.push_back(std::move(r));
+    }
+    sqlite3_finalize(stmt);
+
+    for (size_t i : missing_size) records[i].file_size = getVersionSize(records[i].version_id);
+    return records;
+}
+
+std::vector<DBSnapshot> SqliteMetadataDB::listSnapshots(uint64_t after_id, uint64_t last_id, size_t limit) {
+    std::vector<DBSnapshot> snapshots;
+    sqlite3_stmt* stmt;
+    std::string sql = "SELECT snapshot_id, root_path, created_at FROM snapshots WHERE snapshot_id > ? AND snapshot_id <= ? ORDER BY snapshot_id ASC LIMIT ?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    sqlite3_bind_int64(stmt, 1, after_id);
+    sqlite3_bind_int64(stmt, 2, last_id);
+    sqlite3_bind_int64(stmt, 3, static_cast<int64_t>(limit));
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        DBSnapshot snapshot;
+        snapshot.snapshot_id = sqlite3_column_int64(stmt, 0);
+        const char* p = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        snapshot.root_path = p ? p : "";
+        snapshot.created_at = sqlite3_column_int64(stmt, 2);
+        snapshots.push_back(std::move(snapshot));
+    }
+    sqlite3_finalize(stmt);
+
+    sql = "SELECT version_id FROM snapshot_versions WHERE snapshot_id = ? ORDER BY version_id";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+    for (auto& snapshot : snapshots) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, snapshot.snapshot_id);
+        while (sqlite3_step(stmt) == SQLITE_ROW) snapshot.version_ids.push_back(sqlite3_column_int64(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+    return snapshots;
+}
+
+void SqliteMetadataDB::importVersions(const std::string& source, const std::vector<ReplicaVersion>& versions) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    executeSQL("BEGIN TRANSACTION");
+
+    // Statements reused for every row of the batch
+    enum { FindFile, InsertFile, FindBlock, FindLeaf, MapVersion, InsertVersion, InsertList, InsertExtent, InsertContent, InsertMapping, StatementCount };
+    static const char* statements_sql[StatementCount] = {
+        "SELECT file_id FROM files WHERE file_path = ?",
+        "INSERT INTO files (file_path, created_at) VALUES (?, ?)",
+        "SELECT block_id, size FROM blocks WHERE block_hash = ?",
+        "SELECT children FROM merkle_nodes WHERE node_hash = ? AND level = 1",
+        "SELECT version_id FROM replica_versions WHERE source = ? AND source_id = ?",
+        "INSERT INTO versions (file_id, parent_id, file_hash, created_at, source_version_id, file_size, merkle_root, mode) VALUES (?, ?, ?, ?, ?, ?, ?, ?)",
+        "INSERT INTO version_block_lists (version_id, block_count, encoding, data) VALUES (?, ?, ?, ?)",
+        "INSERT INTO packed_extents (version_id, block_id, block_offset, length) VALUES (?, ?, ?, ?)",
+        "INSERT OR IGNORE INTO file_contents (file_hash, file_size, version_id) VALUES (?, ?, ?)",
+        "INSERT INTO replica_versions (source, source_id, version_id) VALUES (?, ?, ?)",
+    };
+    sqlite3_stmt* stmts[StatementCount] = {};
+
+    auto run = [&](int which) {
+        if (sqlite3_step(stmts[which]) != SQLITE_DONE) throw std::runtime_error("Import step failed: " + std::string(statements_sql[which]));
+    };
+    auto lookup = [&](int which) -> uint64_t {
+        uint64_t id = 0;
+        if (sqlite3_step(stmts[which]) == SQLITE_ROW) id = sqlite3_column_int64(stmts[which], 0);
+        sqlite3_reset(stmts[which]);
+        return id;
+    };
+    auto mapVersion = [&](uint64_t source_id) -> uint64_t {
+        if (source_id == 0) return 0;
+        sqlite3_bind_text(stmts[MapVersion], 1, source.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmts[MapVersion], 2, source_id);
+        return lookup(MapVersion);
+    };
+
+    try {
+        for (int i = 0; i < StatementCount; ++i) {
+            if (sqlite3_prepare_v2(db, statements_sql[i], -1, &stmts[i], nullptr) != SQLITE_OK) {
+                throw std::runtime_error("Prepare import failed");
+            }
+        }
+
+        std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> block_ids;   // Hash -> local (id, size), per batch
+        auto findBlock = [&](const std::string& hash) -> std::pair<uint64_t, uint64_t> {
+            auto it = block_ids.find(hash);
+            if (it != block_ids.end()) return it->second;
+            sqlite3_bind_text(stmts[FindBlock], 1, hash.c_str(), -1, SQLITE_TRANSIENT);
+            std::pair<uint64_t, uint64_t> block{0, 0};
+            if (sqlite3_step(stmts[FindBlock]) == SQLITE_ROW) {
+                block = {sqlite3_column_int64(stmts[FindBlock], 0), sqlite3_column_int64(stmts[FindBlock], 1)};
+            }
+            sqlite3_reset(stmts[FindBlock]);
+            if (block.first == 0) throw std::runtime_error("Replicated version references a block that is not stored: " + hash);
+            block_ids.emplace(hash, block);
+            return block;
+        };
+
+        // A level-1 node already stored here resolves its whole run of blocks in
+        // one lookup, so a version that mostly matches an earlier one costs work
+        // in proportion to the runs that changed
+        auto findLeaf = [&](const std::vector<MerkleChild>& leaf, std::vector<MerkleChild>& stored) -> bool {
+            std::string leaf_hash = merkleNodeHash(1, leaf);
+            sqlite3_bind_text(stmts[FindLeaf], 1, leaf_hash.c_str(), -1, SQLITE_TRANSIENT);
+            bool found = sqlite3_step(stmts[FindLeaf]) == SQLITE_ROW;
+            if (found) {
+                const auto* data = static_cast<const uint8_t*>(sqlite3_column_blob(stmts[FindLeaf], 0));
+                stored = decodeMerkleChildren(1, data, sqlite3_column_bytes(stmts[FindLeaf], 0));
+                found = stored.size() == leaf.size();
+            }
+            sqlite3_reset(stmts[FindLeaf]);
+            return found;
+        };
+
+        for (const auto& replica : versions) {
+            const auto& r = replica.record;
+            if (mapVersion(r.version_id) != 0) continue;   // Imported before
+
+            sqlite3_bind_text(stmts[FindFile], 1, r.file_path.c_str(), -1, SQLITE_STATIC);
+            uint64_t file_id = lookup(FindFile);
+            if (file_id == 0) {
+                sqlite3_reset(stmts[InsertFile]);
+                sqlite3_bind_text(stmts[InsertFile], 1, r.file_path.c_str(), -1, SQLITE_STATIC);
+                sqlite3_bind_int64(stmts[InsertFile], 2, r.created_at);
+                run(InsertFile);
+                file_id = getLastInsertId();
+            }
+
+            uint64_t clone_of = 0;
+            if (r.source_version_id != 0) {
+                clone_of = mapVersion(r.source_version_id);
+                if (clone_of == 0) throw std::runtime_error("Clone source not replicated: version " + std::to_string(r.source_version_id));
+            }
+
+            std::vector<uint64_t> ids;
+            std::string merkle_root;
+            if (clone_of == 0 && replica.packed) {
+                if (replica.block_hashes.size() != 1) throw std::runtime_error("Packed version needs exactly one block");
+                ids.push_back(findBlock(replica.block_hashes[0]).first);
+            } else if (clone_of == 0) {
+                const auto& hashes = replica.block_hashes;
+                ids.reserve(hashes.size());
+                MerkleTreeBuilder tree([this](const MerkleNode& node) { storeMerkleNode(node); });
+                std::vector<MerkleChild> leaf, stored;
+                for (size_t first = 0; first < hashes.size(); first += MERKLE_FANOUT) {
+                    size_t count = std::min(MERKLE_FANOUT, hashes.size() - first);
+                    leaf.assign(count, MerkleChild{});
+                    for (size_t i = 0; i < count; ++i) leaf[i].digest = hashes[first + i];
+                    if (!findLeaf(leaf, stored)) {
+                        stored.assign(count, MerkleChild{});
+                        for (size_t i = 0; i < count; ++i) {
+                            auto [id, size] = findBlock(leaf[i].digest);
+                            stored[i].block_id = id;
+                            stored[i].bytes = size;
+                        }
+                    }
+                    for (size_t i = 0; i < count; ++i) {
+                        ids.push_back(stored[i].block_id);
+                        tree.addBlock(leaf[i].digest, stored[i].block_id, stored[i].bytes);
+                    }
+                }
+                merkle_root = tree.finish();
+            }
+
+            sqlite3_reset(stmts[InsertVersion]);
+            sqlite3_bind_int64(stmts[InsertVersion], 1, file_id);
+            sqlite3_bind_int64(stmts[InsertVersion], 2, mapVersion(r.parent_id));
+            sqlite3_bind_text(stmts[InsertVersion], 3, r.file_hash.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(stmts[InsertVersion], 4, r.created_at);
+            sqlite3_bind_int64(stmts[InsertVersion], 5, clone_of);
+            sqlite3_bind_int64(stmts[InsertVersion], 6, r.file_size);
+            if (clone_of == 0 && !replica.packed) {
+                sqlite3_bind_text(stmts[InsertVersion], 7, merkle_root.c_str(), -1, SQLITE_STATIC);
+            } else {
+                sqlite3_bind_null(stmts[InsertVersion], 7);
+            }
+            bindMode(stmts[InsertVersion], 8, r.mode);
+            run(InsertVersion);
+            uint64_t version_id = getLastInsertId();
+
+            if (clone_of == 0) {
+                std::vector<uint8_t> encoded;
+                if (replica.packed) {
+                    sqlite3_reset(stmts[InsertExtent]);
+                    sqlite3_bind_int64(stmts[InsertExtent], 1, version_id);
+                    sqlite3_bind_int64(stmts[InsertExtent], 2, ids[0]);
+                    sqlite3_bind_int64(stmts[InsertExtent], 3, replica.packed_offset);
+                    sqlite3_bind_int64(stmts[InsertExtent], 4, r.file_size);
+                    run(InsertExtent);
+                } else {
+                    BlockListEncoding encoding;
+                    encoded = encodeBlockList(ids, encoding);
+                    sqlite3_reset(stmts[InsertList]);
+                    sqlite3_bind_int64(stmts[InsertList], 1, version_id);
+                    sqlite3_bind_int64(stmts[InsertList], 2, ids.size());
+                    sqlite3_bind_int(stmts[InsertList], 3, static_cast<int>(encoding));
+                    sqlite3_bind_blob(stmts[InsertList], 4, encoded.data(), static_cast<int>(encoded.size()), SQLITE_STATIC);
+                    run(InsertList);
+                }
+                addBlockRefs(ids, 1);
+
+                sqlite3_reset(stmts[InsertContent]);
+                sqlite3_bind_text(stmts[InsertContent], 1, r.file_hash.c_str(), -1, SQLITE_STATIC);
+                sqlite3_bind_int64(stmts[InsertContent], 2, r.file_size);
+                sqlite3_bind_int64(stmts[InsertContent], 3, version_id);
+                run(InsertContent);
+            }
+
+            sqlite3_reset(stmts[InsertMapping]);
+            sqlite3_bind_text(stmts[InsertMapping], 1, source.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(stmts[InsertMapping], 2, r.version_id);
+            sqlite3_bind_int64(stmts[InsertMapping], 3, version_id);
+            run(InsertMapping);
+        }
+
+        for (auto* stmt : stmts) sqlite3_finalize(stmt);
+        executeSQL("COMMIT");
+    } catch (...) {
+        for (auto* stmt : stmts) sqlite3_finalize(stmt);
+        executeSQL("ROLLBACK");
+        throw;
+    }
+}
+
+void SqliteMetadataDB::importSnapshots(const std::string& source, const std::vector<DBSnapshot>& snapshots) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    executeSQL("BEGIN TRANSACTION");
+    sqlite3_stmt* snapshot_stmt = nullptr;
+    sqlite3_stmt* member_stmt = nullptr;
+    sqlite3_stmt* map_stmt = nullptr;
+    sqlite3_stmt* mapping_stmt = nullptr;
+    sqlite3_stmt* seen_stmt = nullptr;
+    try {
+        std::string sql = "INSERT INTO snapshots (root_path, created_at) VALUES (?, ?)";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &snapshot_stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare snapshot failed");
+        sql = "INSERT OR IGNORE INTO snapshot_versions (snapshot_id, version_id) VALUES (?, ?)";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &member_stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare snapshot mapping failed");
+        sql = "SELECT version_id FROM replica_versions WHERE source = ? AND source_id = ?";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &map_stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+        sql = "INSERT INTO replica_snapshots (source, source_id, snapshot_id) VALUES (?, ?, ?)";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &mapping_stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare replica mapping failed");
+
+        sql = "SELECT snapshot_id FROM replica_snapshots WHERE source = ? AND source_id = ?";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &seen_stmt, nullptr) != SQLITE_OK) throw std::runtime_error("Prepare query failed");
+
+        for (const auto& snapshot : snapshots) {
+            sqlite3_reset(seen_stmt);
+            sqlite3_bind_text(seen_stmt, 1, source.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(seen_stmt, 2, snapshot.snapshot_id);
+            if (sqlite3_step(seen_stmt) == SQLITE_ROW) continue;   // Imported before
+
+            sqlite3_reset(snapshot_stmt);
+            sqlite3_bind_text(snapshot_stmt, 1, snapshot.root_path.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(snapshot_stmt, 2, snapshot.created_at);
+            if (sqlite3_step(snapshot_stmt) != SQLITE_DONE) throw std::runtime_error("Step snapshot failed");
+            uint64_t snapshot_id = getLastInsertId();
+
+            for (uint64_t source_vid : snapshot.version_ids) {
+                sqlite3_reset(map_stmt);
+                sqlite3_bind_text(map_stmt, 1, source.c_str(), -1, SQLITE_STATIC);
+                sqlite3_bind_int64(map_stmt, 2, source_vid);
+                uint64_t vid = sqlite3_step(map_stmt) == SQLITE_ROW ? sqlite3_column_int64(map_stmt, 0) : 0;
+                if (vid == 0) throw std::runtime_error("Snapshot version not replicated: " + std::to_string(source_vid));
+
+                sqlite3_reset(member_stmt);
+                sqlite3_bind_int64(member_stmt, 1, snapshot_id);
+                sqlite3_bind_int64(member_stmt, 2, vid);
+                if (sqlite3_step(member_stmt) != SQLITE_DONE) throw std::runtime_error("Step snapshot mapping failed");
+            }
+
+            sqlite3_reset(mapping_stmt);
+            sqlite3_bind_text(mapping_stmt, 1, source.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(mapping_stmt, 2, snapshot.snapshot_id);
+            sqlite3_bind_int64(mapping_stmt, 3, snapshot_id);
+            if (sqlite3_step(mapping_stmt) != SQLITE_DONE) throw std::runtime_error("Step replica mapping failed");
+        }
+
+        sqlite3_finalize(snapshot_stmt);
+        sqlite3_finalize(member_stmt);
+        sqlite3_finalize(map_stmt);
+        sqlite3_finalize(mapping_stmt);
+        sqlite3_finalize(seen_stmt);
+        executeSQL("COMMIT");
+    } catch (...) {
+        sqlite3_finalize(snapshot_stmt);
+        sqlite3_finalize(member_stmt);
+        sqlite3_finalize(map_stmt);
+        sqlite3_finalize(mapping_stmt);
+        sqlite3_finalize(seen_stmt);
+        executeSQL("ROLLBACK");
+        throw;
+    }
+}
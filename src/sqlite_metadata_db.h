@@ -0,0 +1,118 @@
+#pragma once
+
+#include <mutex>
+#include <sqlite3.h>
+#include "metadata_db.h"
+
+// Catalog in a single SQLite database file (metadata.db). Reads run
+// concurrently; writes are serialized on db_mutex, one transaction each.
+class SqliteMetadataDB : public MetadataDB {
+public:
+    ~SqliteMetadataDB() override;
+
+    // Open DB connection and create tables if needed
+    void initialize(const std::string& db_path);
+
+    uint64_t getOrCreateFile(const std::string& path) override;
+
+    uint64_t storeBlock(const std::string& hash, int size, int compressed_size, int compression_level = 3,
+                        const std::string& delta_base = "", int delta_depth = 0) override;
+    uint64_t findBlock(const std::string& hash) override;
+    bool getBlock(const std::string& hash, DBBlock& block) override;
+
+    void addBlockFeatures(uint64_t block_id, const BlockSketch& sketch) override;
+    bool findSimilarBlock(const BlockSketch& sketch, int max_depth, DBBlock& base) override;
+
+    uint64_t createVersion(
+        uint64_t file_id,
+        const std::string& file_hash,
+        uint64_t file_size,
+        const std::vector<uint64_t>& block_ids,
+        uint64_t parent_id = 0,
+        uint32_t mode = FILE_MODE_UNKNOWN
+    ) override;
+    uint64_t getLatestVersionId(uint64_t file_id) override;
+    bool hasContentOfSize(uint64_t file_size) override;
+    uint64_t findVersionByContent(const std::string& file_hash, uint64_t file_size) override;
+    uint64_t createVersionFromContent(
+        uint64_t file_id,
+        const std::string& file_hash,
+        uint64_t file_size,
+        uint64_t source_version_id,
+        uint64_t parent_id = 0,
+        uint32_t mode = FILE_MODE_UNKNOWN
+    ) override;
+    std::vector<uint64_t> createPackedVersions(
+        uint64_t block_id,
+        const std::vector<PackedFileEntry>& entries
+    ) override;
+
+    void saveCheckpoint(const BackupCheckpoint& checkpoint) override;
+    bool loadCheckpoint(const std::string& file_path, BackupCheckpoint& checkpoint) override;
+    void clearCheckpoint(const std::string& file_path) override;
+
+    uint64_t createSnapshot(const std::string& root_path, const std::vector<uint64_t>& version_ids) override;
+    std::vector<DBSnapshotEntry> getSnapshotFiles(uint64_t snapshot_id) override;
+
+    bool getBlockRef(uint64_t block_id, DBBlockRef& ref) override;
+    uint64_t getVersionBlockCount(uint64_t version_id) override;
+    bool getPackedExtent(uint64_t version_id, DBPackedExtent& extent) override;
+    uint64_t getVersionSize(uint64_t version_id) override;
+    std::vector<DBBlock> listBlocks(uint64_t after_block_id, size_t limit) override;
+    std::pair<uint64_t, uint64_t> getBlockTotals(uint64_t after_block_id) override;
+    std::vector<uint64_t> findVersionsUsingBlocks(const std::vector<uint64_t>& block_ids) override;
+    bool versionExists(uint64_t version_id) override;
+
+    std::vector<DBBlock> listCompactionCandidates(uint64_t after_block_id, int64_t stored_before,
+                                                  int below_level, size_t limit) override;
+    std::pair<uint64_t, uint64_t> getCompactionTotals(int64_t stored_before, int below_level) override;
+    void updateBlockCompression(const std::vector<DBBlock>& blocks) override;
+
+    void forEachBlockInRange(const std::string& first_hash, const std::string& end_hash,
+                             const std::function<void(const DBBlock&)>& callback) override;
+    void storeBlocks(const std::vector<DBBlock>& blocks) override;
+    uint64_t getMaxVersionId() override;
+    uint64_t getMaxSnapshotId() override;
+    std::vector<DBVersionRecord> listVersionRecords(uint64_t after_id, uint64_t last_id, size_t limit) override;
+    std::vector<DBSnapshot> listSnapshots(uint64_t after_id, uint64_t last_id, size_t limit) override;
+    uint64_t getReplicaVersionCursor(const std::string& source) override;
+    uint64_t getReplicaSnapshotCursor(const std::string& source) override;
+    void importVersions(const std::string& source, const std::vector<ReplicaVersion>& versions) override;
+    void importSnapshots(const std::string& source, const std::vector<DBSnapshot>& snapshots) override;
+
+    std::vector<DBVersion> listVersions(const std::string& file_path) override;
+
+    std::string getMerkleRoot(uint64_t version_id) override;
+    bool getMerkleNode(const std::string& node_hash, MerkleNode& node) override;
+
+protected:
+    // Follow versions.source_version_id to the version that owns the block list
+    uint64_t resolveContentVersion(uint64_t version_id) override;
+    bool hasContentClones(uint64_t version_id) override;
+
+    // Falls back to per-row file_blocks for catalogs written before
+    // version_block_lists existed.
+    void readVersionBlockIds(uint64_t version_id,
+                             const std::function<void(const uint64_t* ids, size_t count)>& sink) override;
+    std::vector<DBBlockRef> lookupBlockRefs(const uint64_t* block_ids, size_t count) override;
+
+private:
+    sqlite3* db = nullptr;
+    std::mutex db_mutex;
+
+    void executeSQL(const std::string& sql);
+    int64_t getLastInsertId();
+
+    // Add a column to an existing table if an older schema lacks it; returns true if it was added
+    bool ensureColumn(const std::string& table, const std::string& column, const std::string& definition);
+
+    // Add `delta` to blocks.ref_count of each distinct block in `block_ids` (caller holds the transaction)
+    void addBlockRefs(std::vector<uint64_t> block_ids, int64_t delta);
+
+    // Insert a tree node unless an identical one is stored (caller holds the transaction)
+    void storeMerkleNode(const MerkleNode& node);
+
+    // Build, store and return the root of a resolved version's tree from its block list
+    // (caller holds db_mutex)
+    std::string buildMerkleTree(uint64_t version_id);
+};
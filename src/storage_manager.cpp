@@ -2,9 +2,141 @@
 #include <filesystem>
 #include <fstream>
 #include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include "checksum.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <process.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
 
 namespace fs = std::filesystem;
 
+namespace {
+
+const char BLOCK_MAGIC[4] = {'D', 'V', 'B', 'K'};
+const uint32_t ZSTD_FRAME_MAGIC = 0xFD2FB528u;   // Little-endian, as stored
+const char* TEMP_SUFFIX = ".tmp";                 // <hash>.bin.tmp<pid>.<n> while being written
+const char* LOCK_NAME = "storage.lock";
+
+void putU32(uint8_t* p, uint32_t v) {
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+    p[2] = static_cast<uint8_t>(v >> 16);
+    p[3] = static_cast<uint8_t>(v >> 24);
+}
+
+uint32_t getU32(const uint8_t* p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+// "<hash>.bin.tmp<pid>.<n>" (or "<hash>.bin.tmp<n>" from older versions)
+bool isTempName(const std::string& name) {
+    const std::string marker = std::string(".bin") + TEMP_SUFFIX;
+    size_t pos = name.find(marker);
+    if (pos == 0 || pos == std::string::npos || pos + marker.size() == name.size()) return false;
+    return std::all_of(name.begin() + pos + marker.size(), name.end(), [](char c) {
+        return (c >= '0' && c <= '9') || c == '.';
+    });
+}
+
+int processId() {
+#ifdef _WIN32
+    return _getpid();
+#else
+    return static_cast<int>(getpid());
+#endif
+}
+
+// Create `path`, failing if it exists; -1 on error (errno is set)
+int createExclusive(const std::string& path) {
+#ifdef _WIN32
+    return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+#endif
+}
+
+bool writeAll(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+#ifdef _WIN32
+        int n = _write(fd, data, static_cast<unsigned>(std::min<size_t>(size, 1u << 30)));
+#else
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Flush the file's data to the device and close it
+bool syncAndClose(int fd) {
+#ifdef _WIN32
+    bool ok = _commit(fd) == 0;
+    return _close(fd) == 0 && ok;
+#else
+    bool ok = fsync(fd) == 0;
+    return ::close(fd) == 0 && ok;
+#endif
+}
+
+// Make renames in `dir` durable
+void syncDirectory(const std::string& dir) {
+#ifndef _WIN32
+    int fd = ::open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+#endif
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+} // namespace
+
+std::string deltaBaseHash(const uint8_t* payload, size_t size) {
+    if (size < DELTA_BASE_SIZE) throw BlockCorruptError("Delta payload too short");
+    static const char* digits = "0123456789abcdef";
+    std::string hex(DELTA_BASE_SIZE * 2, '0');
+    for (size_t i = 0; i < DELTA_BASE_SIZE; i++) {
+        hex[2 * i] = digits[payload[i] >> 4];
+        hex[2 * i + 1] = digits[payload[i] & 0x0f];
+    }
+    return hex;
+}
+
+void putDeltaBase(uint8_t* payload, const std::string& base_hash) {
+    if (base_hash.size() != DELTA_BASE_SIZE * 2) throw std::runtime_error("Not a block hash: " + base_hash);
+    for (size_t i = 0; i < DELTA_BASE_SIZE; ++i) {
+        int hi = hexValue(base_hash[2 * i]);
+        int lo = hexValue(base_hash[2 * i + 1]);
+        if (hi < 0 || lo < 0) throw std::runtime_error("Not a block hash: " + base_hash);
+        payload[i] = static_cast<uint8_t>(hi << 4 | lo);
+    }
+}
+
+StorageManager::~StorageManager() {
+    releaseLock();
+}
+
 void StorageManager::initialize(const std::string& root) {
     std::lock_guard<std::mutex> lock(storage_mutex);
     root_path = root;
@@ -13,6 +145,58 @@ void StorageManager::initialize(const std::string& root) {
     if (!fs::exists(blocks_path)) {
         fs::create_directories(blocks_path);
     }
+
+    // Temp files left behind by a crash mid-write are never valid blocks, but
+    // those of another process using the repository are still being written
+    releaseLock();
+    if (lockExclusive()) {
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(blocks_path, ec)) {
+            if (isTempName(entry.path().filename().string())) {
+                fs::remove(entry.path(), ec);
+            }
+        }
+    }
+    lockShared();
+}
+
+// Every StorageManager holds storage.lock shared while it lives, so one that
+// gets it exclusively knows no other process is writing blocks
+bool StorageManager::lockExclusive() {
+    std::string lock_path = root_path + "/" + LOCK_NAME;
+#ifdef _WIN32
+    if (_sopen_s(&lock_fd, lock_path.c_str(), _O_RDWR | _O_CREAT, _SH_DENYRW, _S_IREAD | _S_IWRITE) != 0) {
+        lock_fd = -1;
+        return false;
+    }
+    return true;
+#else
+    lock_fd = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    return lock_fd >= 0 && flock(lock_fd, LOCK_EX | LOCK_NB) == 0;
+#endif
+}
+
+void StorageManager::lockShared() {
+    std::string lock_path = root_path + "/" + LOCK_NAME;
+#ifdef _WIN32
+    releaseLock();
+    if (_sopen_s(&lock_fd, lock_path.c_str(), _O_RDWR | _O_CREAT, _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0) {
+        lock_fd = -1;
+    }
+#else
+    if (lock_fd < 0) lock_fd = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd >= 0) flock(lock_fd, LOCK_SH);   // Converts an exclusive lock in place
+#endif
+}
+
+void StorageManager::releaseLock() {
+    if (lock_fd < 0) return;
+#ifdef _WIN32
+    _close(lock_fd);
+#else
+    ::close(lock_fd);
+#endif
+    lock_fd = -1;
 }
 
 std::string StorageManager::getBlockPath(const std::string& block_hash) {
@@ -22,39 +206,145 @@ std::string StorageManager::getBlockPath(const std::string& block_hash) {
 }
 
 bool StorageManager::writeBlock(const std::string& block_hash, const std::vector<uint8_t>& block_data) {
-    std::lock_guard<std::mutex> lock(storage_mutex);
+    return writeBlock(block_hash, block_data.data(), block_data.size());
+}
+
+bool StorageManager::writeBlock(const std::string& block_hash, const uint8_t* data, size_t size, uint32_t flags) {
     std::string path = getBlockPath(block_hash);
 
-    // If already exists, we can skip writing (immutability assumption), 
-    // but explicit write is safer for now.
+    // Blocks are immutable and only ever created by rename, but one stored by
+    // a crashed writer may still be torn: keep it only if its header and size
+    // describe the payload we have, otherwise replace it
     if (fs::exists(path)) {
-        return true; 
+        if (blockMatches(block_hash, data, size, flags)) return true;
+        return writeBlockFile(path, data, size, flags);
+    }
+    // Another writer may have stored the same block first. The rename then
+    // replaces its file; should that fail (on Windows, while a reader has the
+    // file open), the block the other writer stored stands.
+    return writeBlockFile(path, data, size, flags) || fs::exists(path);
+}
+
+bool StorageManager::replaceBlock(const std::string& block_hash, const uint8_t* data, size_t size, uint32_t flags) {
+    std::string path = getBlockPath(block_hash);
+    if (!fs::exists(path)) {
+        return false;
+    }
+    return writeBlockFile(path, data, size, flags);
+}
+
+bool StorageManager::writeBlockFile(const std::string& path, const uint8_t* data, size_t size, uint32_t flags) {
+    // Write to a private temp file, sync it and rename it into place, so a
+    // crash can never leave a partial file under a block's name. Writers don't
+    // need storage_mutex: temp names are unique (pid + counter, created
+    // exclusively) and the rename is atomic.
+    std::string temp_path;
+    int fd = -1;
+    for (int attempt = 0; fd < 0 && attempt < 8; ++attempt) {
+        temp_path = path + TEMP_SUFFIX + std::to_string(processId()) + "." +
+                    std::to_string(temp_counter.fetch_add(1));
+        fd = createExclusive(temp_path);
+        if (fd < 0 && errno != EEXIST) return false;   // A stale name from a crashed process is skipped
     }
+    if (fd < 0) return false;
+
+    uint8_t header[BLOCK_HEADER_SIZE];
+    std::memcpy(header, BLOCK_MAGIC, 4);
+    putU32(header + 4, flags);
+    putU32(header + 8, crc32c(data, size));
 
-    std::ofstream file(path, std::ios::binary);
-    if (!file) {
+    bool written = writeAll(fd, header, BLOCK_HEADER_SIZE) && writeAll(fd, data, size);
+    written = syncAndClose(fd) && written;
+    std::error_code ec;
+    if (!written) {
+        fs::remove(temp_path, ec);
         return false;
     }
 
-    file.write(reinterpret_cast<const char*>(block_data.data()), block_data.size());
+    fs::rename(temp_path, path, ec);
+    if (ec) {
+        fs::remove(temp_path, ec);
+        return false;
+    }
+    // The catalog row committed after this must never point at a lost rename
+    syncDirectory(blocks_path);
     return true;
 }
 
-std::vector<uint8_t> StorageManager::readBlock(const std::string& block_hash) {
-    std::lock_guard<std::mutex> lock(storage_mutex);
-    std::string path = getBlockPath(block_hash);
+bool StorageManager::blockMatches(const std::string& block_hash, const uint8_t* data, size_t size, uint32_t flags) {
+    try {
+        BlockFile block = openBlock(block_hash);
+        return !block.legacy && block.flags == flags && block.payload_size == size && block.crc == crc32c(data, size);
+    } catch (const std::exception&) {
+        return false;
+    }
+}
 
-    std::ifstream file(path, std::ios::binary);
-    if (!file) {
+StorageManager::BlockFile StorageManager::openBlock(const std::string& block_hash) {
+    // Blocks are immutable once written, so readers don't serialize on storage_mutex
+    BlockFile block;
+    block.file.open(getBlockPath(block_hash), std::ios::binary);
+    if (!block.file) {
         throw std::runtime_error("Block not found: " + block_hash);
     }
 
     // Get size
-    file.seekg(0, std::ios::end);
-    size_t fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
+    block.file.seekg(0, std::ios::end);
+    size_t fileSize = block.file.tellg();
+    block.file.seekg(0, std::ios::beg);
+
+    uint8_t header[BLOCK_HEADER_SIZE] = {};
+    block.file.read(reinterpret_cast<char*>(header), std::min<size_t>(fileSize, BLOCK_HEADER_SIZE));
+
+    if (fileSize >= 4 && getU32(header) == ZSTD_FRAME_MAGIC) {
+        // Legacy block without a header: the whole file is the zstd frame
+        block.file.clear();
+        block.file.seekg(0, std::ios::beg);
+        block.payload_size = fileSize;
+        block.legacy = true;
+        return block;
+    }
+    if (fileSize < BLOCK_HEADER_SIZE || std::memcmp(header, BLOCK_MAGIC, 4) != 0) {
+        throw BlockCorruptError("Block header damaged: " + block_hash);
+    }
+    block.payload_size = fileSize - BLOCK_HEADER_SIZE;
+    block.flags = getU32(header + 4);
+    block.crc = getU32(header + 8);
+    return block;
+}
 
-    std::vector<uint8_t> buffer(fileSize);
-    file.read(reinterpret_cast<char*>(buffer.data()), fileSize);
+void StorageManager::readPayload(BlockFile& block, uint8_t* out, const std::string& block_hash) {
+    if (!block.file.read(reinterpret_cast<char*>(out), block.payload_size) && !block.legacy) {
+        throw BlockCorruptError("Block truncated: " + block_hash);
+    }
+    if (!block.legacy && crc32c(out, block.payload_size) != block.crc) {
+        throw BlockCorruptError("Block checksum mismatch: " + block_hash);
+    }
+}
+
+std::vector<uint8_t> StorageManager::readBlock(const std::string& block_hash) {
+    BlockFile block = openBlock(block_hash);
+    std::vector<uint8_t> buffer(block.payload_size);
+    readPayload(block, buffer.data(), block_hash);
     return buffer;
 }
+
+PooledBuffer StorageManager::readBlock(const std::string& block_hash, BufferPool& pool, uint32_t* flags) {
+    BlockFile block = openBlock(block_hash);
+    if (flags) *flags = block.flags;
+    PooledBuffer buffer = pool.acquire(block.payload_size);
+    readPayload(block, buffer.data(), block_hash);
+    return buffer;
+}
+
+BlockLocation StorageManager::locateBlock(const std::string& block_hash) {
+    BlockFile block = openBlock(block_hash);
+    BlockLocation location;
+    location.path = getBlockPath(block_hash);
+    location.legacy = block.legacy;
+    location.payload_offset = block.legacy ? 0 : BLOCK_HEADER_SIZE;
+    location.payload_size = block.payload_size;
+    location.flags = block.flags;
+    location.crc = block.crc;
+    return location;
+}
@@ -3,23 +3,124 @@
 #include <string>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <fstream>
+#include "buffer_pool.h"
+
+// Thrown by readBlock when a block file exists but its checksum does not match
+class BlockCorruptError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Block file layout:
+//   "DVBK" | u32 flags | u32 crc32c(payload) | payload (compressed block)
+// Files written before the header existed start directly with the zstd frame
+// magic and are read without a checksum.
+constexpr size_t BLOCK_HEADER_SIZE = 12;
+
+// Header flags
+constexpr uint32_t BLOCK_FLAG_ENCRYPTED = 1;   // Payload is BlockCipher output (ciphertext + tag)
+constexpr uint32_t BLOCK_FLAG_DELTA = 2;       // Payload is a delta against another block (below)
+constexpr uint32_t BLOCK_FLAG_BASE_SEALED = 4; // Encrypted delta whose base reference is GCM associated data
+
+// A delta payload starts with the raw SHA-256 of its base block, in the clear
+// so that replication and archives can bring bases along without a key. The
+// rest is a HashEngine::compressDeltaInto frame over the base's content,
+// encrypted like a whole payload if BLOCK_FLAG_ENCRYPTED is set. Encrypted
+// deltas also carry BLOCK_FLAG_BASE_SEALED: the base reference is passed to
+// AES-GCM as associated data, so a changed reference fails authentication
+// instead of decoding against the wrong base. (Deltas written before the flag
+// existed are decrypted without it.)
+constexpr size_t DELTA_BASE_SIZE = 32;
+
+// Base block hash of a delta payload (throws if the payload is too short)
+std::string deltaBaseHash(const uint8_t* payload, size_t size);
+
+// Write the base reference at the start of a delta payload
+void putDeltaBase(uint8_t* payload, const std::string& base_hash);
+
+// Bits 8-15 of the flags count how often the payload was rewritten in place
+// (recompressed); encrypted payloads use it as their key generation
+constexpr uint32_t BLOCK_GENERATION_SHIFT = 8;
+constexpr uint32_t BLOCK_GENERATION_MAX = 0xff;
+
+inline uint32_t blockGeneration(uint32_t flags) { return (flags >> BLOCK_GENERATION_SHIFT) & BLOCK_GENERATION_MAX; }
+inline uint32_t withBlockGeneration(uint32_t flags, uint32_t generation) {
+    return (flags & ~(BLOCK_GENERATION_MAX << BLOCK_GENERATION_SHIFT)) | (generation << BLOCK_GENERATION_SHIFT);
+}
+
+// Where a block's payload lives on disk, for transfers that bypass readBlock
+struct BlockLocation {
+    std::string path;
+    uint64_t payload_offset = 0;   // BLOCK_HEADER_SIZE, or 0 for legacy blocks
+    uint64_t payload_size = 0;
+    uint32_t flags = 0;
+    uint32_t crc = 0;              // CRC-32C of the payload (not set for legacy blocks)
+    bool legacy = false;
+};
 
 class StorageManager {
 public:
-    // Initialize storage directory, e.g., ".deltavault"
+    StorageManager() = default;
+    ~StorageManager();
+
+    // Initialize storage directory, e.g., ".deltavault". Temp files of
+    // interrupted writes are removed unless another process has the storage open.
     void initialize(const std::string& root_path);
 
     // Write block to persistent storage, return true on success
     // filename derived from block_id or hash
     bool writeBlock(const std::string& block_hash, const std::vector<uint8_t>& block_data);
+    bool writeBlock(const std::string& block_hash, const uint8_t* data, size_t size, uint32_t flags = 0);
+
+    // Replace the payload of a stored block (same content, e.g. recompressed).
+    // The new file is renamed over the old one, so readers see either.
+    bool replaceBlock(const std::string& block_hash, const uint8_t* data, size_t size, uint32_t flags);
 
-    // Read block from storage
+    // Read block from storage; verifies the CRC-32C of the payload
+    // (throws BlockCorruptError on mismatch) and returns the payload only
     std::vector<uint8_t> readBlock(const std::string& block_hash);
 
+    // Same, into a buffer borrowed from `pool`; `flags` receives the header flags
+    PooledBuffer readBlock(const std::string& block_hash, BufferPool& pool, uint32_t* flags = nullptr);
+
+    // Header fields and payload position of a stored block, without reading the
+    // payload (so nothing is verified); throws if the block is missing
+    BlockLocation locateBlock(const std::string& block_hash);
+
 private:
+    // An open block file positioned at its payload
+    struct BlockFile {
+        std::ifstream file;
+        size_t payload_size = 0;
+        uint32_t crc = 0;
+        uint32_t flags = 0;
+        bool legacy = false;   // No header, no checksum
+    };
+
+    // Write a complete block file next to `path`, sync it and rename it into place
+    bool writeBlockFile(const std::string& path, const uint8_t* data, size_t size, uint32_t flags);
+
+    // True if the stored block's header and size say it holds exactly this
+    // payload (same flags, length and CRC-32C); only the header is read
+    bool blockMatches(const std::string& block_hash, const uint8_t* data, size_t size, uint32_t flags);
+
+    // storage.lock: exclusive (if no other process has it) while sweeping temp files, shared after
+    bool lockExclusive();
+    void lockShared();
+    void releaseLock();
+
+    BlockFile openBlock(const std::string& block_hash);
+    void readPayload(BlockFile& block, uint8_t* out, const std::string& block_hash);
+
     std::string root_path;
     std::string blocks_path;
     std::mutex storage_mutex;
+    std::atomic<uint64_t> temp_counter{0};
+    int lock_fd = -1;
 
     std::string getBlockPath(const std::string& block_hash);
 };
@@ -0,0 +1,73 @@
+#include "live_graph.h"
+#include <QPainter>
+#include <QPainterPath>
+#include <algorithm>
+
+LiveGraph::LiveGraph(const QString& title, const QString& unit, QWidget* parent)
+    : QWidget(parent), title(title), unit(unit) {
+    setMinimumSize(200, 120);
+}
+
+int LiveGraph::addSeries(const QString& name, const QColor& color) {
+    series.push_back({name, color, {}});
+    return static_cast<int>(series.size() - 1);
+}
+
+void LiveGraph::addSample(const std::vector<double>& values) {
+    for (size_t i = 0; i < series.size(); ++i) {
+        auto& samples = series[i].values;
+        samples.push_back(i < values.size() ? std::max(0.0, values[i]) : 0.0);
+        if (samples.size() > MAX_SAMPLES) samples.pop_front();
+    }
+    update();   // Repaints on the next event loop pass, coalescing bursts of samples
+}
+
+void LiveGraph::clear() {
+    for (auto& s : series) s.values.clear();
+    update();
+}
+
+void LiveGraph::paintEvent(QPaintEvent*) {
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.fillRect(rect(), QColor(30, 30, 30));
+
+    const int margin = 6;
+    const int line_height = fontMetrics().height();
+    QRect plot = rect().adjusted(margin, margin + line_height * 2, -margin, -margin);
+
+    double peak = 0.0;
+    for (const auto& s : series) {
+        for (double v : s.values) peak = std::max(peak, v);
+    }
+    double top = peak > 0.0 ? peak * 1.1 : 1.0;
+
+    // Title with the y scale, then each series' latest value in its colour
+    painter.setPen(QColor(220, 220, 220));
+    painter.drawText(margin, margin + line_height - 3,
+                     QString("%1 (max %2 %3)").arg(title).arg(top, 0, 'f', 1).arg(unit));
+    int x = margin;
+    for (const auto& s : series) {
+        QString label = s.values.empty() ? s.name : QString("%1 %2").arg(s.name).arg(s.values.back(), 0, 'f', 1);
+        painter.setPen(s.color);
+        painter.drawText(x, margin + line_height * 2 - 3, label);
+        x += fontMetrics().horizontalAdvance(label) + 10;
+    }
+
+    painter.setPen(QColor(70, 70, 70));
+    painter.drawRect(plot);
+
+    // Newest sample on the right edge
+    double step = plot.width() / static_cast<double>(MAX_SAMPLES - 1);
+    for (const auto& s : series) {
+        if (s.values.size() < 2) continue;
+        QPainterPath path;
+        double x0 = plot.right() - step * (s.values.size() - 1);
+        for (size_t i = 0; i < s.values.size(); ++i) {
+            QPointF point(x0 + step * i, plot.bottom() - plot.height() * (s.values[i] / top));
+            if (i == 0) path.moveTo(point); else path.lineTo(point);
+        }
+        painter.setPen(QPen(s.color, 1.5));
+        painter.drawPath(path);
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <QColor>
+#include <QString>
+#include <QWidget>
+#include <deque>
+#include <vector>
+
+// Scrolling line chart of the most recent samples of one or more series.
+// The y axis scales to the largest value on screen. GUI thread only: workers
+// hand their numbers to the window, which appends them here.
+class LiveGraph : public QWidget {
+    Q_OBJECT
+
+public:
+    LiveGraph(const QString& title, const QString& unit, QWidget* parent = nullptr);
+
+    // Returns the index of the new series
+    int addSeries(const QString& name, const QColor& color);
+
+    // One value per series, in the order they were added
+    void addSample(const std::vector<double>& values);
+    void clear();
+
+    QSize sizeHint() const override { return QSize(260, 140); }
+
+protected:
+    void paintEvent(QPaintEvent* event) override;
+
+private:
+    struct Series {
+        QString name;
+        QColor color;
+        std::deque<double> values;
+    };
+
+    static constexpr size_t MAX_SAMPLES = 240;   // One minute at the default 250 ms progress interval
+
+    QString title;
+    QString unit;
+    std::vector<Series> series;
+};
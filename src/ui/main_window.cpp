@@ -5,6 +5,7 @@
 #include <QMessageBox>
 #include <QDateTime>
 #include <QApplication>
+#include <QCloseEvent>
 #include <thread>
 #include <QFileInfo>
 
@@ -20,20 +21,18 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent) {
         splitter = std::make_shared<BlockSplitter>();
         hasher = std::make_shared<HashEngine>();
         storage = std::make_shared<StorageManager>();
-        db = std::make_shared<MetadataDB>();
-        
-        size_t threads = std::thread::hardware_concurrency();
-        if (threads == 0) threads = 4;
-        threadPool = std::make_shared<ThreadPool>(threads);
 
         // Initialize persistent storage
         storage->initialize("./.deltavault");
-        db->initialize("./.deltavault/metadata.db");
+        db = MetadataDB::open("./.deltavault");
 
         // Explicitly using new to avoid make_unique template issues if any
         pipeline.reset(new BackupPipeline(
-            scanner, splitter, hasher, storage, db, threadPool
+            scanner, splitter, hasher, storage, db
         ));
+        pipeline->setProgressCallback([this](const ProgressSnapshot& p) {
+            QMetaObject::invokeMethod(this, [this, p]() { showProgress(p); });
+        });
         
         logMessage("System Initialized. Storage: ./.deltavault");
     } catch (const std::exception& e) {
@@ -42,7 +41,11 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent) {
 }
 
 MainWindow::~MainWindow() {
-    // Destructor definition is required for unique_ptr of forward declared class
+    // closeEvent normally lets the job stop first; this only waits if the window is torn down directly
+    if (jobThread.joinable()) {
+        jobToken->cancel();
+        jobThread.join();
+    }
 }
 
 void MainWindow::setupUi() {
@@ -74,7 +77,11 @@ void MainWindow::setupUi() {
     versionIdEdit->setFixedWidth(100);
     restoreButton = new QPushButton("Restore");
     
+    cancelButton = new QPushButton("Cancel");
+    cancelButton->setEnabled(false);
+
     actionLayout->addWidget(backupButton);
+    actionLayout->addWidget(cancelButton);
     actionLayout->addStretch();
     actionLayout->addWidget(restoreLabel);
     actionLayout->addWidget(versionIdEdit);
@@ -86,6 +93,25 @@ void MainWindow::setupUi() {
     progressBar->setValue(0);
     mainLayout->addWidget(progressBar);
 
+    // --- Live Graphs ---
+    QHBoxLayout* graphLayout = new QHBoxLayout();
+    throughputGraph = new LiveGraph("Throughput", "MB/s");
+    throughputGraph->addSeries("MB/s", QColor(76, 175, 80));
+    dedupGraph = new LiveGraph("Dedup", "%");
+    dedupGraph->addSeries("dedup %", QColor(33, 150, 243));
+    stageGraph = new LiveGraph("Stage utilization", "threads");
+    const QColor stageColors[STAGE_COUNT] = {
+        QColor(255, 193, 7), QColor(156, 39, 176), QColor(121, 85, 72), QColor(244, 67, 54),
+        QColor(0, 188, 212), QColor(139, 195, 74), QColor(158, 158, 158)
+    };
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        stageGraph->addSeries(stageName(static_cast<PipelineStage>(i)), stageColors[i]);
+    }
+    graphLayout->addWidget(throughputGraph);
+    graphLayout->addWidget(dedupGraph);
+    graphLayout->addWidget(stageGraph);
+    mainLayout->addLayout(graphLayout);
+
     // --- Log Area ---
     logArea = new QTextEdit();
     logArea->setReadOnly(true);
@@ -98,6 +124,7 @@ void MainWindow::setupUi() {
     connect(browseButton, &QPushButton::clicked, this, &MainWindow::onBrowseFile);
     connect(backupButton, &QPushButton::clicked, this, &MainWindow::onBackup);
     connect(restoreButton, &QPushButton::clicked, this, &MainWindow::onRestore);
+    connect(cancelButton, &QPushButton::clicked, this, &MainWindow::onCancel);
 }
 
 void MainWindow::logMessage(const QString& msg) {
@@ -105,6 +132,115 @@ void MainWindow::logMessage(const QString& msg) {
     logArea->append(QString("[%1] %2").arg(timestamp, msg));
 }
 
+void MainWindow::showProgress(const ProgressSnapshot& p) {
+    progressBar->setRange(0, 1000);
+    progressBar->setValue(static_cast<int>(p.fraction() * 1000));
+
+    QString text = QString("%1 MB/s, dedup %2%")
+        .arg(p.throughput_bps / (1024.0 * 1024.0), 0, 'f', 1)
+        .arg(p.dedup_ratio * 100.0, 0, 'f', 1);
+    if (!p.finished && p.eta_seconds >= 0) {
+        text += QString(", ETA %1s").arg(static_cast<qulonglong>(p.eta_seconds));
+    }
+    statusLabel->setText(text);
+
+    if (!jobThread.joinable()) return;
+    throughputGraph->addSample({p.throughput_bps / (1024.0 * 1024.0)});
+    dedupGraph->addSample({p.dedup_ratio * 100.0});
+    if (jobIsBackup) sampleStageUtilization(p.elapsed_seconds);
+}
+
+void MainWindow::sampleStageUtilization(double elapsed_seconds) {
+    // Relaxed atomic loads only, so sampling never waits on the pipeline
+    PipelineStatsSnapshot stats = pipeline->getStats();
+    double interval = elapsed_seconds - lastElapsed;
+    if (interval <= 0.0) return;
+
+    // Stage time spent during the interval / the interval = average busy threads
+    std::vector<double> busy(STAGE_COUNT);
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        uint64_t ns = stats.stages[i].total_ns - lastStats.stages[i].total_ns;
+        busy[i] = ns / 1e9 / interval;
+    }
+    stageGraph->addSample(busy);
+    lastStats = stats;
+    lastElapsed = elapsed_seconds;
+}
+
+void MainWindow::startJob(const QString& name, bool isBackup, JobWork work) {
+    backupButton->setEnabled(false);
+    restoreButton->setEnabled(false);
+    cancelButton->setEnabled(true);
+    progressBar->setRange(0, 1000);
+    progressBar->setValue(0);
+    throughputGraph->clear();
+    dedupGraph->clear();
+    stageGraph->clear();
+
+    jobToken = std::make_shared<CancellationToken>();
+    jobIsBackup = isBackup;
+    lastElapsed = 0.0;
+    if (isBackup) lastStats = pipeline->getStats();
+
+    // Only the completion handler touches the window, and the thread is joined
+    // before the window goes away, so capturing `this` is safe
+    jobThread = std::thread([this, name, work = std::move(work), token = jobToken]() {
+        std::function<void()> onSuccess;
+        QString error;
+        bool canceled = false;
+        try {
+            onSuccess = work(token);
+        } catch (const OperationCanceled&) {
+            canceled = true;
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        QMetaObject::invokeMethod(this, [this, name, onSuccess, error, canceled]() {
+            finishJob(name, onSuccess, error, canceled);
+        });
+    });
+}
+
+void MainWindow::finishJob(const QString& name, const std::function<void()>& onSuccess,
+                           const QString& error, bool canceled) {
+    jobThread.join();   // Posting this was the thread's last step
+    jobToken.reset();
+
+    if (canceled) {
+        logMessage(name + " Canceled");
+        statusLabel->setText(name + " Canceled");
+    } else if (!error.isEmpty()) {
+        logMessage(QString("%1 Failed: %2").arg(name, error));
+        statusLabel->setText("Error");
+    } else {
+        onSuccess();
+    }
+    backupButton->setEnabled(true);
+    restoreButton->setEnabled(true);
+    cancelButton->setEnabled(false);
+
+    if (closeRequested) close();
+}
+
+void MainWindow::onCancel() {
+    if (!jobThread.joinable()) return;
+    jobToken->cancel();
+    cancelButton->setEnabled(false);
+    statusLabel->setText("Canceling...");
+    logMessage("Cancel requested");
+}
+
+void MainWindow::closeEvent(QCloseEvent* event) {
+    if (!jobThread.joinable()) {
+        event->accept();
+        return;
+    }
+    // Never block the GUI thread on the job; finishJob closes the window
+    closeRequested = true;
+    onCancel();
+    event->ignore();
+}
+
 void MainWindow::onBrowseFile() {
     QString fileName = QFileDialog::getOpenFileName(this, "Select File to Backup");
     if (!fileName.isEmpty()) {
@@ -119,36 +255,19 @@ void MainWindow::onBackup() {
         return;
     }
 
-    backupButton->setEnabled(false);
-    restoreButton->setEnabled(false);
-    progressBar->setRange(0, 0); // Indeterminate mode
     statusLabel->setText("Backing up...");
     logMessage("Starting backup for: " + path);
 
-    std::thread([this, path]() {
-        try {
-            uint64_t vid = pipeline->runBackup(path.toStdString());
-            
-            QMetaObject::invokeMethod(this, [this, vid]() {
-                logMessage(QString("Backup Successful! Created Version ID: %1").arg(vid));
-                statusLabel->setText("Backup Complete");
-                progressBar->setRange(0, 100);
-                progressBar->setValue(100);
-                backupButton->setEnabled(true);
-                restoreButton->setEnabled(true);
-                versionIdEdit->setText(QString::number(vid));
-            });
-        } catch (const std::exception& e) {
-             QString err = e.what();
-             QMetaObject::invokeMethod(this, [this, err]() {
-                logMessage(QString("Backup Failed: %1").arg(err));
-                statusLabel->setText("Error");
-                progressBar->setRange(0, 100);
-                backupButton->setEnabled(true);
-                restoreButton->setEnabled(true);
-            });
-        }
-    }).detach();
+    startJob("Backup", true, [this, path](std::shared_ptr<CancellationToken> token) -> std::function<void()> {
+        pipeline->setCancellationToken(token);
+        uint64_t vid = pipeline->runBackup(path.toStdString());
+        return [this, vid]() {
+            logMessage(QString("Backup Successful! Created Version ID: %1").arg(vid));
+            statusLabel->setText("Backup Complete");
+            progressBar->setValue(progressBar->maximum());
+            versionIdEdit->setText(QString::number(vid));
+        };
+    });
 }
 
 void MainWindow::onRestore() {
@@ -168,30 +287,19 @@ void MainWindow::onRestore() {
     }
     uint64_t vid = vidStr.toULongLong();
 
-    backupButton->setEnabled(false);
-    restoreButton->setEnabled(false);
     statusLabel->setText("Restoring...");
     logMessage(QString("Restoring Version %1 to %2").arg(vid).arg(restorePath));
 
-     std::thread([this, vid, restorePath]() {
-        try {
-            RestoreManager restorer(db, storage, hasher);
-            restorer.restoreFile(vid, restorePath.toStdString());
-
-            QMetaObject::invokeMethod(this, [this, restorePath]() {
-                logMessage("Restore Successful! File saved to: " + restorePath);
-                statusLabel->setText("Restore Complete");
-                backupButton->setEnabled(true);
-                restoreButton->setEnabled(true);
-            });
-        } catch (const std::exception& e) {
-             QString err = e.what();
-             QMetaObject::invokeMethod(this, [this, err]() {
-                logMessage(QString("Restore Failed: %1").arg(err));
-                statusLabel->setText("Error");
-                backupButton->setEnabled(true);
-                restoreButton->setEnabled(true);
-            });
-        }
-    }).detach();
+    startJob("Restore", false, [this, vid, restorePath](std::shared_ptr<CancellationToken> token) -> std::function<void()> {
+        RestoreManager restorer(db, storage, hasher);
+        restorer.setProgressCallback([this](const ProgressSnapshot& p) {
+            QMetaObject::invokeMethod(this, [this, p]() { showProgress(p); });
+        });
+        restorer.setCancellationToken(token);
+        restorer.restoreFile(vid, restorePath.toStdString());
+        return [this, restorePath]() {
+            logMessage("Restore Successful! File saved to: " + restorePath);
+            statusLabel->setText("Restore Complete");
+        };
+    });
 }
@@ -7,16 +7,19 @@
 #include <QLabel>
 #include <QProgressBar>
 #include <QStatusBar>
+#include <functional>
 #include <memory>
+#include <thread>
 
 #include "file_scanner.h"
 #include "block_splitter.h"
 #include "hash_engine.h"
 #include "storage_manager.h"
 #include "metadata_db.h"
-#include "thread_pool.h"
 #include "backup_pipeline.h"
 #include "restore_manager.h"
+#include "cancellation.h"
+#include "live_graph.h"
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -25,24 +28,42 @@ public:
     explicit MainWindow(QWidget* parent = nullptr);
     ~MainWindow();
 
+protected:
+    // Closing while a job runs cancels it; the window closes once the job has stopped
+    void closeEvent(QCloseEvent* event) override;
+
 private slots:
     void onBrowseFile();
     void onBackup();
     void onRestore();
+    void onCancel();
 
 private:
+    // Runs on the job thread; returns what to do on the GUI thread if it succeeds
+    using JobWork = std::function<std::function<void()>(std::shared_ptr<CancellationToken> token)>;
+
     void setupUi();
     void logMessage(const QString& msg);
+    void showProgress(const ProgressSnapshot& progress);
+    void sampleStageUtilization(double elapsed_seconds);
+
+    // One backup or restore at a time, on a thread the window owns and joins
+    void startJob(const QString& name, bool isBackup, JobWork work);
+    void finishJob(const QString& name, const std::function<void()>& onSuccess, const QString& error, bool canceled);
 
     // UI Elements
     QLineEdit* filePathEdit;
     QPushButton* browseButton;
     QPushButton* backupButton;
     QPushButton* restoreButton;
+    QPushButton* cancelButton;
     QTextEdit* logArea;
     QProgressBar* progressBar;
     QLabel* statusLabel;
     QLineEdit* versionIdEdit; // Simple input for restoration for now
+    LiveGraph* throughputGraph;
+    LiveGraph* dedupGraph;
+    LiveGraph* stageGraph;     // Busy threads per pipeline stage (backups only)
 
     // Core Components
     std::shared_ptr<FileScanner> scanner;
@@ -50,6 +71,13 @@ private:
     std::shared_ptr<HashEngine> hasher;
     std::shared_ptr<StorageManager> storage;
     std::shared_ptr<MetadataDB> db;
-    std::shared_ptr<ThreadPool> threadPool;
     std::unique_ptr<BackupPipeline> pipeline;
+
+    // Running job
+    std::thread jobThread;
+    std::shared_ptr<CancellationToken> jobToken;
+    bool jobIsBackup = false;
+    bool closeRequested = false;
+    PipelineStatsSnapshot lastStats;   // Pipeline counters at the previous graph sample
+    double lastElapsed = 0.0;
 };
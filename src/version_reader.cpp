@@ -0,0 +1,59 @@
+#include "version_reader.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+VersionReader::VersionReader(std::shared_ptr<MetadataDB> db, std::shared_ptr<BlockReader> reader, uint64_t version_id)
+    : db(db), reader(reader), version_id(version_id)
+{
+    // A small file is one slice of an aggregate block
+    DBPackedExtent packed;
+    if (db->getPackedExtent(version_id, packed)) {
+        total_size = packed.length;
+        extents.push_back({packed.length, packed.offset, packed.ref_count, packed.block_hash});
+        return;
+    }
+
+    extents.reserve(db->getVersionBlockCount(version_id));
+    db->forEachVersionBlock(version_id, [this](const DBBlockRef& ref) {
+        total_size += ref.size;
+        extents.push_back({total_size, 0, ref.ref_count, ref.block_hash});
+        return true;
+    });
+}
+
+size_t VersionReader::readAt(uint64_t offset, uint8_t* out, size_t length) const {
+    if (offset >= total_size) return 0;
+    length = static_cast<size_t>(std::min<uint64_t>(length, total_size - offset));
+
+    // First extent whose end lies beyond offset
+    auto it = std::upper_bound(extents.begin(), extents.end(), offset,
+                               [](uint64_t value, const Extent& e) { return value < e.end; });
+
+    size_t copied = 0;
+    while (copied < length && it != extents.end()) {
+        uint64_t extent_start = (it == extents.begin()) ? 0 : std::prev(it)->end;
+        uint64_t within = offset + copied - extent_start;
+        size_t take = static_cast<size_t>(std::min<uint64_t>(length - copied, it->end - extent_start - within));
+
+        // Decode only as far as this read needs
+        auto data = reader->readPrefix(it->block_hash, it->block_offset + within + take, it->ref_count);
+        std::memcpy(out + copied, data->data() + it->block_offset + within, take);
+
+        copied += take;
+        ++it;
+    }
+    return copied;
+}
+
+std::vector<uint8_t> VersionReader::readRange(uint64_t offset, size_t length) const {
+    std::vector<uint8_t> buffer(static_cast<size_t>(std::min<uint64_t>(length, offset < total_size ? total_size - offset : 0)));
+    buffer.resize(readAt(offset, buffer.data(), buffer.size()));
+    return buffer;
+}
+
+size_t VersionReader::Stream::read(uint8_t* out, size_t length) {
+    size_t n = reader->readAt(position, out, length);
+    position += n;
+    return n;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "metadata_db.h"
+#include "block_reader.h"
+
+// Random access into a stored version without restoring it. Opening builds a
+// cumulative offset index of the version's blocks (one Extent per block, which
+// carries the block hash so reads need no catalog lookups); each read
+// binary-searches it and fetches/decompresses only the blocks it touches.
+// readAt is safe to call from several threads at once.
+class VersionReader {
+public:
+    VersionReader(std::shared_ptr<MetadataDB> db, std::shared_ptr<BlockReader> reader, uint64_t version_id);
+
+    uint64_t size() const { return total_size; }
+    uint64_t versionId() const { return version_id; }
+
+    // Copy up to `length` bytes starting at `offset` into `out`; returns the number
+    // of bytes read (short only at the end of the version)
+    size_t readAt(uint64_t offset, uint8_t* out, size_t length) const;
+
+    std::vector<uint8_t> readRange(uint64_t offset, size_t length) const;
+
+    // Sequential cursor over a shared reader; one stream per thread
+    class Stream {
+    public:
+        explicit Stream(std::shared_ptr<const VersionReader> reader) : reader(std::move(reader)) {}
+
+        size_t read(uint8_t* out, size_t length);
+        void seek(uint64_t offset) { position = offset; }
+        uint64_t tell() const { return position; }
+        bool eof() const { return position >= reader->size(); }
+
+    private:
+        std::shared_ptr<const VersionReader> reader;
+        uint64_t position = 0;
+    };
+
+private:
+    struct Extent {
+        uint64_t end;            // Cumulative end offset within the version
+        uint64_t block_offset;   // Where the extent starts inside the decompressed block
+        uint64_t ref_count;      // Block references when the reader was opened (cache admission)
+        std::string block_hash;
+    };
+
+    std::shared_ptr<MetadataDB> db;
+    std::shared_ptr<BlockReader> reader;
+    uint64_t version_id;
+    uint64_t total_size = 0;
+    std::vector<Extent> extents;
+};
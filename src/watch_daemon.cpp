@@ -0,0 +1,157 @@
+#include "watch_daemon.h"
+#include "backup_pipeline.h"
+#include "cancellation.h"
+#include "change_watcher.h"
+#include "file_scanner.h"
+#include "metadata_db.h"
+#include <algorithm>
+
+namespace {
+
+std::string normalRoot(const std::string& path) {
+    std::string root = fs::absolute(path).lexically_normal().string();
+    if (root.size() > 1 && root.back() == fs::path::preferred_separator) root.pop_back();
+    return root;
+}
+
+bool isBelow(const std::string& path, const std::string& dir) {
+    return path == dir || (path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 &&
+                           path[dir.size()] == fs::path::preferred_separator);
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Longest sleep between checks of the stop token
+constexpr std::chrono::milliseconds MAX_WAIT{500};
+
+} // namespace
+
+WatchDaemon::WatchDaemon(
+    std::shared_ptr<FileScanner> scanner,
+    std::shared_ptr<BackupPipeline> pipeline,
+    std::shared_ptr<MetadataDB> db,
+    const std::string& root
+) : scanner(scanner), pipeline(pipeline), db(db), root(normalRoot(root)) {}
+
+void WatchDaemon::run(const WatchOptions& options, const CancellationToken& stop, const WatchCallback& on_cycle) {
+    using clock = std::chrono::steady_clock;
+    WatchOptions normalized = options;
+    for (auto& dir : normalized.exclude) dir = normalRoot(dir);
+
+    // Watch before the first scan, so changes made while it runs are caught
+    ChangeWatcher watcher(root);
+    for (const auto& dir : normalized.exclude) watcher.exclude(dir);
+    watcher.start();
+
+    std::string reported_watch_error;
+    auto report = [&](WatchCycle cycle, bool rescan) {
+        cycle.rescan = rescan;
+        cycle.watching = watcher.isWatching();
+        cycle.pending = watcher.dirtyCount();
+        if (watcher.error() != reported_watch_error) {
+            cycle.watch_error = reported_watch_error = watcher.error();
+        }
+        if (on_cycle && (cycle.snapshot_id != 0 || !cycle.error.empty() || !cycle.watch_error.empty())) {
+            on_cycle(cycle);
+        }
+    };
+
+    try {
+        std::vector<std::string> removed;
+        report(backup(scanner->scanChangedFiles(root, &removed), removed, normalized, watcher), true);
+        auto next_backup = clock::now() + normalized.interval;
+        auto next_rescan = clock::now() + normalized.rescan_interval;
+
+        while (!stop.isCanceled()) {
+            auto now = clock::now();
+            if (now < next_backup) {
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(next_backup - now);
+                watcher.wait(std::min(remaining + std::chrono::milliseconds(1), MAX_WAIT));
+                continue;
+            }
+            next_backup = now + normalized.interval;
+
+            // A lost event may hide any change, and without events there are none to go by
+            bool rescan = watcher.takeOverflow() || (!watcher.isWatching() && now >= next_rescan);
+            std::vector<std::string> paths, removed, settled;
+            if (rescan) {
+                next_rescan = now + normalized.rescan_interval;
+                paths = scanner->scanChangedFiles(root, &removed);
+            }
+            if (watcher.isWatching()) {
+                settled = watcher.takeSettled(normalized.settle, normalized.max_deferral);
+                paths.insert(paths.end(), settled.begin(), settled.end());
+            }
+            WatchCycle cycle = backup(std::move(paths), removed, normalized, watcher);
+            // Only now are the settled files known to be safe, so a rescan need not report them again
+            if (cycle.error.empty()) scanner->updateManifest(settled);
+            report(cycle, rescan);
+        }
+    } catch (const OperationCanceled&) {
+        // Stopped in the middle of a backup; its checkpoints let the next run continue
+    }
+}
+
+WatchCycle WatchDaemon::backup(std::vector<std::string> paths, const std::vector<std::string>& removed,
+                               const WatchOptions& options, ChangeWatcher& watcher) {
+    auto start = std::chrono::steady_clock::now();
+    WatchCycle cycle;
+    size_t tree_size = tree.size();
+    for (const auto& path : removed) removeFromTree(path);
+
+    // Deleted and replaced-by-directory paths drop out; a file reported twice is backed up once
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+    std::vector<std::string> files;
+    for (auto& path : paths) {
+        bool skip = false;
+        for (const auto& dir : options.exclude) skip = skip || isBelow(path, dir);
+        std::error_code ec;
+        if (skip) continue;
+        if (!fs::is_regular_file(path, ec)) {
+            removeFromTree(path);
+            continue;
+        }
+        cycle.bytes += fs::file_size(path, ec);
+        files.push_back(std::move(path));
+    }
+    cycle.removed = tree_size - std::min(tree_size, tree.size());
+    tree_changed = tree_changed || tree.size() < tree_size;
+    if (files.empty() && !tree_changed) return cycle;
+
+    // Files that did not change keep the versions they have in the last snapshot
+    std::vector<uint64_t> unchanged;
+    unchanged.reserve(tree.size());
+    for (const auto& [path, version_id] : tree) {
+        if (!std::binary_search(files.begin(), files.end(), path)) unchanged.push_back(version_id);
+    }
+
+    cycle.files = files.size();
+    try {
+        cycle.snapshot_id = pipeline->runBackupFiles(files, root, unchanged);
+        tree.clear();
+        for (const auto& entry : db->getSnapshotFiles(cycle.snapshot_id)) tree[entry.file_path] = entry.version_id;
+        tree_changed = false;
+    } catch (const OperationCanceled&) {
+        throw;
+    } catch (const std::exception& e) {
+        cycle.error = e.what();
+        // Report the files as changed again, by the next rescan or from the dirty set
+        scanner->forgetFiles(files);
+        if (watcher.isWatching()) watcher.markDirty(files);
+    }
+    cycle.seconds = secondsSince(start);
+    return cycle;
+}
+
+void WatchDaemon::removeFromTree(const std::string& path) {
+    tree.erase(path);
+    std::error_code ec;
+    if (fs::exists(path, ec)) return;   // Replaced by a directory: its files are reported themselves
+    std::string prefix = path + static_cast<char>(fs::path::preferred_separator);
+    for (auto it = tree.lower_bound(prefix); it != tree.end() && it->first.compare(0, prefix.size(), prefix) == 0;) {
+        it = tree.erase(it);
+    }
+}
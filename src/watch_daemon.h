@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class FileScanner;
+class BackupPipeline;
+class MetadataDB;
+class CancellationToken;
+class ChangeWatcher;
+
+struct WatchOptions {
+    std::chrono::milliseconds interval{60 * 1000};     // Back up changed files at most this often
+    std::chrono::milliseconds settle{2 * 1000};        // ...once they had no change event for this long
+    std::chrono::milliseconds max_deferral{5 * 60 * 1000};   // ...or have been changing for this long
+    std::chrono::milliseconds rescan_interval{10 * 60 * 1000};   // Full rescan period when events are unavailable
+    std::vector<std::string> exclude;                  // Directories never backed up (e.g. the repository)
+};
+
+// What one backup cycle did
+struct WatchCycle {
+    uint64_t snapshot_id = 0;    // 0 when the cycle failed
+    size_t files = 0;            // Changed files backed up
+    size_t removed = 0;          // Files dropped from the tree since the previous snapshot
+    uint64_t bytes = 0;
+    bool rescan = false;         // Changes found by scanning the tree rather than from events
+    bool watching = false;       // Change events are in use (false: polling by rescans)
+    size_t pending = 0;          // Changed files held back because they are still being written
+    double seconds = 0.0;
+    std::string error;           // Set if the backup failed; its files are tried again next cycle
+    std::string watch_error;     // Why change events stopped (on the first cycle after they did)
+};
+
+using WatchCallback = std::function<void(const WatchCycle&)>;
+
+// Continuous backup of a directory tree. A ChangeWatcher keeps a dirty set of
+// changed paths; every `interval` the files that have settled are backed up
+// through the pipeline as one snapshot, so the recovery point lags by about
+// interval + settle. While nothing changes the daemon sleeps in poll() and
+// does no I/O. When events were lost (queue overflow) or are unavailable, the
+// tree is rescanned instead, comparing size and mtime against the scanner's
+// manifest, which only stats files.
+//
+// Each snapshot describes the whole tree: the files that changed in that cycle
+// plus the versions of the unchanged ones from the previous snapshot, minus
+// files that were deleted. A file written without pause is backed up once it
+// has been changing for `max_deferral`, as it is at that moment.
+class WatchDaemon {
+public:
+    WatchDaemon(
+        std::shared_ptr<FileScanner> scanner,
+        std::shared_ptr<BackupPipeline> pipeline,
+        std::shared_ptr<MetadataDB> db,
+        const std::string& root
+    );
+
+    // Back up the whole tree, then changes, until `stop` is canceled.
+    // Give the pipeline the same token to also cut a running backup short.
+    void run(const WatchOptions& options, const CancellationToken& stop, const WatchCallback& on_cycle);
+
+private:
+    // Back up the regular files among `paths` as one snapshot of the whole tree.
+    // Paths that are gone, and those in `removed`, leave the tree. If the backup
+    // fails, its files are handed back to the scanner and watcher for the next cycle.
+    WatchCycle backup(std::vector<std::string> paths, const std::vector<std::string>& removed,
+                      const WatchOptions& options, ChangeWatcher& watcher);
+
+    // Drop `path` from the tree, and everything below it if it no longer exists
+    void removeFromTree(const std::string& path);
+
+    std::shared_ptr<FileScanner> scanner;
+    std::shared_ptr<BackupPipeline> pipeline;
+    std::shared_ptr<MetadataDB> db;
+    std::string root;
+    std::map<std::string, uint64_t> tree;   // Path -> version in the last snapshot
+    bool tree_changed = false;              // Files were removed since the last snapshot
+};
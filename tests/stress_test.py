@@ -5,12 +5,21 @@ import hashlib
 import time
 import shutil
 import random
+import re
+import signal
+import struct
 
 CLI_PATH = os.path.join("build", "Debug", "deltavault_cli.exe")
 TEST_DIR = "test_env"
 LARGE_FILE_NAME = "large_test_file.bin"
 LARGE_FILE_SIZE = 100 * 1024 * 1024 # 100 MB for quick test, can be increased to 1GB
 STORAGE_DIR = ".deltavault_test"
+# Every test runs once per catalog backend, each in a fresh repository
+METADATA_BACKENDS = ["sqlite", "lsm"]
+metadata_backend = METADATA_BACKENDS[0]
+
+def cli_command(*args):
+    return [CLI_PATH, f"--metadata={metadata_backend}", *args]
 
 def calculate_sha256(file_path):
     sha256_hash = hashlib.sha256()
@@ -33,7 +42,7 @@ def generate_large_file(file_path, size):
 def run_backup(file_path):
     print(f"Running Backup for {file_path}...")
     start_time = time.time()
-    result = subprocess.run([CLI_PATH, file_path], capture_output=True, text=True)
+    result = subprocess.run(cli_command(file_path), capture_output=True, text=True)
     end_time = time.time()
     
     if result.returncode != 0:
@@ -63,6 +72,57 @@ def verify_restore(original_path, restored_path):
         print("FAILURE: Hash Mismatch!")
         return False
 
+def remove_paths(*paths):
+    for path in paths:
+        if os.path.isdir(path):
+            shutil.rmtree(path)
+        elif os.path.exists(path):
+            os.remove(path)
+
+def generate_tree(root, count):
+    # Random (incompressible) and repetitive text files of assorted sizes, some sharing content
+    words = [f"w{i}" for i in range(500)]
+    for i in range(count):
+        fpath = os.path.join(root, f"d{i % 4}", f"f{i}.bin")
+        os.makedirs(os.path.dirname(fpath), exist_ok=True)
+        size = random.choice([0, 100, 5000, 100000, 1500000])
+        with open(fpath, "wb") as f:
+            if i % 2:
+                f.write(os.urandom(size))
+            else:
+                f.write(" ".join(random.choice(words) for _ in range(size // 4)).encode())
+
+def backup_tree(tree, *args):
+    # Returns the snapshot id of the backup, or None if it failed
+    result = subprocess.run(cli_command("--no-progress", *args, tree), capture_output=True, text=True)
+    for line in result.stdout.splitlines():
+        if "Snapshot ID:" in line:
+            return int(line.split(":")[-1].strip())
+    print(result.stderr)
+    return None
+
+def tree_mismatches(tree, out, check_modes=False):
+    mismatches = 0
+    for dirpath, _, files in os.walk(tree):
+        for name in files:
+            original = os.path.join(dirpath, name)
+            restored = os.path.join(out, os.path.relpath(original, tree))
+            if not os.path.exists(restored) or calculate_sha256(original) != calculate_sha256(restored):
+                mismatches += 1
+            elif check_modes and os.stat(original).st_mode != os.stat(restored).st_mode:
+                mismatches += 1
+    return mismatches
+
+def restore_matches(snapshot_id, tree, out, *args):
+    # Restore a snapshot with the given repository options and compare it to `tree`
+    remove_paths(out)
+    result = subprocess.run(cli_command(*args, "restore", f"--snapshot={snapshot_id}", "--no-progress", out),
+                            capture_output=True, text=True)
+    if result.returncode != 0:
+        print(result.stderr)
+        return False
+    return tree_mismatches(tree, out) == 0
+
 def test_large_file():
     print("--- STARTING LARGE FILE TEST ---")
     if not os.path.exists(TEST_DIR):
@@ -84,6 +144,256 @@ def test_large_file():
     else:
         print("Restored file not found.")
 
+def test_snapshot_restore():
+    print("\n--- STARTING SNAPSHOT RESTORE TEST ---")
+    tree = os.path.join(TEST_DIR, "tree")
+    out = os.path.join(TEST_DIR, "tree.out")
+    for d in (tree, out, tree + ".restored"):
+        if os.path.exists(d):
+            shutil.rmtree(d)
+
+    # Nested directories of small (packed), medium and multi-block files with assorted permissions
+    # (Windows only has a read-only flag, which would also stop the next run from deleting the tree)
+    modes = [0o644, 0o600, 0o755, 0o444] if os.name != "nt" else [0o666]
+    for i in range(200):
+        fpath = os.path.join(tree, f"d{i % 5}", f"s{i % 3}", f"f{i}.bin")
+        os.makedirs(os.path.dirname(fpath), exist_ok=True)
+        with open(fpath, "wb") as f:
+            f.write(os.urandom(random.choice([0, 100, 5000, 100000, 1500000])))
+        os.chmod(fpath, modes[i % len(modes)])
+
+    result = subprocess.run(cli_command("--no-progress", tree), capture_output=True, text=True)
+    snapshot_id = None
+    for line in result.stdout.splitlines():
+        if "Snapshot ID:" in line:
+            snapshot_id = int(line.split(":")[-1].strip())
+    if snapshot_id is None:
+        print("Could not get Snapshot ID.")
+        print(result.stderr)
+        return
+
+    result = subprocess.run(cli_command("restore", f"--snapshot={snapshot_id}", "--no-progress", out),
+                            capture_output=True, text=True)
+    if result.returncode != 0:
+        print("FAILURE: Snapshot restore failed!")
+        print(result.stderr)
+        return
+    print(result.stdout.strip())
+
+    mismatches = tree_mismatches(tree, out, check_modes=os.name != "nt")
+    if mismatches == 0:
+        print("SUCCESS: Snapshot tree restored with contents and permissions.")
+    else:
+        print(f"FAILURE: {mismatches} restored files differ!")
+
+def test_encryption():
+    print("\n--- STARTING ENCRYPTION TEST ---")
+    tree = os.path.join(TEST_DIR, "enc_tree")
+    repo = os.path.join(TEST_DIR, "enc_repo")
+    key = os.path.join(TEST_DIR, "enc.key")
+    wrong_key = os.path.join(TEST_DIR, "enc_wrong.key")
+    out = os.path.join(TEST_DIR, "enc_tree.out")
+    remove_paths(tree, tree + ".restored", repo, key, wrong_key, out)
+    generate_tree(tree, 40)
+    subprocess.run([CLI_PATH, "keygen", key], capture_output=True)
+    subprocess.run([CLI_PATH, "keygen", wrong_key], capture_output=True)
+
+    # A second backup of slightly edited files stores deltas, whose base reference is kept in the clear
+    backup_tree(tree, f"--repo={repo}", f"--encrypt-key={key}", "--delta")
+    for dirpath, _, files in os.walk(tree):
+        for name in files:
+            fpath = os.path.join(dirpath, name)
+            if os.path.getsize(fpath) > 10000:
+                with open(fpath, "r+b") as f:
+                    f.seek(5000)
+                    f.write(b"edited")
+    snapshot_id = backup_tree(tree, f"--repo={repo}", f"--encrypt-key={key}", "--delta")
+    if snapshot_id is None:
+        print("FAILURE: Encrypted backup failed!")
+        return
+    if restore_matches(snapshot_id, tree, out, f"--repo={repo}", f"--encrypt-key={key}"):
+        print("SUCCESS: Encrypted snapshot restored.")
+    else:
+        print("FAILURE: Encrypted snapshot did not restore!")
+
+    for args in ([f"--encrypt-key={wrong_key}"], []):
+        remove_paths(out)
+        result = subprocess.run(cli_command(f"--repo={repo}", *args, "restore", f"--snapshot={snapshot_id}",
+                                            "--no-progress", out), capture_output=True, text=True)
+        if result.returncode != 0 and not os.path.exists(out):
+            print(f"SUCCESS: Restore {'with the wrong key' if args else 'without a key'} refused.")
+        else:
+            print(f"FAILURE: Restore {'with the wrong key' if args else 'without a key'} was not refused!")
+
+def test_replication():
+    print("\n--- STARTING REPLICATION TEST ---")
+    tree = os.path.join(TEST_DIR, "rep_tree")
+    source = os.path.join(TEST_DIR, "rep_source")
+    plain = os.path.join(TEST_DIR, "rep_plain")
+    replica = os.path.join(TEST_DIR, "rep_replica")
+    key = os.path.join(TEST_DIR, "rep.key")
+    out = os.path.join(TEST_DIR, "rep_tree.out")
+    remove_paths(tree, tree + ".restored", source, plain, replica, key, out)
+    generate_tree(tree, 30)
+    subprocess.run([CLI_PATH, "keygen", key], capture_output=True)
+
+    snapshot_id = backup_tree(tree, f"--repo={source}", f"--encrypt-key={key}")
+    if snapshot_id is None or backup_tree(tree, f"--repo={plain}") is None:
+        print("FAILURE: Backup before replication failed!")
+        return
+
+    # An empty target takes on the source's key
+    result = subprocess.run(cli_command(f"--repo={source}", f"--encrypt-key={key}", "replicate", replica),
+                            capture_output=True, text=True)
+    if result.returncode == 0 and restore_matches(snapshot_id, tree, out, f"--repo={replica}", f"--encrypt-key={key}"):
+        print("SUCCESS: Replica of an encrypted repository restored.")
+    else:
+        print("FAILURE: Replication into an empty repository failed!")
+        print(result.stderr)
+
+    # Encrypted and unencrypted repositories never mix, in either direction
+    for from_args, target in (([f"--repo={plain}"], source), ([f"--repo={source}", f"--encrypt-key={key}"], plain)):
+        result = subprocess.run(cli_command(*from_args, "replicate", target), capture_output=True, text=True)
+        if result.returncode != 0:
+            print(f"SUCCESS: Replication into {target} refused: {result.stderr.strip()}")
+        else:
+            print(f"FAILURE: Replication into {target} was not refused!")
+
+def test_archive():
+    print("\n--- STARTING ARCHIVE TEST ---")
+    tree = os.path.join(TEST_DIR, "arc_tree")
+    source = os.path.join(TEST_DIR, "arc_source")
+    target = os.path.join(TEST_DIR, "arc_target")
+    archive = os.path.join(TEST_DIR, "arc.dva")
+    out = os.path.join(TEST_DIR, "arc_tree.out")
+    remove_paths(tree, tree + ".restored", source, target, archive, out)
+    generate_tree(tree, 30)
+
+    snapshot_id = backup_tree(tree, f"--repo={source}")
+    if snapshot_id is None:
+        print("FAILURE: Backup before export failed!")
+        return
+
+    result = subprocess.run(cli_command(f"--repo={source}", "export", f"--snapshot={snapshot_id}", f"--output={archive}"),
+                            capture_output=True, text=True)
+    if result.returncode != 0:
+        print("FAILURE: Export failed!")
+        print(result.stderr)
+        return
+    result = subprocess.run(cli_command(f"--repo={target}", "import", archive), capture_output=True, text=True)
+    if result.returncode == 0 and restore_matches(snapshot_id, tree, out, f"--repo={target}"):
+        print("SUCCESS: Imported snapshot restored.")
+    else:
+        print("FAILURE: Export/import round-trip failed!")
+        print(result.stderr)
+
+    # --target leaves out blocks that repository already has; a missing one is an error, not an empty repository
+    missing = os.path.join(TEST_DIR, "arc_missing")
+    result = subprocess.run(cli_command(f"--repo={source}", "export", f"--snapshot={snapshot_id}",
+                                        f"--output={archive}", f"--target={missing}"), capture_output=True, text=True)
+    if result.returncode != 0 and not os.path.exists(missing):
+        print("SUCCESS: Export against a missing target refused.")
+    else:
+        print("FAILURE: Export against a missing target was not refused!")
+
+def test_compaction():
+    print("\n--- STARTING COMPACTION TEST ---")
+    tree = os.path.join(TEST_DIR, "cmp_tree")
+    repo = os.path.join(TEST_DIR, "cmp_repo")
+    key = os.path.join(TEST_DIR, "cmp.key")
+    out = os.path.join(TEST_DIR, "cmp_tree.out")
+    remove_paths(tree, tree + ".restored", repo, key, out)
+    generate_tree(tree, 20)
+    # At least one file that a higher zstd level shrinks, whatever sizes were drawn
+    with open(os.path.join(tree, "log.txt"), "w") as f:
+        f.write(" ".join(f"entry{random.randrange(2000)}" for _ in range(200000)))
+    subprocess.run([CLI_PATH, "keygen", key], capture_output=True)
+
+    snapshot_id = backup_tree(tree, f"--repo={repo}", f"--encrypt-key={key}")
+    if snapshot_id is None:
+        print("FAILURE: Backup before compaction failed!")
+        return
+
+    result = subprocess.run(cli_command(f"--repo={repo}", f"--encrypt-key={key}", "compact", "--min-age-days=0",
+                                        "--level=19", "--no-progress"), capture_output=True, text=True)
+    if result.returncode != 0:
+        print("FAILURE: Compaction failed!")
+        print(result.stderr)
+        return
+    print(result.stdout.strip())
+
+    # A rewritten block is encrypted under a new key generation (header flags bits 8-15)
+    blocks_dir = os.path.join(repo, "blocks")
+    rewritten = 0
+    for name in os.listdir(blocks_dir):
+        with open(os.path.join(blocks_dir, name), "rb") as f:
+            header = f.read(8)
+        if len(header) == 8 and (struct.unpack_from("<I", header, 4)[0] >> 8) & 0xff:
+            rewritten += 1
+    if rewritten == 0:
+        print("FAILURE: Compaction rewrote no blocks!")
+    elif restore_matches(snapshot_id, tree, out, f"--repo={repo}", f"--encrypt-key={key}"):
+        print(f"SUCCESS: Snapshot restored after {rewritten} blocks were re-encrypted.")
+    else:
+        print("FAILURE: Snapshot did not restore after compaction!")
+
+def wait_for_snapshot(log_path, after_id, timeout=60):
+    # Id of the first watch snapshot after `after_id` that left nothing pending, or None
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        with open(log_path) as f:
+            for match in re.finditer(r"Snapshot (\d+):.*\((\w+), (\d+) pending\)", f.read()):
+                if int(match.group(1)) > after_id and int(match.group(3)) == 0:
+                    return int(match.group(1))
+        time.sleep(0.5)
+    return None
+
+def test_watch():
+    print("\n--- STARTING WATCH TEST ---")
+    if os.name == "nt":
+        print("Skipped: the daemon is stopped with SIGINT.")
+        return
+    tree = os.path.join(TEST_DIR, "watch_tree")
+    repo = os.path.join(TEST_DIR, "watch_repo")
+    out = os.path.join(TEST_DIR, "watch_tree.out")
+    log_path = os.path.join(TEST_DIR, "watch.log")
+    remove_paths(tree, repo, out, log_path)
+    generate_tree(tree, 30)
+
+    with open(log_path, "w") as log:
+        daemon = subprocess.Popen(cli_command(f"--repo={repo}", "watch", tree, "--interval=1", "--settle=1"),
+                                  stdout=log, stderr=subprocess.STDOUT)
+    try:
+        first = wait_for_snapshot(log_path, 0)
+        if first is None:
+            print("FAILURE: Watch took no initial snapshot!")
+            return
+
+        # Change, add and delete files and move a directory; the next snapshot must describe the whole tree
+        with open(os.path.join(tree, "d1", "f1.bin"), "ab") as f:
+            f.write(os.urandom(1000))
+        with open(os.path.join(tree, "d2", "added.bin"), "wb") as f:
+            f.write(os.urandom(20000))
+        os.remove(os.path.join(tree, "d3", "f3.bin"))
+        os.rename(os.path.join(tree, "d0"), os.path.join(tree, "moved"))
+        snapshot_id = wait_for_snapshot(log_path, first)
+    finally:
+        daemon.send_signal(signal.SIGINT)
+        daemon.wait(timeout=30)
+
+    if snapshot_id is None:
+        print("FAILURE: Watch took no snapshot of the changes!")
+        with open(log_path) as f:
+            print(f.read())
+        return
+    original_files = sum(len(files) for _, _, files in os.walk(tree))
+    restored = restore_matches(snapshot_id, tree, out, f"--repo={repo}")
+    restored_files = sum(len(files) for _, _, files in os.walk(out)) if os.path.exists(out) else 0
+    if restored and restored_files == original_files:
+        print(f"SUCCESS: Watch snapshot {snapshot_id} restored the full tree ({restored_files} files).")
+    else:
+        print(f"FAILURE: Watch snapshot {snapshot_id} restored {restored_files} of {original_files} files!")
+
 def test_corruption():
     print("\n--- STARTING CORRUPTION TEST ---")
     # Clean up previous data to ensure we corrupt the right block
@@ -97,7 +407,7 @@ def test_corruption():
     
     # 2. Backup
     print("Backing up file...")
-    subprocess.run([CLI_PATH, fpath], capture_output=True)
+    subprocess.run(cli_command(fpath), capture_output=True)
     
     # 3. Find a block and corrupt it
     blocks_dir = os.path.join(STORAGE_DIR, "blocks")
@@ -116,7 +426,7 @@ def test_corruption():
         
     # 4. Try Restore (Run CLI again)
     print("Running Restore (expecting failure or mismatch)...")
-    subprocess.run([CLI_PATH, fpath], capture_output=True, text=True)
+    subprocess.run(cli_command(fpath), capture_output=True, text=True)
     
     restored_path = fpath + ".restored"
     if os.path.exists(restored_path):
@@ -130,8 +440,18 @@ def test_corruption():
         print("Refusal to restore? (Could be valid behavior)")
 
 if __name__ == "__main__":
-    test_large_file()
-    # Note: Corruption test modifies the global storage, might affect other tests if not cleaned
-    # For now running it second.
-    test_corruption() 
+    for metadata_backend in METADATA_BACKENDS:
+        print(f"\n=== METADATA BACKEND: {metadata_backend} ===")
+        if os.path.exists(STORAGE_DIR):
+            shutil.rmtree(STORAGE_DIR)
+        test_large_file()
+        test_snapshot_restore()
+        test_encryption()
+        test_replication()
+        test_archive()
+        test_compaction()
+        test_watch()
+        # Note: Corruption test modifies the global storage, might affect other tests if not cleaned
+        # For now running it second.
+        test_corruption() 
     # For now, let's just run large file test.